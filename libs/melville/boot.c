@@ -110,7 +110,12 @@ static finish_init() {
     object daemon, wizobj, room, test_obj;
     
     syslog("Compiling objects required for system operation...");
-    
+
+    /* Parse them all up front, in parallel when compile_threads is set;
+     * the compile_object() calls below then only install them */
+    precompile(({ OBJECT_PATH, LIVING_PATH, USER_OB, ROOM_PATH,
+                  PLAYER_OB, CMD_D, USERS_D }));
+
     /* Compile (don't clone) system prototypes */
     syslog("...object.c");
     compile_object(OBJECT_PATH);
@@ -459,6 +464,14 @@ clone(path) {
     return new(path);
 }
 
+/* Load a program on first use (lazy_load in netci.ini)
+ * The driver calls this when call_other(), clone_object() or atoo()
+ * names a program that has a source file but isn't loaded yet.
+ */
+load_object(path) {
+    return compile_object(path);
+}
+
 /* Send a message to an object via its listen() function
  * Provides safe message delivery
  */
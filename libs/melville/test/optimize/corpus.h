@@ -0,0 +1,264 @@
+/* corpus.h - Programs test_optimize runs with and without optimizing
+ *
+ * on.c and off.c include this with #pragma optimize and #pragma
+ * no_optimize.  Each function here returns what it computed, and
+ * test_optimize checks both copies return the same.  Add a function to
+ * the list in test_optimize.c when adding one here.
+ */
+
+int g, gsteps;
+string gs;
+
+note(int x) {
+    gsteps++;
+    return x;
+}
+
+arith() {
+    int a;
+
+    a = 2 + 3 * 4 - (10 / 3) % 2;
+    return ({ a, -5, -(-7), ~3, 7 / 2, -7 / 2, 7 % 3, -7 % 3,
+              1 << 10, 1024 >> 3, -16 >> 2, 12 & 10, 12 | 3, 12 ^ 5 });
+}
+
+overflow() {
+    return ({ 9223372036854775807 + 1, 3037000500 * 3037000500,
+              1 << 62, (1 << 62) * 4 });
+}
+
+logic() {
+    return ({ 1 && 0, 0 || 3, !0, !5, 1 < 2, 2 <= 2, 3 > 4, 4 >= 5,
+              3 == 3, 3 != 3, "a" == 0, 0 == 0 });
+}
+
+strings() {
+    string s;
+
+    s = "foo" + "bar";
+    s += "" + "x";
+    s = s + itoa(3 * 4) + "y" + "";
+    return ({ s, "abc" == "abc", "abc" != "abd", "a" < "b", "" < "a",
+              "b" > "a", strlen("a" + "bc") });
+}
+
+constants() {
+    int a, b;
+
+    if (0)
+        a = 1;
+    else
+        a = 2;
+    if (1)
+        b = 3;
+    else
+        b = 4;
+    if (0) {
+        a = 100;
+        b = 100;
+    }
+    return ({ a, b, 1 ? 10 : 20, 0 ? 1 : 2, (1 + 1 == 2) ? "yes" : "no" });
+}
+
+dead_stores() {
+    int dead, live;
+    string s;
+
+    dead = 5;
+    dead = 7;
+    live = dead;
+    s = "one";
+    s = "two";
+    dead = 9;
+    return ({ live, s });
+}
+
+loops() {
+    int i, j, s, t;
+
+    s = 0;
+    i = 0;
+    while (i < 5) {
+        s += i;
+        i++;
+    }
+    for (i = 0; i < 4; i++)
+        s += 10;
+    for (i = 0; i < 3; i++)
+        for (j = 0; j < 3; j++)
+            t += i * j + (2 * 3);
+    do {
+        s--;
+    } while (s > 30);
+    for (i = 10; i > 0; i -= 3)
+        t += i;
+    for (;;) {
+        t++;
+        if (t > 100)
+            return ({ s, t, i, j });
+    }
+    return 0;
+}
+
+nested(int x) {
+    if (x) {
+        if (x > 1) {
+            if (x > 2)
+                return "big";
+            else
+                return "two";
+        }
+        return "one";
+    } else
+        return "zero";
+}
+
+branches() {
+    return ({ nested(0), nested(1), nested(2), nested(3) });
+}
+
+steps() {
+    int i, j, c, n;
+
+    i = 5;
+    i++;
+    ++i;
+    i--;
+    i += 10;
+    i -= 3;
+    n = i;
+    c = 1;
+    j = c ? ++i : 0;
+    n = n * 100 + j;
+    j = c ? i++ : 0;
+    n = n * 100 + j;
+    c = 0;
+    j = c ? 0 : i--;
+    n = n * 100 + j;
+    j = (c ? i++ : i--) + 10;
+    return ({ n, i, j });
+}
+
+compare_branch(int x) {
+    int n;
+
+    n = 0;
+    if (x < 3) n += 1;
+    if (x <= 3) n += 2;
+    if (x > 3) n += 4;
+    if (x >= 3) n += 8;
+    if (x == 3) n += 16;
+    if (x != 3) n += 32;
+    return n;
+}
+
+compares() {
+    return ({ compare_branch(2), compare_branch(3), compare_branch(4),
+              compare_branch(-1) });
+}
+
+globals() {
+    int n;
+
+    g = 3 * 7;
+    gs = "a" + "b";
+    g++;
+    g += 2;
+    n = 0;
+    while (g < 30)
+        g++;
+    if (g == 30)
+        n = 1;
+    return ({ g, gs, n });
+}
+
+short_circuit() {
+    int r;
+
+    gsteps = 0;
+    r = (note(0) && note(1)) + (note(1) || note(2)) * 10 +
+        (note(1) && note(2)) * 100 + (note(0) || note(0)) * 1000;
+    return ({ r, gsteps });
+}
+
+fib(int n) {
+    if (n < 2)
+        return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+recursion() {
+    return ({ fib(10), fib(15) });
+}
+
+arrays() {
+    int *a, *b;
+    int i, s;
+
+    a = ({ 1, 2, 3 }) + ({ 4 });
+    b = a;
+    b += ({ 5 });
+    s = 0;
+    for (i = 0; i < sizeof(b); i++)
+        s += b[i];
+    return ({ a, b, s, a[1..2], b[-2..], sizeof(a) });
+}
+
+mappings() {
+    mapping m, n;
+
+    m = ([ "a": 1, "b": 2 ]);
+    n = m;
+    n["c"] = 3;
+    m["a"] += 10;
+    return ({ m["a"], m["b"], m["c"], n["a"], n["c"], sizeof(keys(n)) });
+}
+
+ranges() {
+    string s;
+
+    s = "abcdef";
+    return ({ s[0], s[-1], s[1..3], s[..1], s[4..], s[10..], s[3..1],
+              ("x" + "yz")[1..] });
+}
+
+subscripts() {
+    mapping m;
+    int *a;
+    int i, n, t;
+
+    /* the stores of 0 look dead: m and a are only ever read through a
+       subscript */
+    for (i = 0; i < 3; i++) {
+        m = 0;
+        m["k"] = m["k"] + 1;
+        n = m["k"];
+    }
+    t = 0;
+    for (i = 0; i < 5; i++) {
+        a = 0;
+        t += a[0];
+        a[0] = 1;
+    }
+    return ({ n, t });
+}
+
+scan() {
+    int n;
+    string w;
+
+    sscanf("12 abc", "%d %s", n, w);
+    return ({ n, w });
+}
+
+args_helper(int a, int b) {
+    a = 5;
+    return a + b;
+}
+
+args() {
+    int a;
+
+    a = 1;
+    return ({ args_helper(a, 2), a });
+}
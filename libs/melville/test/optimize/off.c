@@ -0,0 +1,4 @@
+/* off.c - corpus.h with the optimizer off; see test_optimize.c */
+
+#pragma no_optimize
+#include "/test/optimize/corpus.h"
@@ -0,0 +1,4 @@
+/* on.c - corpus.h with the optimizer on; see test_optimize.c */
+
+#pragma optimize
+#include "/test/optimize/corpus.h"
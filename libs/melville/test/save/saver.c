@@ -0,0 +1,21 @@
+/* saver.c - An object for test_save_queue to save with
+ *
+ * Each copy saves its own val under whatever key it's given; fill() makes
+ * a save big enough to keep the writer thread busy for a moment.
+ */
+
+int val;
+string *data;
+
+fill(int n) {
+    int i;
+
+    data = ({ });
+    for (i = 0; i < n; i++)
+        data += ({ "0123456789012345678901234567890123456789" + itoa(i) });
+}
+
+save_as(string key, int v) {
+    val = v;
+    save_object(key);
+}
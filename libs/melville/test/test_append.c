@@ -0,0 +1,203 @@
+/* test_append.c - += on strings, arrays and mappings
+ *
+ * += grows the variable in place when nothing else holds its value, and
+ * copies when something does.  These check that an append is never seen
+ * through another holder, and that the in place path gives the same
+ * results as a + b.
+ *
+ * Run via: eval new("/test/test_append").run_tests();
+ */
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+string gs;
+int *garr;
+mapping gmap;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+same(a, b) {
+    int i;
+
+    if (sizeof(a) != sizeof(b))
+        return 0;
+    for (i = 0; i < sizeof(a); i++)
+        if (a[i] != b[i])
+            return 0;
+    return 1;
+}
+
+append_string(string s) {
+    s += "!";
+    return s;
+}
+
+append_array(int *a) {
+    a += ({ 9 });
+    return a;
+}
+
+test_strings() {
+    string s, t;
+    int i;
+
+    syswrite("=== Test 1: Strings ===");
+    s = "ab";
+    s += "cd";
+    s += "";
+    check(s == "abcd", "s += \"cd\" and s += \"\"");
+    t = s;
+    s += "e";
+    check(s == "abcde" && t == "abcd", "append leaves an earlier copy");
+    t += "x";
+    check(s == "abcde" && t == "abcdx", "append to the copy leaves the original");
+    s = 0;
+    s += "z";
+    check(s == "z", "append to an unset variable");
+    s = "q";
+    check(append_string(s) == "q!" && s == "q", "append to an argument");
+    t = (s += "r");
+    s += "s";
+    check(t == "qr" && s == "qrs", "value of += is a copy");
+
+    s = "";
+    for (i = 0; i < 1000; i++)
+        s += "x" + itoa(i % 10);
+    check(strlen(s) == 2000, "1000 appends in a loop");
+    check(s[0..3] == "x0x1" && s[1996..] == "x8x9", "loop appends in order");
+
+    gs = "g";
+    for (i = 0; i < 100; i++)
+        gs += "h";
+    check(strlen(gs) == 101 && gs[100] == 'h', "appends to a global string");
+}
+
+test_arrays() {
+    int *a, *b, *r;
+    int i, n;
+
+    syswrite("\n=== Test 2: Arrays ===");
+    a = ({ 1, 2 });
+    b = a;
+    a += ({ 3 });
+    check(same(a, ({ 1, 2, 3 })) && same(b, ({ 1, 2 })),
+          "append leaves an earlier copy");
+    b = a;
+    b += ({ 4 });
+    check(same(a, ({ 1, 2, 3 })) && same(b, ({ 1, 2, 3, 4 })),
+          "append to the copy leaves the original");
+    a += ({ });
+    check(same(a, ({ 1, 2, 3 })), "append an empty array");
+
+    a = ({ 1, 2 });
+    a += a;
+    check(same(a, ({ 1, 2, 1, 2 })), "a += a");
+
+    a = ({ 5 });
+    r = append_array(a);
+    check(same(a, ({ 5 })) && same(r, ({ 5, 9 })), "append to an argument");
+
+    a = ({ 1 });
+    b = (a += ({ 2 }));
+    b[0] = 7;
+    check(same(a, ({ 1, 2 })) && same(b, ({ 7, 2 })),
+          "write to the value of += leaves the variable");
+    a += ({ 3 });
+    check(same(a, ({ 1, 2, 3 })) && same(b, ({ 7, 2 })),
+          "append after the value of += was kept");
+
+    a = ({ });
+    for (i = 0; i < 500; i++)
+        a += ({ i });
+    n = 0;
+    for (i = 0; i < sizeof(a); i++)
+        if (a[i] == i)
+            n++;
+    check(sizeof(a) == 500 && n == 500, "500 appends in a loop");
+
+    garr = ({ });
+    b = garr;
+    for (i = 0; i < 10; i++)
+        garr += ({ i });
+    check(sizeof(garr) == 10 && sizeof(b) == 0, "appends to a shared global array");
+}
+
+test_mappings() {
+    mapping m, n;
+
+    syswrite("\n=== Test 3: Mappings ===");
+    m = ([ "a": 1 ]);
+    n = m;
+    m += ([ "b": 2 ]);
+    check(sizeof(keys(m)) == 2 && sizeof(keys(n)) == 1,
+          "merge leaves an earlier copy");
+    n += ([ "a": 10, "c": 3 ]);
+    check(m["a"] == 1 && n["a"] == 10 && n["c"] == 3 && !m["c"],
+          "merge into the copy leaves the original");
+
+    m = ([ "a": 1 ]);
+    m += m;
+    check(sizeof(keys(m)) == 1 && m["a"] == 1, "m += m");
+
+    gmap = ([ ]);
+    n = gmap;
+    gmap += ([ "one": 2 ]);
+    check(gmap["one"] == 2 && sizeof(keys(n)) == 0, "merge into a shared global mapping");
+}
+
+test_elements() {
+    int *a, *b;
+    mapping m, n;
+
+    syswrite("\n=== Test 4: Elements and mapping values ===");
+    a = ({ 1, 2 });
+    b = a;
+    a[0] += 10;
+    check(same(a, ({ 11, 2 })) && same(b, ({ 1, 2 })), "element += integer");
+
+    m = ([ "n": 1, "s": "ab", "l": ({ 1 }) ]);
+    n = m;
+    m["n"] += 5;
+    m["s"] += "cd";
+    check(m["n"] == 6 && m["s"] == "abcd", "mapping value += integer and string");
+    check(n["n"] == 1 && n["s"] == "ab", "the copy's values are unchanged");
+    m["l"] += ({ 2 });
+    check(same(m["l"], ({ 1, 2 })) && same(n["l"], ({ 1 })),
+          "mapping value += array leaves the copy's array");
+    n["l"] += ({ 3 });
+    check(same(m["l"], ({ 1, 2 })) && same(n["l"], ({ 1, 3 })),
+          "mapping value += array through the copy");
+    m["new"] += "x";
+    check(m["new"] == "x" && !n["new"], "+= on a missing key");
+}
+
+run_tests() {
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Append Test Suite");
+    syswrite("===============================================\n");
+
+    test_strings();
+    test_arrays();
+    test_mappings();
+    test_elements();
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
@@ -0,0 +1,89 @@
+/* test_array_sets.c - The array set operators and unique_array()
+ *
+ * a & b, a | b and a - b treat arrays as sets: results have no duplicates
+ * and keep first-seen order, strings match by content and arrays by
+ * identity.  On integers & and | stay bitwise.
+ *
+ * Run via: eval new("/test/test_array_sets").run_tests();
+ */
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+same(a, b) {
+    int i;
+
+    if (sizeof(a) != sizeof(b))
+        return 0;
+    for (i = 0; i < sizeof(a); i++)
+        if (a[i] != b[i])
+            return 0;
+    return 1;
+}
+
+test_set_operators() {
+    int *a, *b;
+    string *s;
+    int *x, *y;
+
+    syswrite("\n=== Test 1: & | and - ===");
+    a = ({ 1, 2, 2, 3, 4 });
+    b = ({ 4, 3, 5, 3 });
+    check(same(a & b, ({ 3, 4 })), "intersection, first-seen order");
+    check(same(a | b, ({ 1, 2, 3, 4, 5 })), "union without duplicates");
+    check(same(a - b, ({ 1, 2, 2 })), "difference");
+    check(same(b & a, ({ 4, 3 })), "intersection follows the left side");
+    check(sizeof(a & ({ })) == 0 && same(({ }) | b, ({ 4, 3, 5 })),
+          "empty operands");
+    check(same(a, ({ 1, 2, 2, 3, 4 })), "operands are unchanged");
+
+    s = ({ "x", "y" }) & ({ "y" + "", "z" });
+    check(same(s, ({ "y" })), "strings match by content");
+
+    x = ({ 1 });
+    y = ({ 1 });
+    check(sizeof(({ x, y }) & ({ x })) == 1, "arrays match by identity");
+    check(sizeof(({ x }) | ({ y })) == 2, "equal-looking arrays stay apart");
+
+    check((12 & 10) == 8 && (12 | 3) == 15, "integers stay bitwise");
+}
+
+test_unique() {
+    syswrite("\n=== Test 2: unique_array() ===");
+    check(same(unique_array(({ 3, 1, 3, 2, 1 })), ({ 3, 1, 2 })),
+          "first occurrence kept");
+    check(same(unique_array(({ "a", "b", "a" })), ({ "a", "b" })),
+          "strings");
+    check(sizeof(unique_array(({ }))) == 0, "empty array");
+}
+
+run_tests() {
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Array Set Operator Test Suite");
+    syswrite("===============================================\n");
+
+    test_set_operators();
+    test_unique();
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
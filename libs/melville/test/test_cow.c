@@ -0,0 +1,206 @@
+/* test_cow.c - Copy-on-write arrays and mappings
+ *
+ * Arrays and mappings are shared when assigned, passed or returned, and
+ * copied only when one holder writes to them.  These check that a write
+ * through one holder is never seen through another.
+ *
+ * Run via: eval new("/test/test_cow").run_tests();
+ */
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+int *garr;
+mapping gmap;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+same(a, b) {
+    int i;
+
+    if (sizeof(a) != sizeof(b))
+        return 0;
+    for (i = 0; i < sizeof(a); i++)
+        if (a[i] != b[i])
+            return 0;
+    return 1;
+}
+
+poke_array(int *a) {
+    a[0] = 99;
+    a[1]++;
+    return a;
+}
+
+poke_mapping(mapping m) {
+    m["new"] = 1;
+    m["a"] = 99;
+    map_delete(m, "b");
+    return m;
+}
+
+get_garr() {
+    return garr;
+}
+
+test_assignment() {
+    int *a, *b;
+    mapping m, n;
+
+    syswrite("=== Test 1: Assignment ===");
+    a = ({ 1, 2, 3 });
+    b = a;
+    b[0] = 9;
+    check(same(a, ({ 1, 2, 3 })) && same(b, ({ 9, 2, 3 })),
+          "element write through the copy leaves the original");
+    b = a;
+    a[2] += 5;
+    check(same(a, ({ 1, 2, 8 })) && same(b, ({ 1, 2, 3 })),
+          "element += through the original leaves the copy");
+    b = a;
+    b[1]++;
+    --b[0];
+    check(same(a, ({ 1, 2, 8 })) && same(b, ({ 0, 3, 8 })),
+          "++ and -- on elements of a copy");
+
+    m = ([ "a": 1, "b": 2 ]);
+    n = m;
+    n["c"] = 3;
+    m["a"] = 10;
+    check(m["a"] == 10 && n["a"] == 1, "mapping value write is private");
+    check(sizeof(keys(m)) == 2 && sizeof(keys(n)) == 3,
+          "adding a key to the copy leaves the original");
+    n = m;
+    map_delete(n, "a");
+    check(sizeof(keys(m)) == 2 && sizeof(keys(n)) == 1,
+          "map_delete() on the copy leaves the original");
+    n = m;
+    n["missing"];
+    check(sizeof(keys(m)) == 2, "reading a missing key of a copy");
+}
+
+test_nested() {
+    int *a, *b, *inner;
+    mapping m, n;
+
+    syswrite("\n=== Test 2: Nested values ===");
+    a = ({ ({ 1, 2 }), ({ 3, 4 }) });
+    b = a;
+    inner = b[0];
+    inner[1] = 20;
+    check(a[0][1] == 2 && b[0][1] == 2 && inner[1] == 20,
+          "write to an inner array taken from a copy");
+    b[1] = ({ 30 });
+    check(a[1][0] == 3 && b[1][0] == 30, "replace an inner array of a copy");
+
+    m = ([ "list": ({ 1, 2 }) ]);
+    n = m;
+    inner = n["list"];
+    inner[0] = 10;
+    n["list"] = inner;
+    check(m["list"][0] == 1 && n["list"][0] == 10,
+          "write to an array held in a copied mapping");
+}
+
+test_calls() {
+    int *a, *r;
+    mapping m, r2;
+
+    syswrite("\n=== Test 3: Arguments and return values ===");
+    a = ({ 1, 2, 3 });
+    r = poke_array(a);
+    check(same(a, ({ 1, 2, 3 })), "callee's writes to an argument stay there");
+    check(same(r, ({ 99, 3, 3 })), "callee's copy is returned");
+
+    m = ([ "a": 1, "b": 2 ]);
+    r2 = poke_mapping(m);
+    check(m["a"] == 1 && sizeof(keys(m)) == 2, "mapping argument unchanged");
+    check(r2["a"] == 99 && r2["new"] == 1 && sizeof(keys(r2)) == 2,
+          "callee's mapping returned");
+
+    a = ({ 5, 6 });
+    r = call_other(this_object(), "poke_array", a);
+    check(same(a, ({ 5, 6 })) && same(r, ({ 99, 7 })),
+          "array through call_other()");
+
+    garr = ({ 1, 2 });
+    r = get_garr();
+    r[0] = 50;
+    check(garr[0] == 1, "write to a returned global array");
+    gmap = ([ "k": 1 ]);
+    m = gmap;
+    m["k"] = 2;
+    check(gmap["k"] == 1, "write to a copy of a global mapping");
+    m = gmap;
+    gmap["k"]++;
+    check(gmap["k"] == 2 && m["k"] == 1, "++ on a shared global mapping value");
+    r = garr;
+    garr[1]--;
+    check(garr[1] == 1 && r[1] == 2, "-- on a shared global array element");
+}
+
+test_operators() {
+    int *a, *b;
+    mapping m, n;
+
+    syswrite("\n=== Test 4: Operators that share their operand ===");
+    a = ({ 1, 2, 3 });
+    b = a + ({ });
+    b[0] = 7;
+    check(a[0] == 1, "a + ({ }) then a write");
+    b = a - ({ 9 });
+    b[0] = 7;
+    check(a[0] == 1, "a - ({ 9 }) then a write");
+    b = a[0..];
+    b[0] = 7;
+    check(a[0] == 1, "whole range then a write");
+    b = reverse(a);
+    check(same(a, ({ 1, 2, 3 })) && same(b, ({ 3, 2, 1 })),
+          "reverse() leaves its argument");
+
+    m = ([ "a": 1 ]);
+    n = m + ([ ]);
+    n["a"] = 5;
+    check(m["a"] == 1, "m + ([ ]) then a write");
+}
+
+test_sscanf() {
+    int *a, *b;
+
+    syswrite("\n=== Test 5: sscanf() into an element ===");
+    a = ({ 0, 0 });
+    b = a;
+    sscanf("42", "%d", b[1]);
+    check(a[1] == 0 && b[1] == 42, "sscanf() into an element of a copy");
+}
+
+run_tests() {
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Copy-on-Write Test Suite");
+    syswrite("===============================================\n");
+
+    test_assignment();
+    test_nested();
+    test_calls();
+    test_operators();
+    test_sscanf();
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
@@ -0,0 +1,134 @@
+/* test_fused.c - Fused instruction sequences
+ *
+ * The compiler fuses a few common sequences starting at a plain variable
+ * (a compare and branch, a return, a ++ or -- statement, a += or -= of an
+ * integer) into one instruction.  A ++ or -- is fused only when its value
+ * is thrown away, so these check that a ++ or -- whose value is used, as in
+ * an arm of ?:, still leaves that value.
+ *
+ * Run via: eval new("/test/test_fused").run_tests();
+ */
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+int g;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+test_conditional() {
+    int i, j, c;
+
+    syswrite("=== Test 1: ++ and -- in an arm of ?: ===");
+    c = 1;
+    i = 5;
+    j = c ? ++i : 0;
+    check(j == 6 && i == 6, "j = c ? ++i : 0");
+    i = 5;
+    j = c ? i++ : 0;
+    check(j == 5 && i == 6, "j = c ? i++ : 0");
+    i = 5;
+    j = c ? --i : 0;
+    check(j == 4 && i == 4, "j = c ? --i : 0");
+    i = 5;
+    j = c ? i-- : 0;
+    check(j == 5 && i == 4, "j = c ? i-- : 0");
+
+    c = 0;
+    i = 5;
+    j = c ? 0 : ++i;
+    check(j == 6 && i == 6, "j = c ? 0 : ++i");
+    i = 5;
+    j = c ? 0 : i--;
+    check(j == 5 && i == 4, "j = c ? 0 : i--");
+    i = 5;
+    j = c ? ++i : 0;
+    check(j == 0 && i == 5, "untaken arm leaves i alone");
+
+    i = 5;
+    j = (c ? i++ : i--) + 10;
+    check(j == 15 && i == 4, "?: with a step feeding an addition");
+    i = 1;
+    j = (i ? i++ : 0) + (i ? i++ : 0);
+    check(j == 3 && i == 3, "two ?: steps in one expression");
+}
+
+test_statements() {
+    int i, j, n;
+
+    syswrite("\n=== Test 2: Steps as statements and loop steps ===");
+    i = 0;
+    i++;
+    ++i;
+    i--;
+    check(i == 1, "++ and -- statements");
+    i += 10;
+    i -= 3;
+    check(i == 8, "+= and -= statements");
+
+    n = 0;
+    for (i = 0; i < 10; i++)
+        n++;
+    check(n == 10 && i == 10, "for loop with i++");
+    n = 0;
+    for (i = 10; i > 0; --i)
+        n += 2;
+    check(n == 20 && i == 0, "for loop with --i");
+    n = 0;
+    for (i = 0; i < 10; i++)
+        n += i < 5 ? 1 : 0;
+    check(n == 5, "?: inside a loop body");
+
+    j = 0;
+    i = 0;
+    while (i < 4) {
+        j = i ? j++ : ++j;
+        i++;
+    }
+    check(i == 4, "while loop with a step statement");
+}
+
+step_return(int i) {
+    return i++;
+}
+
+test_other() {
+    int i;
+
+    syswrite("\n=== Test 3: Other uses of a step's value ===");
+    check(step_return(3) == 3, "return i++");
+    i = 7;
+    check(i++ == 7 && i == 8, "i++ as a call argument");
+    g = 1;
+    i = g ? g++ : 0;
+    check(i == 1 && g == 2, "global in an arm of ?:");
+}
+
+run_tests() {
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Fused Sequence Test Suite");
+    syswrite("===============================================\n");
+
+    test_conditional();
+    test_statements();
+    test_other();
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
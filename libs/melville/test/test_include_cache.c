@@ -0,0 +1,103 @@
+/* test_include_cache.c - Cached headers and the headers they include
+ *
+ * A header that is nothing but directives is cached after its first
+ * #include and replayed after that, along with whatever its own #includes
+ * defined.  These check that changing a header included from a cached one
+ * is seen by the next compile, by compile_object() and by recompile()
+ * (which, with bytecode_path set, also goes through the bytecode cache).
+ *
+ * The headers are written under /test, then left for two seconds: a header
+ * changed within the last second isn't cached, so the results print when
+ * the alarm goes off.
+ *
+ * Run via: eval new("/test/test_include_cache").run_tests();
+ */
+
+#define OUTER "/test/cache_outer.h"
+#define INNER "/test/cache_inner.h"
+#define PROG_A "/test/cache_prog_a"
+#define PROG_B "/test/cache_prog_b"
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+put_file(string path, string text) {
+    ferase(path);
+    write_file(path, text);
+}
+
+set_inner(int value) {
+    put_file(INNER, "#define CACHE_VALUE " + itoa(value) + "\n");
+}
+
+put_prog(string path) {
+    put_file(path + ".c", "#include \"" + OUTER + "\"\n\n" +
+             "value() { return CACHE_VALUE; }\n");
+}
+
+clean_up() {
+    object o;
+
+    if (o = atoo(PROG_A)) destruct(o);
+    if (o = atoo(PROG_B)) destruct(o);
+    remove(PROG_A + ".c");
+    remove(PROG_B + ".c");
+    remove(OUTER);
+    remove(INNER);
+}
+
+run_tests() {
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Include Cache Test Suite");
+    syswrite("===============================================\n");
+
+    clean_up();
+    put_file(OUTER, "#include \"" + INNER + "\"\n");
+    set_inner(1);
+    put_prog(PROG_A);
+    put_prog(PROG_B);
+    syswrite("(waiting two seconds for the headers to be cacheable)");
+    alarm(2, "finish_tests");
+}
+
+finish_tests() {
+    object a, b;
+
+    syswrite("=== Test 1: A nested header changes ===");
+    a = compile_object(PROG_A);
+    check(a && a.value() == 1, "first compile sees the nested #define");
+    set_inner(22);
+    b = compile_object(PROG_B);
+    check(b && b.value() == 22,
+          "next compile sees the changed nested header");
+
+    syswrite("\n=== Test 2: recompile() after a nested header changes ===");
+    set_inner(333);
+    recompile(INNER);
+    a = atoo(PROG_A);
+    check(a && a.value() == 333, "recompile() picks up the new #define");
+
+    clean_up();
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
@@ -0,0 +1,116 @@
+/* test_lazy_load.c - Loading programs on first use
+ *
+ * With lazy_load set in netci.ini, atoo(), call_other() and clone_object()
+ * load a program that isn't loaded yet but has a source file.  A path
+ * with no source, or whose source doesn't compile, gives 0 and is
+ * remembered for a while, unless its source changes.
+ *
+ * The programs are written under /test as the tests run.  With lazy_load
+ * unset there is nothing to test.
+ *
+ * Run via: eval new("/test/test_lazy_load").run_tests();
+ */
+
+#define HIT "/test/lz_hit"
+#define CALLED "/test/lz_called"
+#define MISSING "/test/lz_missing"
+#define BROKEN "/test/lz_broken"
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+put_file(string path, string text) {
+    ferase(path);
+    write_file(path, text);
+}
+
+put_prog(string path, string name) {
+    put_file(path + ".c", "name() { return \"" + name + "\"; }\n");
+}
+
+clean_up() {
+    object o;
+
+    if (o = atoo(HIT)) destruct(o);
+    if (o = atoo(CALLED)) destruct(o);
+    if (o = atoo(BROKEN)) destruct(o);
+    remove(HIT + ".c");
+    remove(CALLED + ".c");
+    remove(BROKEN + ".c");
+}
+
+summary() {
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
+
+test_hit() {
+    object o;
+
+    syswrite("=== Test 1: A program with a source file ===");
+    put_prog(HIT, "hit");
+    o = atoo(HIT);
+    check(o && o.name() == "hit", "atoo() loads it");
+    check(atoo(HIT) == o, "and finds it loaded after that");
+    put_prog(CALLED, "called");
+    check(call_other(CALLED, "name") == "called", "call_other() loads it");
+}
+
+test_miss() {
+    syswrite("\n=== Test 2: A path with no source file ===");
+    check(!atoo(MISSING), "atoo() gives 0");
+    check(!atoo(MISSING), "and 0 again");
+    check(!call_other(MISSING, "name"), "call_other() gives 0");
+}
+
+test_broken() {
+    object o;
+
+    syswrite("\n=== Test 3: A source that doesn't compile ===");
+    put_file(BROKEN + ".c", "name() { return \"broken\" }\n");
+    check(!atoo(BROKEN), "atoo() gives 0");
+    check(!atoo(BROKEN), "and 0 again");
+    put_prog(BROKEN, "mended");
+    o = atoo(BROKEN);
+    check(o && o.name() == "mended", "loads once the source is mended");
+}
+
+run_tests() {
+    mapping config;
+
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Lazy Load Test Suite");
+    syswrite("===============================================\n");
+
+    config = query_config();
+    if (!config["lazy_load"]) {
+        syswrite("(lazy_load is off: nothing to test)");
+        summary();
+        return;
+    }
+    clean_up();
+    test_hit();
+    test_miss();
+    test_broken();
+    clean_up();
+    summary();
+}
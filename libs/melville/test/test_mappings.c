@@ -0,0 +1,135 @@
+/* test_mappings.c - Mapping table growth, deletion and assignment targets
+ *
+ * The mapping table grows (and moves its slots) when it passes its load
+ * limit.  An assignment looks up the value it is storing into before the
+ * right-hand side runs, so these check that a right-hand side which makes
+ * the same mapping grow doesn't leave it storing into the old table.
+ *
+ * Run via: eval new("/test/test_mappings").run_tests();
+ */
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+/* 13 keys: the next insert passes 7/8 of 16 slots and grows the table */
+thirteen() {
+    mapping m;
+    int i;
+
+    m = ([]);
+    for (i = 0; i < 13; i++)
+        m[i] = i * 10;
+    return m;
+}
+
+test_growth() {
+    mapping m;
+    int i, ok;
+
+    syswrite("=== Test 1: Growth keeps every entry ===");
+    m = ([]);
+    for (i = 0; i < 1000; i++)
+        m[i] = i * 2;
+    ok = 1;
+    for (i = 0; i < 1000; i++)
+        if (m[i] != i * 2)
+            ok = 0;
+    check(ok, "1000 integer keys survive repeated growth");
+    check(sizeof(keys(m)) == 1000, "sizeof(keys()) is 1000 after growth");
+
+    m = ([]);
+    for (i = 0; i < 200; i++)
+        m["key" + itoa(i)] = i;
+    check(m["key0"] == 0 && m["key199"] == 199, "string keys survive growth");
+}
+
+test_assignment_target() {
+    mapping m;
+
+    syswrite("\n=== Test 2: Assignment target survives growth ===");
+
+    /* reading a missing key inserts it, so the right-hand side grows m */
+    m = thirteen();
+    m[100] = m[200];
+    check(m[100] == 0, "m[100] = m[200] with a missing m[200]");
+    check(sizeof(keys(m)) == 15, "both keys are present afterwards");
+
+    m = thirteen();
+    m[200] = 7;
+    m[100] = m[200];
+    check(m[100] == 7, "m[100] = m[200] copies the value");
+
+    m = thirteen();
+    m[100] = m[201] + m[202] + m[203] + 5;
+    check(m[100] == 5 && sizeof(keys(m)) == 17,
+          "right-hand side inserting several keys");
+
+    m = thirteen();
+    m[5] += m[400] + 1;
+    check(m[5] == 51, "+= into an existing key while the table grows");
+
+    m = thirteen();
+    check(m[300] + m[301] + m[5] == 50 && sizeof(keys(m)) == 15,
+          "reads that insert while the table grows");
+
+    m = thirteen();
+    m[100] = map_delete(m, 100) + 9;
+    check(m[100] == 9, "right-hand side deleting the target key");
+
+    m = thirteen();
+    check(sscanf("42", "%d", m[500]) == 1 && m[500] == 42,
+          "sscanf() into a new key");
+}
+
+test_delete() {
+    mapping m;
+    int i, ok;
+
+    syswrite("\n=== Test 3: Deleting and reinserting ===");
+    m = ([]);
+    for (i = 0; i < 100; i++)
+        m[i] = i;
+    for (i = 0; i < 100; i += 2)
+        map_delete(m, i);
+    check(sizeof(keys(m)) == 50, "half the keys deleted");
+    ok = 1;
+    for (i = 1; i < 100; i += 2)
+        if (m[i] != i)
+            ok = 0;
+    check(ok, "remaining keys keep their values");
+    for (i = 0; i < 100; i += 2)
+        m[i] = -i;
+    check(sizeof(keys(m)) == 100 && m[50] == -50, "deleted keys reinserted");
+}
+
+run_tests() {
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Mapping Test Suite");
+    syswrite("===============================================\n");
+
+    test_growth();
+    test_assignment_target();
+    test_delete();
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
@@ -0,0 +1,62 @@
+/* test_optimize.c - Optimized and unoptimized code give the same results
+ *
+ * optimize/on.c and optimize/off.c are the same program, optimize/corpus.h,
+ * compiled with #pragma optimize and #pragma no_optimize.  Each corpus
+ * function is called in both and the results compared, so a change to
+ * the optimizer (or to the fused instructions the compiler always emits)
+ * that alters what a program computes shows up here as a difference.
+ *
+ * Run via: eval new("/test/test_optimize").run_tests();
+ */
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+
+run_tests() {
+    object on, off;
+    string *names;
+    string a, b;
+    int i;
+
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Optimizer Differential Test Suite");
+    syswrite("===============================================\n");
+
+    on = new("/test/optimize/on");
+    off = new("/test/optimize/off");
+    if (!on || !off) {
+        syswrite("  [FAIL] couldn't compile optimize/on or optimize/off");
+        return;
+    }
+
+    syswrite("=== Test 1: Corpus results match ===");
+    /* every function in optimize/corpus.h */
+    names = ({ "arith", "overflow", "logic", "strings", "constants",
+               "dead_stores", "loops", "branches", "steps", "compares",
+               "globals", "short_circuit", "recursion", "arrays",
+               "mappings", "ranges", "subscripts", "scan", "args" });
+    for (i = 0; i < sizeof(names); i++) {
+        a = sprintf("%O", call_other(on, names[i]));
+        b = sprintf("%O", call_other(off, names[i]));
+        tests_run++;
+        if (a == b) {
+            syswrite("  [PASS] " + names[i] + "()");
+            tests_passed++;
+        } else {
+            syswrite("  [FAIL] " + names[i] + "(): optimized " + a +
+                     ", unoptimized " + b);
+            tests_failed++;
+        }
+    }
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
@@ -0,0 +1,146 @@
+/* test_ranges.c - Index and range operators
+ *
+ * str[i] gives a character code, str[a..b] and arr[a..b] an inclusive
+ * slice.  Either end of a range may be left out, negative positions count
+ * from the end, out of range reads give 0 and ranges are clipped.
+ *
+ * Run via: eval new("/test/test_ranges").run_tests();
+ */
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+string gs;
+int *garr;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+same(a, b) {
+    int i;
+
+    if (sizeof(a) != sizeof(b))
+        return 0;
+    for (i = 0; i < sizeof(a); i++)
+        if (a[i] != b[i])
+            return 0;
+    return 1;
+}
+
+word() {
+    return "hello";
+}
+
+list() {
+    return ({ 10, 20, 30, 40 });
+}
+
+test_string_index() {
+    string s;
+
+    syswrite("=== Test 1: String index ===");
+    s = "abc";
+    check(s[0] == 'a' && s[2] == 'c', "s[0] and s[2]");
+    check(s[-1] == 'c' && s[-3] == 'a', "negative positions");
+    check(s[3] == 0 && s[-4] == 0 && s[100] == 0, "out of range gives 0");
+    check('\n' == 10 && 'A' == 65 && '\'' == 39, "character constants");
+    s = "";
+    check(s[0] == 0, "index of \"\"");
+    s = 0;
+    check(s[0] == 0, "index of an unset variable");
+}
+
+test_string_range() {
+    string s;
+
+    syswrite("\n=== Test 2: String ranges ===");
+    s = "abcdef";
+    check(s[1..3] == "bcd", "s[1..3]");
+    check(s[..1] == "ab" && s[4..] == "ef", "omitted start and end");
+    check(s[0..] == "abcdef" && s[..-1] == "abcdef", "the whole string");
+    check(s[-2..] == "ef" && s[-3..-2] == "de", "negative positions");
+    check(s[2..2] == "c", "one character");
+    check(s[3..1] == "" && s[10..] == "" && s[..-10] == "",
+          "empty ranges give \"\"");
+    check(s[-100..1] == "ab" && s[4..100] == "ef", "ranges are clipped");
+    s = "";
+    check(s[0..] == "" && s[..0] == "", "range of \"\"");
+}
+
+test_array_range() {
+    int *a, *b;
+
+    syswrite("\n=== Test 3: Array ranges ===");
+    a = ({ 1, 2, 3, 4, 5 });
+    check(same(a[1..2], ({ 2, 3 })), "a[1..2]");
+    check(same(a[..1], ({ 1, 2 })) && same(a[3..], ({ 4, 5 })),
+          "omitted start and end");
+    check(same(a[-2..], ({ 4, 5 })), "negative start");
+    check(same(a[4..4], ({ 5 })), "one element");
+    check(sizeof(a[3..1]) == 0 && sizeof(a[10..]) == 0, "empty ranges give ({ })");
+    check(same(a[-10..1], ({ 1, 2 })) && same(a[3..10], ({ 4, 5 })),
+          "ranges are clipped");
+
+    b = a[0..];
+    check(same(b, a), "whole range");
+    b[0] = 100;
+    check(a[0] == 1 && b[0] == 100, "write to a whole range leaves the array");
+    b = a[1..3];
+    b[0] = 200;
+    check(a[1] == 2, "write to a part range leaves the array");
+
+    a = ({ ({ 1, 2 }), ({ 3, 4 }) });
+    b = a[1..];
+    check(same(b[0], ({ 3, 4 })), "range of an array of arrays");
+}
+
+test_other_operands() {
+    int *a;
+    mapping m;
+
+    syswrite("\n=== Test 4: Other operands ===");
+    check(word()[0] == 'h' && word()[1..3] == "ell", "function results");
+    check(list()[1] == 20 && same(list()[2..], ({ 30, 40 })),
+          "array function results");
+    check(("ab" + "cd")[1..2] == "bc", "parenthesised expression");
+    check("literal"[0..2] == "lit", "string literal");
+
+    a = ({ "one", "two" });
+    check(a[1][0] == 't' && a[0][1..] == "ne", "index and range of an element");
+    m = ([ "k": "value" ]);
+    check(m["k"][0..1] == "va" && m["k"][-1] == 'e', "range of a mapping value");
+
+    gs = "global";
+    garr = ({ 7, 8, 9 });
+    check(gs[1..2] == "lo" && gs[-1] == 'l', "global string");
+    check(same(garr[1..], ({ 8, 9 })), "global array");
+}
+
+run_tests() {
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Index and Range Test Suite");
+    syswrite("===============================================\n");
+
+    test_string_index();
+    test_string_range();
+    test_array_range();
+    test_other_operands();
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
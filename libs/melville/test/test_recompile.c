@@ -0,0 +1,124 @@
+/* test_recompile.c - recompile() along an inherit chain
+ *
+ * recompile() compiles a program again along with every program that
+ * inherits it.  The prototype keeps the globals whose names are still
+ * declared, and a program whose source, includes and parents haven't
+ * changed is left as it is, with or without bytecode_path.
+ *
+ * The programs are written under /test as the tests run.
+ *
+ * Run via: eval new("/test/test_recompile").run_tests();
+ */
+
+#define BASE "/test/rc_base"
+#define MID "/test/rc_mid"
+#define TOP "/test/rc_top"
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+put_file(string path, string text) {
+    ferase(path);
+    write_file(path, text);
+}
+
+put_base(int value) {
+    put_file(BASE + ".c", "base_value() { return " + itoa(value) + "; }\n");
+}
+
+put_mid() {
+    put_file(MID + ".c", "inherit \"" + BASE + "\";\n\n" +
+             "mid_value() { return base_value() + 10; }\n");
+}
+
+put_top(string extra) {
+    put_file(TOP + ".c", "inherit \"" + MID + "\";\n\n" + extra +
+             "int count;\n\n" +
+             "set_count(n) { count = n; }\n" +
+             "get_count() { return count; }\n" +
+             "top_value() { return mid_value() + 100; }\n");
+}
+
+clean_up() {
+    object o;
+
+    if (o = atoo(TOP)) destruct(o);
+    if (o = atoo(MID)) destruct(o);
+    if (o = atoo(BASE)) destruct(o);
+    remove(TOP + ".c");
+    remove(MID + ".c");
+    remove(BASE + ".c");
+}
+
+test_chain() {
+    object top;
+
+    syswrite("=== Test 1: A change at the root of the chain ===");
+    put_base(1);
+    put_mid();
+    put_top("");
+    top = compile_object(TOP);
+    check(top && top.top_value() == 111, "chain compiles");
+    top.set_count(5);
+    put_base(2);
+    check(recompile(BASE) > 0, "recompile() of the root replaces programs");
+    top = atoo(TOP);
+    check(top && top.top_value() == 112, "inheritor sees the new root");
+    check(top && top.get_count() == 5, "inheritor keeps its globals");
+}
+
+test_unchanged() {
+    object top;
+
+    syswrite("\n=== Test 2: Nothing changed ===");
+    check(recompile(BASE) == 0, "unchanged root replaces nothing");
+    check(recompile(MID) == 0, "unchanged middle replaces nothing");
+    top = atoo(TOP);
+    check(top && top.top_value() == 112 && top.get_count() == 5,
+          "program left as it was");
+}
+
+test_new_global() {
+    object top;
+
+    syswrite("\n=== Test 3: A global added ahead of another ===");
+    put_top("int added;\n");
+    check(recompile(TOP) == 1, "recompile() of the leaf replaces one program");
+    top = atoo(TOP);
+    check(top && top.get_count() == 5, "global kept by name");
+    check(top && top.top_value() == 112, "inherited code still runs");
+}
+
+run_tests() {
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Recompile Test Suite");
+    syswrite("===============================================\n");
+
+    clean_up();
+    test_chain();
+    test_unchanged();
+    test_new_global();
+    clean_up();
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
@@ -0,0 +1,85 @@
+/* test_save_queue.c - Order of background save_object() writes
+ *
+ * save_object() queues its file for a writer thread, and a save that
+ * replaces the same object's save of the same key still waiting is
+ * written once.  These check the file always ends up with the last save
+ * made, whichever objects saved the key in between.
+ *
+ * Run via: eval new("/test/test_save_queue").run_tests();
+ */
+
+#define SAVER "/test/save/saver"
+#define KEY "/test/save/shared"
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+saved() {
+    mapping m;
+
+    m = restore_map(KEY);
+    return m ? m["val"] : 0;
+}
+
+run_tests() {
+    object a, b, big;
+    int i;
+
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Save Queue Test Suite");
+    syswrite("===============================================\n");
+
+    a = new(SAVER);
+    b = new(SAVER);
+    big = new(SAVER);
+
+    syswrite("=== Test 1: Saves of one key by two objects ===");
+    a.save_as(KEY, 1);
+    b.save_as(KEY, 2);
+    check(saved() == 2, "second object's save is the one kept");
+
+    /* hold the writer up so the next three saves all wait in the queue */
+    big.fill(3000);
+    big.save_as("/test/save/big", 0);
+    a.save_as(KEY, 3);
+    b.save_as(KEY, 4);
+    a.save_as(KEY, 5);
+    check(saved() == 5, "A, B, A queued together: the last A is kept");
+
+    big.save_as("/test/save/big", 0);
+    a.save_as(KEY, 6);
+    a.save_as(KEY, 7);
+    check(saved() == 7, "A, A queued together: the second is kept");
+
+    for (i = 0; i < 100; i++) {
+        a.save_as(KEY, i * 2);
+        b.save_as(KEY, i * 2 + 1);
+    }
+    check(saved() == 199, "alternating saves end with the last one");
+
+    destruct(a);
+    destruct(b);
+    destruct(big);
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
@@ -0,0 +1,152 @@
+/* test_sort_array.c - sort_array()
+ *
+ * sort_array() returns a sorted copy.  The sort is stable, can run
+ * descending or through a comparator, and takes about n comparisons on
+ * input that is already sorted.
+ *
+ * Run via: eval new("/test/test_sort_array").run_tests();
+ */
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+int compares;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+same(a, b) {
+    int i;
+
+    if (sizeof(a) != sizeof(b))
+        return 0;
+    for (i = 0; i < sizeof(a); i++)
+        if (a[i] != b[i])
+            return 0;
+    return 1;
+}
+
+ascending(arr) {
+    int i;
+
+    for (i = 1; i < sizeof(arr); i++)
+        if (arr[i - 1] > arr[i])
+            return 0;
+    return 1;
+}
+
+/* orders "key:tag" strings by key alone, so tags show stability */
+by_key(a, b) {
+    compares++;
+    return a[0] - b[0];
+}
+
+by_length(a, b) {
+    return strlen(a) - strlen(b);
+}
+
+broken(a, b) {
+    return a / 0;
+}
+
+test_sort_basic() {
+    int *arr, *sorted;
+
+    syswrite("=== Test 1: sort_array() ===");
+    arr = ({ 5, 2, 8, 1, 9, 2 });
+    sorted = sort_array(arr);
+    check(same(sorted, ({ 1, 2, 2, 5, 8, 9 })), "integers");
+    check(same(arr, ({ 5, 2, 8, 1, 9, 2 })), "the original is unchanged");
+    check(same(sort_array(arr, -1), ({ 9, 8, 5, 2, 2, 1 })), "negative direction");
+    check(same(sort_array(arr, 1), sorted), "positive direction");
+    check(same(sort_array(({ "Charlie", "alice", "Bob" })),
+               ({ "Bob", "Charlie", "alice" })), "strings, case-sensitive");
+    check(same(sort_array(({ "b", 3, "a", 1 })), ({ 1, 3, "a", "b" })),
+          "mixed types group integers first");
+    check(sizeof(sort_array(({ }))) == 0, "empty array");
+    check(same(sort_array(({ 7 })), ({ 7 })), "one element");
+}
+
+test_sort_large() {
+    int *arr, *sorted;
+    int i, ok;
+
+    syswrite("\n=== Test 2: Larger inputs ===");
+    arr = ({ });
+    for (i = 0; i < 500; i++)
+        arr += ({ (i * 7919) % 1009 });
+    sorted = sort_array(arr);
+    check(sizeof(sorted) == 500 && ascending(sorted), "500 scrambled integers");
+    check(same(sort_array(sorted), sorted), "already sorted input");
+    sorted = sort_array(arr, -1);
+    ok = 1;
+    for (i = 1; i < sizeof(sorted); i++)
+        if (sorted[i - 1] < sorted[i])
+            ok = 0;
+    check(ok, "500 integers descending");
+}
+
+test_sort_comparator() {
+    string *arr, *sorted;
+    int i;
+
+    syswrite("\n=== Test 3: Comparators ===");
+    arr = ({ "b:1", "a:1", "b:2", "c:1", "a:2", "b:3", "a:3" });
+    sorted = sort_array(arr, "by_key");
+    check(same(sorted, ({ "a:1", "a:2", "a:3", "b:1", "b:2", "b:3", "c:1" })),
+          "equal keys keep their order");
+    check(same(sort_array(({ "ccc", "a", "bb" }), "by_length", this_object()),
+               ({ "a", "bb", "ccc" })), "comparator in a given object");
+
+    arr = ({ });
+    for (i = 0; i < 200; i++)
+        arr += ({ "k" + itoa(1000 + i) });
+    compares = 0;
+    sort_array(arr, "by_key");
+    check(compares < 400, "sorted input takes about n comparisons");
+}
+
+/* an error in sort_array() aborts the call, so these give 0 */
+
+sort_missing() {
+    return sort_array(({ 2, 1 }), "no_such_function");
+}
+
+sort_broken() {
+    return sort_array(({ 2, 1 }), "broken");
+}
+
+test_sort_errors() {
+    syswrite("\n=== Test 4: Comparator errors ===");
+    check(this_object().sort_missing() == 0, "missing comparator is an error");
+    check(this_object().sort_broken() == 0, "comparator that fails is an error");
+}
+
+run_tests() {
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("sort_array() Test Suite");
+    syswrite("===============================================\n");
+
+    test_sort_basic();
+    test_sort_large();
+    test_sort_comparator();
+    test_sort_errors();
+
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
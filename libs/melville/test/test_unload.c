@@ -0,0 +1,143 @@
+/* test_unload.c - Unloading idle programs
+ *
+ * With lazy_load and unload_idle set in netci.ini, a program whose object
+ * has been left alone for unload_idle seconds is unloaded, and loaded
+ * again the next time its path is used.  Only a program that loading
+ * again gives back exactly goes: not one whose globals changed since
+ * init(), nor one an array or mapping element still refers to.
+ *
+ * The programs are written under /test, then left for a few sweeps: the
+ * results print when the alarm goes off.  Run with, for instance,
+ * lazy_load=1 and unload_idle=1; with either unset there is nothing to
+ * test.
+ *
+ * Run via: eval new("/test/test_unload").run_tests();
+ */
+
+#define IDLE "/test/ul_idle"
+#define STATE "/test/ul_state"
+#define ARR "/test/ul_arr"
+#define MAP "/test/ul_map"
+
+int tests_run;
+int tests_passed;
+int tests_failed;
+object *held_arr;
+mapping held_map;
+
+check(int ok, string description) {
+    tests_run++;
+    if (ok) {
+        syswrite("  [PASS] " + description);
+        tests_passed++;
+    } else {
+        syswrite("  [FAIL] " + description);
+        tests_failed++;
+    }
+}
+
+put_file(string path, string text) {
+    ferase(path);
+    write_file(path, text);
+}
+
+put_prog(string path) {
+    put_file(path + ".c", "int val;\nstring name;\n\n" +
+             "init() { name = \"from init\"; }\n" +
+             "setval(n) { val = n; }\n" +
+             "getval() { return val; }\n" +
+             "getname() { return name; }\n");
+}
+
+/* Whether path is loaded, without loading it */
+loaded(string path) {
+    object p;
+    string s;
+
+    p = atoo("/boot");
+    while (p) {
+        s = otoa(p);
+        if (s == path || s[0..strlen(path)] == path + "#")
+            return 1;
+        p = next_proto(p);
+    }
+    return 0;
+}
+
+clean_up() {
+    object o;
+
+    held_arr = 0;
+    held_map = 0;
+    if (o = atoo(IDLE)) destruct(o);
+    if (o = atoo(STATE)) destruct(o);
+    if (o = atoo(ARR)) destruct(o);
+    if (o = atoo(MAP)) destruct(o);
+    remove(IDLE + ".c");
+    remove(STATE + ".c");
+    remove(ARR + ".c");
+    remove(MAP + ".c");
+}
+
+summary() {
+    syswrite("\n===============================================");
+    syswrite("Tests Run:    " + itoa(tests_run));
+    syswrite("Tests Passed: " + itoa(tests_passed));
+    syswrite("Tests Failed: " + itoa(tests_failed));
+    syswrite("===============================================\n");
+}
+
+run_tests() {
+    mapping config;
+    int idle;
+
+    tests_run = 0;
+    tests_passed = 0;
+    tests_failed = 0;
+
+    syswrite("\n===============================================");
+    syswrite("Unload Test Suite");
+    syswrite("===============================================\n");
+
+    config = query_config();
+    idle = config["unload_idle"];
+    if (!config["lazy_load"] || idle <= 0) {
+        syswrite("(lazy_load or unload_idle is off: nothing to test)");
+        summary();
+        return;
+    }
+    clean_up();
+    put_prog(IDLE);
+    put_prog(STATE);
+    put_prog(ARR);
+    put_prog(MAP);
+    compile_object(IDLE);
+    compile_object(STATE).setval(5);
+    held_arr = ({ compile_object(ARR) });
+    held_map = ([ "k": compile_object(MAP) ]);
+    syswrite("(waiting for the programs to go idle)");
+    alarm(2 * idle + 2, "finish_tests");
+}
+
+finish_tests() {
+    syswrite("=== Test 1: An idle program ===");
+    check(!loaded(IDLE), "unloaded");
+    check(call_other(IDLE, "getname") == "from init",
+          "loaded again, through init(), when called");
+
+    syswrite("\n=== Test 2: Globals changed since init() ===");
+    check(loaded(STATE), "kept loaded");
+    if (loaded(STATE))
+        check(atoo(STATE).getval() == 5, "kept its globals");
+
+    syswrite("\n=== Test 3: Held by an array or mapping ===");
+    check(loaded(ARR), "array element's program kept loaded");
+    if (loaded(ARR))
+        check(held_arr[0].getname() == "from init", "array element usable");
+    check(loaded(MAP), "mapping value's program kept loaded");
+    if (loaded(MAP))
+        check(held_map["k"].getname() == "from init", "mapping value usable");
+
+    clean_up();
+    summary();
+}
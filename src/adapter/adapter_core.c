@@ -1,12 +1,28 @@
 /* adapter/adapter_core.c - Save adapter management */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <errno.h>
 #include "../config.h"
 #include "../autoconf.h"
 #include "../object.h"
 #include "../save_adapter.h"
 #include "../file.h"
 
+extern char *fs_path;
+extern char *save_path;
+extern char *save_type;
+
+/* Adapters selectable with save_type= in the ini file */
+static save_adapter_t *known_adapters[] = {
+    &file_adapter,
+    &binary_adapter,
+    &kv_adapter,
+    NULL
+};
+
 /* Current active adapter */
 static save_adapter_t *current_adapter = NULL;
 
@@ -30,11 +46,95 @@ void set_save_adapter(save_adapter_t *adapter) {
     }
 }
 
-/* Initialize save adapter system */
+/* Initialize save adapter system from the configured save_type */
 void init_save_adapter(void) {
     char buf[256];
+    int i;
     
     current_adapter = &file_adapter;
-    sprintf(buf, "  save_adapter: initialized with file adapter");
+    if (save_type && *save_type) {
+        for (i = 0; known_adapters[i]; i++)
+            if (!strcmp(known_adapters[i]->name, save_type))
+                break;
+        if (known_adapters[i]) {
+            current_adapter = known_adapters[i];
+        } else {
+            snprintf(buf, sizeof(buf), "  save_adapter: unknown save_type '%s', using file",
+                     save_type);
+            logger(LOG_WARNING, buf);
+        }
+    }
+    sprintf(buf, "  save_adapter: initialized with %s adapter", current_adapter->name);
     logger(LOG_INFO, buf);
 }
+
+/* Build full save path from key
+ * Returns allocated string: fs_path/save_path + key + ext
+ */
+char *adapter_save_path(char *key, char *ext) {
+    char *result;
+    char *key_part;
+    int len, save_path_len;
+    
+    /* Default save_path if not configured */
+    if (!save_path || !*save_path) {
+        save_path = "data/save/";
+    }
+    
+    /* Skip leading slash in key if save_path ends with slash */
+    save_path_len = strlen(save_path);
+    key_part = key;
+    if (save_path[save_path_len - 1] == '/' && key[0] == '/') {
+        key_part = key + 1;  /* Skip the leading slash in key */
+    }
+    
+    /* Build full path: fs_path + "/" + save_path + key_part + ext */
+    len = strlen(fs_path) + strlen(save_path) + strlen(key_part) + strlen(ext) + 2;
+    result = MALLOC(len);
+    
+    /* Construct path */
+    sprintf(result, "%s/%s%s%s", fs_path, save_path, key_part, ext);
+    
+    return result;
+}
+
+/* Create parent directories for a file path */
+int adapter_make_dirs(char *filepath) {
+    char *path, *p;
+    struct stat st;
+    char logbuf[512];
+    
+    /* Copy path so we can modify it */
+    path = MALLOC(strlen(filepath) + 1);
+    strcpy(path, filepath);
+    
+    sprintf(logbuf, "  save_adapter: adapter_make_dirs for: %s", filepath);
+    logger(LOG_DEBUG, logbuf);
+    
+    /* Walk path and create directories */
+    for (p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            
+            /* Check if directory exists */
+            if (stat(path, &st) != 0) {
+                /* Directory doesn't exist, try to create it */
+                sprintf(logbuf, "  save_adapter: creating directory: %s", path);
+                logger(LOG_INFO, logbuf);
+                
+                if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+                    sprintf(logbuf, "  save_adapter: mkdir failed for %s (errno=%d: %s)", 
+                            path, errno, strerror(errno));
+                    logger(LOG_ERROR, logbuf);
+                    FREE(path);
+                    return -1;
+                }
+            }
+            
+            *p = '/';
+        }
+    }
+    
+    FREE(path);
+    return 0;
+}
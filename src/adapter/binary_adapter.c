@@ -0,0 +1,505 @@
+/* adapter/binary_adapter.c - Compact binary storage adapter for save_object
+ *
+ * Selected with save_type=binary.  Files are written next to the text
+ * saves as <key>.bin:
+ *
+ *   magic     "NCIB"
+ *   version   2 bytes, little-endian (BINARY_SAVE_VERSION)
+ *   flags     2 bytes, reserved (0)
+ *   strings   count, then per string: length, bytes, NUL
+ *   value     one tagged value (the saved mapping)
+ *
+ * Counts, lengths and string indices are unsigned LEB128 varints and
+ * integers are zigzag varints, so small numbers take a single byte.
+ * Each distinct string (mapping keys, string values, object paths) is
+ * stored once in the table and referenced by index afterwards.
+ *
+ * Value tags:
+ *   'i' integer       'i' varint
+ *   's' string        's' table index
+ *   'a' array         'a' count, count values
+ *   'm' mapping       'm' count, count key/value pairs
+ *
+ * Restore maps the file read-only and decodes straight out of the
+ * mapping; table strings are NUL-terminated in the file so string keys
+ * are looked up in place and only copied once, into the result.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "../config.h"
+#include "../autoconf.h"
+#include "../object.h"
+#include "../save_adapter.h"
+#include "../constrct.h"
+#include "../file.h"
+#include "../protos.h"
+#include "../saveq.h"
+
+#define BINARY_SAVE_MAGIC "NCIB"
+#define BINARY_SAVE_VERSION 1
+#define BINARY_HEADER_SIZE 8
+#define MAX_SAVE_DEPTH 50         /* same limit as save_value() */
+
+#define TAG_INTEGER 'i'
+#define TAG_STRING  's'
+#define TAG_ARRAY   'a'
+#define TAG_MAPPING 'm'
+
+/* Growable output buffer for the encoded value */
+struct bin_buf {
+    unsigned char *data;
+    unsigned long length;
+    unsigned long capacity;
+    int failed;                   /* an allocation failed; data is short */
+};
+
+/* Encoder state: output plus the string table being built */
+struct bin_encoder {
+    struct bin_buf out;
+    struct heap_mapping *index;   /* string -> table index + 1 */
+    char **strings;               /* table, in index order (not owned) */
+    unsigned int nstrings;
+    unsigned int max_strings;
+};
+
+/* Decoder state: a window on the mapped file */
+struct bin_decoder {
+    const unsigned char *p;
+    const unsigned char *end;
+    char **strings;               /* point into the mapped file */
+    unsigned long *lengths;
+    unsigned long nstrings;
+};
+
+/* Returns 0 once b has room for extra more bytes; 1, with b->failed
+ * set, if it couldn't be grown
+ */
+static int bin_reserve(struct bin_buf *b, unsigned long extra) {
+    unsigned long cap;
+    unsigned char *data;
+
+    if (b->failed) return 1;
+    if (b->length + extra <= b->capacity) return 0;
+    cap = b->capacity ? b->capacity : 256;
+    while (cap < b->length + extra)
+        cap *= 2;
+    data = realloc(b->data, cap);
+    if (!data) {
+        b->failed = 1;
+        return 1;
+    }
+    b->data = data;
+    b->capacity = cap;
+    return 0;
+}
+
+static void bin_put_byte(struct bin_buf *b, int c) {
+    if (bin_reserve(b, 1)) return;
+    b->data[b->length++] = (unsigned char) c;
+}
+
+static void bin_put_uvar(struct bin_buf *b, unsigned long v) {
+    if (bin_reserve(b, 10)) return;
+    while (v >= 0x80) {
+        b->data[b->length++] = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    b->data[b->length++] = (unsigned char) v;
+}
+
+/* Table index for str, adding it on first sight */
+static unsigned long intern_string(struct bin_encoder *enc, char *str) {
+    struct var key, *slot;
+
+    key.type = STRING;
+    key.value.string = str;
+    slot = mapping_get_or_create(enc->index, &key);
+    if (slot->value.integer)
+        return slot->value.integer - 1;
+    if (enc->nstrings == enc->max_strings) {
+        unsigned int max = enc->max_strings ? enc->max_strings * 2 : 64;
+        char **strings = realloc(enc->strings, sizeof(char *) * max);
+
+        if (!strings) {
+            enc->out.failed = 1;
+            return 0;
+        }
+        enc->strings = strings;
+        enc->max_strings = max;
+    }
+    enc->strings[enc->nstrings] = str;
+    slot->value.integer = ++enc->nstrings;
+    return enc->nstrings - 1;
+}
+
+static int encode_value(struct bin_encoder *enc, struct var *value, int depth) {
+    struct heap_array *arr;
+    struct heap_mapping *map;
+    unsigned long v;
+    unsigned int i;
+
+    if (depth > MAX_SAVE_DEPTH) {
+        logger(LOG_ERROR, "  binary_adapter: maximum recursion depth exceeded");
+        return 1;
+    }
+
+    switch (value->type) {
+        case INTEGER:
+            v = (unsigned long) value->value.integer;
+            bin_put_byte(&enc->out, TAG_INTEGER);
+            bin_put_uvar(&enc->out, value->value.integer < 0 ? ~(v << 1) : v << 1);
+            break;
+
+        case STRING:
+            bin_put_byte(&enc->out, TAG_STRING);
+            bin_put_uvar(&enc->out, intern_string(enc, value->value.string));
+            break;
+
+        case ARRAY:
+            arr = value->value.array_ptr;
+            bin_put_byte(&enc->out, TAG_ARRAY);
+            bin_put_uvar(&enc->out, arr ? arr->size : 0);
+            for (i = 0; arr && i < arr->size; i++)
+                if (encode_value(enc, &arr->elements[i], depth + 1))
+                    return 1;
+            break;
+
+        case MAPPING:
+            map = value->value.mapping_ptr;
+            bin_put_byte(&enc->out, TAG_MAPPING);
+            bin_put_uvar(&enc->out, map ? map->size : 0);
+            for (i = 0; map && i < map->capacity; i++) {
+                if (!MAPPING_SLOT_USED(map, i))
+                    continue;
+                if (encode_value(enc, &map->slots[i].key, depth + 1) ||
+                    encode_value(enc, &map->slots[i].value, depth + 1))
+                    return 1;
+            }
+            break;
+
+        case OBJECT:
+            /* Objects are saved as their path, as in the text format */
+            if (value->value.objptr && value->value.objptr->parent &&
+                value->value.objptr->parent->pathname) {
+                bin_put_byte(&enc->out, TAG_STRING);
+                bin_put_uvar(&enc->out,
+                             intern_string(enc, value->value.objptr->parent->pathname));
+                break;
+            }
+            bin_put_byte(&enc->out, TAG_INTEGER);
+            bin_put_uvar(&enc->out, 0);
+            break;
+
+        default:
+            {
+                char logbuf[256];
+                sprintf(logbuf, "  binary_adapter: unsupported type %d", value->type);
+                logger(LOG_WARNING, logbuf);
+            }
+            bin_put_byte(&enc->out, TAG_INTEGER);
+            bin_put_uvar(&enc->out, 0);
+            break;
+    }
+    return enc->out.failed;
+}
+
+/* Lay out header, string table and encoded value in one buffer
+ * Returns 0 on success, 1 if the buffer couldn't be grown
+ */
+static int build_file(struct bin_buf *file, struct bin_encoder *enc) {
+    unsigned long len;
+    unsigned int i;
+
+    if (bin_reserve(file, BINARY_HEADER_SIZE + enc->out.length)) return 1;
+    memcpy(file->data, BINARY_SAVE_MAGIC, 4);
+    file->data[4] = BINARY_SAVE_VERSION & 0xff;
+    file->data[5] = (BINARY_SAVE_VERSION >> 8) & 0xff;
+    file->data[6] = file->data[7] = 0;
+    file->length = BINARY_HEADER_SIZE;
+    bin_put_uvar(file, enc->nstrings);
+    for (i = 0; i < enc->nstrings; i++) {
+        len = strlen(enc->strings[i]);
+        bin_put_uvar(file, len);
+        if (bin_reserve(file, len + 1)) return 1;
+        memcpy(file->data + file->length, enc->strings[i], len + 1);
+        file->length += len + 1;
+    }
+    if (bin_reserve(file, enc->out.length)) return 1;
+    memcpy(file->data + file->length, enc->out.data, enc->out.length);
+    file->length += enc->out.length;
+    return 0;
+}
+
+/* Encode a mapping as a complete binary save image
+ * Returns: allocated image (caller must FREE) with its length in *len,
+ * or NULL on error
+ */
+char *binary_encode_map(struct heap_mapping *data, unsigned long *len) {
+    struct bin_encoder enc;
+    struct bin_buf file;
+    struct var map_var;
+
+    memset(&enc, 0, sizeof(enc));
+    memset(&file, 0, sizeof(file));
+    enc.index = allocate_mapping(0);
+    map_var.type = MAPPING;
+    map_var.value.mapping_ptr = data;
+    if (!encode_value(&enc, &map_var, 0) && !build_file(&file, &enc)) {
+        *len = file.length;
+    } else {
+        free(file.data);
+        file.data = NULL;
+    }
+    mapping_release(enc.index);
+    free(enc.strings);
+    free(enc.out.data);
+    return (char *) file.data;
+}
+
+/* Binary adapter: save mapping to <key>.bin
+ * The file is built here and written behind by the save queue.
+ */
+static int binary_save_map(char *key, struct heap_mapping *data, struct object *caller) {
+    char *path, *image;
+    unsigned long len;
+    int result;
+    char logbuf[512];
+
+    if (!key || !data) return -1;
+
+    path = adapter_save_path(key, ".bin");
+    if (adapter_make_dirs(path) != 0) {
+        sprintf(logbuf, "  binary_adapter: failed to create directory for: %s (errno=%d)",
+                path, errno);
+        logger(LOG_ERROR, logbuf);
+        FREE(path);
+        return -1;
+    }
+
+    /* Encode now: the mapping may change once we return */
+    image = binary_encode_map(data, &len);
+    if (!image) {
+        logger(LOG_ERROR, "  binary_adapter: serialization failed");
+        FREE(path);
+        return -1;
+    }
+    result = saveq_write(path, key, image, len, caller);
+    FREE(path);
+    return result;
+}
+
+static int get_uvar(struct bin_decoder *dec, unsigned long *v) {
+    unsigned long result = 0;
+    int shift = 0;
+
+    while (dec->p < dec->end && shift < 64) {
+        result |= (unsigned long) (*dec->p & 0x7f) << shift;
+        if (!(*dec->p++ & 0x80)) {
+            *v = result;
+            return 0;
+        }
+        shift += 7;
+    }
+    return 1;
+}
+
+static int get_string_index(struct bin_decoder *dec, unsigned long *idx) {
+    return get_uvar(dec, idx) || *idx >= dec->nstrings;
+}
+
+/* Decode one value into result.  result is always left holding a valid
+ * value, even on failure, so the caller can clear what was built.
+ * Returns 0 on success, 1 on a malformed file.
+ */
+static int decode_value(struct bin_decoder *dec, struct var *result, int depth) {
+    struct heap_array *arr;
+    struct heap_mapping *map;
+    struct var key, *slot;
+    unsigned long v, count, i;
+
+    result->type = INTEGER;
+    result->value.integer = 0;
+    if (depth > MAX_SAVE_DEPTH || dec->p >= dec->end) return 1;
+
+    switch (*dec->p++) {
+        case TAG_INTEGER:
+            if (get_uvar(dec, &v)) return 1;
+            result->value.integer = (signed long) ((v & 1) ? ~(v >> 1) : v >> 1);
+            return 0;
+
+        case TAG_STRING:
+            if (get_string_index(dec, &v)) return 1;
+            result->type = STRING;
+            result->value.string = MALLOC(dec->lengths[v] + 1);
+            memcpy(result->value.string, dec->strings[v], dec->lengths[v] + 1);
+            return 0;
+
+        case TAG_ARRAY:
+            /* every element takes at least two bytes */
+            if (get_uvar(dec, &count) || count > (unsigned long) (dec->end - dec->p) / 2)
+                return 1;
+            arr = allocate_array(count, UNLIMITED_ARRAY_SIZE);
+            if (!arr) return 1;
+            result->type = ARRAY;
+            result->value.array_ptr = arr;
+            for (i = 0; i < count; i++)
+                if (decode_value(dec, &arr->elements[i], depth + 1))
+                    return 1;
+            return 0;
+
+        case TAG_MAPPING:
+            if (get_uvar(dec, &count) || count > (unsigned long) (dec->end - dec->p) / 4)
+                return 1;
+            /* size the table so the loads below never rehash */
+            map = allocate_mapping(count + count / 7 + 1);
+            if (!map) return 1;
+            result->type = MAPPING;
+            result->value.mapping_ptr = map;
+            for (i = 0; i < count; i++) {
+                if (dec->p < dec->end && *dec->p == TAG_STRING) {
+                    /* string keys are looked up straight out of the file */
+                    dec->p++;
+                    if (get_string_index(dec, &v)) return 1;
+                    key.type = STRING;
+                    key.value.string = dec->strings[v];
+                    slot = mapping_get_or_create(map, &key);
+                } else {
+                    if (decode_value(dec, &key, depth + 1)) {
+                        clear_var(&key);
+                        return 1;
+                    }
+                    slot = mapping_get_or_create(map, &key);
+                    clear_var(&key);
+                }
+                if (!slot) return 1;
+                clear_var(slot);
+                if (decode_value(dec, slot, depth + 1))
+                    return 1;
+            }
+            return 0;
+    }
+    return 1;
+}
+
+/* Decode a binary save image; name is used in log messages
+ * Returns: the mapping, or NULL if the image is invalid
+ */
+struct heap_mapping *binary_decode_map(unsigned char *base, unsigned long size,
+                                       char *name) {
+    struct bin_decoder dec;
+    struct heap_mapping *result = NULL;
+    struct var parsed_value;
+    unsigned long i, len;
+    char logbuf[512];
+    int version;
+
+    if (size < BINARY_HEADER_SIZE || memcmp(base, BINARY_SAVE_MAGIC, 4)) {
+        snprintf(logbuf, sizeof(logbuf), "  binary_adapter: not a binary save: %s", name);
+        logger(LOG_ERROR, logbuf);
+        return NULL;
+    }
+    version = base[4] | (base[5] << 8);
+    if (version > BINARY_SAVE_VERSION) {
+        snprintf(logbuf, sizeof(logbuf),
+                 "  binary_adapter: %s is format version %d, newer than %d",
+                 name, version, BINARY_SAVE_VERSION);
+        logger(LOG_ERROR, logbuf);
+        return NULL;
+    }
+
+    memset(&dec, 0, sizeof(dec));
+    dec.p = base + BINARY_HEADER_SIZE;
+    dec.end = base + size;
+
+    /* Index the string table in place */
+    if (get_uvar(&dec, &dec.nstrings) ||
+        dec.nstrings > (unsigned long) (dec.end - dec.p) / 2)
+        goto corrupt;
+    dec.strings = MALLOC(sizeof(char *) * (dec.nstrings + 1));
+    dec.lengths = MALLOC(sizeof(unsigned long) * (dec.nstrings + 1));
+    for (i = 0; i < dec.nstrings; i++) {
+        if (get_uvar(&dec, &len) || len >= (unsigned long) (dec.end - dec.p) ||
+            dec.p[len] != '\0')
+            goto corrupt;
+        dec.strings[i] = (char *) dec.p;
+        dec.lengths[i] = len;
+        dec.p += len + 1;
+    }
+
+    if (decode_value(&dec, &parsed_value, 0)) {
+        clear_var(&parsed_value);
+        goto corrupt;
+    }
+    if (parsed_value.type != MAPPING) {
+        logger(LOG_ERROR, "  binary_adapter: restored value is not a mapping");
+        clear_var(&parsed_value);
+        goto done;
+    }
+    result = parsed_value.value.mapping_ptr;
+    goto done;
+
+corrupt:
+    snprintf(logbuf, sizeof(logbuf), "  binary_adapter: corrupt save: %s", name);
+    logger(LOG_ERROR, logbuf);
+done:
+    if (dec.strings) FREE(dec.strings);
+    if (dec.lengths) FREE(dec.lengths);
+    return result;
+}
+
+/* Binary adapter: restore mapping from <key>.bin
+ * Falls back to a text save when no binary one exists yet, so switching
+ * save_type to binary keeps existing saves readable.
+ */
+static struct heap_mapping *binary_restore_map(char *key, struct object *caller) {
+    struct heap_mapping *result = NULL;
+    struct stat st;
+    unsigned char *base;
+    char *path;
+    char logbuf[512];
+    int fd;
+
+    if (!key) return NULL;
+
+    path = adapter_save_path(key, ".bin");
+    saveq_wait(path);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        FREE(path);
+        return file_adapter.restore_map(key, caller);
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < BINARY_HEADER_SIZE) {
+        logger(LOG_ERROR, "  binary_adapter: invalid file size");
+        close(fd);
+        FREE(path);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        sprintf(logbuf, "  binary_adapter: mmap failed for: %s (errno=%d)", path, errno);
+        logger(LOG_ERROR, logbuf);
+        FREE(path);
+        return NULL;
+    }
+    result = binary_decode_map(base, st.st_size, path);
+    munmap(base, st.st_size);
+    FREE(path);
+    return result;
+}
+
+/* Binary adapter definition */
+save_adapter_t binary_adapter = {
+    "binary",
+    binary_save_map,
+    binary_restore_map,
+    NULL
+};
@@ -13,145 +13,51 @@
 #include "../file.h"
 #include "../token.h"
 #include "../protos.h"
-
-extern char *fs_path;
-extern char *save_path;
+#include "../saveq.h"
 
 /* Forward declarations for functions used by adapter */
-extern char *save_value_internal(struct var *value, int indent);
 extern void clear_var(struct var *v);
 extern void mapping_addref(struct heap_mapping *map);
 
-/* Build full save path from key
- * Returns allocated string: fs_path/save_path + key + ".o"
- */
-static char *build_save_path(char *key) {
-    char *result;
-    char *base_dir;
-    char *key_part;
-    int len, save_path_len;
-    
-    /* Default save_path if not configured */
-    if (!save_path || !*save_path) {
-        save_path = "data/save/";
-    }
-    
-    /* Skip leading slash in key if save_path ends with slash */
-    save_path_len = strlen(save_path);
-    key_part = key;
-    if (save_path[save_path_len - 1] == '/' && key[0] == '/') {
-        key_part = key + 1;  /* Skip the leading slash in key */
-    }
-    
-    /* Build full path: fs_path + "/" + save_path + key_part + ".o" */
-    len = strlen(fs_path) + strlen(save_path) + strlen(key_part) + 6;
-    result = MALLOC(len);
-    
-    /* Construct path */
-    sprintf(result, "%s/%s%s.o", fs_path, save_path, key_part);
-    
-    return result;
-}
-
-/* Create parent directories for a file path */
-static int ensure_directory_exists(char *filepath) {
-    char *path, *p;
-    struct stat st;
-    char logbuf[512];
-    
-    /* Copy path so we can modify it */
-    path = MALLOC(strlen(filepath) + 1);
-    strcpy(path, filepath);
-    
-    sprintf(logbuf, "  file_adapter: ensure_directory_exists for: %s", filepath);
-    logger(LOG_DEBUG, logbuf);
-    
-    /* Walk path and create directories */
-    for (p = path + 1; *p; p++) {
-        if (*p == '/') {
-            *p = '\0';
-            
-            /* Check if directory exists */
-            if (stat(path, &st) != 0) {
-                /* Directory doesn't exist, try to create it */
-                sprintf(logbuf, "  file_adapter: creating directory: %s", path);
-                logger(LOG_INFO, logbuf);
-                
-                if (mkdir(path, 0755) != 0 && errno != EEXIST) {
-                    sprintf(logbuf, "  file_adapter: mkdir failed for %s (errno=%d: %s)", 
-                            path, errno, strerror(errno));
-                    logger(LOG_ERROR, logbuf);
-                    FREE(path);
-                    return -1;
-                }
-            }
-            
-            *p = '/';
-        }
-    }
-    
-    FREE(path);
-    return 0;
-}
-
 /* File adapter: save mapping to file
- * Format: mapping literal using save_value() serialization
+ * Format: mapping literal using save_value() serialization.  The text is
+ * built here and written behind by the save queue.
  */
 static int file_save_map(char *key, struct heap_mapping *data, struct object *caller) {
-    char *path;
-    char *serialized;
-    FILE *fp;
-    int result = 0;
+    struct var map_var;
+    char *path, *text;
+    unsigned long len;
+    int result;
     char logbuf[512];
     
     if (!key || !data) return -1;
     
     /* Build file path */
-    path = build_save_path(key);
+    path = adapter_save_path(key, ".o");
     
     sprintf(logbuf, "  file_adapter: attempting to save to: %s", path);
     logger(LOG_DEBUG, logbuf);
     
     /* Ensure parent directory exists */
-    if (ensure_directory_exists(path) != 0) {
+    if (adapter_make_dirs(path) != 0) {
         sprintf(logbuf, "  file_adapter: failed to create directory for: %s (errno=%d)", path, errno);
         logger(LOG_ERROR, logbuf);
         FREE(path);
         return -1;
     }
     
-    /* Serialize mapping to string using save_value_internal() */
-    {
-        struct var map_var;
-        map_var.type = MAPPING;
-        map_var.value.mapping_ptr = data;
-        serialized = save_value_internal(&map_var, 0);
-        /* Don't clear map_var since we don't own the mapping */
-    }
-    
-    if (!serialized) {
+    /* Serialize now: the mapping may change once we return */
+    map_var.type = MAPPING;
+    map_var.value.mapping_ptr = data;
+    /* Don't clear map_var since we don't own the mapping */
+    text = save_value_line(&map_var, &len);
+    if (!text) {
         logger(LOG_ERROR, "  file_adapter: serialization failed");
         FREE(path);
         return -1;
     }
     
-    /* Write to file */
-    fp = fopen(path, "w");
-    if (!fp) {
-        logger(LOG_ERROR, "  file_adapter: failed to open file for writing");
-        FREE(serialized);
-        FREE(path);
-        return -1;
-    }
-    
-    /* Write serialized mapping */
-    if (fprintf(fp, "%s\n", serialized) < 0) {
-        logger(LOG_ERROR, "  file_adapter: write failed");
-        result = -1;
-    }
-    
-    fclose(fp);
-    FREE(serialized);
+    result = saveq_write(path, key, text, len, caller);
     FREE(path);
     
     return result;
@@ -168,7 +74,10 @@ static struct heap_mapping *file_restore_map(char *key, struct object *caller) {
     if (!key) return NULL;
     
     /* Build file path */
-    path = build_save_path(key);
+    path = adapter_save_path(key, ".o");
+    
+    /* Don't read past a save that is still being written */
+    saveq_wait(path);
     
     /* Open file */
     fp = fopen(path, "r");
@@ -253,5 +162,6 @@ static struct heap_mapping *file_restore_map(char *key, struct object *caller) {
 save_adapter_t file_adapter = {
     "file",
     file_save_map,
-    file_restore_map
+    file_restore_map,
+    NULL
 };
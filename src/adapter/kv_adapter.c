@@ -0,0 +1,441 @@
+/* adapter/kv_adapter.c - Single-file key-value store adapter for save_object
+ *
+ * Selected with save_type=kv.  Every save lives in one append-only log,
+ * save_path/store.kv, instead of a file per key:
+ *
+ *   header    "NCKV", version (2 bytes), flags (2 bytes)
+ *   records   crc32, key length, value length, key, value
+ *
+ * Lengths are LEB128 varints and values are binary_adapter save images.
+ * The crc covers everything in the record after it, so a record torn by
+ * a crash is found and cut off the next time the store is opened.
+ *
+ * An index of every live key, sorted so prefixes can be listed, is built
+ * when the store is opened.  Saves append a new record and repoint the
+ * index; appends go through the save queue, which merges everything saved
+ * while the writer is busy into one write and one fsync.  Once more of
+ * the file is dead records than live ones the writer rewrites it with
+ * only the live records; the game thread just renumbers the index.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "../config.h"
+#include "../autoconf.h"
+#include "../object.h"
+#include "../save_adapter.h"
+#include "../constrct.h"
+#include "../file.h"
+#include "../protos.h"
+#include "../saveq.h"
+
+#define KV_MAGIC "NCKV"
+#define KV_VERSION 1
+#define KV_HEADER_SIZE 8
+#define KV_RECORD_MAX_HEAD 24     /* crc plus two varints */
+
+struct kv_entry {
+    char *key;
+    unsigned long offset;         /* start of the record in the file */
+    unsigned long length;         /* whole record */
+    unsigned long value_len;      /* value, at the end of the record */
+};
+
+static struct kv_entry *entries;  /* sorted by key */
+static unsigned long num_entries, max_entries;
+static unsigned long live_bytes;  /* total length of indexed records */
+static unsigned long store_end;   /* end of the file once queued appends land */
+static char *store_path;
+static int store_fd = -1;
+static int store_stale;           /* file was replaced; reopen before reading */
+static unsigned long crc_table[256];
+
+static unsigned long kv_crc(unsigned char *data, unsigned long len) {
+    unsigned long crc, c;
+    int i, j;
+
+    if (!crc_table[1]) {
+        for (i = 0; i < 256; i++) {
+            c = i;
+            for (j = 0; j < 8; j++)
+                c = (c & 1) ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+    }
+    crc = 0xffffffffUL;
+    while (len--)
+        crc = crc_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffUL;
+}
+
+static unsigned char *put_uvar(unsigned char *p, unsigned long v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char) v;
+    return p;
+}
+
+static unsigned char *get_uvar(unsigned char *p, unsigned char *end, unsigned long *v) {
+    unsigned long result = 0;
+    int shift = 0;
+
+    while (p < end && shift < 64) {
+        result |= (unsigned long) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) {
+            *v = result;
+            return p;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+/* Parse the record at p; returns its length, or 0 if it is torn or corrupt */
+static unsigned long parse_record(unsigned char *p, unsigned char *end,
+                                  unsigned char **key, unsigned long *key_len,
+                                  unsigned long *value_len) {
+    unsigned char *q;
+    unsigned long crc;
+
+    if (end - p < 6) return 0;
+    crc = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long) p[3] << 24);
+    if (!(q = get_uvar(p + 4, end, key_len))) return 0;
+    if (!(q = get_uvar(q, end, value_len))) return 0;
+    if (*key_len > (unsigned long) (end - q) ||
+        *value_len > (unsigned long) (end - q) - *key_len)
+        return 0;
+    *key = q;
+    q += *key_len + *value_len;
+    if (kv_crc(p + 4, q - p - 4) != crc) return 0;
+    return q - p;
+}
+
+/* saveq_compact() check: 0 if data is exactly one intact record */
+static int kv_check(char *data, unsigned long len) {
+    unsigned char *key;
+    unsigned long key_len, value_len;
+
+    return parse_record((unsigned char *) data, (unsigned char *) data + len,
+                        &key, &key_len, &value_len) != len;
+}
+
+static void kv_header(unsigned char *head) {
+    memcpy(head, KV_MAGIC, 4);
+    head[4] = KV_VERSION & 0xff;
+    head[5] = (KV_VERSION >> 8) & 0xff;
+    head[6] = head[7] = 0;
+}
+
+/* Binary search; returns 1 and the entry's position if key is indexed,
+ * else 0 and the position it would be inserted at */
+static int find_entry(char *key, unsigned long *pos) {
+    unsigned long lo = 0, hi = num_entries, mid;
+    int cmp;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        cmp = strcmp(entries[mid].key, key);
+        if (!cmp) {
+            *pos = mid;
+            return 1;
+        }
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *pos = lo;
+    return 0;
+}
+
+static void index_set(char *key, unsigned long offset, unsigned long length,
+                      unsigned long value_len) {
+    struct kv_entry *entry;
+    unsigned long pos;
+
+    if (find_entry(key, &pos)) {
+        live_bytes -= entries[pos].length;
+    } else {
+        if (num_entries == max_entries) {
+            max_entries = max_entries ? max_entries * 2 : 256;
+            entries = realloc(entries, sizeof(struct kv_entry) * max_entries);
+        }
+        memmove(&entries[pos + 1], &entries[pos],
+                sizeof(struct kv_entry) * (num_entries - pos));
+        num_entries++;
+        entries[pos].key = copy_string(key);
+    }
+    entry = &entries[pos];
+    entry->offset = offset;
+    entry->length = length;
+    entry->value_len = value_len;
+    live_bytes += length;
+}
+
+static void index_clear() {
+    unsigned long i;
+
+    for (i = 0; i < num_entries; i++)
+        FREE(entries[i].key);
+    num_entries = 0;
+    live_bytes = 0;
+}
+
+/* (Re)build the index from the store file, cutting off a torn tail */
+static int kv_load() {
+    struct stat st;
+    unsigned char *base, *p, *key;
+    unsigned char head[KV_HEADER_SIZE];
+    unsigned long length, key_len, value_len;
+    char *keybuf;
+    char logbuf[512];
+
+    if (store_fd != -1) close(store_fd);
+    store_stale = 0;
+    index_clear();
+    store_fd = open(store_path, O_RDWR | O_CREAT, 0644);
+    if (store_fd < 0 || fstat(store_fd, &st)) {
+        sprintf(logbuf, "  kv_adapter: can't open %s (errno=%d)", store_path, errno);
+        logger(LOG_ERROR, logbuf);
+        if (store_fd != -1) close(store_fd);
+        store_fd = -1;
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        kv_header(head);
+        if (pwrite(store_fd, head, KV_HEADER_SIZE, 0) != KV_HEADER_SIZE ||
+            fsync(store_fd)) {
+            logger(LOG_ERROR, "  kv_adapter: can't write store header");
+            goto fail;
+        }
+        store_end = KV_HEADER_SIZE;
+        return 0;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, store_fd, 0);
+    if (base == MAP_FAILED) {
+        sprintf(logbuf, "  kv_adapter: mmap failed for: %s (errno=%d)", store_path, errno);
+        logger(LOG_ERROR, logbuf);
+        goto fail;
+    }
+    if (st.st_size < KV_HEADER_SIZE || memcmp(base, KV_MAGIC, 4) ||
+        (base[4] | (base[5] << 8)) > KV_VERSION) {
+        sprintf(logbuf, "  kv_adapter: %s is not a store this driver can read", store_path);
+        logger(LOG_ERROR, logbuf);
+        munmap(base, st.st_size);
+        goto fail;
+    }
+
+    p = base + KV_HEADER_SIZE;
+    while (p < base + st.st_size) {
+        length = parse_record(p, base + st.st_size, &key, &key_len, &value_len);
+        if (!length) {
+            sprintf(logbuf, "  kv_adapter: dropping %ld bytes of torn records from %s",
+                    (long) (base + st.st_size - p), store_path);
+            logger(LOG_WARNING, logbuf);
+            if (ftruncate(store_fd, p - base))
+                logger(LOG_ERROR, "  kv_adapter: truncate failed");
+            break;
+        }
+        keybuf = MALLOC(key_len + 1);
+        memcpy(keybuf, key, key_len);
+        keybuf[key_len] = '\0';
+        index_set(keybuf, p - base, length, value_len);
+        FREE(keybuf);
+        p += length;
+    }
+    store_end = p - base;
+    munmap(base, st.st_size);
+
+    sprintf(logbuf, "  kv_adapter: %lu keys in %s", num_entries, store_path);
+    logger(LOG_INFO, logbuf);
+    return 0;
+
+fail:
+    close(store_fd);
+    store_fd = -1;
+    return -1;
+}
+
+static int kv_open() {
+    if (store_path) return store_fd == -1 ? -1 : 0;
+    store_path = adapter_save_path("store", ".kv");
+    if (adapter_make_dirs(store_path)) {
+        store_fd = -1;
+        return -1;
+    }
+    return kv_load();
+}
+
+/* Bring the file up to date with the index before reading it */
+static int kv_sync() {
+    struct stat st;
+
+    saveq_wait(store_path);
+    if (store_stale) {
+        close(store_fd);
+        store_stale = 0;
+        store_fd = open(store_path, O_RDWR);
+        if (store_fd < 0) return -1;
+        /* a compaction that didn't happen leaves the old, longer file */
+        if (fstat(store_fd, &st) || (unsigned long) st.st_size != store_end)
+            return kv_load();
+    }
+    return 0;
+}
+
+/* Read an indexed record and check it is intact and really holds its key
+ * Returns: allocated record (caller must FREE), or NULL
+ */
+static unsigned char *read_record(struct kv_entry *entry) {
+    unsigned char *rec, *key;
+    unsigned long key_len, value_len;
+
+    rec = MALLOC(entry->length);
+    if (pread(store_fd, rec, entry->length, entry->offset) != entry->length ||
+        parse_record(rec, rec + entry->length, &key, &key_len, &value_len) != entry->length ||
+        key_len != strlen(entry->key) || memcmp(key, entry->key, key_len)) {
+        FREE(rec);
+        return NULL;
+    }
+    return rec;
+}
+
+/* Have the writer rewrite the store with only its live records, once
+ * they are outnumbered.  The index is renumbered for the new file now;
+ * appends queued after this land after the rewrite, and if the rewrite
+ * fails kv_sync() finds the file isn't the length the index expects and
+ * rebuilds the index from it. */
+static void kv_compact() {
+    struct saveq_range *ranges;
+    unsigned char *head;
+    unsigned long dead, offset, i;
+    char logbuf[256];
+
+    dead = store_end - KV_HEADER_SIZE - live_bytes;
+    if (dead < KV_COMPACT_MIN || dead < live_bytes) return;
+
+    head = MALLOC(KV_HEADER_SIZE);
+    kv_header(head);
+    ranges = MALLOC(sizeof(struct saveq_range) * num_entries);
+    offset = KV_HEADER_SIZE;
+    for (i = 0; i < num_entries; i++) {
+        ranges[i].offset = entries[i].offset;
+        ranges[i].length = entries[i].length;
+        entries[i].offset = offset;
+        offset += entries[i].length;
+    }
+
+    sprintf(logbuf, "  kv_adapter: compacting store, %lu of %lu bytes live",
+            offset, store_end);
+    logger(LOG_INFO, logbuf);
+    if (saveq_compact(store_path, (char *) head, KV_HEADER_SIZE, ranges,
+                      num_entries, kv_check)) {
+        kv_load();
+        return;
+    }
+    store_end = offset;
+    store_stale = 1;
+}
+
+/* KV adapter: append a record for key */
+static int kv_save_map(char *key, struct heap_mapping *data, struct object *caller) {
+    unsigned char *rec, *p;
+    char *image;
+    unsigned long image_len, key_len, crc, length;
+    int result;
+
+    if (!key || !data || kv_open()) return -1;
+
+    image = binary_encode_map(data, &image_len);
+    if (!image) {
+        logger(LOG_ERROR, "  kv_adapter: serialization failed");
+        return -1;
+    }
+
+    key_len = strlen(key);
+    rec = MALLOC(KV_RECORD_MAX_HEAD + key_len + image_len);
+    p = put_uvar(rec + 4, key_len);
+    p = put_uvar(p, image_len);
+    memcpy(p, key, key_len);
+    memcpy(p + key_len, image, image_len);
+    length = p + key_len + image_len - rec;
+    crc = kv_crc(rec + 4, length - 4);
+    rec[0] = crc & 0xff;
+    rec[1] = (crc >> 8) & 0xff;
+    rec[2] = (crc >> 16) & 0xff;
+    rec[3] = (crc >> 24) & 0xff;
+    FREE(image);
+
+    result = saveq_append(store_path, key, (char *) rec, length, caller);
+    FREE(rec);
+    if (result) return -1;
+
+    index_set(key, store_end, length, image_len);
+    store_end += length;
+    kv_compact();
+    return 0;
+}
+
+/* KV adapter: restore mapping for key
+ * Keys not in the store are looked for as binary or text save files, so
+ * switching save_type to kv keeps existing saves readable.
+ */
+static struct heap_mapping *kv_restore_map(char *key, struct object *caller) {
+    struct heap_mapping *result;
+    unsigned char *rec;
+    unsigned long pos;
+
+    if (!key || kv_open() || kv_sync()) return NULL;
+
+    if (!find_entry(key, &pos))
+        return binary_adapter.restore_map(key, caller);
+    if (!(rec = read_record(&entries[pos]))) {
+        /* a failed write left the index wrong; start over from the file */
+        if (kv_load() || !find_entry(key, &pos) || !(rec = read_record(&entries[pos])))
+            return NULL;
+    }
+    result = binary_decode_map(rec + entries[pos].length - entries[pos].value_len,
+                               entries[pos].value_len, key);
+    FREE(rec);
+    return result;
+}
+
+/* KV adapter: keys starting with prefix, in sorted order */
+static struct heap_array *kv_list_keys(char *prefix, struct object *caller) {
+    struct heap_array *arr;
+    unsigned long first, last, prefix_len, i;
+
+    if (kv_open()) return NULL;
+    prefix_len = strlen(prefix);
+    find_entry(prefix, &first);
+    for (last = first; last < num_entries; last++)
+        if (strncmp(entries[last].key, prefix, prefix_len))
+            break;
+
+    arr = allocate_array(last - first, UNLIMITED_ARRAY_SIZE);
+    if (!arr) return NULL;
+    for (i = first; i < last; i++) {
+        arr->elements[i - first].type = STRING;
+        arr->elements[i - first].value.string = copy_string(entries[i].key);
+    }
+    return arr;
+}
+
+/* KV adapter definition */
+save_adapter_t kv_adapter = {
+    "kv",
+    kv_save_map,
+    kv_restore_map,
+    kv_list_keys
+};
@@ -132,7 +132,7 @@ int main(int argc, char *argv[])
   fputs(" -DDEBUG",makefile);
 #endif
   fputc('\n',makefile);
-  fputs("LFLAGS=",makefile);
+  fputs("LFLAGS= -lpthread",makefile);
   if ((infile=fopen("/usr/lib/libnsl.a","r"))) {
     fputs("#define USE_NSL\n",autoconf);
     fputs(" -lnsl",makefile);
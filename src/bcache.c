@@ -0,0 +1,972 @@
+/**
+ * @file bcache.c
+ * @brief On-disk cache of compiled programs
+ *
+ * Every boot used to compile every program from source.  parse_code()
+ * now writes each program it compiles to <bytecode_path><program>.bc
+ * and, next time, maps that file and rebuilds the struct code from it
+ * instead of preprocessing, tokenizing and parsing again.
+ *
+ * An entry records two hashes: one over the source and every file it
+ * #included, checked before anything else is touched, and the program's
+ * key, which also covers the keys of the programs it inherits.  Those
+ * are loaded (from their own entries or from source) before the key is
+ * compared, so changing a parent recompiles every program built on it.
+ * Entries that fail their checksum, or were written by a driver with
+ * different instruction numbering or an older BCACHE_VERSION, are
+ * ignored and overwritten.
+ *
+ * The interpreter runs whatever code it is given, so an entry is as
+ * trusted as the compiler.  bytecode_path is taken from the driver's
+ * directory, like syslog, and the cache is turned off if it lies inside
+ * the mudlib, where LPC code could write entries of its own; and every
+ * entry loaded is checked for what the compiler never writes.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#include "object.h"
+#include "instr.h"
+#include "constrct.h"
+#include "globals.h"
+#include "file.h"
+#include "compile.h"
+#include "save_adapter.h"
+#include "bcache.h"
+
+extern int (*oper_array[NUM_OPERS+NUM_SCALLS])(struct object *caller,
+                                               struct object *obj,
+                                               struct object *player,
+                                               struct var_stack **rts);
+
+#define BCACHE_MAGIC "NCBC"
+#define BCACHE_NULL_STR 0xFFFFFFFF
+/* magic, four u32 and the u64 checksum of everything after them */
+#define BCACHE_HEADER 28
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/* ========================================================================
+ * HASHING
+ * ======================================================================== */
+
+static unsigned long long hash_bytes(unsigned long long h, const void *data,
+                                     unsigned long len) {
+    const unsigned char *p = data;
+
+    while (len--) {
+        h ^= *p++;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static unsigned long long hash_str(unsigned long long h, char *s) {
+    return hash_bytes(h, s, strlen(s) + 1);
+}
+
+/* Fold the contents of a mudlib file into h.  Returns 0, or 1 if the
+ * file can't be read. */
+static int hash_file(char *name, unsigned long long *h) {
+    FILE *f;
+    char buf[8192];
+    size_t n;
+
+    if (!(f = open_source(name)))
+        return 1;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        *h = hash_bytes(*h, buf, n);
+    close_file(f);
+    return 0;
+}
+
+/* Hash of the program's own text: filename.c and everything it
+ * #included, in the order the preprocessor opened them.  optimize= is
+ * folded in too, since it changes the code without touching the text. */
+static int local_hash(char *filename, struct dep_list *includes,
+                      unsigned long long *h) {
+    char *src;
+    int failed;
+    unsigned int version = BCACHE_VERSION;
+
+    *h = hash_bytes(FNV_OFFSET, &version, sizeof(version));
+    *h = hash_bytes(*h, &optimize, sizeof(optimize));
+    *h = hash_str(*h, filename);
+    src = MALLOC(strlen(filename) + 3);
+    sprintf(src, "%s.c", filename);
+    failed = hash_file(src, h);
+    FREE(src);
+    while (includes && !failed) {
+        *h = hash_str(*h, includes->name);
+        failed = hash_file(includes->name, h);
+        includes = includes->next;
+    }
+    return failed;
+}
+
+/* The hash of a program's own text, for callers that hold compiled code
+ * and want to know whether it still matches the files.  0 means a file
+ * couldn't be read. */
+unsigned long long bcache_text_key(char *filename, struct dep_list *includes) {
+    unsigned long long h;
+
+    if (local_hash(filename, includes, &h))
+        return 0;
+    return h ? h : 1;
+}
+
+/* The program key: its local hash plus the key of every program it
+ * inherits.  0 means the program can't be keyed. */
+static unsigned long long program_key(unsigned long long local,
+                                      struct code *the_code) {
+    struct inherit_list *inh;
+    unsigned long long h;
+
+    h = local;
+    for (inh = the_code->inherits; inh; inh = inh->next) {
+        if (!inh->parent_proto || !inh->parent_proto->funcs ||
+            !inh->parent_proto->funcs->src_key)
+            return 0;
+        h = hash_str(h, inh->inherit_path);
+        h = hash_bytes(h, &inh->parent_proto->funcs->src_key,
+                       sizeof(unsigned long long));
+    }
+    return h ? h : 1;
+}
+
+/* ========================================================================
+ * HELPERS
+ * ======================================================================== */
+
+int bcache_enabled(char *filename) {
+    /* compile_string() compiles throw-away files under /eval */
+    return bytecode_path && *bytecode_path && strncmp(filename, "/eval/", 6);
+}
+
+/* Instructions actually in use.  oper_array has spare room, so
+ * NUM_SCALLS alone needn't change when an efun is added; this does, and
+ * keeps an entry from running with another driver's numbering.
+ */
+static unsigned int num_instrs() {
+    unsigned int n;
+
+    for (n = NUM_OPERS + NUM_SCALLS; n && !oper_array[n - 1]; n--)
+        ;
+    return n;
+}
+
+static char *cache_path(char *filename) {
+    char *path;
+    int sep;
+
+    sep = (bytecode_path[strlen(bytecode_path) - 1] == '/' &&
+           *filename == '/');
+    path = MALLOC(strlen(bytecode_path) + strlen(filename) + 4);
+    sprintf(path, "%s%s.bc", bytecode_path, filename + sep);
+    return path;
+}
+
+/* Make the cache directory, and turn the cache off unless it is outside
+ * the mudlib.  Called once at boot, before anything is compiled. */
+void bcache_init() {
+    char fs[PATH_MAX], cache[PATH_MAX], *probe;
+    char logbuf[PATH_MAX + 128];
+    size_t len;
+    int ok;
+
+    if (!bytecode_path || !*bytecode_path)
+        return;
+    probe = MALLOC(strlen(bytecode_path) + 3);
+    sprintf(probe, "%s/x", bytecode_path);
+    ok = (!adapter_make_dirs(probe) && realpath(fs_path, fs) &&
+          realpath(bytecode_path, cache));
+    FREE(probe);
+    if (!ok) {
+        sprintf(logbuf, "bcache: can't use %.*s, compiling from source",
+                PATH_MAX, bytecode_path);
+        logger(LOG_ERROR, logbuf);
+        bytecode_path = NULL;
+        return;
+    }
+    len = strlen(fs);
+    if (len == 1 || (!strncmp(cache, fs, len) &&
+                     (cache[len] == '/' || !cache[len]))) {
+        sprintf(logbuf, "bcache: %.*s is inside the mudlib, compiling from "
+                "source", PATH_MAX, bytecode_path);
+        logger(LOG_ERROR, logbuf);
+        bytecode_path = NULL;
+    }
+}
+
+void free_dep_list(struct dep_list *deps) {
+    struct dep_list *next;
+
+    while (deps) {
+        next = deps->next;
+        FREE(deps->name);
+        FREE(deps);
+        deps = next;
+    }
+}
+
+/* A proto among the ancestors of the_code, found the way the compiler
+ * found it: through the inherit lists */
+static struct proto *find_ancestor(struct code *the_code, char *pathname) {
+    struct inherit_list *inh;
+    struct proto *found;
+
+    if (!the_code)
+        return NULL;
+    for (inh = the_code->inherits; inh; inh = inh->next) {
+        if (!inh->parent_proto)
+            continue;
+        if (!strcmp(inh->parent_proto->pathname, pathname))
+            return inh->parent_proto;
+        if ((found = find_ancestor(inh->parent_proto->funcs, pathname)))
+            return found;
+    }
+    return NULL;
+}
+
+/* ========================================================================
+ * WRITING
+ * ======================================================================== */
+
+struct bc_out {
+    unsigned char *data;
+    unsigned long len;
+    unsigned long size;
+    int bad;                  /* hit something that can't be stored */
+};
+
+static void put_bytes(struct bc_out *out, const void *p, unsigned long n) {
+    if (out->len + n > out->size) {
+        while (out->len + n > out->size)
+            out->size = out->size ? out->size * 2 : 4096;
+        out->data = realloc(out->data, out->size);
+    }
+    memcpy(out->data + out->len, p, n);
+    out->len += n;
+}
+
+static void put_u8(struct bc_out *out, unsigned char v) {
+    put_bytes(out, &v, 1);
+}
+
+static void put_u16(struct bc_out *out, unsigned short v) {
+    put_bytes(out, &v, sizeof(v));
+}
+
+static void put_u32(struct bc_out *out, unsigned int v) {
+    put_bytes(out, &v, sizeof(v));
+}
+
+static void put_u64(struct bc_out *out, unsigned long long v) {
+    put_bytes(out, &v, sizeof(v));
+}
+
+static void put_str(struct bc_out *out, char *s) {
+    unsigned int len;
+
+    if (!s) {
+        put_u32(out, BCACHE_NULL_STR);
+        return;
+    }
+    len = strlen(s);
+    put_u32(out, len);
+    put_bytes(out, s, len);
+}
+
+static void put_proto(struct bc_out *out, struct proto *p) {
+    put_str(out, p ? p->pathname : NULL);
+}
+
+static void put_vars(struct bc_out *out, struct var_tab *v) {
+    struct var_tab *curr;
+    struct array_size *dim;
+    unsigned int count;
+
+    for (count = 0, curr = v; curr; curr = curr->next)
+        count++;
+    put_u32(out, count);
+    for (curr = v; curr; curr = curr->next) {
+        put_str(out, curr->name);
+        put_u32(out, curr->base);
+        put_u32(out, curr->is_mapping);
+        put_u16(out, curr->owner_local_index);
+        put_proto(out, curr->origin_prog);
+        for (count = 0, dim = curr->array; dim; dim = dim->next)
+            count++;
+        put_u32(out, count);
+        for (dim = curr->array; dim; dim = dim->next)
+            put_u32(out, dim->size);
+    }
+}
+
+static void put_instr(struct bc_out *out, struct var *v, struct code *the_code) {
+    struct fns *target;
+
+    put_u8(out, v->type);
+    switch (v->type) {
+        case INTEGER:
+        case RETURN:
+        case LOCAL_REF:
+        case GLOBAL_REF:
+            put_u64(out, (unsigned long long) v->value.integer);
+            break;
+        case STRING:
+        case FUNC_NAME:
+        case EXTERN_FUNC:
+            put_str(out, v->value.string);
+            break;
+        case ASM_INSTR:
+            put_u8(out, v->value.instruction);
+            break;
+        case GLOBAL_L_VALUE:
+        case LOCAL_L_VALUE:
+        case LOCAL_CMP_BRANCH:
+        case GLOBAL_CMP_BRANCH:
+        case LOCAL_STEP:
+        case LOCAL_RETURN:
+        case GLOBAL_RETURN:
+            put_u64(out, v->value.l_value.ref);
+            put_u32(out, v->value.l_value.size);
+            break;
+        case FUNC_CALL:
+            for (target = the_code->func_list; target; target = target->next)
+                if (target == v->value.func_call)
+                    break;
+            if (!target)
+                out->bad = 1;
+            else
+                put_u16(out, target->func_index);
+            break;
+        case NUM_ARGS:
+        case JUMP:
+        case BRANCH:
+        case NEW_LINE:
+            put_u64(out, v->value.num);
+            break;
+        case CALL_SUPER:
+        case CALL_PARENT_NAMED:
+            put_u16(out, v->value.parent_call.inherit_idx);
+            put_u16(out, v->value.parent_call.func_idx);
+            break;
+        default:
+            out->bad = 1;
+            break;
+    }
+}
+
+static void put_code(struct bc_out *out, struct code *the_code) {
+    struct fns *f;
+    struct inherit_list *inh;
+    unsigned int count, i;
+
+    /* inherits first: the loader has to have the parents before it can
+       resolve the variable tables */
+    for (count = 0, inh = the_code->inherits; inh; inh = inh->next)
+        count++;
+    put_u32(out, count);
+    for (inh = the_code->inherits; inh; inh = inh->next) {
+        put_str(out, inh->inherit_path);
+        put_str(out, inh->entry ? inh->entry->alias : NULL);
+        put_str(out, inh->entry ? inh->entry->canon_path : NULL);
+        put_u16(out, inh->entry ? inh->entry->func_offset : 0);
+        put_u16(out, inh->entry ? inh->entry->var_offset : 0);
+    }
+    put_u32(out, the_code->num_globals);
+    put_u16(out, the_code->self_var_offset);
+    for (count = 0, f = the_code->func_list; f; f = f->next)
+        count++;
+    put_u32(out, count);
+    for (f = the_code->func_list; f; f = f->next) {
+        put_str(out, f->funcname);
+        put_u8(out, f->is_static);
+        put_u32(out, f->num_args);
+        put_u32(out, f->num_locals);
+        put_u16(out, f->func_index);
+        put_u8(out, f->visibility);
+        put_vars(out, f->lst);
+        put_u64(out, f->num_instr);
+        for (i = 0; i < f->num_instr; i++)
+            put_instr(out, &f->code[i], the_code);
+    }
+    put_vars(out, the_code->gst);
+    put_vars(out, the_code->own_vars);
+    put_u16(out, the_code->ancestor_count);
+    for (i = 0; i < the_code->ancestor_count; i++) {
+        put_proto(out, the_code->ancestor_map[i].proto);
+        put_u16(out, the_code->ancestor_map[i].var_offset);
+    }
+    put_u16(out, the_code->gst_count);
+    for (i = 0; i < the_code->gst_count; i++) {
+        put_proto(out, the_code->gst_map[i].owner);
+        put_u16(out, the_code->gst_map[i].local_index);
+    }
+}
+
+/* Key a freshly compiled program, cache or no cache: recompile() uses
+ * src_key to skip programs whose text and parents haven't changed.
+ * Returns non-zero, with src_key 0, if it can't be keyed; otherwise
+ * *local is the hash bcache_store() wants. */
+int bcache_key(char *filename, struct code *the_code,
+               struct dep_list *includes, unsigned long long *local) {
+    the_code->src_key = 0;
+    if (local_hash(filename, includes, local))
+        return 1;
+    the_code->src_key = program_key(*local, the_code);
+    return !the_code->src_key;
+}
+
+/* Write the cache entry for a program bcache_key() has keyed.  Failing
+ * to write only costs the next boot a compile, so errors are just
+ * logged. */
+void bcache_store(char *filename, struct code *the_code,
+                  struct dep_list *includes, unsigned long long local) {
+    struct bc_out out;
+    struct dep_list *dep;
+    unsigned long long sum;
+    unsigned int count;
+    char *path, *tmp_path;
+    char logbuf[512];
+    FILE *f;
+    int ok;
+
+    out.data = NULL;
+    out.len = out.size = 0;
+    out.bad = 0;
+    put_bytes(&out, BCACHE_MAGIC, 4);
+    put_u32(&out, BCACHE_VERSION);
+    put_u32(&out, NUM_OPERS);
+    put_u32(&out, num_instrs());
+    put_u32(&out, sizeof(long));
+    put_u64(&out, 0);         /* checksum, filled in below */
+    put_u64(&out, local);
+    put_u64(&out, the_code->src_key);
+    for (count = 0, dep = includes; dep; dep = dep->next)
+        count++;
+    put_u32(&out, count);
+    for (dep = includes; dep; dep = dep->next)
+        put_str(&out, dep->name);
+    put_code(&out, the_code);
+    sum = hash_bytes(FNV_OFFSET, out.data + BCACHE_HEADER,
+                     out.len - BCACHE_HEADER);
+    memcpy(out.data + BCACHE_HEADER - sizeof(sum), &sum, sizeof(sum));
+    if (out.bad) {
+        sprintf(logbuf, "bcache: %s can't be cached", filename);
+        logger(LOG_WARNING, logbuf);
+        free(out.data);
+        return;
+    }
+    path = cache_path(filename);
+    tmp_path = MALLOC(strlen(path) + 5);
+    sprintf(tmp_path, "%s.tmp", path);
+    ok = 0;
+    if (!adapter_make_dirs(path) && (f = fopen(tmp_path, "wb"))) {
+        ok = (fwrite(out.data, 1, out.len, f) == out.len);
+        ok = (fclose(f) == 0) && ok;
+        ok = ok && !rename(tmp_path, path);
+        if (!ok)
+            remove(tmp_path);
+    }
+    if (!ok) {
+        sprintf(logbuf, "bcache: couldn't write %s", path);
+        logger(LOG_WARNING, logbuf);
+    }
+    free(out.data);
+    FREE(tmp_path);
+    FREE(path);
+}
+
+/* ========================================================================
+ * READING
+ * ======================================================================== */
+
+struct bc_in {
+    unsigned char *p;
+    unsigned char *end;
+    int bad;                  /* ran off the end or found nonsense */
+};
+
+static void get_bytes(struct bc_in *in, void *dst, unsigned long n) {
+    if (in->bad || (unsigned long) (in->end - in->p) < n) {
+        in->bad = 1;
+        memset(dst, 0, n);
+        return;
+    }
+    memcpy(dst, in->p, n);
+    in->p += n;
+}
+
+static unsigned char get_u8(struct bc_in *in) {
+    unsigned char v;
+
+    get_bytes(in, &v, sizeof(v));
+    return v;
+}
+
+static unsigned short get_u16(struct bc_in *in) {
+    unsigned short v;
+
+    get_bytes(in, &v, sizeof(v));
+    return v;
+}
+
+static unsigned int get_u32(struct bc_in *in) {
+    unsigned int v;
+
+    get_bytes(in, &v, sizeof(v));
+    return v;
+}
+
+static unsigned long long get_u64(struct bc_in *in) {
+    unsigned long long v;
+
+    get_bytes(in, &v, sizeof(v));
+    return v;
+}
+
+static char *get_str(struct bc_in *in) {
+    unsigned int len;
+    char *s;
+
+    len = get_u32(in);
+    if (len == BCACHE_NULL_STR || in->bad)
+        return NULL;
+    if ((unsigned long) (in->end - in->p) < len) {
+        in->bad = 1;
+        return NULL;
+    }
+    s = MALLOC(len + 1);
+    memcpy(s, in->p, len);
+    s[len] = '\0';
+    in->p += len;
+    return s;
+}
+
+/* A count that can't be larger than what is left of the file */
+static unsigned long get_count(struct bc_in *in, unsigned long min_size) {
+    unsigned long n;
+
+    n = get_u32(in);
+    if (n > (unsigned long) (in->end - in->p) / min_size)
+        in->bad = 1;
+    return in->bad ? 0 : n;
+}
+
+static struct proto *get_proto(struct bc_in *in, struct code *the_code) {
+    struct proto *p;
+    char *name;
+
+    if (!(name = get_str(in)))
+        return NULL;
+    if (!(p = find_ancestor(the_code, name)))
+        in->bad = 1;
+    FREE(name);
+    return p;
+}
+
+static struct var_tab *get_vars(struct bc_in *in, struct code *the_code) {
+    struct var_tab *head, **tail, *v;
+    struct array_size **dim;
+    unsigned long count, dims;
+
+    head = NULL;
+    tail = &head;
+    count = get_count(in, 18);
+    while (count-- && !in->bad) {
+        v = MALLOC(sizeof(struct var_tab));
+        v->name = get_str(in);
+        v->base = get_u32(in);
+        v->is_mapping = get_u32(in);
+        v->owner_local_index = get_u16(in);
+        v->origin_prog = get_proto(in, the_code);
+        v->array = NULL;
+        v->next = NULL;
+        *tail = v;
+        tail = &v->next;
+        if (!v->name) {
+            v->name = copy_string("");
+            in->bad = 1;
+        }
+        dims = get_count(in, 4);
+        dim = &v->array;
+        while (dims--) {
+            *dim = MALLOC(sizeof(struct array_size));
+            (*dim)->size = get_u32(in);
+            (*dim)->next = NULL;
+            dim = &(*dim)->next;
+        }
+    }
+    return head;
+}
+
+static void get_instr(struct bc_in *in, struct var *v) {
+    v->type = get_u8(in);
+    switch (v->type) {
+        case INTEGER:
+        case RETURN:
+        case LOCAL_REF:
+        case GLOBAL_REF:
+            v->value.integer = (signed long) get_u64(in);
+            break;
+        case STRING:
+        case FUNC_NAME:
+        case EXTERN_FUNC:
+            if (!(v->value.string = get_str(in))) {
+                v->type = INTEGER;
+                v->value.integer = 0;
+                in->bad = 1;
+            }
+            break;
+        case ASM_INSTR:
+            v->value.instruction = get_u8(in);
+            break;
+        case GLOBAL_L_VALUE:
+        case LOCAL_L_VALUE:
+        case LOCAL_CMP_BRANCH:
+        case GLOBAL_CMP_BRANCH:
+        case LOCAL_STEP:
+        case LOCAL_RETURN:
+        case GLOBAL_RETURN:
+            v->value.l_value.ref = get_u64(in);
+            v->value.l_value.size = get_u32(in);
+            break;
+        case FUNC_CALL:
+            /* an index for now, turned into a pointer once all the
+               functions exist */
+            v->value.num = get_u16(in);
+            break;
+        case NUM_ARGS:
+        case JUMP:
+        case BRANCH:
+        case NEW_LINE:
+            v->value.num = get_u64(in);
+            break;
+        case CALL_SUPER:
+        case CALL_PARENT_NAMED:
+            v->value.parent_call.inherit_idx = get_u16(in);
+            v->value.parent_call.func_idx = get_u16(in);
+            break;
+        default:
+            v->type = INTEGER;
+            v->value.integer = 0;
+            in->bad = 1;
+            break;
+    }
+}
+
+/* The interpreter trusts the compiler: it calls through oper_array
+ * unchecked, jumps wherever a JUMP says, reads a fused instruction's
+ * operands from the instructions after it and takes a variable reference
+ * beyond the variables for a pointer.  A loaded function has to look like
+ * one the compiler wrote: returns 1 if it doesn't. */
+static int check_func(struct code *the_code, struct fns *f,
+                      unsigned int opers) {
+    struct var *code;
+    struct inherit_list *inh;
+    struct fns *target;
+    unsigned long i, n, ref;
+    unsigned int idx;
+
+    code = f->code;
+    n = f->num_instr;
+    if (f->num_args > f->num_locals)
+        return 1;
+    if (!n)
+        return 0;
+    /* nothing may run off the end */
+    if (code[n - 1].type != RETURN && code[n - 1].type != JUMP)
+        return 1;
+    for (i = 0; i < n; i++) {
+        ref = code[i].value.l_value.ref;
+        switch (code[i].type) {
+            case ASM_INSTR:
+                if (code[i].value.instruction >= opers ||
+                    !oper_array[code[i].value.instruction])
+                    return 1;
+                break;
+            case JUMP:
+            case BRANCH:
+                if (code[i].value.num >= n)
+                    return 1;
+                break;
+            case LOCAL_L_VALUE:
+            case LOCAL_RETURN:
+                if (ref >= f->num_locals)
+                    return 1;
+                break;
+            case GLOBAL_L_VALUE:
+            case GLOBAL_RETURN:
+                if (ref >= the_code->gst_count || ref >= the_code->num_globals)
+                    return 1;
+                break;
+            case LOCAL_CMP_BRANCH:
+            case GLOBAL_CMP_BRANCH:
+                if (ref >= (code[i].type == LOCAL_CMP_BRANCH ?
+                            f->num_locals : the_code->gst_count) ||
+                    i + 3 >= n || code[i + 1].type != INTEGER ||
+                    code[i + 2].type != ASM_INSTR ||
+                    code[i + 2].value.instruction < CONDEQ_OPER ||
+                    code[i + 2].value.instruction > GREATEQ_OPER ||
+                    code[i + 3].type != BRANCH)
+                    return 1;
+                break;
+            case LOCAL_STEP:
+                if (ref >= f->num_locals || i + 2 >= n)
+                    return 1;
+                if (code[i + 1].type == ASM_INSTR) {
+                    if (code[i + 1].value.instruction < POSTADD_OPER ||
+                        code[i + 1].value.instruction > PREMIN_OPER)
+                        return 1;
+                } else if (code[i + 1].type != INTEGER || i + 3 >= n ||
+                           code[i + 2].type != ASM_INSTR ||
+                           (code[i + 2].value.instruction != PLEQ_OPER &&
+                            code[i + 2].value.instruction != MIEQ_OPER))
+                    return 1;
+                break;
+            case CALL_SUPER:
+            case CALL_PARENT_NAMED:
+                inh = the_code->inherits;
+                for (idx = 0; inh && idx < code[i].value.parent_call.inherit_idx;
+                     idx++)
+                    inh = inh->next;
+                if (!inh || !inh->parent_proto || !inh->parent_proto->funcs)
+                    return 1;
+                target = inh->parent_proto->funcs->func_list;
+                for (idx = 0; target && idx < code[i].value.parent_call.func_idx;
+                     idx++)
+                    target = target->next;
+                if (!target)
+                    return 1;
+                break;
+        }
+    }
+    return 0;
+}
+
+static struct code *new_code() {
+    struct code *the_code;
+
+    the_code = MALLOC(sizeof(struct code));
+    memset(the_code, 0, sizeof(struct code));
+    return the_code;
+}
+
+/* Load every inherited program first, the same way add_inherit() does,
+ * since the variable tables below refer to them */
+static void get_inherits(struct bc_in *in, struct code *the_code) {
+    struct inherit_list *inh, **tail;
+    unsigned long count;
+
+    tail = &the_code->inherits;
+    count = get_count(in, 16);
+    while (count-- && !in->bad) {
+        inh = MALLOC(sizeof(struct inherit_list));
+        inh->entry = MALLOC(sizeof(struct inherit_entry));
+        inh->inherit_path = get_str(in);
+        inh->entry->alias = get_str(in);
+        inh->entry->canon_path = get_str(in);
+        inh->entry->func_offset = get_u16(in);
+        inh->entry->var_offset = get_u16(in);
+        inh->next = NULL;
+        *tail = inh;
+        tail = &inh->next;
+        inh->parent_proto = NULL;
+        if (!in->bad && inh->inherit_path)
+            inh->parent_proto = load_inherit(inh->inherit_path);
+        inh->entry->proto = inh->parent_proto;
+        if (!inh->parent_proto)
+            in->bad = 1;
+    }
+}
+
+static struct code *get_code(struct bc_in *in) {
+    struct code *the_code;
+    struct fns *f, **tail, *target;
+    unsigned long count, i;
+    unsigned int opers;
+
+    the_code = new_code();
+    get_inherits(in, the_code);
+    the_code->num_globals = get_u32(in);
+    the_code->self_var_offset = get_u16(in);
+    tail = &the_code->func_list;
+    count = get_count(in, 20);
+    while (count-- && !in->bad) {
+        f = MALLOC(sizeof(struct fns));
+        memset(f, 0, sizeof(struct fns));
+        *tail = f;
+        tail = &f->next;
+        f->funcname = get_str(in);
+        if (!f->funcname) {
+            f->funcname = copy_string("");
+            in->bad = 1;
+        }
+        f->is_static = get_u8(in);
+        f->num_args = get_u32(in);
+        f->num_locals = get_u32(in);
+        f->func_index = get_u16(in);
+        f->visibility = get_u8(in);
+        f->lst = get_vars(in, the_code);
+        f->num_instr = get_u64(in);
+        if (f->num_instr > (unsigned long) (in->end - in->p)) {
+            f->num_instr = 0;
+            in->bad = 1;
+        }
+        if (f->num_instr)
+            f->code = MALLOC(sizeof(struct var) * f->num_instr);
+        for (i = 0; i < f->num_instr; i++)
+            get_instr(in, &f->code[i]);
+    }
+    the_code->gst = get_vars(in, the_code);
+    the_code->own_vars = get_vars(in, the_code);
+
+    the_code->ancestor_count = get_u16(in);
+    the_code->ancestor_capacity = the_code->ancestor_count;
+    if (the_code->ancestor_count)
+        the_code->ancestor_map = MALLOC(sizeof(struct ancestor_var_offset) *
+                                        the_code->ancestor_count);
+    for (i = 0; i < the_code->ancestor_count; i++) {
+        the_code->ancestor_map[i].proto = get_proto(in, the_code);
+        the_code->ancestor_map[i].var_offset = get_u16(in);
+    }
+    the_code->gst_count = get_u16(in);
+    if (the_code->gst_count)
+        the_code->gst_map = MALLOC(sizeof(struct gst_ref_entry) *
+                                   the_code->gst_count);
+    for (i = 0; i < the_code->gst_count; i++) {
+        the_code->gst_map[i].owner = get_proto(in, the_code);
+        the_code->gst_map[i].local_index = get_u16(in);
+    }
+
+    /* now that every function exists, resolve the calls between them */
+    for (f = the_code->func_list; f; f = f->next)
+        for (i = 0; i < f->num_instr; i++)
+            if (f->code[i].type == FUNC_CALL) {
+                for (target = the_code->func_list; target; target = target->next)
+                    if (target->func_index == f->code[i].value.num)
+                        break;
+                if (!target) {
+                    /* keep free_code() away from a bogus pointer */
+                    f->code[i].type = INTEGER;
+                    f->code[i].value.integer = 0;
+                    in->bad = 1;
+                } else
+                    f->code[i].value.func_call = target;
+            }
+    if (in->p != in->end)
+        in->bad = 1;
+    opers = num_instrs();
+    for (f = the_code->func_list; f && !in->bad; f = f->next)
+        if (check_func(the_code, f, opers))
+            in->bad = 1;
+    return the_code;
+}
+
+/* free_code() leaves the local and inherit tables to the compiler's
+ * bookkeeping; a half-loaded program owns them outright */
+static void discard_code(struct code *the_code) {
+    struct inherit_list *inh, *next;
+    struct fns *f;
+
+    for (f = the_code->func_list; f; f = f->next)
+        free_gst(f->lst);
+    for (inh = the_code->inherits; inh; inh = next) {
+        next = inh->next;
+        FREE(inh->entry->alias);
+        FREE(inh->entry->canon_path);
+        FREE(inh->entry);
+        FREE(inh->inherit_path);
+        FREE(inh);
+    }
+    free_code(the_code);
+}
+
+/* Rebuild filename's program from its cache entry.  Returns 0 and sets
+ * *result when the entry is current, 1 when it has to be compiled. */
+int bcache_load(char *filename, struct code **result) {
+    struct bc_in in;
+    struct dep_list *includes, **tail;
+    struct code *the_code;
+    struct stat st;
+    unsigned long long local, stored_local, key, actual;
+    unsigned long count;
+    unsigned char *map;
+    char *path;
+    int fd, failed;
+
+    path = cache_path(filename);
+    fd = open(path, O_RDONLY);
+    FREE(path);
+    if (fd == -1)
+        return 1;
+    if (fstat(fd, &st) || st.st_size < BCACHE_HEADER + 20) {
+        close(fd);
+        return 1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+    in.p = map;
+    in.end = map + st.st_size;
+    in.bad = 0;
+    failed = 1;
+    if (memcmp(in.p, BCACHE_MAGIC, 4))
+        goto done;
+    in.p += 4;
+    if (get_u32(&in) != BCACHE_VERSION || get_u32(&in) != NUM_OPERS ||
+        get_u32(&in) != num_instrs() || get_u32(&in) != sizeof(long) ||
+        get_u64(&in) != hash_bytes(FNV_OFFSET, map + BCACHE_HEADER,
+                                   st.st_size - BCACHE_HEADER))
+        goto done;
+    stored_local = get_u64(&in);
+    key = get_u64(&in);
+
+    /* check the program's own text before loading anything it inherits */
+    includes = NULL;
+    tail = &includes;
+    count = get_count(&in, 4);
+    while (count-- && !in.bad) {
+        *tail = MALLOC(sizeof(struct dep_list));
+        (*tail)->next = NULL;
+        if (!((*tail)->name = get_str(&in)))
+            (*tail)->name = copy_string("");
+        tail = &(*tail)->next;
+    }
+    failed = in.bad || local_hash(filename, includes, &local) ||
+             local != stored_local;
+    if (failed) {
+        free_dep_list(includes);
+        goto done;
+    }
+
+    the_code = get_code(&in);
+    failed = in.bad;
+    if (!failed) {
+        actual = program_key(local, the_code);
+        failed = (!actual || actual != key);
+    }
+    if (failed) {
+        discard_code(the_code);
+        free_dep_list(includes);
+    } else {
+        the_code->src_key = key;
+        the_code->includes = includes;
+        *result = the_code;
+    }
+done:
+    munmap(map, st.st_size);
+    return failed;
+}
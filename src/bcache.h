@@ -0,0 +1,27 @@
+/* bcache.h */
+
+/* On-disk cache of compiled programs.  parse_code() keys every program
+   it compiles by a hash of the source, every file it #included and the
+   keys of the programs it inherits; with bytecode_path set it also
+   stores the program under that key and tries the cache before
+   compiling.  A stale, damaged or foreign entry is simply compiled
+   over.  bcache_init() keeps the cache out of the mudlib, since the
+   driver runs what it loads. */
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+/* bump whenever the compiler's output or the file layout changes */
+#define BCACHE_VERSION 2
+
+void bcache_init();
+int bcache_enabled(char *filename);
+int bcache_load(char *filename, struct code **result);
+int bcache_key(char *filename, struct code *the_code,
+               struct dep_list *includes, unsigned long long *local);
+void bcache_store(char *filename, struct code *the_code,
+                  struct dep_list *includes, unsigned long long local);
+void free_dep_list(struct dep_list *deps);
+unsigned long long bcache_text_key(char *filename, struct dep_list *includes);
+
+#endif /* BCACHE_H */
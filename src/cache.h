@@ -15,4 +15,5 @@ void init_globals(char *loadpath, char *savepath, char *panicpath);
 /* Proto cache functions */
 struct proto *find_cached_proto(char *pathname);
 void cache_proto(char *pathname, struct proto *proto);
+void uncache_proto(char *pathname);
 void clear_proto_cache();
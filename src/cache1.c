@@ -135,6 +135,8 @@ void init_globals(char *loadpath, char *savepath, char *panicpath) {
   c_err_msg=NULL;
   cmd_head=NULL;
   cmd_tail=NULL;
+  cmd_held=NULL;
+  cmd_held_tail=NULL;
   dest_list=NULL;
   alarm_list=NULL;
   now_time=time2int(time(NULL));
@@ -380,6 +380,25 @@ void cache_proto(char *pathname, struct proto *proto) {
     proto_cache_head = entry;
 }
 
+/* Drop pathname from the cache, so the next install_inherit() of it
+ * replaces it.  The proto itself is left alone.
+ */
+void uncache_proto(char *pathname) {
+    struct proto_cache_entry **curr = &proto_cache_head;
+    struct proto_cache_entry *found;
+    
+    while (*curr) {
+        if (strcmp((*curr)->pathname, pathname) == 0) {
+            found = *curr;
+            *curr = found->next;
+            FREE(found->pathname);
+            FREE(found);
+            return;
+        }
+        curr = &(*curr)->next;
+    }
+}
+
 /* Clear the proto cache (for development/testing)
  * Note: Does not free the protos themselves as they may still be in use
  */
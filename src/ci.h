@@ -26,6 +26,7 @@
 #define PRIV        32
 #define RESIDENT    64
 #define LOCALVERBS  128
+#define HELD        256   /* during an unload sweep, see unload.c */
 
 /* the flags on files */
 
@@ -36,6 +37,13 @@
 #define MALLOC(SIZE_) malloc(SIZE_)
 #define FREE(POINTER_) free(POINTER_)
 
+/* per-thread storage, for the compiler state precompile() workers use */
+#ifdef USE_WINDOWS
+#define THREAD_LOCAL __declspec(thread)
+#else /* USE_WINDOWS */
+#define THREAD_LOCAL __thread
+#endif /* USE_WINDOWS */
+
 #ifdef DEBUG
 #define FATAL_ERROR() abort()
 #else /* DEBUG */
@@ -11,6 +11,8 @@
 #include "intrface.h"
 #include "file.h"
 #include "protos.h"
+#include "recomp.h"
+#include "unload.h"
 
 /* functions for clearing the queues */
 
@@ -22,7 +24,6 @@ void handle_destruct() {
   struct ref_list *curr_ref;
   struct attach_list *curr_attach,*prev_attach;
   struct verb *next_verb,*curr_verb;
-  struct cmdq *curr_cmd,*prev_cmd,*tmp_cmd;
   struct alarmq *curr_alarm,*prev_alarm;
   char logbuf[256];
 
@@ -35,26 +36,9 @@ void handle_destruct() {
             curr_dest->obj->parent ? curr_dest->obj->parent->pathname : "NULL",
             (long)curr_dest->obj->refno);
     logger(LOG_INFO, logbuf);
-    curr_cmd=cmd_head;
-    prev_cmd=NULL;
     if (curr_dest->obj->devnum!=(-1))
       immediate_disconnect(curr_dest->obj->devnum);
-    while (curr_cmd) {
-      if (curr_cmd->obj==curr_dest->obj) {
-        if (prev_cmd)
-          prev_cmd->next=curr_cmd->next;
-        if (cmd_head==curr_cmd)
-          cmd_head=curr_cmd->next;
-        if (cmd_tail==curr_cmd)
-          cmd_tail=prev_cmd;
-        tmp_cmd=curr_cmd;
-        curr_cmd=curr_cmd->next;
-        FREE(tmp_cmd);
-      } else {
-        prev_cmd=curr_cmd;
-        curr_cmd=curr_cmd->next;
-      }
-    }
+    if (curr_dest->obj->num_cmds) unqueue_commands(curr_dest->obj);
     curr_alarm=alarm_list;
     prev_alarm=NULL;
     while (curr_alarm) {
@@ -103,6 +87,7 @@ void handle_destruct() {
       }
     }
     load_data(curr_dest->obj);
+    free_load_globals(curr_dest->obj,num_globals);
     loop=0;
     while (loop<num_globals) {
       clear_global_var(curr_dest->obj,loop);
@@ -127,7 +112,7 @@ void handle_destruct() {
         FREE(curr_inherit);
         curr_inherit = next_inherit;
       }
-      free_code(curr_dest->obj->parent->funcs);
+      retire_code(curr_dest->obj->parent->funcs);
       FREE(curr_dest->obj->parent);
     }
     curr_attach=curr_dest->obj->attachees;
@@ -211,6 +196,7 @@ void handle_destruct() {
     free_obj_list=curr_dest->obj;
     FREE(curr_dest);
   }
+  free_retired();
 }
 
 void handle_alarm() {
@@ -369,20 +355,81 @@ int find_verb(struct object *player, struct object *obj, char *vname, char
   return 0;
 }
 
-void handle_command() {
+/* commands are scheduled in rounds: each round, every object on cmd_head
+   gets its oldest command run, as long as it is still within its
+   cmd_budget/cycle_budget for the current pulse.  an object over budget
+   moves to cmd_held, which rejoins cmd_head once the pulse changes, so
+   picking the next command never walks anybody else's input. */
+
+static unsigned long cmd_round;
+static unsigned long held_pulse;
+
+static int within_budget(struct object *obj) {
+  if (obj->cmd_pulse!=current_pulse) {
+    obj->cmd_pulse=current_pulse;
+    obj->cmd_count=0;
+    obj->cmd_cycles=0;
+  }
+  if (cmd_budget && obj->cmd_count>=cmd_budget) return 0;
+  if (cycle_budget && obj->cmd_cycles>=cycle_budget) return 0;
+  return 1;
+}
+
+/* unlinks and returns the next command to run this round, or NULL */
+
+static struct cmdq *next_command() {
+  struct object *obj;
+  struct cmdq *curr;
+
+  while ((obj=cmd_head) && obj->cmd_round!=cmd_round) {
+    obj->cmd_round=cmd_round;
+    cmd_head=obj->next_cmd_obj;
+    if (!cmd_head) cmd_tail=NULL;
+    obj->next_cmd_obj=NULL;
+    if (!within_budget(obj)) {
+      if (cmd_held_tail)
+        cmd_held_tail->next_cmd_obj=obj;
+      else
+        cmd_held=obj;
+      cmd_held_tail=obj;
+      held_pulse=current_pulse;
+      continue;
+    }
+    curr=obj->cmds;
+    obj->cmds=curr->next;
+    if (!obj->cmds) obj->last_cmd=NULL;
+    if (--obj->num_cmds) {
+      /* more to come - back of the line for the next round */
+      if (cmd_tail)
+        cmd_tail->next_cmd_obj=obj;
+      else
+        cmd_head=obj;
+      cmd_tail=obj;
+    } else
+      obj->cmd_dropped=0;
+    return curr;
+  }
+  return NULL;
+}
+
+/* runs one round of commands, returns the number run */
+
+static int command_round() {
   struct cmdq *curr;
   char *vname,*funcname;
   signed long begin_char,count,loop;
-  struct object *curr_obj;
-  int done;
+  struct object *curr_obj,*cmd_obj;
+  int done,num_run;
   struct var_stack *rts;
   struct var tmp;
   struct fns *func;
 
-  while (cmd_head) {
-    curr=cmd_head;
-    cmd_head=curr->next;
-    if (!cmd_head) cmd_tail=NULL;
+  num_run=0;
+  cmd_round++;
+  while ((curr=next_command())) {
+    num_run++;
+    cmd_obj=curr->obj;
+    cmd_obj->cmd_count++;
 
 #ifdef CYCLE_SOFT_MAX
     soft_cycles=0;
@@ -429,6 +476,7 @@ void handle_command() {
         FREE(curr->cmd);
       }
       FREE(curr);
+      cmd_obj->cmd_cycles+=soft_cycles;
       handle_destruct();
       continue;
     }
@@ -473,6 +521,28 @@ void handle_command() {
     }
     
     FREE(curr);
+    cmd_obj->cmd_cycles+=soft_cycles;
     handle_destruct();
   }
+  return num_run;
+}
+
+/* runs every queued command that is within budget, returns the number run */
+
+int handle_command() {
+  int num_run,round_run;
+
+  if (cmd_held && held_pulse!=current_pulse) {
+    /* a new pulse, a new budget */
+    if (cmd_tail)
+      cmd_tail->next_cmd_obj=cmd_held;
+    else
+      cmd_head=cmd_held;
+    cmd_tail=cmd_held_tail;
+    cmd_held=NULL;
+    cmd_held_tail=NULL;
+  }
+  num_run=0;
+  while ((round_run=command_round())) num_run+=round_run;
+  return num_run;
 }
@@ -4,4 +4,4 @@
 
 void handle_destruct();
 void handle_alarm();
-void handle_command();
+int handle_command();
@@ -2,3 +2,5 @@
 
 unsigned int parse_code(char *filename, struct object *caller_obj,
                         struct code **result);
+struct proto *load_inherit(char *pathname);
+struct proto *install_inherit(char *pathname, struct code *parent_code);
@@ -4,6 +4,7 @@
    interpreted form */
 
 #include "config.h"
+#include <pthread.h>
 #include "object.h"
 #include "instr.h"
 #include "constrct.h"
@@ -13,6 +14,7 @@
 #include "dbhandle.h"
 #include "compile.h"
 #include "cache.h"
+#include "precomp.h"
 
 /* Forward declarations */
 int add_inherit(filptr *file_info, char *pathname);
@@ -49,6 +51,23 @@ static struct fns *find_function_in_proto(char *func_name, struct proto *proto)
     return NULL;
 }
 
+/* Helper: Position of a function in its proto's function list, which is
+ * what CALL_SUPER and CALL_PARENT_NAMED index by at run time.  The parent
+ * is shared (and may be read by other compiles), so this is worked out
+ * here rather than written back into func_index. */
+static int function_position(struct fns *func, struct proto *proto) {
+    struct fns *curr_func = proto->funcs->func_list;
+    int pos = 0;
+    
+    while (curr_func) {
+        if (curr_func == func)
+            return pos;
+        pos++;
+        curr_func = curr_func->next;
+    }
+    return -1;
+}
+
 /* Compute Method Resolution Order (MRO) for inheritance
  * Returns array of protos in linearized order: child first, then ancestors
  * This is a simplified depth-first traversal with duplicate removal
@@ -152,7 +171,8 @@ char *scall_array[NUM_SCALLS]={ "add_verb","add_xverb","call_other",
   "compile_string","crypt","read_file","write_file","remove","rename",
   "get_dir","file_size","users","objects","children","all_inventory",
   "send_prompt","query_terminal","get_mssp","set_mssp","save_object",
-  "restore_object","restore_map","query_idle_time","query_config","set_heart_beat"
+  "restore_object","restore_map","query_idle_time","query_config","set_heart_beat",
+  "get_devqueue","save_keys",NULL,NULL,"precompile","recompile"
 };
 
 /* The functions themselves */
@@ -164,22 +184,18 @@ void set_c_err_msg(char *msg) {
 
 void resize(fn_t *fn, unsigned long newsize)
 {
-  struct var *tmp;
-  unsigned long x;
-
   if (newsize) {
-    tmp=(struct var *) MALLOC(newsize*sizeof(struct var));
-    for (x=0;x<(fn->num_code);x++)
-      tmp[x]=fn->code[x];
-    FREE(fn->code);
-    fn->code=tmp;
+    fn->code=(struct var *) realloc(fn->code,newsize*sizeof(struct var));
+    fn->num_alloc=newsize;
   }
 }
 
+/* the code buffer doubles when it fills, so a long function costs
+   O(n) copying rather than O(n^2) */
 #define make_new(fn)                                                        \
   if ((fn->num_code)) {                                                     \
     if ((fn->num_code+1)>(fn->num_alloc))                                   \
-      resize(fn,(fn->num_alloc)+=FN_BLK);                                   \
+      resize(fn,(fn->num_alloc)*2);                                         \
     (fn->num_code)++;                                                       \
   } else {                                                                  \
     fn->code=(struct var *) MALLOC(FN_BLK*sizeof(struct var));              \
@@ -203,6 +219,7 @@ void resize(fn_t *fn, unsigned long newsize)
   {                                                                         \
     make_new(curr_fn)                                                       \
     curr_fn->code[curr_fn->num_code-1].type=B;                              \
+    curr_fn->code[curr_fn->num_code-1].value.integer=0;                     \
   }
 
 #define DO_FUNC3(A,B)                                                       \
@@ -234,6 +251,23 @@ DO_FUNC2(add_code_lr,        LOCAL_REF)
 DO_FUNC3(add_code_glv,       GLOBAL_L_VALUE)
 DO_FUNC3(add_code_llv,       LOCAL_L_VALUE)
 
+/* If the last thing compiled was a subscript, flag it as the target of a
+   write so the interpreter separates a shared array or mapping first */
+
+static void mark_ref_write(fn_t *curr_fn)
+{
+  struct var *last;
+
+  if (!curr_fn->num_code) return;
+  last=&(curr_fn->code[curr_fn->num_code-1]);
+  if (last->type==GLOBAL_REF || last->type==LOCAL_REF)
+    last->value.integer=1;
+}
+
+/* set while compiling the arguments of an efun that writes through them */
+
+static THREAD_LOCAL int lvalue_args;
+
 void add_code_string(fn_t *curr_fn, char *val)
 {
   unsigned long x;
@@ -267,6 +301,8 @@ void free_sym_t(sym_tab_t *sym)
     FREE(curr_var);
     curr_var=next_var;
   }
+  free_index(sym->index);
+  sym->index=NULL;
 }
 
 void free_file_stack(filptr *file_info)
@@ -275,7 +311,7 @@ void free_file_stack(filptr *file_info)
 
   curr=file_info->previous;
   while (curr) {
-    close_file(curr->file_ptr);
+    free_source(curr->file_ptr);
     next=curr->previous;
     FREE(curr);
     curr=next;
@@ -285,24 +321,16 @@ void free_file_stack(filptr *file_info)
 void free_define(filptr *file_info)
 {
   struct define *curr, *next;
-  struct parm *currparm, *nextparm;
+  int x;
 
-  curr=file_info->defs;
-  while (curr) {
-    next=curr->next;
-    currparm=curr->params;
-    while (currparm) {
-      nextparm=currparm->next;
-      FREE(currparm->name);
-      if (currparm->exp)
-        FREE(currparm->exp);
-      FREE(currparm);
-      currparm=nextparm;
+  for (x=0;x<DEF_HASH;x++) {
+    curr=file_info->defs[x];
+    while (curr) {
+      next=curr->next;
+      free_one_define(curr);
+      curr=next;
     }
-    FREE(curr->name);
-    FREE(curr->definition);
-    FREE(curr);
-    curr=next;
+    file_info->defs[x]=NULL;
   }
 }
 
@@ -314,12 +342,26 @@ unsigned int calc_size(struct array_size *array)
     return (array->size)*calc_size(array->next);
 }
 
-unsigned char find_syscall(char *name)
+/* scall_array by name, built once; precompile() workers may be first */
+static struct name_index *scall_index;
+static pthread_once_t scall_once=PTHREAD_ONCE_INIT;
+
+static void build_scall_index()
 {
   int x;
-  for (x=0;x<NUM_SCALLS;x++)
-    if (scall_array[x] && !strcmp(name,scall_array[x]))
-      return x+NUM_OPERS;
+
+  for (x=NUM_SCALLS-1;x>=0;x--)
+    if (scall_array[x])
+      index_add(&scall_index,scall_array[x],&(scall_array[x]));
+}
+
+unsigned char find_syscall(char *name)
+{
+  char **entry;
+
+  pthread_once(&scall_once,build_scall_index);
+  if ((entry=(char **) index_find(scall_index,name)))
+    return (entry-scall_array)+NUM_OPERS;
   
   /* LPC compatibility aliases - maps standard LPC names to NetCI names */
   /* NetCI Unix-style names (deprecated, use LPC standard names instead) */
@@ -335,27 +377,74 @@ unsigned char find_syscall(char *name)
   return 0;
 }
 
-struct fns *find_func(struct fns *position, char *name)
+void *index_find(struct name_index *idx, char *name)
 {
-  while (position) {
-    if (!strcmp(position->funcname,name))
-      return position;
-    position=position->next;
+  struct name_ent *curr;
+
+  if (!idx) return NULL;
+  curr=idx->bucket[name_bucket(name,NAME_HASH)];
+  while (curr) {
+    if (!strcmp(curr->name,name))
+      return curr->item;
+    curr=curr->next;
   }
   return NULL;
 }
 
-struct var_tab *find_var(char *name, sym_tab_t *sym)
+/* name isn't copied: it must last as long as the index */
+void index_add(struct name_index **idx, char *name, void *item)
 {
-  struct var_tab *curr;
+  struct name_ent *ent;
+  unsigned int bucket,x;
 
-  curr=sym->varlist;
-  while (curr) {
-    if (!strcmp(curr->name,name))
-      return curr;
-    curr=curr->next;
+  if (!*idx) {
+    *idx=(struct name_index *) MALLOC(sizeof(struct name_index));
+    for (x=0;x<NAME_HASH;x++)
+      (*idx)->bucket[x]=NULL;
+    (*idx)->count=0;
   }
-  return NULL;
+  bucket=name_bucket(name,NAME_HASH);
+  ent=(struct name_ent *) MALLOC(sizeof(struct name_ent));
+  ent->name=name;
+  ent->item=item;
+  ent->next=(*idx)->bucket[bucket];
+  (*idx)->bucket[bucket]=ent;
+  (*idx)->count++;
+}
+
+void free_index(struct name_index *idx)
+{
+  struct name_ent *curr,*next;
+  unsigned int x;
+
+  if (!idx) return;
+  for (x=0;x<NAME_HASH;x++) {
+    curr=idx->bucket[x];
+    while (curr) {
+      next=curr->next;
+      FREE(curr);
+      curr=next;
+    }
+  }
+  FREE(idx);
+}
+
+struct fns *find_func(struct name_index *funcs, char *name)
+{
+  return (struct fns *) index_find(funcs,name);
+}
+
+struct var_tab *find_var(char *name, sym_tab_t *sym)
+{
+  return (struct var_tab *) index_find(sym->index,name);
+}
+
+/* Put var at the head of sym's list */
+void link_var(sym_tab_t *sym, struct var_tab *var)
+{
+  var->next=sym->varlist;
+  sym->varlist=var;
+  index_add(&(sym->index),var->name,var);
 }
 
 unsigned int add_var(filptr *file_info, sym_tab_t *sym, int is_mapping)
@@ -378,25 +467,22 @@ unsigned int add_var(filptr *file_info, sym_tab_t *sym, int is_mapping)
     return file_info->phys_line;
   }
   /* Check if variable already exists in all_vars (from ancestors) */
-  struct var_tab *existing = sym->varlist;
-  while (existing) {
-    if (!strcmp(existing->name, token.token_data.name)) {
-      if (existing->origin_prog != NULL) {
-        /* Variable exists from an ancestor - shadowing error */
-        char errbuf[512];
-        sprintf(errbuf, "variable '%s' already defined in ancestor '%s'", 
-                token.token_data.name,
-                existing->origin_prog->pathname ? existing->origin_prog->pathname : "unknown");
-        set_c_err_msg(errbuf);
-        return file_info->phys_line;
-      }
-      /* Variable already defined in current program - duplicate error */
-      char errbuf[256];
-      sprintf(errbuf, "variable '%s' already defined", token.token_data.name);
+  struct var_tab *existing = find_var(token.token_data.name, sym);
+  if (existing) {
+    if (existing->origin_prog != NULL) {
+      /* Variable exists from an ancestor - shadowing error */
+      char errbuf[512];
+      sprintf(errbuf, "variable '%s' already defined in ancestor '%s'", 
+              token.token_data.name,
+              existing->origin_prog->pathname ? existing->origin_prog->pathname : "unknown");
       set_c_err_msg(errbuf);
       return file_info->phys_line;
     }
-    existing = existing->next;
+    /* Variable already defined in current program - duplicate error */
+    char errbuf[256];
+    sprintf(errbuf, "variable '%s' already defined", token.token_data.name);
+    set_c_err_msg(errbuf);
+    return file_info->phys_line;
   }
   
   curr_var=(struct var_tab *) MALLOC(sizeof(struct var_tab));
@@ -406,8 +492,7 @@ unsigned int add_var(filptr *file_info, sym_tab_t *sym, int is_mapping)
   curr_var->is_mapping=is_mapping;
   curr_var->origin_prog=NULL;  /* NULL = defined in current program */
   curr_var->owner_local_index=curr_var->base;
-  curr_var->next=sym->varlist;
-  sym->varlist=curr_var;
+  link_var(sym,curr_var);
   
   /* Also add to own_vars list ONLY if this is a GLOBAL variable */
   if (sym == file_info->glob_sym) {
@@ -495,18 +580,83 @@ unsigned int add_var(filptr *file_info, sym_tab_t *sym, int is_mapping)
   return 0;
 }
 
-unsigned int parse_base(filptr *file_info,fn_t *curr_fn, sym_tab_t
-                        *loc_sym, struct array_size **rest)
+/* Finish a subscript on a value that is already on the code list.  "i]"
+   compiles to S_INDEX and "a..b]" to S_RANGE; either bound of a range may
+   be left out, an empty start is 0 and an empty end is -1 (the last
+   element) */
+
+static unsigned int parse_range_end(filptr *file_info, fn_t *curr_fn,
+                                    sym_tab_t *loc_sym)
 {
   token_t token;
 
-  if (*rest==NULL) {
-    set_c_err_msg("array reference on non-array type");
-    return file_info->phys_line;
+  get_token(file_info,&token);
+  if (token.type==RARRAY_TOK)
+    add_code_integer(curr_fn,-1);
+  else {
+    unget_token(file_info,&token);
+    if (parse_exp(file_info,curr_fn,loc_sym,0,0))
+      return file_info->phys_line;
+    get_token(file_info,&token);
+    if (token.type!=RARRAY_TOK) {
+      set_c_err_msg("expected ]");
+      return file_info->phys_line;
+    }
   }
-  (*rest)=(*rest)->next;
+  add_code_num_args(curr_fn,3);
+  add_code_instr(curr_fn,S_RANGE);
+  return 0;
+}
+
+static unsigned int parse_subscript(filptr *file_info, fn_t *curr_fn,
+                                    sym_tab_t *loc_sym)
+{
+  token_t token;
+
+  get_token(file_info,&token);
+  if (token.type==RANGE_TOK) {
+    add_code_integer(curr_fn,0);
+    return parse_range_end(file_info,curr_fn,loc_sym);
+  }
+  unget_token(file_info,&token);
   if (parse_exp(file_info,curr_fn,loc_sym,0,0))
     return file_info->phys_line;
+  get_token(file_info,&token);
+  if (token.type==RANGE_TOK)
+    return parse_range_end(file_info,curr_fn,loc_sym);
+  if (token.type!=RARRAY_TOK) {
+    set_c_err_msg("expected ]");
+    return file_info->phys_line;
+  }
+  add_code_num_args(curr_fn,2);
+  add_code_instr(curr_fn,S_INDEX);
+  return 0;
+}
+
+/* An S_INDEX or S_RANGE result is a fresh value, not a variable */
+
+static int is_subscript_value(fn_t *curr_fn)
+{
+  struct var *last;
+
+  if (!curr_fn->num_code) return 0;
+  last=&(curr_fn->code[curr_fn->num_code-1]);
+  return (last->type==ASM_INSTR && (last->value.instruction==S_INDEX ||
+                                    last->value.instruction==S_RANGE));
+}
+
+unsigned int parse_base(filptr *file_info,fn_t *curr_fn, sym_tab_t
+                        *loc_sym, struct array_size **rest);
+
+/* The index expression of the current dimension has been compiled; scale
+   it and carry on into the next declared dimension, if any */
+
+static unsigned int parse_base_end(filptr *file_info, fn_t *curr_fn,
+                                   sym_tab_t *loc_sym,
+                                   struct array_size **rest)
+{
+  token_t token;
+
   add_code_integer(curr_fn,calc_size(*rest));
   add_code_instr(curr_fn,MUL_OPER);
   
@@ -517,16 +667,30 @@ unsigned int parse_base(filptr *file_info,fn_t *curr_fn, sym_tab_t
     return file_info->phys_line;
   }
   get_token(file_info,&token);
-  if (token.type==LARRAY_TOK) {
+  if (token.type==LARRAY_TOK && *rest) {
     /* More dimensions - ADD now and recurse */
     add_code_instr(curr_fn,ADD_OPER);
     return parse_base(file_info,curr_fn,loc_sym,rest);
   }
-  /* Last dimension - DON'T add, let runtime do it after bounds check */
+  /* Last dimension - DON'T add, let runtime do it after bounds check.
+     A further [ subscripts the element and is left to parse_exp() */
   unget_token(file_info,&token);
   return 0;
 }
 
+unsigned int parse_base(filptr *file_info,fn_t *curr_fn, sym_tab_t
+                        *loc_sym, struct array_size **rest)
+{
+  if (*rest==NULL) {
+    set_c_err_msg("array reference on non-array type");
+    return file_info->phys_line;
+  }
+  (*rest)=(*rest)->next;
+  if (parse_exp(file_info,curr_fn,loc_sym,0,0))
+    return file_info->phys_line;
+  return parse_base_end(file_info,curr_fn,loc_sym,rest);
+}
+
 unsigned int parse_var(char *name,filptr *file_info,fn_t *curr_fn,sym_tab_t
                        *loc_sym)
 {
@@ -534,6 +698,8 @@ unsigned int parse_var(char *name,filptr *file_info,fn_t *curr_fn,sym_tab_t
   int global;
   struct var_tab *the_var;
   struct array_size *rest;
+  unsigned long mark;
+  int have_start;
   // char logbuf[256];
 
   // sprintf(logbuf, "parse_var: name='%s'", name);
@@ -582,11 +748,41 @@ unsigned int parse_var(char *name,filptr *file_info,fn_t *curr_fn,sym_tab_t
         add_code_gr(curr_fn);
       else
         add_code_lr(curr_fn);
+    } else if (!the_var->array) {
+      /* STRING (or anything else held in a plain variable): read-only
+       * index or range on its value
+       */
+      if (global)
+        add_code_glv(curr_fn,the_var->base,1);
+      else
+        add_code_llv(curr_fn,the_var->base,1);
+      return parse_subscript(file_info,curr_fn,loc_sym);
     } else {
-      /* ARRAY: Use existing array logic */
-      rest=the_var->array;
+      /* ARRAY: Use existing array logic, unless the subscript turns out
+       * to be a range; then the base slot becomes the whole array
+       */
+      mark=curr_fn->num_code;
       add_code_integer(curr_fn,the_var->base);
-      if (parse_base(file_info,curr_fn,loc_sym,&rest))
+      have_start=0;
+      get_token(file_info,&token);
+      if (token.type!=RANGE_TOK) {
+        unget_token(file_info,&token);
+        if (parse_exp(file_info,curr_fn,loc_sym,0,0))
+          return file_info->phys_line;
+        have_start=1;
+        get_token(file_info,&token);
+      }
+      if (token.type==RANGE_TOK) {
+        curr_fn->code[mark].type=(global ? GLOBAL_L_VALUE : LOCAL_L_VALUE);
+        curr_fn->code[mark].value.l_value.ref=the_var->base;
+        curr_fn->code[mark].value.l_value.size=calc_size(the_var->array);
+        if (!have_start)
+          add_code_integer(curr_fn,0);
+        return parse_range_end(file_info,curr_fn,loc_sym);
+      }
+      unget_token(file_info,&token);
+      rest=the_var->array->next;
+      if (parse_base_end(file_info,curr_fn,loc_sym,&rest))
         return file_info->phys_line;
       /* Push size of FIRST dimension for bounds checking, not remaining */
       add_code_integer(curr_fn,the_var->array->size);
@@ -603,8 +799,10 @@ unsigned int parse_arglist(filptr *file_info, fn_t *curr_fn, sym_tab_t
                           *loc_sym)
 {
   token_t token;
-  int done,argcount;
+  int done,argcount,mark;
 
+  mark=lvalue_args;
+  lvalue_args=0;
   done=0;
   get_token(file_info,&token);
   if (token.type==RPAR_TOK)
@@ -615,6 +813,7 @@ unsigned int parse_arglist(filptr *file_info, fn_t *curr_fn, sym_tab_t
   while (!done) {
     if (parse_exp(file_info,curr_fn,loc_sym,1,0))
       return file_info->phys_line;
+    if (mark) mark_ref_write(curr_fn);
     get_token(file_info,&token);
     if (token.type==RPAR_TOK)
       done=1;
@@ -837,7 +1036,8 @@ unsigned int parse_exp(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym,
         make_new(curr_fn);
         curr_fn->code[x].type = CALL_PARENT_NAMED;
         curr_fn->code[x].value.parent_call.inherit_idx = target_inherit_idx;
-        curr_fn->code[x].value.parent_call.func_idx = target_func->func_index;
+        curr_fn->code[x].value.parent_call.func_idx =
+          function_position(target_func, target_inherit->entry->proto);
         
         // char logbuf[256];
         // sprintf(logbuf, "Debug>> Resolved %s::%s() to inherit[%d].func[%d]", 
@@ -848,9 +1048,13 @@ unsigned int parse_exp(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym,
       last_was_arg = 1;
       get_token(file_info, &token);
     } else if (token.type==LPAR_TOK) {
+      if (!find_func(file_info->funcs,name)) {
+        instr=find_syscall(name);
+        lvalue_args=(instr==S_SSCANF || instr==S_FREAD || instr==S_MAP_DELETE);
+      }
       if (parse_arglist(file_info,curr_fn,loc_sym))
         return file_info->phys_line;
-      if ((func=find_func(file_info->curr_code->func_list,name)))
+      if ((func=find_func(file_info->funcs,name)))
         add_code_func_call(curr_fn,func);
       else
         if ((instr=find_syscall(name)))
@@ -910,6 +1114,7 @@ unsigned int parse_exp(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym,
     struct fns *next_func = NULL;
     struct proto *next_proto = NULL;
     int next_inherit_idx = -1;
+    int next_func_idx = -1;
     
     for (int i = 0; i < mro_length; i++) {
         struct proto *candidate = mro[i];
@@ -968,20 +1173,7 @@ unsigned int parse_exp(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym,
              * We cannot use candidate_func->func_index because that might be from a different context.
              * We must walk the parent proto's function list to find the real index.
              */
-            struct fns *parent_fn = next_proto->funcs->func_list;
-            int parent_idx = 0;
-            int found_idx = -1;
-            while (parent_fn) {
-                if (parent_fn == candidate_func) {
-                    found_idx = parent_idx;
-                    sprintf(logbuf, "Debug>>   Found '%s' at ACTUAL parent index %d (func_index field was %d)", 
-                            func_name, parent_idx, candidate_func->func_index);
-                    logger(LOG_DEBUG, logbuf);
-                    break;
-                }
-                parent_idx++;
-                parent_fn = parent_fn->next;
-            }
+            int found_idx = function_position(candidate_func, next_proto);
             
             if (found_idx < 0) {
                 sprintf(logbuf, "INTERNAL ERROR: Function '%s' found but not in parent's function list!", func_name);
@@ -990,9 +1182,10 @@ unsigned int parse_exp(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym,
                 return file_info->phys_line;
             }
             
-            /* Override func_index with the actual parent table index */
-            candidate_func->func_index = found_idx;
-            
+            sprintf(logbuf, "Debug>>   Found '%s' at ACTUAL parent index %d (func_index field is %d)", 
+                    func_name, found_idx, candidate_func->func_index);
+            logger(LOG_DEBUG, logbuf);
+            next_func_idx = found_idx;
             break;
         }
     }
@@ -1023,17 +1216,22 @@ unsigned int parse_exp(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym,
         make_new(curr_fn);
         curr_fn->code[x].type = CALL_SUPER;
         curr_fn->code[x].value.parent_call.inherit_idx = next_inherit_idx;
-        curr_fn->code[x].value.parent_call.func_idx = next_func->func_index;
+        curr_fn->code[x].value.parent_call.func_idx = next_func_idx;
         
         char logbuf[256];
         sprintf(logbuf, "Emitted CALL_SUPER for %s: inherit_idx=%d, func_idx=%d", 
-                func_name, next_inherit_idx, next_func->func_index);
+                func_name, next_inherit_idx, next_func_idx);
         logger(LOG_DEBUG, logbuf);
     }
     
     last_was_arg = 1;
     get_token(file_info, &token);
   }
+  while (token.type==LARRAY_TOK && last_was_arg) {
+    if (parse_subscript(file_info,curr_fn,loc_sym))
+      return file_info->phys_line;
+    get_token(file_info,&token);
+  }
   if (token.type==DOT_TOK || token.type==CALL_TOK) {
     if (!last_was_arg) {
       set_c_err_msg("malformed expression (invalid use of call operator)");
@@ -1060,6 +1258,11 @@ unsigned int parse_exp(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym,
     add_code_instr(curr_fn,S_CALL_OTHER);
     get_token(file_info,&token);
   }
+  while (token.type==LARRAY_TOK && last_was_arg) {
+    if (parse_subscript(file_info,curr_fn,loc_sym))
+      return file_info->phys_line;
+    get_token(file_info,&token);
+  }
   if (token.type<NUM_OPERS) {
     if ((token.type==MIN_OPER) && (!last_was_arg))
       token.type=UMIN_OPER;
@@ -1077,6 +1280,14 @@ unsigned int parse_exp(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym,
       set_c_err_msg("malformed expression");
       return file_info->phys_line;
     }
+    if ((instr>=EQ_OPER && instr<=RSEQ_OPER) || instr==POSTADD_OPER ||
+        instr==POSTMIN_OPER) {
+      if (is_subscript_value(curr_fn)) {
+        set_c_err_msg("cannot assign to an index or range of a value");
+        return file_info->phys_line;
+      }
+      mark_ref_write(curr_fn);
+    }
     if (instr==COND_OPER) {
       add_code_branch(curr_fn,0);
       marker1=curr_fn->num_code-1;
@@ -1100,6 +1311,13 @@ unsigned int parse_exp(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym,
         if (parse_exp(file_info,curr_fn,loc_sym,prec_array[instr].res_prec,
                        0))
           return file_info->phys_line;
+      if (instr==PREADD_OPER || instr==PREMIN_OPER) {
+        if (is_subscript_value(curr_fn)) {
+          set_c_err_msg("cannot assign to an index or range of a value");
+          return file_info->phys_line;
+        }
+        mark_ref_write(curr_fn);
+      }
       add_code_instr(curr_fn,instr);
     }
     return parse_exp(file_info,curr_fn,loc_sym,prec,1);
@@ -1196,8 +1414,7 @@ unsigned int parse_line(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym)
         marker1=marker2;
       } else
         unget_token(file_info,&token);
-      get_token(file_info,&token);
-      unget_token(file_info,&token);
+      peek_token(file_info,0,&token);
       add_code_new_line(curr_fn,file_info->phys_line);
       curr_fn->code[marker1].value.num=curr_fn->num_code-1;
       break;
@@ -1228,8 +1445,7 @@ unsigned int parse_line(filptr *file_info, fn_t *curr_fn, sym_tab_t *loc_sym)
           return file_info->phys_line;
       }
       add_code_jump(curr_fn,marker1);
-      get_token(file_info,&token);
-      unget_token(file_info,&token);
+      peek_token(file_info,0,&token);
       add_code_new_line(curr_fn,file_info->phys_line);
       curr_fn->code[marker2].value.num=curr_fn->num_code-1;
       break;
@@ -1509,35 +1725,31 @@ int build_variable_layout(filptr *file_info) {
                 
                 /* Check if variable name already exists in child */
                 struct var_tab *existing = file_info->glob_sym ? 
-                                          file_info->glob_sym->varlist : NULL;
+                                          find_var(var->name, file_info->glob_sym) : NULL;
                 int name_exists = 0;
                 struct proto *existing_origin = NULL;
                 
-                while (existing) {
-                    if (!strcmp(existing->name, var->name)) {
-                        name_exists = 1;
-                        existing_origin = existing->origin_prog;
-                        
-                        /* Check if from same origin (OK) or different origin (ERROR) */
-                        if (existing_origin && existing_origin != prog) {
-                            char errbuf[512];
-                            sprintf(errbuf, "variable '%s' defined in both '%s' and '%s'", 
-                                    var->name, 
-                                    existing_origin->pathname ? existing_origin->pathname : "unknown",
-                                    prog->pathname ? prog->pathname : "unknown");
-                            set_c_err_msg(errbuf);
-                            // sprintf(logbuf, "build_variable_layout: ERROR - %s", errbuf);
-                            // logger(LOG_ERROR, logbuf);
-                            FREE(order);
-                            return 1;  /* Compile error */
-                        }
-                        
-                        // sprintf(logbuf, "build_variable_layout: var '%s' already exists from same origin '%s', skipping", 
-                        //         var->name, prog->pathname ? prog->pathname : "unknown");
-                        // logger(LOG_DEBUG, logbuf);
-                        break;
+                if (existing) {
+                    name_exists = 1;
+                    existing_origin = existing->origin_prog;
+                    
+                    /* Check if from same origin (OK) or different origin (ERROR) */
+                    if (existing_origin && existing_origin != prog) {
+                        char errbuf[512];
+                        sprintf(errbuf, "variable '%s' defined in both '%s' and '%s'", 
+                                var->name, 
+                                existing_origin->pathname ? existing_origin->pathname : "unknown",
+                                prog->pathname ? prog->pathname : "unknown");
+                        set_c_err_msg(errbuf);
+                        // sprintf(logbuf, "build_variable_layout: ERROR - %s", errbuf);
+                        // logger(LOG_ERROR, logbuf);
+                        FREE(order);
+                        return 1;  /* Compile error */
                     }
-                    existing = existing->next;
+                    
+                    // sprintf(logbuf, "build_variable_layout: var '%s' already exists from same origin '%s', skipping", 
+                    //         var->name, prog->pathname ? prog->pathname : "unknown");
+                    // logger(LOG_DEBUG, logbuf);
                 }
                 
                 if (!name_exists) {
@@ -1568,16 +1780,15 @@ int build_variable_layout(filptr *file_info) {
                     }
                     
                     new_var->is_mapping = var->is_mapping;
-                    new_var->next = file_info->glob_sym ? file_info->glob_sym->varlist : NULL;
                     
-                    if (file_info->glob_sym) {
-                        file_info->glob_sym->varlist = new_var;
-                        file_info->glob_sym->num++;
-                    } else {
+                    if (!file_info->glob_sym) {
                         file_info->glob_sym = MALLOC(sizeof(sym_tab_t));
-                        file_info->glob_sym->num = 1;
-                        file_info->glob_sym->varlist = new_var;
+                        file_info->glob_sym->num = 0;
+                        file_info->glob_sym->varlist = NULL;
+                        file_info->glob_sym->index = NULL;
                     }
+                    link_var(file_info->glob_sym, new_var);
+                    file_info->glob_sym->num++;
                     file_info->curr_code->num_globals++;
                     var_count++;
                     
@@ -1688,104 +1899,133 @@ int build_variable_layout(filptr *file_info) {
     return 0;
 }
 
-/* Process inherit statement - load parent proto and add to chain
- * Returns 0 on success, 1 on failure
+/* Give a compiled inheritable program its own proto, linked into the
+ * boot object's proto chain and cached for later inherits.
  */
-int add_inherit(filptr *file_info, char *pathname) {
-    struct inherit_list *new_inherit;
+struct proto *install_inherit(char *pathname, struct code *parent_code) {
     struct proto *parent_proto;
-    struct code *parent_code;
-    struct object *parent_obj;
-    unsigned int result;
     char logbuf[256];
     
-    sprintf(logbuf, "add_inherit: loading '%s'", pathname);
-    logger(LOG_DEBUG, logbuf);
+    /* Create proto for parent */
+    parent_proto = MALLOC(sizeof(struct proto));
+    parent_proto->pathname = copy_string(pathname);
+    parent_proto->funcs = parent_code;
+    parent_proto->proto_obj = NULL;  /* No instance yet */
+    parent_proto->next_proto = NULL;
+    parent_proto->inherits = parent_code->inherits;  /* Copy inherits from code */
     
-    /* Check if already inherited in current file */
-    struct inherit_list *curr = file_info->curr_code->inherits;
-    while (curr) {
-        if (!strcmp(curr->inherit_path, pathname)) {
-            sprintf(logbuf, "add_inherit: '%s' already inherited in current file", pathname);
-            logger(LOG_WARNING, logbuf);
-            return 0;  /* Not an error, just skip */
+    /* Set origin_proto for all functions in this proto */
+    {
+        struct fns *curr_fn = parent_code->func_list;
+        int count = 0;
+        while (curr_fn) {
+            sprintf(logbuf, "install_inherit: Setting origin_proto for func '%s' to proto '%s' (%p)",
+                    curr_fn->funcname ? curr_fn->funcname : "unknown",
+                    parent_proto->pathname ? parent_proto->pathname : "unknown",
+                    (void*)parent_proto);
+            logger(LOG_DEBUG, logbuf);
+            curr_fn->origin_proto = parent_proto;
+            curr_fn = curr_fn->next;
+            count++;
         }
-        curr = curr->next;
+        sprintf(logbuf, "install_inherit: Set origin_proto for %d functions in '%s'", 
+                count, parent_proto->pathname ? parent_proto->pathname : "unknown");
+        logger(LOG_DEBUG, logbuf);
     }
     
+    /* Add to proto list (link to boot object's proto chain) */
+    struct object *boot_obj = ref_to_obj(0);
+    if (boot_obj && boot_obj->parent) {
+        parent_proto->next_proto = boot_obj->parent->next_proto;
+        boot_obj->parent->next_proto = parent_proto;
+    }
+    
+    /* Cache it globally */
+    cache_proto(pathname, parent_proto);
+    return parent_proto;
+}
+
+/* Find or compile the program an inherit statement names.  Returns
+ * NULL (with c_err_msg set) on failure.
+ */
+struct proto *load_inherit(char *pathname) {
+    struct proto *parent_proto;
+    struct code *parent_code;
+    unsigned int result;
+    char logbuf[256];
+    
     /* Check global proto cache first */
     parent_proto = find_cached_proto(pathname);
     
     if (parent_proto) {
-        sprintf(logbuf, "add_inherit: using cached proto for '%s'", pathname);
+        sprintf(logbuf, "load_inherit: using cached proto for '%s'", pathname);
         logger(LOG_DEBUG, logbuf);
         
         /* Validate cached proto */
         if (!parent_proto->funcs) {
-            sprintf(logbuf, "add_inherit: ERROR - cached proto for '%s' has NULL funcs", pathname);
+            sprintf(logbuf, "load_inherit: ERROR - cached proto for '%s' has NULL funcs", pathname);
             logger(LOG_ERROR, logbuf);
             set_c_err_msg("cached proto has no function table");
-            return 1;
+            return NULL;
         }
         if (!parent_proto->pathname) {
-            sprintf(logbuf, "add_inherit: ERROR - cached proto for '%s' has NULL pathname", pathname);
+            sprintf(logbuf, "load_inherit: ERROR - cached proto for '%s' has NULL pathname", pathname);
             logger(LOG_ERROR, logbuf);
             set_c_err_msg("cached proto has no pathname");
-            return 1;
+            return NULL;
         }
+    } else if (precomp_worker()) {
+        /* Only the main thread adds protos; precompile() loads this one
+         * and then compiles the inheritor again */
+        precomp_need(pathname);
+        set_c_err_msg("inherited program not loaded yet");
+        return NULL;
     } else {
         /* Compile once and cache */
-        sprintf(logbuf, "add_inherit: compiling and caching '%s'", pathname);
+        sprintf(logbuf, "load_inherit: compiling and caching '%s'", pathname);
         logger(LOG_DEBUG, logbuf);
         
         result = parse_code(pathname, NULL, &parent_code);
         if (result) {
             char errbuf[512];
-            sprintf(logbuf, "add_inherit: failed to compile '%s'", pathname);
+            sprintf(logbuf, "load_inherit: failed to compile '%s'", pathname);
             logger(LOG_ERROR, logbuf);
             sprintf(errbuf, "failed to compile inherited file '%s'", pathname);
             set_c_err_msg(errbuf);
-            return 1;
-        }
-        
-        /* Create proto for parent */
-        parent_proto = MALLOC(sizeof(struct proto));
-        parent_proto->pathname = copy_string(pathname);
-        parent_proto->funcs = parent_code;
-        parent_proto->proto_obj = NULL;  /* No instance yet */
-        parent_proto->next_proto = NULL;
-        parent_proto->inherits = parent_code->inherits;  /* Copy inherits from code */
-        
-        /* Set origin_proto for all functions in this proto */
-        {
-            struct fns *curr_fn = parent_code->func_list;
-            int count = 0;
-            while (curr_fn) {
-                sprintf(logbuf, "add_inherit: Setting origin_proto for func '%s' to proto '%s' (%p)",
-                        curr_fn->funcname ? curr_fn->funcname : "unknown",
-                        parent_proto->pathname ? parent_proto->pathname : "unknown",
-                        (void*)parent_proto);
-                logger(LOG_DEBUG, logbuf);
-                curr_fn->origin_proto = parent_proto;
-                curr_fn = curr_fn->next;
-                count++;
-            }
-            sprintf(logbuf, "add_inherit: Set origin_proto for %d functions in '%s'", 
-                    count, parent_proto->pathname ? parent_proto->pathname : "unknown");
-            logger(LOG_DEBUG, logbuf);
+            return NULL;
         }
-        
-        /* Add to proto list (link to boot object's proto chain) */
-        struct object *boot_obj = ref_to_obj(0);
-        if (boot_obj && boot_obj->parent) {
-            parent_proto->next_proto = boot_obj->parent->next_proto;
-            boot_obj->parent->next_proto = parent_proto;
+        parent_proto = install_inherit(pathname, parent_code);
+    }
+    
+    return parent_proto;
+}
+
+/* Process inherit statement - load parent proto and add to chain
+ * Returns 0 on success, 1 on failure
+ */
+int add_inherit(filptr *file_info, char *pathname) {
+    struct inherit_list *new_inherit;
+    struct proto *parent_proto;
+    struct object *parent_obj;
+    char logbuf[256];
+    
+    sprintf(logbuf, "add_inherit: loading '%s'", pathname);
+    logger(LOG_DEBUG, logbuf);
+    
+    /* Check if already inherited in current file */
+    struct inherit_list *curr = file_info->curr_code->inherits;
+    while (curr) {
+        if (!strcmp(curr->inherit_path, pathname)) {
+            sprintf(logbuf, "add_inherit: '%s' already inherited in current file", pathname);
+            logger(LOG_WARNING, logbuf);
+            return 0;  /* Not an error, just skip */
         }
-        
-        /* Cache it globally */
-        cache_proto(pathname, parent_proto);
+        curr = curr->next;
     }
     
+    if (!(parent_proto = load_inherit(pathname)))
+        return 1;
+    
     /* Create inherit entry with alias */
     struct inherit_entry *entry = MALLOC(sizeof(struct inherit_entry));
     entry->alias = get_default_alias(pathname);  /* Extract basename as default alias */
@@ -1893,15 +2133,10 @@ unsigned int top_level_parse(filptr *file_info)
           struct define *def;
           
           /* Look for macro definition */
-          def = file_info->defs;
-          while (def) {
-            if (!strcmp(def->name, token.token_data.name)) {
-              /* Found macro - expand it to STRING_TOK */
-              token.type = STRING_TOK;
-              token.token_data.name = copy_string(def->definition);
-              break;
-            }
-            def = def->next;
+          if ((def = find_define(file_info, token.token_data.name))) {
+            /* Found macro - expand it to STRING_TOK */
+            token.type = STRING_TOK;
+            token.token_data.name = copy_string(def->definition);
           }
         }
         
@@ -1976,6 +2211,7 @@ unsigned int top_level_parse(filptr *file_info)
         curr_func.num_alloc=0;
         loc_sym.num=0;
         loc_sym.varlist=NULL;
+        loc_sym.index=NULL;
         tmp_fns=(struct fns *) MALLOC(sizeof(struct fns));
         tmp_fns->is_static=is_static;
         tmp_fns->num_args=0;
@@ -1985,21 +2221,14 @@ unsigned int top_level_parse(filptr *file_info)
         tmp_fns->funcname=copy_string(token.token_data.name);
         tmp_fns->lst=NULL;  /* Initialize local symbol table */
         
-        /* Assign function index - count existing functions */
-        {
-            int func_count = 0;
-            struct fns *count_fn = file_info->curr_code->func_list;
-            while (count_fn) {
-                func_count++;
-                count_fn = count_fn->next;
-            }
-            tmp_fns->func_index = func_count;
-        }
+        /* Assign function index - one per function defined so far */
+        tmp_fns->func_index = file_info->funcs ? file_info->funcs->count : 0;
         
         tmp_fns->visibility=is_static ? VISIBILITY_PRIVATE : VISIBILITY_PUBLIC;
         tmp_fns->origin_proto=NULL;  /* Will be set after proto is created */
         tmp_fns->next=file_info->curr_code->func_list;
         file_info->curr_code->func_list=tmp_fns;
+        index_add(&(file_info->funcs),tmp_fns->funcname,tmp_fns);
         get_token(file_info,&token);
         if (token.type!=LPAR_TOK) {
           set_c_err_msg("expected (");
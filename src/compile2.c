@@ -11,6 +11,9 @@
 #include "file.h"
 #include "token.h"
 #include "globals.h"
+#include "bcache.h"
+#include "precomp.h"
+#include "optimize.h"
 
 unsigned int parse_code(char *filename, struct object *caller_obj,
                         struct code **result)
@@ -19,9 +22,12 @@ unsigned int parse_code(char *filename, struct object *caller_obj,
   unsigned int line_num;
   filptr file_info;
   char *buf;
+  struct code *held_code;
+  unsigned long long local_key;
   char logbuf[512];
   int is_boot;
   long start_time, end_time;
+  int x;
 
   c_err_msg=NULL;
   buf=(char *) MALLOC(strlen(filename)+3);
@@ -36,8 +42,21 @@ unsigned int parse_code(char *filename, struct object *caller_obj,
     logger(LOG_INFO, logbuf);
     start_time = time(NULL);
   }
+
+  if ((held_code=precomp_take(filename))) {
+    *result=held_code;
+    FREE(buf);
+    return 0;
+  }
+
+  if (bcache_enabled(filename) && !bcache_load(filename,result)) {
+    if (is_boot)
+      logger(LOG_INFO, "COMPILE: boot.c loaded from the bytecode cache");
+    FREE(buf);
+    return 0;
+  }
   
-  if (!(file_info.curr_file=open_file(buf,FREAD_MODE,NULL))) {
+  if (!(file_info.curr_file=load_source(buf))) {
     if (is_boot) {
       logger(LOG_ERROR, "COMPILE: boot.c FAILED - could not open file");
     }
@@ -45,9 +64,8 @@ unsigned int parse_code(char *filename, struct object *caller_obj,
     return (unsigned int) -1;
   }
   FREE(buf);
-  ungetc('\n',file_info.curr_file);
   file_info.previous=NULL;
-  file_info.is_put_back=0;
+  file_info.num_ahead=0;
   file_info.expanded=NULL;
   file_info.curr_code=(struct code *) MALLOC(sizeof(struct code));
   file_info.curr_code->num_refs=0;
@@ -64,17 +82,31 @@ unsigned int parse_code(char *filename, struct object *caller_obj,
   /* Initialize GST ref mapping */
   file_info.curr_code->gst_map=NULL;
   file_info.curr_code->gst_count=0;
+  file_info.curr_code->src_key=0;
+  file_info.curr_code->includes=NULL;
+  file_info.includes=NULL;
   file_info.depth=0;
   file_info.layout_locked=0;  /* Initialize layout_locked flag */
   glob_sym.num=0;
   glob_sym.varlist=NULL;
+  glob_sym.index=NULL;
   file_info.glob_sym=&glob_sym;
+  file_info.funcs=NULL;
+  file_info.optimize=optimize;
   file_info.phys_line=0;
-  file_info.defs=NULL;
+  for (x=0;x<DEF_HASH;x++)
+    file_info.defs[x]=NULL;
   line_num=top_level_parse(&file_info);
-  close_file(file_info.curr_file);
+  free_source(file_info.curr_file);
+  clear_lookahead(&file_info);
+  if (!line_num && file_info.optimize)
+    optimize_code(file_info.curr_code);
+  if (!line_num)
+    fuse_code(file_info.curr_code);
   file_info.curr_code->gst=glob_sym.varlist;
   file_info.curr_code->num_globals=glob_sym.num;
+  free_index(glob_sym.index);
+  free_index(file_info.funcs);
   
   /* Build GST ref mapping: gst[base] -> {owner_proto, owner_local_index} */
   if (file_info.curr_code->num_globals) {
@@ -157,6 +189,11 @@ unsigned int parse_code(char *filename, struct object *caller_obj,
   
   free_file_stack(&file_info);
   free_define(&file_info);
+  if (!line_num && !bcache_key(filename,file_info.curr_code,
+                               file_info.includes,&local_key) &&
+      bcache_enabled(filename))
+    bcache_store(filename,file_info.curr_code,file_info.includes,local_key);
+  file_info.curr_code->includes=file_info.includes;
   if (line_num) {
     if (is_boot) {
       sprintf(logbuf, "COMPILE: boot.c FAILED at line %u - %s", line_num, c_err_msg ? c_err_msg : "unknown error");
@@ -10,6 +10,7 @@
 #include "file.h"
 #include "cache.h"
 #include "interp.h"  /* For struct call_frame definition */
+#include "bcache.h"
 
 /**
  * Validates filename for virtual filesystem
@@ -104,10 +105,12 @@ void free_code(struct code *the_code) {
     FREE(curr);
   }
   free_gst(the_code->gst);
+  free_gst(the_code->own_vars);
   if (the_code->ancestor_map)
     FREE(the_code->ancestor_map);
   if (the_code->gst_map)
     FREE(the_code->gst_map);
+  free_dep_list(the_code->includes);
   FREE(the_code);
 }
 
@@ -212,7 +215,7 @@ int resolve_var(struct var *data, struct object *obj) {
     /* Check if this is a heap array element (pointer) or regular global */
     if (data->value.l_value.ref>=obj->parent->funcs->num_globals) {
       /* This is a pointer to a heap array element */
-      element_ptr = (struct var *)data->value.l_value.ref;
+      element_ptr = element_slot(data->value.l_value.ref);
       if (!element_ptr) {
         logger(LOG_DEBUG, "resolve_var: null element_ptr");
         return 1;
@@ -278,7 +281,7 @@ int resolve_var(struct var *data, struct object *obj) {
       /* Check if this is a heap array element (pointer) or regular local */
       if (data->value.l_value.ref>=num_locals) {
         /* This is a pointer to a heap array element */
-        element_ptr = (struct var *)data->value.l_value.ref;
+        element_ptr = element_slot(data->value.l_value.ref);
         if (!element_ptr) {
           logger(LOG_DEBUG, "resolve_var: null element_ptr (LOCAL)");
           return 1;
@@ -336,6 +339,41 @@ int resolve_var(struct var *data, struct object *obj) {
   return 0;
 }
 
+/* The var an l-value ref past the locals or globals stands for: an array
+ * element, or a mapping value looked up again.  NULL if there is none.
+ */
+struct var *element_slot(unsigned long ref) {
+  if (ref & MAPPING_REF_TAG)
+    return mapping_ref_value(ref);
+  return (struct var *) ref;
+}
+
+/* Find the variable or array/mapping element an l-value refers to, for
+ * efuns that modify their argument in place.  Returns NULL if it is out
+ * of range.
+ */
+struct var *lvalue_slot(struct var *data, struct object *obj) {
+  extern struct call_frame *call_stack;
+  unsigned int effective_index;
+  int ok = 0;
+
+  if (data->type==GLOBAL_L_VALUE) {
+    if (!obj || !obj->parent || !obj->parent->funcs || !obj->globals)
+      return NULL;
+    if (data->value.l_value.ref>=obj->parent->funcs->num_globals)
+      return element_slot(data->value.l_value.ref);
+    effective_index = global_index_for(obj, call_stack ? call_stack->func : NULL,
+                                       (unsigned int)data->value.l_value.ref, &ok);
+    return ok ? &obj->globals[effective_index] : NULL;
+  }
+  if (data->type==LOCAL_L_VALUE) {
+    if (data->value.l_value.ref>=num_locals)
+      return element_slot(data->value.l_value.ref);
+    return &locals[data->value.l_value.ref];
+  }
+  return NULL;
+}
+
 int popint(struct var *data, struct var_stack **rts, struct object *obj) {
   struct var tmp;
   struct var_stack *ptr;
@@ -534,7 +572,8 @@ void clear_var(struct var *data) {
 void clear_global_var(struct object *obj, unsigned int ref) {
   struct ref_list *next,*curr;
 
-  if (ref>=obj->parent->funcs->num_globals)
+  /* globals are NULL once unload_data() has dropped them */
+  if (ref>=obj->parent->funcs->num_globals || !obj->globals)
     return;
   obj->obj_state=DIRTY;
   if (obj->globals[ref].type==STRING || obj->globals[ref].type==FUNC_NAME)
@@ -15,6 +15,8 @@ void clear_var(struct var *data);
 void clear_global_var(struct object *obj, unsigned int ref);
 void copy_var(struct var *dest, struct var *src);
 int resolve_var(struct var *data, struct object *obj);
+struct var *element_slot(unsigned long ref);
+struct var *lvalue_slot(struct var *data, struct object *obj);
 struct var_stack *gen_stack(struct var_stack **rts, struct object *obj);
 struct var_stack *gen_stack_noresolve(struct var_stack **rts,
                                       struct object *obj);
@@ -72,19 +72,107 @@ void remove_verb(struct object *obj, char *verb_name) {
   }
 }
 
+/* queued input is kept on each object, oldest first.  objects with input
+   waiting are chained through next_cmd_obj: cmd_head..cmd_tail are ready
+   to run, cmd_held..cmd_held_tail have used up their budget for this
+   pulse (see clearq.c).  an object is on one of the two lists exactly
+   when num_cmds is non-zero. */
+
 void queue_command(struct object *player, char *cmd) {
   struct cmdq *new;
+  char logbuf[256];
 
   if (!player) return;
+  if (cmd_queue_max && player->num_cmds>=cmd_queue_max) {
+    if (!player->cmd_dropped++) {
+      sprintf(logbuf,"queue: %s#%ld has %d commands waiting, dropping input",
+              player->parent ? player->parent->pathname : "NULL",
+              (long) player->refno,player->num_cmds);
+      logger(LOG_WARNING,logbuf);
+    }
+    return;
+  }
   new=MALLOC(sizeof(struct cmdq));
   new->cmd=copy_string(cmd);
   new->obj=player;
   new->next=NULL;
-  if (cmd_tail)
-    cmd_tail->next=new;
-  if (!cmd_head)
-    cmd_head=new;
-  cmd_tail=new;
+  if (player->last_cmd)
+    player->last_cmd->next=new;
+  else {
+    player->cmds=new;
+    player->next_cmd_obj=NULL;
+    if (cmd_tail)
+      cmd_tail->next_cmd_obj=player;
+    else
+      cmd_head=player;
+    cmd_tail=player;
+  }
+  player->last_cmd=new;
+  player->num_cmds++;
+}
+
+static void unlink_cmd_obj(struct object *obj, struct object **head,
+                           struct object **tail) {
+  struct object *curr,*prev;
+
+  prev=NULL;
+  for (curr=*head;curr;curr=curr->next_cmd_obj) {
+    if (curr==obj) {
+      if (prev)
+        prev->next_cmd_obj=curr->next_cmd_obj;
+      else
+        *head=curr->next_cmd_obj;
+      if (*tail==curr) *tail=prev;
+      curr->next_cmd_obj=NULL;
+      return;
+    }
+    prev=curr;
+  }
+}
+
+/* removes cmd from its object's queue and frees it */
+
+void unqueue_command(struct cmdq *cmd) {
+  struct object *obj;
+  struct cmdq *curr,*prev;
+
+  obj=cmd->obj;
+  prev=NULL;
+  for (curr=obj->cmds;curr && curr!=cmd;curr=curr->next) prev=curr;
+  if (!curr) return;
+  if (prev)
+    prev->next=cmd->next;
+  else
+    obj->cmds=cmd->next;
+  if (obj->last_cmd==cmd) obj->last_cmd=prev;
+  if (!--obj->num_cmds) {
+    obj->cmd_dropped=0;
+    unlink_cmd_obj(obj,&cmd_head,&cmd_tail);
+    unlink_cmd_obj(obj,&cmd_held,&cmd_held_tail);
+  }
+  if (cmd->cmd) FREE(cmd->cmd);
+  FREE(cmd);
+}
+
+/* throws away everything obj has queued */
+
+void unqueue_commands(struct object *obj) {
+  while (obj->cmds) unqueue_command(obj->cmds);
+}
+
+/* walks every queued command, ready objects first; NULL starts the walk */
+
+struct cmdq *next_queued(struct cmdq *curr) {
+  struct object *obj;
+
+  if (!curr)
+    obj=cmd_head ? cmd_head : cmd_held;
+  else {
+    if (curr->next) return curr->next;
+    obj=curr->obj->next_cmd_obj;
+    if (!obj && curr->obj==cmd_tail) obj=cmd_held;
+  }
+  return obj ? obj->cmds : NULL;
 }
 
 void queue_for_destruct(struct object *obj) {
@@ -223,6 +311,7 @@ struct object *newobj() {
   obj->contents=NULL;
   obj->next_object=NULL;
   obj->globals=NULL;
+  obj->load_globals=NULL;
   obj->refd_by=NULL;
   obj->verb_list=NULL;
   obj->attachees=NULL;
@@ -230,6 +319,15 @@ struct object *newobj() {
   obj->last_access_time=now_time;  /* Initialize to current time */
   obj->heart_beat_interval=0;      /* Heartbeat disabled by default */
   obj->last_heart_beat=0;
+  obj->cmd_pulse=0;
+  obj->cmd_round=0;
+  obj->cmd_count=0;
+  obj->cmd_cycles=0;
+  obj->cmds=NULL;
+  obj->last_cmd=NULL;
+  obj->num_cmds=0;
+  obj->cmd_dropped=0;
+  obj->next_cmd_obj=NULL;
   return obj;
 }
 
@@ -399,17 +497,18 @@ void call_reset_on_all() {
   struct obj_blk *curr_block;
   struct object *obj;
   struct object *boot_obj;
-  signed long i;
+  signed long i, base;
   int count = 0;
   char logbuf[256];
   
   /* Get boot object for exemption check */
   boot_obj = find_proto("/boot");
   
-  /* Walk all object blocks */
+  /* Walk all object blocks; slots past db_top were never filled in */
   curr_block = obj_list;
+  base = 0;
   while (curr_block) {
-    for (i = 0; i < OBJ_ALLOC_BLKSIZ && ((curr_block->block[i].refno) < db_top); i++) {
+    for (i = 0; i < OBJ_ALLOC_BLKSIZ && base + i < db_top; i++) {
       obj = &(curr_block->block[i]);
       
       /* Skip if garbage */
@@ -433,6 +532,7 @@ void call_reset_on_all() {
         count++;
       }
     }
+    base += OBJ_ALLOC_BLKSIZ;
     curr_block = curr_block->next;
   }
   
@@ -452,7 +552,7 @@ void call_cleanup_on_all() {
   struct object *obj;
   struct object *boot_obj;
   struct ref_list *refs;
-  signed long i;
+  signed long i, base;
   int count = 0;
   int destructed = 0;
   int ref_count;
@@ -462,10 +562,11 @@ void call_cleanup_on_all() {
   /* Get boot object for exemption check */
   boot_obj = find_proto("/boot");
   
-  /* Walk all object blocks */
+  /* Walk all object blocks; slots past db_top were never filled in */
   curr_block = obj_list;
+  base = 0;
   while (curr_block) {
-    for (i = 0; i < OBJ_ALLOC_BLKSIZ && ((curr_block->block[i].refno) < db_top); i++) {
+    for (i = 0; i < OBJ_ALLOC_BLKSIZ && base + i < db_top; i++) {
       obj = &(curr_block->block[i]);
       
       /* Skip if garbage */
@@ -536,6 +637,7 @@ void call_cleanup_on_all() {
         }
       }
     }
+    base += OBJ_ALLOC_BLKSIZ;
     curr_block = curr_block->next;
   }
   
@@ -550,13 +652,14 @@ void call_cleanup_on_all() {
 void call_heart_beat_on_all() {
   struct obj_blk *curr_block;
   struct object *obj;
-  signed long i;
+  signed long i, base;
   int count = 0;
   
-  /* Walk all object blocks */
+  /* Walk all object blocks; slots past db_top were never filled in */
   curr_block = obj_list;
+  base = 0;
   while (curr_block) {
-    for (i = 0; i < OBJ_ALLOC_BLKSIZ && ((curr_block->block[i].refno) < db_top); i++) {
+    for (i = 0; i < OBJ_ALLOC_BLKSIZ && base + i < db_top; i++) {
       obj = &(curr_block->block[i]);
       
       /* Skip if garbage */
@@ -580,6 +683,7 @@ void call_heart_beat_on_all() {
         count++;
       }
     }
+    base += OBJ_ALLOC_BLKSIZ;
     curr_block = curr_block->next;
   }
 }
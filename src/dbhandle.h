@@ -3,6 +3,9 @@
 void db_queue_for_alarm(struct object *obj, long delay, char *funcname);
 void remove_verb(struct object *obj, char *verb_name);
 void queue_command(struct object *player, char *cmd);
+void unqueue_command(struct cmdq *cmd);
+void unqueue_commands(struct object *obj);
+struct cmdq *next_queued(struct cmdq *curr);
 void queue_for_destruct(struct object *obj);
 void queue_for_alarm(struct object *obj, long delay, char *funcname);
 long remove_alarm(struct object *obj, char *funcname);
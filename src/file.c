@@ -6,6 +6,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #ifdef USE_WINDOWS
 #include <direct.h>
@@ -21,6 +22,7 @@
 #include "interp.h"
 #include "constrct.h"
 #include "cache.h"
+#include "lazy.h"
 #ifdef USE_WINDOWS
 #include "intrface.h"
 #include "winmain.h"
@@ -214,6 +216,7 @@ struct file_entry *make_entry(struct file_entry *dir, char *name,
     else
       dir->contents=fe;
   }
+  lazy_forget_missing();
   return fe;
 }
 
@@ -989,6 +992,19 @@ FILE *open_file(char *filename, char *mode, struct object *uid) {
   return NULL;
 }
 
+/* open_file() for the compiler, which precompile() runs on several
+   threads at once: finding a file can add it to the shared file table,
+   so those lookups take turns.  Reading what was opened doesn't. */
+FILE *open_source(char *filename) {
+  static pthread_mutex_t lookup_lock = PTHREAD_MUTEX_INITIALIZER;
+  FILE *f;
+
+  pthread_mutex_lock(&lookup_lock);
+  f=open_file(filename,FREAD_MODE,NULL);
+  pthread_mutex_unlock(&lookup_lock);
+  return f;
+}
+
 int remove_file(char *filename, struct object *uid) {
   struct file_entry *fe;
   char *buf;
@@ -1334,6 +1350,9 @@ void logger(int level, char *msg) {
   time_t now_time;
   FILE *logfile;
   struct tm *time_s;
+#ifndef USE_WINDOWS
+  struct tm tm_buf;
+#endif /* !USE_WINDOWS */
   
   /* Handle LOG_STDOUT specially - always write to syswrite.txt with object-based formatting */
   if (level == LOG_STDOUT) {
@@ -1404,7 +1423,12 @@ void logger(int level, char *msg) {
   /* Use a local wall-clock for log timestamping; do NOT modify global now_time */
   {
     time_t wall_time = time(NULL);
+#ifdef USE_WINDOWS
     time_s = localtime(&wall_time);
+#else /* USE_WINDOWS */
+    /* the save writer and precompile() workers log too */
+    time_s = localtime_r(&wall_time, &tm_buf);
+#endif /* USE_WINDOWS */
   }
   sprintf(timebuf,"%02d-%02d %02d:%02d",(int) (time_s->tm_mon+1),
           (int) time_s->tm_mday,
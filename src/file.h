@@ -22,6 +22,7 @@ int stat_file(char *filename,struct object *uid);
 int owner_file(char *filename,struct object *uid);
 int ls_dir(char *filename, struct object *uid, struct object *player);
 FILE *open_file(char *filename, char *mode, struct object *uid);
+FILE *open_source(char *filename);
 #define close_file(_FILE) fclose(_FILE)
 int remove_file(char *filename, struct object *uid);
 int copy_file(char *src,char *dest,struct object *uid);
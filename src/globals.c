@@ -27,9 +27,11 @@ struct edit_s *edit_list;
 struct file_entry *root_dir;
 unsigned int num_locals;
 struct var *locals;
-char *c_err_msg;
-struct cmdq *cmd_head;
-struct cmdq *cmd_tail;
+THREAD_LOCAL char *c_err_msg;
+struct object *cmd_head;
+struct object *cmd_tail;
+struct object *cmd_held;
+struct object *cmd_held_tail;
 struct destq *dest_list;
 struct alarmq *alarm_list;
 long now_time;
@@ -43,6 +45,7 @@ char *panic_name;
 char *auto_object_path;
 char *save_path;
 char *save_type;
+char *bytecode_path;
 struct object *auto_proto;
 
 /* Periodic timing configuration */
@@ -52,6 +55,19 @@ long time_reset;        /* seconds between reset() calls */
 long time_heartbeat;    /* milliseconds for heartbeat interval */
 long last_reset_time;   /* timestamp of last reset() cycle */
 long last_cleanup_time; /* timestamp of last clean_up() cycle */
+int io_threads;        /* network I/O threads, 0 = sockets on game thread */
+int compile_threads;   /* precompile() workers, 0 = compile on game thread */
+int optimize;           /* optimize every program, not just #pragma optimize */
+int lazy_load;          /* load programs when first named, see lazy.c */
+int unload_idle;        /* seconds before an unused program is unloaded */
+int cmd_budget;         /* commands per object per pulse, 0 = no limit */
+long cycle_budget;      /* command cycles per object per pulse, 0 = no limit */
+int cmd_queue_max;      /* commands queued per object, 0 = no limit */
+int outbuf_high;        /* queued output that marks a connection congested */
+int outbuf_low;         /* ...and that it must drain to before it isn't */
+int outbuf_max;         /* queued output beyond which messages are dropped */
+int outbuf_stall;       /* seconds congested before disconnect, 0 = never */
+unsigned long current_pulse; /* pulses since startup */
 struct object *free_obj_list;
 signed long objects_allocd;
 signed long db_top;
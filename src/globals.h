@@ -31,9 +31,11 @@ extern struct edit_s *edit_list;
 extern struct file_entry *root_dir;
 extern unsigned int num_locals;
 extern struct var *locals;
-extern char *c_err_msg;
-extern struct cmdq *cmd_head;
-extern struct cmdq *cmd_tail;
+extern THREAD_LOCAL char *c_err_msg;
+extern struct object *cmd_head;
+extern struct object *cmd_tail;
+extern struct object *cmd_held;
+extern struct object *cmd_held_tail;
 extern struct destq *dest_list;
 extern struct alarmq *alarm_list;
 extern long now_time;
@@ -45,6 +47,7 @@ extern char *panic_name;
 extern char *auto_object_path;
 extern char *save_path;
 extern char *save_type;
+extern char *bytecode_path;
 extern struct object *auto_proto;
 
 /* Periodic timing configuration */
@@ -54,6 +57,19 @@ extern long time_reset;        /* seconds between reset() calls */
 extern long time_heartbeat;    /* milliseconds for heartbeat interval */
 extern long last_reset_time;   /* timestamp of last reset() cycle */
 extern long last_cleanup_time; /* timestamp of last clean_up() cycle */
+extern int io_threads;        /* network I/O threads, 0 = sockets on game thread */
+extern int compile_threads;   /* precompile() workers, 0 = compile on game thread */
+extern int optimize;           /* optimize every program, not just #pragma optimize */
+extern int lazy_load;          /* load programs when first named, see lazy.c */
+extern int unload_idle;        /* seconds before an unused program is unloaded */
+extern int cmd_budget;         /* commands per object per pulse, 0 = no limit */
+extern long cycle_budget;      /* command cycles per object per pulse, 0 = no limit */
+extern int cmd_queue_max;      /* commands queued per object, 0 = no limit */
+extern int outbuf_high;        /* queued output that marks a connection congested */
+extern int outbuf_low;         /* ...and that it must drain to before it isn't */
+extern int outbuf_max;         /* queued output beyond which messages are dropped */
+extern int outbuf_stall;       /* seconds congested before disconnect, 0 = never */
+extern unsigned long current_pulse; /* pulses since startup */
 extern struct object *free_obj_list;
 extern signed long objects_allocd;
 extern signed long db_top;
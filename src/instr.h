@@ -3,7 +3,7 @@
 /* contains the definitions for the object-code instructions */
 
 #define NUM_OPERS      38
-#define NUM_SCALLS     162  /* Updated for set_heart_beat efun */
+#define NUM_SCALLS     168  /* Updated for precompile and recompile efuns */
 
 #define COMMA_OPER     0    /*  ,   */
 #define EQ_OPER        1    /*  =   */
@@ -214,3 +214,7 @@
 
 /* Driver configuration query */
 #define S_QUERY_CONFIG     160 /* query_config() - get driver config as mapping */
+
+/* Subscript operators on values (compiler generated, no efun name) */
+#define S_INDEX            178 /* value[i] - char code, element or mapping value */
+#define S_RANGE            179 /* value[a..b] - substring or array slice */
@@ -40,7 +40,10 @@ int (*oper_array[NUM_OPERS+NUM_SCALLS])(struct object *caller, struct object
   s_member,s_mapping_literal,s_save_value,s_restore_value,s_replace_string,
   NULL,NULL,s_syswrite,s_compile_string,s_crypt,s_read_file,s_write_file,
   s_remove,s_rename,s_get_dir,s_file_size,s_users,s_objects,s_children,
-  s_all_inventory,s_send_prompt,s_query_terminal,s_get_mssp,s_set_mssp };
+  s_all_inventory,s_send_prompt,s_query_terminal,s_get_mssp,s_set_mssp,
+  s_save_object,s_restore_object,s_restore_map,s_query_idle_time,
+  s_query_config,s_set_heart_beat,s_get_devqueue,
+  s_save_keys,s_index,s_range,s_precompile,s_recompile };
 
 /* Helper function to compute var_base for a function call.
  * Given an object and a function, determine the variable base offset
@@ -476,6 +479,69 @@ void clear_locals() {
   FREE(locals);
 }
 
+/* FUSED INSTRUCTIONS
+ * fuse_code() marks the l-value that starts a common sequence; these find
+ * the variable it names, so interp() can run the sequence without the
+ * operand stack, and push it as a plain l-value when it can't.
+ */
+
+/* The local or global a fused instruction names, or NULL if it isn't
+   plainly one of this object's variables */
+static struct var *fused_slot(struct var *instr, struct object *obj) {
+  unsigned int index;
+  int ok;
+
+  if (instr->type!=GLOBAL_CMP_BRANCH && instr->type!=GLOBAL_RETURN) {
+    if (instr->value.l_value.ref>=num_locals) return NULL;
+    return &(locals[instr->value.l_value.ref]);
+  }
+  if (!obj->parent || !obj->parent->funcs || !obj->globals ||
+      instr->value.l_value.ref>=obj->parent->funcs->num_globals)
+    return NULL;
+  index=global_index_for(obj,call_stack ? call_stack->func : NULL,
+                         (unsigned int) instr->value.l_value.ref,&ok);
+  if (!ok) return NULL;
+  return &(obj->globals[index]);
+}
+
+static void push_fused(struct var *instr, struct var_stack **rts) {
+  struct var tmp;
+
+  tmp=*instr;
+  if (instr->type==GLOBAL_CMP_BRANCH || instr->type==GLOBAL_RETURN)
+    tmp.type=GLOBAL_L_VALUE;
+  else
+    tmp.type=LOCAL_L_VALUE;
+  push(&tmp,rts);
+}
+
+static int fused_compare(unsigned char op, signed long x, signed long y) {
+  switch (op) {
+    case CONDEQ_OPER:
+      return x==y;
+    case NOTEQ_OPER:
+      return x!=y;
+    case LESS_OPER:
+      return x<y;
+    case LESSEQ_OPER:
+      return x<=y;
+    case GREAT_OPER:
+      return x>y;
+    default:
+      return x>=y;
+  }
+}
+
+/* The cycles the instructions a fused one stood in for would have used */
+static void charge_cycles(long count) {
+#ifdef CYCLE_HARD_MAX
+  if (use_hard_cycles) hard_cycles+=count;
+#endif /* CYCLE_HARD_MAX */
+#ifdef CYCLE_SOFT_MAX
+  if (use_soft_cycles) soft_cycles+=count;
+#endif /* CYCLE_SOFT_MAX */
+}
+
 struct fns *find_fns(char *name, struct object *obj) {
   struct fns *next;
 
@@ -803,6 +869,7 @@ int interp(struct object *caller, struct object *obj, struct object *player,
   unsigned int old_num_locals;
   unsigned int num_args, i;  /* For PARENT_CALL */
   struct var *old_locals;
+  struct var *slot;          /* a fused instruction's variable */
   int retstatus;
   int old_use_soft_cycles,old_use_hard_cycles;
   struct object *tmpobj;
@@ -828,7 +895,11 @@ int interp(struct object *caller, struct object *obj, struct object *player,
   frame.line = 0;
   frame.var_offset = compute_var_base(obj, func);
   frame.prev = call_stack;
-  
+
+  /* the program is in use, so unload_idle leaves it loaded */
+  if (obj->parent && obj->parent->proto_obj)
+    obj->parent->proto_obj->last_access_time = now_time;
+
   {
     char logbuf[256];
     sprintf(logbuf, "Frame push: func=%s, var_offset=%d", 
@@ -841,6 +912,8 @@ int interp(struct object *caller, struct object *obj, struct object *player,
    */
   call_stack = &frame;
   call_stack_depth++;
+  /* mapping refs left by frames that have returned */
+  mapping_refs_release(call_stack_depth);
   
   /* STACK OVERFLOW PROTECTION
    * Check depth immediately after push to prevent infinite recursion.
@@ -1029,7 +1102,7 @@ int interp(struct object *caller, struct object *obj, struct object *player,
       case GLOBAL_REF:
         {
           unsigned int var_index, declared_size;
-          unsigned char is_global;
+          unsigned char is_global, is_write;
           struct var *var_slot;
           struct var key_var;  /* Changed: key can be any type */
           struct var tmp2;
@@ -1093,10 +1166,17 @@ int interp(struct object *caller, struct object *obj, struct object *player,
           var_index = tmp.value.integer;
           
           is_global = (func->code[loop].type == GLOBAL_REF);
+          /* set by the compiler when the element is an assignment target */
+          is_write = (func->code[loop].value.integer != 0);
           
-          /* Get variable slot */
+          /* Get variable slot; a global's index is in the defining
+           * program's numbering, like any other global reference */
           if (is_global) {
-            if (var_index >= obj->parent->funcs->num_globals) {
+            unsigned int eff_index;
+            int ok = 0;
+
+            eff_index = global_index_for(obj, func, var_index, &ok);
+            if (!ok) {
               interp_error_with_trace("global variable index out of bounds",player,obj,func,line);
               free_stack(&rts);
               clear_locals();
@@ -1106,7 +1186,7 @@ int interp(struct object *caller, struct object *obj, struct object *player,
               call_stack_depth--;
               return 1;
             }
-            var_slot = &obj->globals[var_index];
+            var_slot = &obj->globals[eff_index];
           } else {
             if (var_index >= num_locals) {
               interp_error_with_trace("local variable index out of bounds",player,obj,func,line);
@@ -1129,7 +1209,11 @@ int interp(struct object *caller, struct object *obj, struct object *player,
            */
           if (var_slot->type == INTEGER && var_slot->value.integer == 0) {
             /* Check symbol table to determine if this is a mapping */
-            struct var_tab *var_info = is_global ? obj->parent->funcs->gst : func->lst;
+            struct var_tab *var_info = func->lst;
+            
+            if (is_global)
+              var_info = (func->origin_proto && func->origin_proto->funcs) ?
+                         func->origin_proto->funcs->gst : obj->parent->funcs->gst;
             int is_mapping_var = 0;
             
             while (var_info) {
@@ -1207,6 +1291,20 @@ int interp(struct object *caller, struct object *obj, struct object *player,
             }
             array_index = key_var.value.integer;
             
+            /* Copy-on-write: writes (including growth on an out of range
+             * index) go to a private copy if the array is shared */
+            if ((is_write || array_index >= var_slot->value.array_ptr->size) &&
+                array_unshare(var_slot)) {
+              interp_error_with_trace("failed to copy array",player,obj,func,line);
+              clear_var(&key_var);
+              free_stack(&rts);
+              clear_locals();
+              use_soft_cycles=old_use_soft_cycles;
+              use_hard_cycles=old_use_hard_cycles;
+              call_stack = frame.prev;
+              call_stack_depth--;
+              return 1;
+            }
             arr = var_slot->value.array_ptr;
             
             /* Bounds check and resize if needed */
@@ -1251,15 +1349,29 @@ int interp(struct object *caller, struct object *obj, struct object *player,
           } else if (var_slot->type == MAPPING) {
             /* MAPPING HANDLING */
             struct heap_mapping *map;
-            struct var *value_ptr;
+            unsigned long value_ref;
             
+            /* Copy-on-write, as for arrays; a missing key is created even
+             * on a read, so that counts as a write too */
+            if (var_slot->value.mapping_ptr->refcount > 1 &&
+                (is_write || !mapping_exists(var_slot->value.mapping_ptr, &key_var)) &&
+                mapping_unshare(var_slot)) {
+              interp_error_with_trace("failed to copy mapping",player,obj,func,line);
+              clear_var(&key_var);
+              free_stack(&rts);
+              clear_locals();
+              use_soft_cycles=old_use_soft_cycles;
+              use_hard_cycles=old_use_hard_cycles;
+              call_stack = frame.prev;
+              call_stack_depth--;
+              return 1;
+            }
             map = var_slot->value.mapping_ptr;
             
-            /* Get or create entry in mapping */
-            value_ptr = mapping_get_or_create(map, &key_var);
-            if (!value_ptr) {
+            /* Get or create entry in mapping; the ref takes the key */
+            value_ref = mapping_ref(map, &key_var, call_stack_depth);
+            if (!value_ref) {
               interp_error_with_trace("mapping access failed",player,obj,func,line);
-              clear_var(&key_var);
               free_stack(&rts);
               clear_locals();
               use_soft_cycles=old_use_soft_cycles;
@@ -1274,10 +1386,9 @@ int interp(struct object *caller, struct object *obj, struct object *player,
             
             /* Push L_VALUE reference to mapping value */
             tmp2.type = (is_global) ? GLOBAL_L_VALUE : LOCAL_L_VALUE;
-            tmp2.value.l_value.ref = (unsigned long)value_ptr;
+            tmp2.value.l_value.ref = value_ref;
             tmp2.value.l_value.size = 1;
             
-            clear_var(&key_var);
             push(&tmp2,&rts);
             
           } else {
@@ -1319,7 +1430,10 @@ int interp(struct object *caller, struct object *obj, struct object *player,
             if (func->code[loop].value.instruction==S_SSCANF ||
                 func->code[loop].value.instruction==S_SPRINTF ||
                 func->code[loop].value.instruction==S_FREAD ||
-                func->code[loop].value.instruction==S_SIZEOF)
+                func->code[loop].value.instruction==S_SIZEOF ||
+                func->code[loop].value.instruction==S_MAP_DELETE ||
+                func->code[loop].value.instruction==S_INDEX ||
+                func->code[loop].value.instruction==S_RANGE)
               stack1=gen_stack_noresolve(&rts,obj);
             else
               stack1=gen_stack(&rts,obj);
@@ -1488,8 +1602,11 @@ int interp(struct object *caller, struct object *obj, struct object *player,
           sprintf(logbuf, "Runtime>> CALL_SUPER: inherit_idx=%d, func_idx=%d", i_idx, f_idx);
           logger(LOG_DEBUG, logbuf);
           
-          /* Get the inherit entry */
-          struct inherit_list *inh = obj->parent->funcs->inherits;
+          /* Get the inherit entry; the index is into the inherits of the
+           * program that defined this function, which for an inherited
+           * function isn't obj's own program */
+          struct inherit_list *inh = (func->origin_proto && func->origin_proto->funcs) ?
+            func->origin_proto->funcs->inherits : obj->parent->funcs->inherits;
           int idx = 0;
           while (inh && idx < i_idx) {
             inh = inh->next;
@@ -1622,8 +1739,11 @@ int interp(struct object *caller, struct object *obj, struct object *player,
           unsigned short i_idx = func->code[loop].value.parent_call.inherit_idx;
           unsigned short f_idx = func->code[loop].value.parent_call.func_idx;
           
-          /* Get the inherit entry */
-          struct inherit_list *inh = obj->parent->funcs->inherits;
+          /* Get the inherit entry; the index is into the inherits of the
+           * program that defined this function, which for an inherited
+           * function isn't obj's own program */
+          struct inherit_list *inh = (func->origin_proto && func->origin_proto->funcs) ?
+            func->origin_proto->funcs->inherits : obj->parent->funcs->inherits;
           int idx = 0;
           while (inh && idx < i_idx) {
             inh = inh->next;
@@ -1779,6 +1899,7 @@ int interp(struct object *caller, struct object *obj, struct object *player,
          * This provides accurate line numbers in error reports with minimal overhead.
          */
         free_stack(&rts);
+        mapping_refs_release(call_stack_depth);
         line=func->code[loop].value.num;
         frame.line = line;  /* Update current frame's line number for traceback */
         loop++;
@@ -1819,6 +1940,71 @@ int interp(struct object *caller, struct object *obj, struct object *player,
         call_stack_depth--;
         return 0;
         break;
+      case LOCAL_CMP_BRANCH:
+      case GLOBAL_CMP_BRANCH:
+        /* variable, integer, comparison, BRANCH */
+        slot=fused_slot(&(func->code[loop]),obj);
+        if (!slot || slot->type!=INTEGER) {
+          push_fused(&(func->code[loop]),&rts);
+          loop++;
+          break;
+        }
+        charge_cycles(3);
+        if (fused_compare(func->code[loop+2].value.instruction,
+                          slot->value.integer,
+                          func->code[loop+1].value.integer))
+          loop+=4;
+        else
+          loop=func->code[loop+3].value.num;
+        break;
+      case LOCAL_STEP:
+        /* local, ++ or --, NEW_LINE or a for loop's JUMP back to its
+         * test; or local, integer, += or -=, NEW_LINE.  The value the
+         * statement leaves would be cleared unread, so it isn't pushed. */
+        slot=fused_slot(&(func->code[loop]),obj);
+        if (!slot || slot->type!=INTEGER) {
+          push_fused(&(func->code[loop]),&rts);
+          loop++;
+          break;
+        }
+        if (func->code[loop+1].type==ASM_INSTR) {
+          if (func->code[loop+1].value.instruction<=PREADD_OPER)
+            ++(slot->value.integer);
+          else
+            --(slot->value.integer);
+          charge_cycles(1);
+          loop+=2;
+        } else {
+          if (func->code[loop+2].value.instruction==PLEQ_OPER)
+            slot->value.integer+=func->code[loop+1].value.integer;
+          else
+            slot->value.integer-=func->code[loop+1].value.integer;
+          charge_cycles(2);
+          loop+=3;
+        }
+        break;
+      case LOCAL_RETURN:
+      case GLOBAL_RETURN:
+        /* variable, RETURN */
+        slot=fused_slot(&(func->code[loop]),obj);
+        if (!slot || (slot->type!=INTEGER && slot->type!=STRING &&
+                      slot->type!=OBJECT && slot->type!=ARRAY &&
+                      slot->type!=MAPPING)) {
+          push_fused(&(func->code[loop]),&rts);
+          loop++;
+          break;
+        }
+        charge_cycles(1);
+        copy_var(&tmp,slot);
+        pushnocopy(&tmp,arg_stack);
+        free_stack(&rts);
+        clear_locals();
+        use_soft_cycles=old_use_soft_cycles;
+        use_hard_cycles=old_use_hard_cycles;
+        call_stack = frame.prev;  /* Pop frame on normal exit */
+        call_stack_depth--;
+        return 0;
+        break;
     }
   }
 }
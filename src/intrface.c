@@ -32,11 +32,19 @@
 #include "file.h"
 #include "cache.h"
 #include "edit.h"
+#include "netio.h"
+#include "resolve.h"
+#include "saveq.h"
+#include "unload.h"
 
 /* Connection list and globals */
 struct connlist_s *connlist;
 int num_conns, num_fds, net_protocol;
 int sockfd;
+static unsigned long next_conn_id;
+static int max_conns;           /* ceiling the table may grow to */
+static int free_conn = -1;      /* head of the free slot list */
+static int conns_in_use;
 
 /**
  * @brief Convert hex string to MAC address
@@ -168,50 +176,51 @@ int detach_session() {
 /**
  * @brief Resolve hostname to IP address
  *
- * Performs DNS lookup to convert a hostname to its IPv4 address string.
+ * Converts a hostname to its IPv4 address string without blocking. Dotted addresses are
+ * answered directly; anything else comes from the resolver cache, and a miss queues a
+ * lookup on the resolver thread and returns NULL until the answer arrives.
  * Only supports TCP protocol type.
  *
  * @param host Hostname to resolve
  * @param net_type Protocol type (CI_PROTOCOL_TCP), or 0 to use net_protocol global
- * @return IP address string on success, NULL on failure or unsupported protocol
+ * @return IP address string on success, NULL on failure, pending lookup or unsupported protocol
  */
 char *host_to_addr(char *host, int net_type) {
-    struct hostent *h;
+    struct in_addr tcp_addr;
+    char *answer;
     
     if (!net_type) net_type = net_protocol;
     if (net_type != CI_PROTOCOL_TCP) return NULL;
     
-    h = gethostbyname(host);
-    if (!h || h->h_addrtype != AF_INET || !h->h_addr_list[0])
-        return NULL;
+    if (inet_aton(host, &tcp_addr))
+        return inet_ntoa(tcp_addr);
     
-    return inet_ntoa(*((struct in_addr *)h->h_addr_list[0]));
+    resolve_lookup(RESOLVE_NAME, host, &answer);
+    return answer;
 }
 
 /**
  * @brief Resolve IP address to hostname
  *
- * Performs reverse DNS lookup to convert an IPv4 address string to its hostname.
+ * Converts an IPv4 address string to its hostname without blocking, answering from the
+ * resolver cache; a miss queues a reverse lookup and returns NULL until the answer arrives.
  * Only supports TCP protocol type.
  *
  * @param addr IP address string (e.g., "192.168.1.1")
  * @param net_type Protocol type (CI_PROTOCOL_TCP), or 0 to use net_protocol global
- * @return Hostname string on success, NULL on failure or unsupported protocol
+ * @return Hostname string on success, NULL on failure, pending lookup or unsupported protocol
  */
 char *addr_to_host(char *addr, int net_type) {
-    struct hostent *h;
     struct in_addr tcp_addr;
+    char *answer;
     
     if (!net_type) net_type = net_protocol;
     if (net_type != CI_PROTOCOL_TCP) return NULL;
     
-    tcp_addr.s_addr = inet_addr(addr);
-    if ((long)tcp_addr.s_addr == -1) return NULL;
-    
-    h = gethostbyaddr((char *)&tcp_addr, sizeof(tcp_addr), AF_INET);
-    if (!h || !*(h->h_name)) return NULL;
+    if (!inet_aton(addr, &tcp_addr)) return NULL;
     
-    return h->h_name;
+    resolve_lookup(RESOLVE_ADDR, inet_ntoa(tcp_addr), &answer);
+    return answer;
 }
 
 /**
@@ -238,26 +247,156 @@ struct object *next_who(struct object *obj) {
     return NULL;
 }
 
+/**
+ * @brief Grow the connection table
+ *
+ * Doubles the table (up to max_conns) and puts the new slots on the free list, lowest first.
+ * Slots hold no buffers until a connection uses them.
+ *
+ * @return 0 on success, -1 if the table is already at its limit
+ */
+static int grow_connlist() {
+    struct connlist_s *tmp;
+    int new_size;
+    
+    if (num_conns >= max_conns) return -1;
+    new_size = num_conns ? num_conns * 2 : CONN_TABLE_INIT;
+    if (new_size > max_conns) new_size = max_conns;
+    
+    tmp = realloc(connlist, sizeof(struct connlist_s) * new_size);
+    if (!tmp) return -1;
+    connlist = tmp;
+    
+    for (int i = new_size - 1; i >= num_conns; i--) {
+        memset(&connlist[i], 0, sizeof(struct connlist_s));
+        connlist[i].fd = -1;
+        connlist[i].next_free = free_conn;
+        free_conn = i;
+    }
+    num_conns = new_size;
+    return 0;
+}
+
+/**
+ * @brief Take a slot from the free list, growing the table if it is empty
+ *
+ * @return Connection index, or -1 if max_conns slots are in use
+ */
+static int alloc_conn() {
+    int devnum;
+    
+    if (free_conn == -1 && grow_connlist()) return -1;
+    devnum = free_conn;
+    free_conn = connlist[devnum].next_free;
+    conns_in_use++;
+    return devnum;
+}
+
+/**
+ * @brief Free a slot's buffers and return it to the free list
+ *
+ * The socket must already be closed or handed to an I/O thread.
+ *
+ * @param devnum Connection index
+ */
+static void release_conn(int devnum) {
+    connlist[devnum].fd = -1;
+    connlist[devnum].conn_state = CONN_OPEN;
+    connlist[devnum].outbuf_count = 0;
+    connlist[devnum].outbuf_size = 0;
+    connlist[devnum].inbuf_count = 0;
+    connlist[devnum].inbuf_size = 0;
+    if (connlist[devnum].outbuf) FREE(connlist[devnum].outbuf);
+    if (connlist[devnum].inbuf) FREE(connlist[devnum].inbuf);
+    if (connlist[devnum].sb_buf) FREE(connlist[devnum].sb_buf);
+    connlist[devnum].outbuf = NULL;
+    connlist[devnum].inbuf = NULL;
+    connlist[devnum].sb_buf = NULL;
+    connlist[devnum].next_free = free_conn;
+    free_conn = devnum;
+    conns_in_use--;
+}
+
+/**
+ * @brief Make room in a connection's output buffer
+ *
+ * The buffer doubles as it fills, so appending is amortized O(1) instead of a copy of
+ * everything already queued.
+ *
+ * @param devnum Connection index
+ * @param len Bytes about to be appended
+ * @return Where the new bytes go
+ */
+static char *outbuf_reserve(int devnum, int len) {
+    struct connlist_s *conn = &connlist[devnum];
+    
+    if (conn->outbuf_count + len + 1 > conn->outbuf_size) {
+        if (!conn->outbuf_size) conn->outbuf_size = 256;
+        while (conn->outbuf_count + len + 1 > conn->outbuf_size)
+            conn->outbuf_size *= 2;
+        conn->outbuf = realloc(conn->outbuf, conn->outbuf_size);
+    }
+    return conn->outbuf + conn->outbuf_count;
+}
+
+/**
+ * @brief Bytes of output queued for a connection
+ *
+ * Counts what the game thread holds plus, in threaded mode, what the connection's I/O
+ * thread last reported it could not yet write.
+ */
+static int outbuf_pending(int devnum) {
+    return connlist[devnum].outbuf_count + connlist[devnum].io_pending;
+}
+
+/**
+ * @brief Update a connection's congestion state against the watermarks
+ *
+ * The object hears about changes through output_pressure(), called from the main loop.
+ *
+ * @param devnum Connection index
+ */
+static void check_pressure(int devnum) {
+    int pending = outbuf_pending(devnum);
+    
+    if (!connlist[devnum].congested && pending >= outbuf_high) {
+        connlist[devnum].congested = 1;
+        connlist[devnum].congested_since = now_time;
+    } else if (connlist[devnum].congested && pending <= outbuf_low) {
+        connlist[devnum].congested = 0;
+    }
+}
+
 /**
  * @brief Write buffered output to socket
  *
- * Attempts to write buffered data to the socket, handling partial writes and EAGAIN conditions.
- * Writes up to WRITE_BURST bytes per call to avoid blocking.
+ * Writes as much buffered data as the socket will take, keeping the rest for the next
+ * POLLOUT. In threaded mode the whole buffer is handed to the connection's I/O thread.
  *
  * @param devnum Connection index in connlist array
  */
 static void unbuf_output(int devnum) {
     int num_written;
-    char *tmp;
-    int write_size;
     
     if (connlist[devnum].outbuf_count == 0) return;
     
-    write_size = (connlist[devnum].outbuf_count > WRITE_BURST) ?
-                 WRITE_BURST : connlist[devnum].outbuf_count;
+    /* Output for an outbound connection waits until it is established */
+    if (connlist[devnum].conn_state != CONN_OPEN) return;
+    
+    if (io_threads) {
+        /* The I/O thread takes the whole buffer; it does the writing */
+        netio_output(devnum, connlist[devnum].conn_id,
+                     connlist[devnum].outbuf, connlist[devnum].outbuf_count);
+        connlist[devnum].outbuf = NULL;
+        connlist[devnum].outbuf_count = 0;
+        connlist[devnum].outbuf_size = 0;
+        check_pressure(devnum);
+        return;
+    }
     
     logger(LOG_DEBUG, "intrface: writing buffered output");
-    num_written = write(connlist[devnum].fd, connlist[devnum].outbuf, write_size);
+    num_written = write(connlist[devnum].fd, connlist[devnum].outbuf,
+                        connlist[devnum].outbuf_count);
     
     if (num_written <= 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -272,20 +411,20 @@ static void unbuf_output(int devnum) {
     if (num_written < connlist[devnum].outbuf_count) {
         /* Partial write */
         logger(LOG_DEBUG, "intrface: partial write, buffering remaining data");
-        tmp = MALLOC(connlist[devnum].outbuf_count - num_written + 1);
-        memcpy(tmp, connlist[devnum].outbuf + num_written,
-               connlist[devnum].outbuf_count - num_written);
-        tmp[connlist[devnum].outbuf_count - num_written] = '\0';
         connlist[devnum].outbuf_count -= num_written;
-        FREE(connlist[devnum].outbuf);
-        connlist[devnum].outbuf = tmp;
+        memmove(connlist[devnum].outbuf, connlist[devnum].outbuf + num_written,
+                connlist[devnum].outbuf_count);
     } else {
-        /* Complete write */
+        /* Complete write; keep a small buffer around for the next message */
         logger(LOG_DEBUG, "intrface: output buffer flushed");
         connlist[devnum].outbuf_count = 0;
-        FREE(connlist[devnum].outbuf);
-        connlist[devnum].outbuf = NULL;
+        if (connlist[devnum].outbuf_size > 4096) {
+            FREE(connlist[devnum].outbuf);
+            connlist[devnum].outbuf = NULL;
+            connlist[devnum].outbuf_size = 0;
+        }
     }
+    check_pressure(devnum);
 }
 
 /**
@@ -325,8 +464,15 @@ void immediate_disconnect(int devnum) {
     
     connlist[devnum].obj->flags &= ~CONNECTED;
     
-    /* Try to flush remaining output */
-    if (connlist[devnum].outbuf_count > 0) {
+    if (connlist[devnum].conn_state != CONN_OPEN) {
+        /* Outbound connect never completed; nothing to flush */
+        close(connlist[devnum].fd);
+    } else if (io_threads) {
+        /* Pending output goes first; the I/O thread flushes and closes */
+        unbuf_output(devnum);
+        netio_close(devnum, connlist[devnum].conn_id);
+    } else if (connlist[devnum].outbuf_count > 0) {
+        /* Try to flush remaining output */
         sprintf(logbuf, "intrface: flushing %d bytes before disconnect",
                 connlist[devnum].outbuf_count);
         logger(LOG_DEBUG, logbuf);
@@ -334,17 +480,45 @@ void immediate_disconnect(int devnum) {
               connlist[devnum].outbuf_count);
     }
     
-    shutdown(connlist[devnum].fd, SHUT_RDWR);
-    close(connlist[devnum].fd);
+    if (!io_threads && connlist[devnum].conn_state == CONN_OPEN) {
+        shutdown(connlist[devnum].fd, SHUT_RDWR);
+        close(connlist[devnum].fd);
+    }
     
-    connlist[devnum].fd = -1;
     connlist[devnum].obj->devnum = -1;
-    connlist[devnum].outbuf_count = 0;
-    
-    if (connlist[devnum].outbuf) {
-        FREE(connlist[devnum].outbuf);
-        connlist[devnum].outbuf = NULL;
-    }
+    release_conn(devnum);
+}
+
+/**
+ * @brief Append raw bytes to a connection's output buffer
+ *
+ * No CRLF conversion and no outbuf_max check; used for telnet control
+ * sequences, which must not be mangled or dropped.
+ *
+ * @param devnum Connection index
+ * @param data Bytes to append
+ * @param len Number of bytes
+ */
+static void outbuf_append(int devnum, const void *data, int len) {
+    memcpy(outbuf_reserve(devnum, len), data, len);
+    connlist[devnum].outbuf_count += len;
+}
+
+/**
+ * @brief Write protocol bytes to a connection right away
+ *
+ * With I/O threads the socket isn't ours to write, so the bytes are queued
+ * behind any pending output and handed over at the end of the pass.
+ *
+ * @param devnum Connection index
+ * @param data Bytes to send
+ * @param len Number of bytes
+ */
+static void conn_write(int devnum, const void *data, int len) {
+    if (io_threads)
+        outbuf_append(devnum, data, len);
+    else
+        write(connlist[devnum].fd, data, len);
 }
 
 /**
@@ -361,7 +535,7 @@ static void send_iac(int conn_num, unsigned char command, unsigned char option)
     buf[0] = TELNET_IAC;
     buf[1] = command;
     buf[2] = option;
-    write(connlist[conn_num].fd, buf, 3);
+    conn_write(conn_num, buf, 3);
 }
 
 /**
@@ -376,7 +550,7 @@ static void send_iac_ga(int conn_num) {
     if (!connlist[conn_num].opt_sga) {
         buf[0] = TELNET_IAC;
         buf[1] = TELNET_GA;
-        write(connlist[conn_num].fd, buf, 2);
+        conn_write(conn_num, buf, 2);
     }
 }
 
@@ -396,12 +570,7 @@ static void send_mssp(int conn_num) {
     char uptime_str[32];
     extern struct heap_mapping *mssp_data;
     
-    /* Count active players */
-    for (int i = 0; i < num_conns; i++) {
-        if (connlist[i].fd != -1 && connlist[i].obj) {
-            active_players++;
-        }
-    }
+    active_players = conns_in_use;
     
     /* Calculate uptime */
     uptime = now_time - boot_time;
@@ -472,7 +641,7 @@ static void send_mssp(int conn_num) {
     buf[len++] = TELNET_IAC;
     buf[len++] = TELNET_SE;
     
-    write(connlist[conn_num].fd, buf, len);
+    conn_write(conn_num, buf, len);
     connlist[conn_num].opt_mssp = 1;
     
     logger(LOG_DEBUG, "intrface: sent MSSP data");
@@ -568,7 +737,7 @@ static void handle_telnet_negotiation(int conn_num, unsigned char command, unsig
                             ttype_req[3] = 1;  /* SEND command */
                             ttype_req[4] = TELNET_IAC;
                             ttype_req[5] = TELNET_SE;
-                            write(connlist[conn_num].fd, ttype_req, 6);
+                            conn_write(conn_num, ttype_req, 6);
                             logger(LOG_DEBUG, "intrface: sent TTYPE SEND request (cycle 1)");
                         }
                     }
@@ -665,7 +834,7 @@ static void handle_telnet_subnegotiation(int conn_num) {
                     unsigned char ttype_req[6] = {
                         TELNET_IAC, TELNET_SB, TELOPT_TTYPE, 1, TELNET_IAC, TELNET_SE
                     };
-                    write(connlist[conn_num].fd, ttype_req, 6);
+                    conn_write(conn_num, ttype_req, 6);
                     logger(LOG_DEBUG, "intrface: sent TTYPE SEND request (cycle 2)");
                     
                 } else if (connlist[conn_num].ttype_cycle == 2) {
@@ -695,7 +864,7 @@ static void handle_telnet_subnegotiation(int conn_num) {
                     unsigned char ttype_req[6] = {
                         TELNET_IAC, TELNET_SB, TELOPT_TTYPE, 1, TELNET_IAC, TELNET_SE
                     };
-                    write(connlist[conn_num].fd, ttype_req, 6);
+                    conn_write(conn_num, ttype_req, 6);
                     logger(LOG_DEBUG, "intrface: sent TTYPE SEND request (cycle 3)");
                     
                 } else if (connlist[conn_num].ttype_cycle == 3) {
@@ -722,18 +891,65 @@ static void handle_telnet_subnegotiation(int conn_num) {
 }
 
 /**
- * @brief Accept new incoming connection
+ * @brief Initialize a connection slot
  *
- * Accepts a connection on the listening socket, assigns it to the boot object, and calls the
+ * Resets buffers, telnet state and MTTS fields, assigns a fresh conn_id and attaches the slot
+ * to obj. Address and protocol are left for the caller.
+ *
+ * @param devnum Free connection index
+ * @param fd Socket for the connection
+ * @param obj Object that will own the connection
+ */
+static void init_conn(int devnum, int fd, struct object *obj) {
+    connlist[devnum].fd = fd;
+    connlist[devnum].conn_state = CONN_OPEN;
+    connlist[devnum].inbuf_count = 0;
+    connlist[devnum].obj = obj;
+    connlist[devnum].outbuf_count = 0;
+    connlist[devnum].outbuf_size = 0;
+    connlist[devnum].outbuf = NULL;
+    connlist[devnum].io_pending = 0;
+    connlist[devnum].congested = 0;
+    connlist[devnum].pressure_told = 0;
+    connlist[devnum].conn_time = now_time;
+    connlist[devnum].last_input_time = now_time;
+    
+    /* Initialize telnet protocol state */
+    connlist[devnum].telnet_state = TELNET_STATE_DATA;
+    connlist[devnum].telnet_opt = 0;
+    connlist[devnum].sb_opt = 0;
+    connlist[devnum].sb_len = 0;
+    connlist[devnum].opt_echo = 0;
+    connlist[devnum].opt_sga = 0;
+    connlist[devnum].opt_mssp = 0;
+    connlist[devnum].opt_naws = 0;
+    connlist[devnum].opt_ttype = 0;
+    connlist[devnum].win_width = 80;
+    connlist[devnum].win_height = 24;
+    
+    /* Initialize MTTS fields */
+    connlist[devnum].ttype_cycle = 0;
+    connlist[devnum].term_client[0] = '\0';
+    connlist[devnum].term_type[0] = '\0';
+    connlist[devnum].term_support = 0;
+    
+    connlist[devnum].conn_id = ++next_conn_id;
+    
+    obj->devnum = devnum;
+    obj->flags |= CONNECTED;
+}
+
+/**
+ * @brief Set up a freshly accepted connection
+ *
+ * Assigns the socket to the boot object, sends the initial telnet negotiations and calls the
  * boot object's connect() function. Logs connection details including IP address and object.
  *
- * @param listen_fd Listening socket file descriptor
+ * @param new_fd Accepted socket
+ * @param tcp_addr Peer address
  */
-static void make_new_conn(int listen_fd) {
+static void setup_conn(int new_fd, struct sockaddr_in *tcp_addr) {
     int devnum;
-    int new_fd;
-    struct sockaddr_in tcp_addr;
-    socklen_t addr_len;
     struct object *boot_obj, *tmpobj;
     struct var_stack *rts;
     struct var tmp;
@@ -742,28 +958,12 @@ static void make_new_conn(int listen_fd) {
     char *ip_addr;
     
     boot_obj = ref_to_obj(0);
-    devnum = -1;
-    
-    logger(LOG_DEBUG, "intrface: accepting new connection");
-    
-    /* Accept the connection */
-    addr_len = sizeof(tcp_addr);
-    new_fd = accept(listen_fd, (struct sockaddr *)&tcp_addr, &addr_len);
-    
-    if (new_fd < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            logger(LOG_DEBUG, "intrface: spurious wakeup (EAGAIN)");
-            return;
-        }
-        logger(LOG_ERROR, "intrface: accept() failed");
-        return;
-    }
     
     /* Get IP address for logging */
-    ip_addr = inet_ntoa(tcp_addr.sin_addr);
+    ip_addr = inet_ntoa(tcp_addr->sin_addr);
     
     sprintf(logbuf, "intrface: connection from %s:%d",
-            ip_addr, ntohs(tcp_addr.sin_port));
+            ip_addr, ntohs(tcp_addr->sin_port));
     logger(LOG_DEBUG, logbuf);
     
     /* Set non-blocking */
@@ -774,15 +974,7 @@ static void make_new_conn(int listen_fd) {
         return;
     }
     
-    /* Find free slot */
-    for (int i = 0; i < num_conns; i++) {
-        if (connlist[i].fd == -1) {
-            devnum = i;
-            break;
-        }
-    }
-    
-    if (devnum == -1 || boot_obj->devnum != -1) {
+    if (boot_obj->devnum != -1 || (devnum = alloc_conn()) == -1) {
         sprintf(logbuf, "intrface: rejected %s (no slots or boot busy)", ip_addr);
         logger(LOG_WARNING, logbuf);
         close(new_fd);
@@ -790,37 +982,12 @@ static void make_new_conn(int listen_fd) {
     }
     
     /* Initialize connection */
-    connlist[devnum].fd = new_fd;
-    connlist[devnum].inbuf_count = 0;
-    connlist[devnum].address.tcp_addr = tcp_addr;
+    init_conn(devnum, new_fd, boot_obj);
+    connlist[devnum].address.tcp_addr = *tcp_addr;
     connlist[devnum].net_type = CI_PROTOCOL_TCP;
-    connlist[devnum].obj = boot_obj;
-    connlist[devnum].outbuf_count = 0;
-    connlist[devnum].outbuf = NULL;
-    connlist[devnum].conn_time = now_time;
-    connlist[devnum].last_input_time = now_time;
     
-    /* Initialize telnet protocol state */
-    connlist[devnum].telnet_state = TELNET_STATE_DATA;
-    connlist[devnum].telnet_opt = 0;
-    connlist[devnum].sb_opt = 0;
-    connlist[devnum].sb_len = 0;
-    connlist[devnum].opt_echo = 0;
-    connlist[devnum].opt_sga = 0;
-    connlist[devnum].opt_mssp = 0;
-    connlist[devnum].opt_naws = 0;
-    connlist[devnum].opt_ttype = 0;
-    connlist[devnum].win_width = 80;
-    connlist[devnum].win_height = 24;
-    
-    /* Initialize MTTS fields */
-    connlist[devnum].ttype_cycle = 0;
-    connlist[devnum].term_client[0] = '\0';
-    connlist[devnum].term_type[0] = '\0';
-    connlist[devnum].term_support = 0;
-    
-    boot_obj->devnum = devnum;
-    boot_obj->flags |= CONNECTED;
+    if (io_threads)
+        netio_adopt(devnum, connlist[devnum].conn_id, new_fd);
     
     /* Send initial telnet negotiations */
     logger(LOG_DEBUG, "intrface: sending initial telnet negotiations");
@@ -851,6 +1018,279 @@ static void make_new_conn(int listen_fd) {
     handle_destruct();
 }
 
+/**
+ * @brief Accept new incoming connection
+ *
+ * Accepts a connection on the listening socket and hands it to setup_conn().
+ *
+ * @param listen_fd Listening socket file descriptor
+ */
+static void make_new_conn(int listen_fd) {
+    int new_fd;
+    struct sockaddr_in tcp_addr;
+    socklen_t addr_len;
+    
+    logger(LOG_DEBUG, "intrface: accepting new connection");
+    
+    /* Accept the connection */
+    addr_len = sizeof(tcp_addr);
+    new_fd = accept(listen_fd, (struct sockaddr *)&tcp_addr, &addr_len);
+    
+    if (new_fd < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            logger(LOG_DEBUG, "intrface: spurious wakeup (EAGAIN)");
+            return;
+        }
+        logger(LOG_ERROR, "intrface: accept() failed");
+        return;
+    }
+    
+    setup_conn(new_fd, &tcp_addr);
+}
+
+/**
+ * @brief Drop a connection the remote end has gone away from
+ *
+ * Disconnects the device and calls the disconnect() function on the object it belonged to.
+ *
+ * @param conn_num Connection index in connlist array
+ */
+static void lost_conn(int conn_num) {
+    struct var_stack *rts;
+    struct var tmp;
+    struct fns *func;
+    struct object *obj, *tmpobj;
+    
+    obj = connlist[conn_num].obj;
+    immediate_disconnect(conn_num);
+    
+    func = find_function("disconnect", obj, &tmpobj);
+    if (func) {
+        logger(LOG_DEBUG, "intrface: calling disconnect() function");
+        rts = NULL;
+        tmp.type = NUM_ARGS;
+        tmp.value.num = 0;
+        push(&tmp, &rts);
+        interp(NULL, tmpobj, NULL, &rts, func);
+        free_stack(&rts);
+    }
+    handle_destruct();
+}
+
+/**
+ * @brief Call a device notification function in an object
+ *
+ * Used for connect_success(), connect_failure() and output_pressure(). Does nothing if the
+ * object doesn't define the function.
+ *
+ * @param obj Object to call
+ * @param name Function name
+ * @param arg Single argument (copied), or NULL for none
+ */
+static void device_apply(struct object *obj, char *name, struct var *arg) {
+    struct var_stack *rts;
+    struct var tmp;
+    struct fns *func;
+    struct object *tmpobj;
+    
+    func = find_function(name, obj, &tmpobj);
+    if (!func) return;
+    rts = NULL;
+    if (arg) push(arg, &rts);
+    tmp.type = NUM_ARGS;
+    tmp.value.num = arg ? 1 : 0;
+    push(&tmp, &rts);
+    interp(NULL, tmpobj, NULL, &rts, func);
+    free_stack(&rts);
+}
+
+/**
+ * @brief Abandon an outbound connection that could not be established
+ *
+ * Frees the slot and calls connect_failure(reason) on the object that asked for it.
+ *
+ * @param devnum Connection index of the pending connection
+ * @param reason Human-readable failure reason
+ */
+static void connect_failed(int devnum, char *reason) {
+    struct object *obj;
+    struct var tmp;
+    char logbuf[256];
+    
+    obj = connlist[devnum].obj;
+    sprintf(logbuf, "intrface: obj #%ld outbound to %s:%d failed (%s)",
+            (long)obj->refno,
+            inet_ntoa(connlist[devnum].address.tcp_addr.sin_addr),
+            ntohs(connlist[devnum].address.tcp_addr.sin_port), reason);
+    logger(LOG_WARNING, logbuf);
+    
+    close(connlist[devnum].fd);
+    release_conn(devnum);
+    obj->devnum = -1;
+    obj->flags &= ~CONNECTED;
+    
+    tmp.type = STRING;
+    tmp.value.string = reason;
+    device_apply(obj, "connect_failure", &tmp);
+    handle_destruct();
+}
+
+/**
+ * @brief Start a non-blocking connect() on a slot whose address is known
+ *
+ * @param devnum Connection index with address.tcp_addr filled in
+ * @return 0 if the connect is under way, -1 on immediate failure (errno set)
+ */
+static int start_connect(int devnum) {
+    if (connect(connlist[devnum].fd, (struct sockaddr *)&connlist[devnum].address.tcp_addr,
+                sizeof(struct sockaddr_in)) < 0 && errno != EINPROGRESS)
+        return -1;
+    
+    /* Even an immediate success is finished from the poll loop */
+    connlist[devnum].conn_state = CONN_CONNECTING;
+    return 0;
+}
+
+/**
+ * @brief Complete a pending connect once the socket reports writable or failed
+ *
+ * On success the connection becomes a normal one (handed to the I/O threads if enabled) and
+ * connect_success() is called on its object.
+ *
+ * @param devnum Connection index in CONN_CONNECTING state
+ */
+static void finish_connect(int devnum) {
+    struct object *obj;
+    char logbuf[256];
+    int err;
+    socklen_t len;
+    
+    err = 0;
+    len = sizeof(err);
+    if (getsockopt(connlist[devnum].fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+    if (err) {
+        connect_failed(devnum, strerror(err));
+        return;
+    }
+    
+    obj = connlist[devnum].obj;
+    connlist[devnum].conn_state = CONN_OPEN;
+    connlist[devnum].conn_time = now_time;
+    connlist[devnum].last_input_time = now_time;
+    
+    if (io_threads)
+        netio_adopt(devnum, connlist[devnum].conn_id, connlist[devnum].fd);
+    
+    sprintf(logbuf, "intrface: obj #%ld (%s) connected to %s:%d",
+            (long)obj->refno,
+            obj->parent ? obj->parent->pathname : "no-parent",
+            inet_ntoa(connlist[devnum].address.tcp_addr.sin_addr),
+            ntohs(connlist[devnum].address.tcp_addr.sin_port));
+    logger(LOG, logbuf);
+    
+    device_apply(obj, "connect_success", NULL);
+    handle_destruct();
+}
+
+/**
+ * @brief Handle a hostname answer for a pending connect_device()
+ *
+ * @param answer Dotted address, or NULL if the host could not be resolved
+ * @param devnum Connection index the lookup was made for
+ * @param conn_id Identity of that connection; stale answers are ignored
+ */
+static void resolve_event(char *answer, int devnum, unsigned long conn_id) {
+    if (devnum >= num_conns || connlist[devnum].fd == -1 ||
+        connlist[devnum].conn_id != conn_id ||
+        connlist[devnum].conn_state != CONN_RESOLVING)
+        return;
+    
+    if (!answer || !inet_aton(answer, &connlist[devnum].address.tcp_addr.sin_addr)) {
+        connect_failed(devnum, "host not found");
+        return;
+    }
+    if (start_connect(devnum))
+        connect_failed(devnum, strerror(errno));
+}
+
+/**
+ * @brief Report a finished background save
+ *
+ * Calls save_done(key, success) on the object that made the save, if it
+ * still exists.
+ *
+ * @param key Storage key given to save_object()
+ * @param refno Object that made the save
+ * @param error errno from the write, 0 if it succeeded
+ */
+static void save_event(char *key, signed long refno, int error) {
+    struct var_stack *rts;
+    struct var tmp;
+    struct fns *func;
+    struct object *obj, *tmpobj;
+    
+    obj = ref_to_obj(refno);
+    if (!obj) return;
+    func = find_function("save_done", obj, &tmpobj);
+    if (!func) return;
+    rts = NULL;
+    tmp.type = STRING;
+    tmp.value.string = key;
+    push(&tmp, &rts);
+    tmp.type = INTEGER;
+    tmp.value.integer = error ? 0 : 1;
+    push(&tmp, &rts);
+    tmp.type = NUM_ARGS;
+    tmp.value.num = 2;
+    push(&tmp, &rts);
+    interp(NULL, tmpobj, NULL, &rts, func);
+    free_stack(&rts);
+    handle_destruct();
+}
+
+/**
+ * @brief Append a character to a connection's input line
+ *
+ * The buffer is allocated on first use and doubled as the line grows; input past
+ * MAX_STR_LEN - 2 characters is dropped.
+ *
+ * @param conn_num Connection index
+ * @param ch Character to append
+ * @return 1 if the character was stored, 0 if the line is full
+ */
+static int inbuf_add(int conn_num, char ch) {
+    struct connlist_s *conn = &connlist[conn_num];
+    
+    if (conn->inbuf_count >= MAX_STR_LEN - 2) return 0;
+    if (conn->inbuf_count + 1 >= conn->inbuf_size) {
+        conn->inbuf_size = conn->inbuf_size ? conn->inbuf_size * 2 : INBUF_INIT;
+        if (conn->inbuf_size > MAX_STR_LEN) conn->inbuf_size = MAX_STR_LEN;
+        conn->inbuf = realloc(conn->inbuf, conn->inbuf_size);
+    }
+    conn->inbuf[conn->inbuf_count++] = ch;
+    return 1;
+}
+
+/**
+ * @brief Terminate and take the connection's input line, leaving the buffer empty
+ *
+ * @param conn_num Connection index
+ * @return The line; valid until the next input on this connection
+ */
+static char *inbuf_line(int conn_num) {
+    struct connlist_s *conn = &connlist[conn_num];
+    
+    if (!conn->inbuf) {
+        conn->inbuf_size = INBUF_INIT;
+        conn->inbuf = MALLOC(INBUF_INIT);
+    }
+    /* inbuf_add() always leaves room for the terminator */
+    conn->inbuf[conn->inbuf_count] = '\0';
+    conn->inbuf_count = 0;
+    return conn->inbuf;
+}
+
 /**
  * @brief Read and buffer input from connection
  *
@@ -861,13 +1301,10 @@ static void make_new_conn(int listen_fd) {
  */
 static void buffer_input(int conn_num) {
     static char buf[MAX_STR_LEN];
-    struct var_stack *rts;
-    struct var tmp;
-    struct fns *func;
     int retlen;
-    struct object *obj, *tmpobj;
     char logbuf[256];
     char *ip_addr;
+    char *line;
     
     retlen = read(connlist[conn_num].fd, buf, MAX_STR_LEN - 2);
     
@@ -886,20 +1323,7 @@ static void buffer_input(int conn_num) {
                 logger(LOG_WARNING, logbuf);
             }
             
-            obj = connlist[conn_num].obj;
-            immediate_disconnect(conn_num);
-            
-            func = find_function("disconnect", obj, &tmpobj);
-            if (func) {
-                logger(LOG_DEBUG, "intrface: calling disconnect() function");
-                rts = NULL;
-                tmp.type = NUM_ARGS;
-                tmp.value.num = 0;
-                push(&tmp, &rts);
-                interp(NULL, tmpobj, NULL, &rts, func);
-                free_stack(&rts);
-            }
-            handle_destruct();
+            lost_conn(conn_num);
         } else {
             logger(LOG_DEBUG, "intrface: read would block");
         }
@@ -930,20 +1354,16 @@ static void buffer_input(int conn_num) {
                             write(connlist[conn_num].fd, crlf, 2);
                         }
                         
-                        connlist[conn_num].inbuf[connlist[conn_num].inbuf_count] = '\0';
+                        line = inbuf_line(conn_num);
                         if (connlist[conn_num].obj->flags & IN_EDITOR)
-                            do_edit_command(connlist[conn_num].obj, connlist[conn_num].inbuf);
+                            do_edit_command(connlist[conn_num].obj, line);
                         else
-                            queue_command(connlist[conn_num].obj, connlist[conn_num].inbuf);
-                        connlist[conn_num].inbuf_count = 0;
+                            queue_command(connlist[conn_num].obj, line);
                     }
                     /* Note: \n following \r will trigger again but with empty buffer */
                 } else if (isprint(ch) || ch == '\t' || ch == '\b') {
                     /* Accept printable characters, tab, and backspace */
-                    if (connlist[conn_num].inbuf_count < MAX_STR_LEN - 2) {
-                        connlist[conn_num].inbuf[connlist[conn_num].inbuf_count] = ch;
-                        connlist[conn_num].inbuf_count++;
-                        
+                    if (inbuf_add(conn_num, ch)) {
                         /* Echo character if server is handling echo */
                         if (connlist[conn_num].opt_echo) {
                             write(connlist[conn_num].fd, &ch, 1);
@@ -956,10 +1376,7 @@ static void buffer_input(int conn_num) {
                 /* Received IAC, determine command */
                 if (ch == TELNET_IAC) {
                     /* Escaped IAC (255 255 = literal 255) */
-                    if (connlist[conn_num].inbuf_count < MAX_STR_LEN - 2) {
-                        connlist[conn_num].inbuf[connlist[conn_num].inbuf_count] = ch;
-                        connlist[conn_num].inbuf_count++;
-                    }
+                    inbuf_add(conn_num, ch);
                     connlist[conn_num].telnet_state = TELNET_STATE_DATA;
                 } else if (ch == TELNET_WILL) {
                     connlist[conn_num].telnet_state = TELNET_STATE_WILL;
@@ -1007,6 +1424,8 @@ static void buffer_input(int conn_num) {
                 
             case TELNET_STATE_SB:
                 /* Start of subnegotiation - first byte is option */
+                if (!connlist[conn_num].sb_buf)
+                    connlist[conn_num].sb_buf = MALLOC(TELNET_SB_MAX);
                 connlist[conn_num].sb_opt = ch;
                 connlist[conn_num].sb_len = 0;
                 connlist[conn_num].telnet_state = TELNET_STATE_SB_IAC;
@@ -1027,7 +1446,7 @@ static void buffer_input(int conn_num) {
                             i++; /* Skip SE */
                         } else if (next_ch == TELNET_IAC) {
                             /* Escaped IAC in subnegotiation */
-                            if (connlist[conn_num].sb_len < 256) {
+                            if (connlist[conn_num].sb_len < TELNET_SB_MAX) {
                                 connlist[conn_num].sb_buf[connlist[conn_num].sb_len++] = TELNET_IAC;
                             }
                             i++; /* Skip second IAC */
@@ -1035,7 +1454,7 @@ static void buffer_input(int conn_num) {
                     }
                 } else {
                     /* Regular data in subnegotiation */
-                    if (connlist[conn_num].sb_len < 256) {
+                    if (connlist[conn_num].sb_len < TELNET_SB_MAX) {
                         connlist[conn_num].sb_buf[connlist[conn_num].sb_len++] = ch;
                     }
                 }
@@ -1046,6 +1465,113 @@ static void buffer_input(int conn_num) {
     connlist[conn_num].last_input_time = now_time;
 }
 
+/**
+ * @brief Handle a message from the network I/O threads
+ *
+ * Runs on the game thread. Lines and telnet events are dispatched exactly as buffer_input()
+ * would have; messages for a connection that has since been dropped or reused are discarded.
+ *
+ * @param msg Message popped from an I/O thread's ring
+ */
+static void netio_event(struct netio_msg *msg) {
+    char logbuf[256];
+    int devnum = msg->devnum;
+    
+    if (msg->type == NETIO_ACCEPT) {
+        setup_conn(msg->fd, &msg->addr);
+        return;
+    }
+    
+    if (devnum < 0 || devnum >= num_conns || connlist[devnum].fd == -1 ||
+        connlist[devnum].conn_id != msg->conn_id) {
+        if (msg->data) FREE(msg->data);
+        return;
+    }
+    
+    switch (msg->type) {
+        case NETIO_LINE:
+            connlist[devnum].last_input_time = now_time;
+            if (connlist[devnum].obj->flags & IN_EDITOR)
+                do_edit_command(connlist[devnum].obj, msg->data);
+            else
+                queue_command(connlist[devnum].obj, msg->data);
+            break;
+            
+        case NETIO_NEGOTIATE:
+            connlist[devnum].last_input_time = now_time;
+            connlist[devnum].telnet_opt = msg->opt;
+            handle_telnet_negotiation(devnum, msg->cmd, msg->opt);
+            break;
+            
+        case NETIO_SUBNEG:
+            connlist[devnum].last_input_time = now_time;
+            if (!connlist[devnum].sb_buf)
+                connlist[devnum].sb_buf = MALLOC(TELNET_SB_MAX);
+            connlist[devnum].sb_opt = msg->opt;
+            connlist[devnum].sb_len = msg->len;
+            memcpy(connlist[devnum].sb_buf, msg->data, msg->len);
+            handle_telnet_subnegotiation(devnum);
+            break;
+            
+        case NETIO_PRESSURE:
+            connlist[devnum].io_pending = msg->len;
+            check_pressure(devnum);
+            break;
+            
+        case NETIO_CLOSED:
+            sprintf(logbuf, "intrface: %s %s (obj #%ld)",
+                    inet_ntoa(connlist[devnum].address.tcp_addr.sin_addr),
+                    msg->cmd == NETIO_EOF ? "closed connection" :
+                    msg->cmd == NETIO_HANGUP ? "hung up" : "socket error",
+                    (long)connlist[devnum].obj->refno);
+            logger(msg->cmd == NETIO_ERROR ? LOG_WARNING : LOG, logbuf);
+            lost_conn(devnum);
+            break;
+    }
+    
+    if (msg->data) FREE(msg->data);
+}
+
+/**
+ * @brief Tell objects whose connections became congested or drained
+ *
+ * Calls output_pressure(1) or output_pressure(0) where the congestion state differs from
+ * what the object was last told, so a buffer that fills and drains within one pass
+ * produces no calls at all.
+ */
+static void deliver_pressure() {
+    struct var tmp;
+    
+    for (int i = 0; i < num_conns; i++) {
+        if (connlist[i].fd == -1 || connlist[i].congested == connlist[i].pressure_told)
+            continue;
+        connlist[i].pressure_told = connlist[i].congested;
+        tmp.type = INTEGER;
+        tmp.value.integer = connlist[i].congested;
+        device_apply(connlist[i].obj, "output_pressure", &tmp);
+        handle_destruct();
+    }
+}
+
+/**
+ * @brief Drop connections that have been congested for longer than outbuf_stall
+ */
+static void drop_stalled() {
+    char logbuf[256];
+    
+    if (!outbuf_stall) return;
+    for (int i = 0; i < num_conns; i++) {
+        if (connlist[i].fd == -1 || !connlist[i].congested ||
+            now_time - connlist[i].congested_since < outbuf_stall)
+            continue;
+        sprintf(logbuf, "intrface: %s stalled with %d bytes queued (obj #%ld)",
+                inet_ntoa(connlist[i].address.tcp_addr.sin_addr),
+                outbuf_pending(i), (long)connlist[i].obj->refno);
+        logger(LOG_WARNING, logbuf);
+        lost_conn(i);
+    }
+}
+
 /**
  * @brief Main network event loop
  *
@@ -1054,12 +1580,13 @@ static void buffer_input(int conn_num) {
  */
 void handle_input() {
     struct pollfd *fds;
+    int *fd_conn;                 /* connection index for each fds[] entry */
+    int fds_size;
     int nfds;
     int timeout;
-    struct var tmp;
-    struct var_stack *rts;
-    struct fns *func;
-    struct object *obj, *tmpobj;
+    int cmds_run;
+    int resolve_idx;
+    int saveq_idx;
     
     /* Pulse system variables */
     long pulse_interval_ms;       /* milliseconds per pulse */
@@ -1081,28 +1608,66 @@ void handle_input() {
     next_pulse_time = current_time_ms + pulse_interval_ms;
     
     /* Allocate poll array */
-    fds = MALLOC(sizeof(struct pollfd) * (num_conns + 1));
+    fds = NULL;
+    fd_conn = NULL;
+    fds_size = 0;
     
     while (1) {
-        /* Build poll array */
+        /* Build poll array, resized whenever the connection table has grown */
+        if (fds_size < num_conns + 3) {
+            fds_size = num_conns + 3;
+            fds = realloc(fds, sizeof(struct pollfd) * fds_size);
+            fd_conn = realloc(fd_conn, sizeof(int) * fds_size);
+        }
         nfds = 0;
         
-        /* Listening socket */
-        fds[nfds].fd = sockfd;
+        /* Listening socket, or the I/O threads' wakeup pipe */
+        fds[nfds].fd = io_threads ? netio_wake_fd() : sockfd;
         fds[nfds].events = POLLIN;
         fds[nfds].revents = 0;
+        fd_conn[nfds] = -1;
         nfds++;
         
-        /* Client connections */
+        /* Client connections (the I/O threads own them when enabled);
+           outbound connects in progress are always watched here */
         for (int i = 0; i < num_conns; i++) {
-            if (connlist[i].fd != -1) {
-                fds[nfds].fd = connlist[i].fd;
+            if (connlist[i].fd == -1 || connlist[i].conn_state == CONN_RESOLVING)
+                continue;
+            if (connlist[i].conn_state == CONN_CONNECTING) {
+                fds[nfds].events = POLLOUT;
+            } else if (io_threads) {
+                continue;
+            } else {
                 fds[nfds].events = POLLIN | POLLERR | POLLHUP;
                 if (connlist[i].outbuf_count > 0)
                     fds[nfds].events |= POLLOUT;
-                fds[nfds].revents = 0;
-                nfds++;
             }
+            fds[nfds].fd = connlist[i].fd;
+            fds[nfds].revents = 0;
+            fd_conn[nfds] = i;
+            nfds++;
+        }
+        
+        /* Answers from the resolver thread */
+        resolve_idx = -1;
+        if (resolve_wake_fd() != -1) {
+            resolve_idx = nfds;
+            fds[nfds].fd = resolve_wake_fd();
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            fd_conn[nfds] = -1;
+            nfds++;
+        }
+        
+        /* Finished writes from the save queue */
+        saveq_idx = -1;
+        if (saveq_wake_fd() != -1) {
+            saveq_idx = nfds;
+            fds[nfds].fd = saveq_wake_fd();
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            fd_conn[nfds] = -1;
+            nfds++;
         }
         
         /* Calculate timeout - wake at next pulse or alarm, whichever is sooner */
@@ -1134,12 +1699,15 @@ void handle_input() {
         /* Process game pulse if it's time */
         if (current_time_ms >= next_pulse_time) {
             pulse_count++;
+            current_pulse++;  /* starts a fresh command budget for everyone */
             next_pulse_time += pulse_interval_ms;
             
             /* Process alarms on every pulse */
             handle_alarm();
             handle_destruct();
             
+            drop_stalled();
+            
             /* Call heart_beat() on all registered objects */
             call_heart_beat_on_all();
             
@@ -1154,29 +1722,41 @@ void handle_input() {
                 call_cleanup_on_all();
                 last_cleanup_time = now_time;
             }
+
+            /* Unload programs left idle; it sweeps at its own rate */
+            if (unload_idle > 0)
+                unload_idle_programs();
         }
         
-        /* Check listening socket */
-        if (fds[0].revents & POLLIN) {
+        /* Lines and events from the I/O threads */
+        if (io_threads) {
+            netio_drain(netio_event);
+        } else if (fds[0].revents & POLLIN) {
+            /* Check listening socket */
             logger(LOG_DEBUG, "intrface: incoming connection detected");
             make_new_conn(sockfd);
         }
         
+        if (resolve_idx != -1 && (fds[resolve_idx].revents & POLLIN))
+            resolve_drain(resolve_event);
+        
+        if (saveq_idx != -1 && (fds[saveq_idx].revents & POLLIN))
+            saveq_drain(save_event);
+        
         /* Check client connections */
         for (int i = 1; i < nfds; i++) {
-            int conn_num = -1;
+            int conn_num = fd_conn[i];
             char logbuf[256];
             char *ip_addr;
             
-            /* Find connection number */
-            for (int j = 0; j < num_conns; j++) {
-                if (connlist[j].fd == fds[i].fd) {
-                    conn_num = j;
-                    break;
-                }
-            }
+            /* Skip events for a slot closed earlier in this pass */
+            if (conn_num == -1 || !fds[i].revents) continue;
+            if (connlist[conn_num].fd != fds[i].fd) continue;
             
-            if (conn_num == -1) continue;
+            if (connlist[conn_num].conn_state == CONN_CONNECTING) {
+                finish_connect(conn_num);
+                continue;
+            }
             
             /* Handle errors/hangup */
             if (fds[i].revents & (POLLERR | POLLHUP)) {
@@ -1192,20 +1772,7 @@ void handle_input() {
                     logger(LOG, logbuf);
                 }
                 
-                obj = connlist[conn_num].obj;
-                immediate_disconnect(conn_num);
-                
-                func = find_function("disconnect", obj, &tmpobj);
-                if (func) {
-                    logger(LOG_DEBUG, "intrface: calling disconnect() function");
-                    rts = NULL;
-                    tmp.type = NUM_ARGS;
-                    tmp.value.num = 0;
-                    push(&tmp, &rts);
-                    interp(NULL, tmpobj, NULL, &rts, func);
-                    free_stack(&rts);
-                }
-                handle_destruct();
+                lost_conn(conn_num);
                 continue;
             }
             
@@ -1222,21 +1789,33 @@ void handle_input() {
             }
         }
         
-        /* Process commands and alarms */
+        deliver_pressure();
+        
+        /* Process commands and alarms; input over its per-pulse budget
+           stays queued until the next pulse */
         do {
             handle_destruct();
             handle_alarm();
             handle_destruct();
-            handle_command();
+            cmds_run = handle_command();
             handle_destruct();
             handle_alarm();
             handle_destruct();
-        } while (cmd_head || dest_list);
+        } while (cmds_run || dest_list);
+        
+        /* Hand this pass's output to the I/O threads in one go */
+        if (io_threads) {
+            for (int i = 0; i < num_conns; i++)
+                if (connlist[i].fd != -1 && connlist[i].outbuf_count)
+                    unbuf_output(i);
+            netio_flush();
+        }
         
         unload_data();
     }
     
     FREE(fds);
+    FREE(fd_conn);
 }
 
 /**
@@ -1303,26 +1882,36 @@ int init_interface(struct net_parms *port, int do_single) {
     
     /* Listen */
     logger(LOG_DEBUG, "intrface: listening for connections");
-    if (listen(sockfd, 5) < 0) {
+    if (listen(sockfd, SOMAXCONN) < 0) {
         logger(LOG_ERROR, "intrface: listen() failed");
         close(sockfd);
         return NOSOCKET;
     }
     
-    /* Allocate connection list */
-    num_conns = num_fds - (7 + MIN_FREE_FILES);
-    if (num_conns < 1) num_conns = 1;
-    if (num_conns > MAX_CONNS) num_conns = MAX_CONNS;
+    /* Allocate connection list; it grows on demand up to max_conns */
+    max_conns = num_fds - (7 + MIN_FREE_FILES);
+    if (max_conns < 1) max_conns = 1;
+    if (max_conns > MAX_CONNS) max_conns = MAX_CONNS;
     
     logger(LOG_INFO, "intrface: ready for connections");
     
-    connlist = MALLOC(sizeof(struct connlist_s) * num_conns);
-    for (int i = 0; i < num_conns; i++) {
-        connlist[i].fd = -1;
-    }
+    connlist = NULL;
+    num_conns = 0;
+    grow_connlist();
     
     signal(SIGPIPE, SIG_IGN);
     
+    if (io_threads) {
+        if (netio_start(sockfd, io_threads)) {
+            logger(LOG_ERROR, "intrface: couldn't start I/O threads, using game thread");
+            io_threads = 0;
+        } else {
+            char logbuf[64];
+            sprintf(logbuf, "intrface: started %d I/O threads", io_threads);
+            logger(LOG_INFO, logbuf);
+        }
+    }
+    
     return 0;
 }
 
@@ -1340,6 +1929,11 @@ void shutdown_interface() {
             immediate_disconnect(i);
     }
     
+    /* Joins the threads once they have flushed and closed everything */
+    if (io_threads) netio_stop();
+    resolve_stop();
+    saveq_stop();
+    
     close(sockfd);
     FREE(connlist);
     
@@ -1388,79 +1982,56 @@ char *get_devconn(struct object *obj) {
 /**
  * @brief Send data to device
  *
- * Appends message to the object's output buffer. If buffer exceeds MAX_OUTBUF_LEN, flushes first.
- * Data is sent asynchronously when socket becomes writable.
+ * Converts LF to CRLF straight into the object's output buffer. A message that would take the
+ * connection's queue past outbuf_max is dropped whole (after trying to flush first) rather than
+ * truncated. Data is sent asynchronously when socket becomes writable.
  *
  * @param obj Object with active connection
  * @param msg Message string to send (null-terminated)
+ * @return 0 if the message was queued (or empty), 1 if it was dropped or
+ *         there is no connection
  */
-void send_device(struct object *obj, char *msg) {
-    int len, newlen, i, j;
-    char *tmp, *converted;
-    int lf_count;
+int send_device(struct object *obj, char *msg) {
+    int len, newlen, i, devnum;
+    char *out;
+    char logbuf[256];
     
-    if (!obj || obj->devnum == -1 || !msg) return;
+    if (!obj || obj->devnum == -1 || !msg) return 1;
+    devnum = obj->devnum;
     
     len = strlen(msg);
-    if (len == 0) return;
+    if (len == 0) return 0;
     
     /* Count LF characters that need to be expanded to CRLF */
-    lf_count = 0;
+    newlen = len;
     for (i = 0; i < len; i++) {
         if (msg[i] == '\n' && (i == 0 || msg[i-1] != '\r')) {
-            lf_count++;
+            newlen++;
         }
     }
     
-    /* Allocate buffer for conversion (may be larger if we add CRs) */
-    newlen = len + lf_count;
-    converted = MALLOC(newlen + 1);
-    
-    /* Convert LF to CRLF */
-    j = 0;
-    for (i = 0; i < len && j < newlen; i++) {
-        if (msg[i] == '\n' && (i == 0 || msg[i-1] != '\r')) {
-            converted[j++] = '\r';  /* Add CR before LF */
-            converted[j++] = '\n';
-        } else {
-            converted[j++] = msg[i];
-        }
-    }
-    converted[j] = '\0';
-    newlen = j;  /* Actual length written */
-    
     /* Check buffer size */
-    if (connlist[obj->devnum].outbuf_count + newlen > MAX_OUTBUF_LEN) {
-        flush_device(obj);
-    }
-    
-    if (connlist[obj->devnum].outbuf_count > MAX_OUTBUF_LEN) {
-        FREE(converted);
-        return;
-    }
-    
-    if (connlist[obj->devnum].outbuf_count + newlen > MAX_OUTBUF_LEN) {
-        newlen = MAX_OUTBUF_LEN - connlist[obj->devnum].outbuf_count;
+    if (outbuf_pending(devnum) + newlen > outbuf_max) {
+        unbuf_output(devnum);
+        if (outbuf_pending(devnum) + newlen > outbuf_max) {
+            sprintf(logbuf, "intrface: dropped %d bytes for obj #%ld (%d queued)",
+                    newlen, (long)obj->refno, outbuf_pending(devnum));
+            logger(LOG_DEBUG, logbuf);
+            check_pressure(devnum);
+            return 1;
+        }
     }
     
-    /* Append to buffer */
-    if (connlist[obj->devnum].outbuf) {
-        tmp = MALLOC(connlist[obj->devnum].outbuf_count + newlen + 1);
-        memcpy(tmp, connlist[obj->devnum].outbuf, connlist[obj->devnum].outbuf_count);
-        memcpy(tmp + connlist[obj->devnum].outbuf_count, converted, newlen);
-        tmp[connlist[obj->devnum].outbuf_count + newlen] = '\0';
-        FREE(connlist[obj->devnum].outbuf);
-        connlist[obj->devnum].outbuf = tmp;
-        connlist[obj->devnum].outbuf_count += newlen;
-    } else {
-        tmp = MALLOC(newlen + 1);
-        memcpy(tmp, converted, newlen);
-        tmp[newlen] = '\0';
-        connlist[obj->devnum].outbuf = tmp;
-        connlist[obj->devnum].outbuf_count = newlen;
+    /* Convert LF to CRLF */
+    out = outbuf_reserve(devnum, newlen);
+    for (i = 0; i < len; i++) {
+        if (msg[i] == '\n' && (i == 0 || msg[i-1] != '\r'))
+            *out++ = '\r';  /* Add CR before LF */
+        *out++ = msg[i];
     }
-    
-    FREE(converted);
+    connlist[devnum].outbuf_count += newlen;
+    check_pressure(devnum);
+    return 0;
 }
 
 /**
@@ -1468,7 +2039,9 @@ void send_device(struct object *obj, char *msg) {
  *
  * Sends a prompt string and appends IAC GA (Go Ahead) if the client
  * has not negotiated SGA (Suppress Go Ahead). This ensures proper
- * telnet protocol compliance for line-mode terminals.
+ * telnet protocol compliance for line-mode terminals. A prompt dropped
+ * by backpressure gets no GA, so the client isn't told to go ahead
+ * without one.
  *
  * @param obj Object with active connection
  * @param prompt Prompt string to send (null-terminated)
@@ -1477,33 +2050,13 @@ void send_prompt(struct object *obj, char *prompt) {
     if (!obj || obj->devnum == -1 || !prompt) return;
     
     /* Send the prompt text */
-    send_device(obj, prompt);
+    if (send_device(obj, prompt)) return;
     
     /* Send IAC GA if SGA not negotiated */
     if (!connlist[obj->devnum].opt_sga) {
         unsigned char ga_seq[2] = { TELNET_IAC, TELNET_GA };
-        int len;
-        char *tmp;
-        
-        /* Append IAC GA to outbuf */
-        if (connlist[obj->devnum].outbuf) {
-            len = connlist[obj->devnum].outbuf_count + 2;
-            tmp = MALLOC(len + 1);
-            memcpy(tmp, connlist[obj->devnum].outbuf, connlist[obj->devnum].outbuf_count);
-            tmp[connlist[obj->devnum].outbuf_count] = ga_seq[0];
-            tmp[connlist[obj->devnum].outbuf_count + 1] = ga_seq[1];
-            tmp[len] = '\0';
-            FREE(connlist[obj->devnum].outbuf);
-            connlist[obj->devnum].outbuf = tmp;
-            connlist[obj->devnum].outbuf_count = len;
-        } else {
-            tmp = MALLOC(3);
-            tmp[0] = ga_seq[0];
-            tmp[1] = ga_seq[1];
-            tmp[2] = '\0';
-            connlist[obj->devnum].outbuf = tmp;
-            connlist[obj->devnum].outbuf_count = 2;
-        }
+
+        outbuf_append(obj->devnum, ga_seq, 2);
     }
 }
 
@@ -1602,18 +2155,22 @@ void flush_device(struct object *obj) {
 /**
  * @brief Establish outbound connection
  *
- * Creates a new outbound TCP connection from the object to the specified remote address and port.
- * Logs connection attempts and results with full details.
+ * Starts a non-blocking TCP connection from the object to the specified remote host and port
+ * and returns without waiting for it. Hostnames are resolved on the resolver thread. When the
+ * connection completes the object's connect_success() function is called; if it cannot be made,
+ * connect_failure(reason) is called and the object is left unconnected. Output sent while the
+ * connection is pending is delivered once it is established.
  *
  * @param obj Object to associate with the connection (must not be connected)
- * @param address Remote IP address string
+ * @param address Remote hostname or IP address string
  * @param port Remote port number
  * @param net_type Protocol type (CI_PROTOCOL_TCP), or 0 to use net_protocol global
- * @return 1 on success, 0 on failure
+ * @return 1 if the connection was initiated, 0 on immediate failure
  */
 int connect_device(struct object *obj, char *address, int port, int net_type) {
     int devnum, new_fd;
-    struct sockaddr_in remote_host;
+    struct in_addr tcp_addr;
+    char *answer;
     char logbuf[256];
     
     if (!net_type) net_type = net_protocol;
@@ -1630,78 +2187,76 @@ int connect_device(struct object *obj, char *address, int port, int net_type) {
         return 0;
     }
     
-    sprintf(logbuf, "intrface: obj #%ld initiating outbound to %s:%d",
+    sprintf(logbuf, "intrface: obj #%ld initiating outbound to %.128s:%d",
             (long)obj->refno, address, port);
     logger(LOG, logbuf);
     
-    /* Find free slot */
-    devnum = -1;
-    for (int i = 0; i < num_conns; i++) {
-        if (connlist[i].fd == -1) {
-            devnum = i;
-            break;
-        }
-    }
-    
-    if (devnum == -1) {
-        sprintf(logbuf, "intrface: obj #%ld outbound to %s:%d failed (no free slots)",
-                (long)obj->refno, address, port);
-        logger(LOG_WARNING, logbuf);
-        return 0;
-    }
-    
     /* Create socket */
     new_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (new_fd < 0) {
-        sprintf(logbuf, "intrface: obj #%ld outbound to %s:%d failed (socket creation)",
+        sprintf(logbuf, "intrface: obj #%ld outbound to %.128s:%d failed (socket creation)",
                 (long)obj->refno, address, port);
         logger(LOG_ERROR, logbuf);
         return 0;
     }
     
-    /* Connect */
-    memset(&remote_host, 0, sizeof(remote_host));
-    remote_host.sin_family = AF_INET;
-    remote_host.sin_port = htons(port);
-    remote_host.sin_addr.s_addr = inet_addr(address);
-    
-    logger(LOG_DEBUG, "intrface: connecting to remote host");
-    if (connect(new_fd, (struct sockaddr *)&remote_host, sizeof(remote_host)) < 0) {
-        sprintf(logbuf, "intrface: obj #%ld outbound to %s:%d failed (refused)",
+    /* Set non-blocking before connecting so connect() returns at once */
+    if (set_nonblocking(new_fd) < 0) {
+        sprintf(logbuf, "intrface: obj #%ld outbound to %.128s:%d failed (non-blocking)",
                 (long)obj->refno, address, port);
-        logger(LOG_WARNING, logbuf);
+        logger(LOG_ERROR, logbuf);
         close(new_fd);
         return 0;
     }
     
-    /* Set non-blocking */
-    if (set_nonblocking(new_fd) < 0) {
-        sprintf(logbuf, "intrface: obj #%ld outbound to %s:%d failed (non-blocking)",
+    if ((devnum = alloc_conn()) == -1) {
+        sprintf(logbuf, "intrface: obj #%ld outbound to %.128s:%d failed (no free slots)",
                 (long)obj->refno, address, port);
-        logger(LOG_ERROR, logbuf);
+        logger(LOG_WARNING, logbuf);
         close(new_fd);
         return 0;
     }
     
     /* Initialize connection */
-    connlist[devnum].fd = new_fd;
-    connlist[devnum].inbuf_count = 0;
+    init_conn(devnum, new_fd, obj);
     connlist[devnum].net_type = net_type;
-    connlist[devnum].address.tcp_addr = remote_host;
-    connlist[devnum].obj = obj;
-    connlist[devnum].outbuf_count = 0;
-    connlist[devnum].outbuf = NULL;
-    connlist[devnum].conn_time = now_time;
-    connlist[devnum].last_input_time = now_time;
-    
-    obj->devnum = devnum;
-    obj->flags |= CONNECTED;
+    memset(&connlist[devnum].address.tcp_addr, 0, sizeof(struct sockaddr_in));
+    connlist[devnum].address.tcp_addr.sin_family = AF_INET;
+    connlist[devnum].address.tcp_addr.sin_port = htons(port);
+    
+    /* Find the address: dotted quads directly, names through the resolver */
+    answer = NULL;
+    if (inet_aton(address, &tcp_addr)) {
+        answer = address;
+    } else if (resolve_connect(address, devnum, connlist[devnum].conn_id,
+                               &answer) == RESOLVE_PENDING) {
+        /* Lookup queued; resolve_event() picks it up from here */
+        connlist[devnum].conn_state = CONN_RESOLVING;
+        return 1;
+    }
+    if (!answer) {
+        sprintf(logbuf, "intrface: obj #%ld outbound to %.128s:%d failed (host not found)",
+                (long)obj->refno, address, port);
+        logger(LOG_WARNING, logbuf);
+        close(new_fd);
+        release_conn(devnum);
+        obj->devnum = -1;
+        obj->flags &= ~CONNECTED;
+        return 0;
+    }
     
-    sprintf(logbuf, "intrface: obj #%ld (%s) connected to %s:%d",
-            (long)obj->refno,
-            obj->parent ? obj->parent->pathname : "no-parent",
-            address, port);
-    logger(LOG, logbuf);
+    inet_aton(answer, &connlist[devnum].address.tcp_addr.sin_addr);
+    logger(LOG_DEBUG, "intrface: connecting to remote host");
+    if (start_connect(devnum)) {
+        sprintf(logbuf, "intrface: obj #%ld outbound to %.128s:%d failed (%s)",
+                (long)obj->refno, address, port, strerror(errno));
+        logger(LOG_WARNING, logbuf);
+        close(new_fd);
+        release_conn(devnum);
+        obj->devnum = -1;
+        obj->flags &= ~CONNECTED;
+        return 0;
+    }
     
     return 1;
 }
@@ -1731,3 +2286,18 @@ long get_conntime(struct object *obj) {
     if (!(obj->flags & CONNECTED) || obj->devnum == -1) return -1;
     return connlist[obj->devnum].conn_time;
 }
+
+/**
+ * @brief Get queued output for a connection
+ *
+ * Returns how many bytes of output are waiting to be written to the connection, including
+ * what an I/O thread last reported holding. Compare with outbuf_high to decide whether
+ * low-priority output is worth sending.
+ *
+ * @param obj Object with active connection
+ * @return Bytes queued, or -1 if object is not connected
+ */
+int get_devqueue(struct object *obj) {
+    if (!(obj->flags & CONNECTED) || obj->devnum == -1) return -1;
+    return outbuf_pending(obj->devnum);
+}
@@ -44,6 +44,13 @@ typedef int SOCKET;
 #define TELNET_STATE_SB   6   /* In subnegotiation */
 #define TELNET_STATE_SB_IAC 7 /* IAC in subnegotiation */
 
+#define TELNET_SB_MAX   256   /* Longest subnegotiation kept */
+
+/* Connection states */
+#define CONN_OPEN       0     /* Connected, normal I/O */
+#define CONN_RESOLVING  1     /* Outbound, waiting on the resolver thread */
+#define CONN_CONNECTING 2     /* Outbound, non-blocking connect() in progress */
+
 #ifdef CMPLNG_INTRFCE
 struct connlist_s {
   SOCKET fd;
@@ -61,19 +68,28 @@ struct connlist_s {
 #endif /* USE_WINDOWS */
   } address;
   int net_type;
-  char inbuf[MAX_STR_LEN];
+  char *inbuf;              /* allocated on first input, NULL until then */
+  int inbuf_size;
   int inbuf_count;
   int outbuf_count;
+  int outbuf_size;          /* allocated size of outbuf */
   char *outbuf;
+  int io_pending;           /* bytes an I/O thread last reported still queued */
+  int congested;            /* passed outbuf_high, not yet back to outbuf_low */
+  int pressure_told;        /* congested as last passed to output_pressure() */
+  long congested_since;
   struct object *obj;
   long conn_time;
   long last_input_time;
+  unsigned long conn_id;    /* tells reused slots apart for the I/O threads */
+  int conn_state;           /* CONN_OPEN, or an outbound connect still pending */
+  int next_free;            /* free list link while fd == -1 */
   
   /* Telnet protocol state */
   int telnet_state;         /* Current parser state */
   unsigned char telnet_opt; /* Current option being negotiated */
   unsigned char sb_opt;     /* Subnegotiation option */
-  unsigned char sb_buf[256]; /* Subnegotiation buffer */
+  unsigned char *sb_buf;    /* Subnegotiation buffer, allocated on first SB */
   int sb_len;               /* Subnegotiation buffer length */
   
   /* Telnet option flags */
@@ -115,7 +131,7 @@ int init_interface(struct net_parms *port, int do_single);
 void shutdown_interface();
 void handle_input();
 char *get_devconn(struct object *obj);
-void send_device(struct object *obj, char *msg);
+int send_device(struct object *obj, char *msg);
 void send_prompt(struct object *obj, char *prompt);
 int reconnect_device(struct object *src, struct object *dest);
 void disconnect_device(struct object *obj);
@@ -124,3 +140,4 @@ void flush_device(struct object *obj);
 int connect_device(struct object *obj, char *address, int port, int net_type);
 long get_devidle(struct object *obj);
 long get_conntime(struct object *obj);
+int get_devqueue(struct object *obj);
@@ -0,0 +1,206 @@
+/**
+ * @file lazy.c
+ * @brief Loading programs the first time they're used
+ *
+ * Normally a program is loaded only by compile_object() (or by being
+ * inherited), so a mudlib compiles everything it might need at boot.
+ * With lazy_load set, call_other(), clone_object() and atoo() compile a
+ * program that isn't loaded yet when they're given its path:
+ *
+ *  - if the boot object has load_object(path), it is called and decides
+ *    what happens, usually compile_object(path); whatever it loaded is
+ *    then looked up again
+ *  - otherwise the program is compiled as compile_object() would
+ *
+ * A path with no source file is a miss, and misses are remembered in a
+ * small table so that code probing for optional objects doesn't go to
+ * the filesystem each time.  A miss is forgotten after LAZY_MISS_TTL
+ * seconds, or as soon as the driver creates any file.  A path whose
+ * source didn't compile is remembered the same way, along with the
+ * source's size and mtime, so a broken program named in a loop is
+ * compiled (and its error reported) once rather than on every call; it
+ * is tried again as soon as the source changes.  A fix to a program it
+ * inherits or a file it #includes is picked up when the entry expires.
+ */
+
+#include "config.h"
+#include "object.h"
+#include "constrct.h"
+#include "globals.h"
+#include "dbhandle.h"
+#include "interp.h"
+#include "protos.h"
+#include "file.h"
+#include "lazy.h"
+
+#include <sys/stat.h>
+
+struct lazy_miss {
+    char *path;               /* NULL when the slot is unused */
+    long expires;
+    long mtime;               /* of the source that failed to compile */
+    long size;                /* of that source, or -1 if there was none */
+};
+
+/* A path being loaded, so load_object() naming it again gets nothing
+   instead of recursing */
+struct lazy_loading {
+    char *path;
+    struct lazy_loading *next;
+};
+
+static struct lazy_miss misses[LAZY_MISS_CACHE];
+static struct lazy_loading *loading;
+
+/* ========================================================================
+ * MISSES
+ * ======================================================================== */
+
+static unsigned int miss_slot(char *path) {
+    unsigned int h = 5381;
+
+    while (*path)
+        h = h * 33 + (unsigned char) *(path++);
+    return h & (LAZY_MISS_CACHE - 1);
+}
+
+/* Find path's source file.  Returns 1 and its size and mtime, or 0 if
+   there is none. */
+static int source_stamp(char *path, long *mtime, long *size) {
+    struct stat st;
+    char *filename;
+    FILE *f;
+
+    filename = MALLOC(strlen(path) + 3);
+    sprintf(filename, "%s.c", path);
+    f = open_file(filename, FREAD_MODE, NULL);
+    FREE(filename);
+    if (!f)
+        return 0;
+    if (fstat(fileno(f), &st)) {
+        st.st_mtime = 0;
+        st.st_size = 0;
+    }
+    fclose(f);
+    *mtime = (long) st.st_mtime;
+    *size = (long) st.st_size;
+    return 1;
+}
+
+static int is_missing(char *path) {
+    struct lazy_miss *m;
+    long mtime, size;
+
+    m = &misses[miss_slot(path)];
+    if (!m->path || strcmp(m->path, path))
+        return 0;
+    if (m->expires > now_time) {
+        if (m->size < 0)
+            return 1;
+        /* it failed to compile; try again once the source changes */
+        if (source_stamp(path, &mtime, &size) && mtime == m->mtime &&
+            size == m->size)
+            return 1;
+    }
+    FREE(m->path);
+    m->path = NULL;
+    return 0;
+}
+
+/* Remember that path has no source (size -1), or has a source of this
+   size and mtime that didn't load */
+static void note_missing(char *path, long mtime, long size) {
+    struct lazy_miss *m;
+
+    m = &misses[miss_slot(path)];
+    if (m->path)
+        FREE(m->path);
+    m->path = copy_string(path);
+    m->expires = now_time + LAZY_MISS_TTL;
+    m->mtime = mtime;
+    m->size = size;
+}
+
+void lazy_forget_missing() {
+    int x;
+
+    for (x = 0; x < LAZY_MISS_CACHE; x++)
+        if (misses[x].path) {
+            FREE(misses[x].path);
+            misses[x].path = NULL;
+        }
+}
+
+/* ========================================================================
+ * LOADING
+ * ======================================================================== */
+
+static int is_loading(char *path) {
+    struct lazy_loading *curr;
+
+    for (curr = loading; curr; curr = curr->next)
+        if (!strcmp(curr->path, path))
+            return 1;
+    return 0;
+}
+
+/* Call load_object(path) in the boot object, or compile_object(path) if
+   it hasn't one */
+static void load(char *path, struct object *obj, struct object *player) {
+    struct object *boot_obj, *tmpobj;
+    struct var_stack *rts;
+    struct var tmp;
+    struct fns *hook;
+    struct var *old_locals;
+    unsigned int old_num_locals;
+
+    rts = NULL;
+    tmp.type = STRING;
+    tmp.value.string = path;
+    push(&tmp, &rts);
+    tmp.type = NUM_ARGS;
+    tmp.value.num = 1;
+    push(&tmp, &rts);
+    boot_obj = ref_to_obj(0);
+    hook = boot_obj ? find_function("load_object", boot_obj, &tmpobj) : NULL;
+    old_locals = locals;
+    old_num_locals = num_locals;
+    if (hook)
+        interp(obj, tmpobj, player, &rts, hook);
+    else
+        s_compile_object(obj, obj, player, &rts);
+    locals = old_locals;
+    num_locals = old_num_locals;
+    free_stack(&rts);
+}
+
+/* find_proto(), loading the program first if lazy_load is set.  Returns
+   NULL if there's no such program or it wouldn't load. */
+struct object *lazy_find_proto(char *path, struct object *obj,
+                               struct object *player) {
+    struct lazy_loading entry;
+    struct object *result;
+    long mtime, size;
+    char logbuf[256];
+
+    if ((result = find_proto(path)) || !lazy_load)
+        return result;
+    if (*path != '/' || is_missing(path) || is_loading(path))
+        return NULL;
+    if (!source_stamp(path, &mtime, &size)) {
+        note_missing(path, 0, -1);
+        return NULL;
+    }
+    entry.path = path;
+    entry.next = loading;
+    loading = &entry;
+    load(path, obj, player);
+    loading = entry.next;
+    result = find_proto(path);
+    if (result) {
+        sprintf(logbuf, "lazy_load: loaded %.200s", path);
+        logger(LOG_DEBUG, logbuf);
+    } else
+        note_missing(path, mtime, size);
+    return result;
+}
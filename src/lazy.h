@@ -0,0 +1,17 @@
+/* lazy.h */
+
+/* lazy_load: with it set in netci.ini, a program that isn't loaded is
+   compiled the first time call_other(), clone_object() or atoo() names
+   it, through the boot object's load_object() when it has one.  Paths
+   with no source file are remembered for LAZY_MISS_TTL seconds, or until
+   a file is created, so repeated lookups of them cost nothing; so are
+   paths whose source didn't load, until that source changes. */
+
+#ifndef LAZY_H
+#define LAZY_H
+
+struct object *lazy_find_proto(char *path, struct object *obj,
+                               struct object *player);
+void lazy_forget_missing();
+
+#endif /* LAZY_H */
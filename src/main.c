@@ -14,6 +14,7 @@
 #include "dbhandle.h"
 #include "file.h"
 #include "save_adapter.h"
+#include "bcache.h"
 #ifdef USE_WINDOWS
 #include "winmain.h"
 #endif /* USE_WINDOWS */
@@ -78,6 +79,7 @@ int read_ini(char *filename,
   static char ini_auto[1024];
   static char ini_save_path[1024];
   static char ini_save_type[1024];
+  static char ini_bytecode_path[1024];
 
   if (!(infile=fopen(filename,"r"))) return -1;
   last_had_nl=1;
@@ -132,6 +134,9 @@ int read_ini(char *filename,
           } else if (!strcmp(key,"save_type")) {
             strcpy(ini_save_type,val);
             save_type=ini_save_type;
+          } else if (!strcmp(key,"bytecode_path")) {
+            strcpy(ini_bytecode_path,val);
+            bytecode_path=ini_bytecode_path;
           } else if (!strcmp(key,"pulses_per_second")) {
             pulses_per_second=atoi(val);
           } else if (!strcmp(key,"time_cleanup")) {
@@ -140,6 +145,30 @@ int read_ini(char *filename,
             time_reset=atol(val);
           } else if (!strcmp(key,"time_heartbeat")) {
             time_heartbeat=atol(val);
+          } else if (!strcmp(key,"io_threads")) {
+            io_threads=atoi(val);
+          } else if (!strcmp(key,"compile_threads")) {
+            compile_threads=atoi(val);
+          } else if (!strcmp(key,"optimize")) {
+            optimize=atoi(val);
+          } else if (!strcmp(key,"lazy_load")) {
+            lazy_load=atoi(val);
+          } else if (!strcmp(key,"unload_idle")) {
+            unload_idle=atoi(val);
+          } else if (!strcmp(key,"cmd_budget")) {
+            cmd_budget=atoi(val);
+          } else if (!strcmp(key,"cycle_budget")) {
+            cycle_budget=atol(val);
+          } else if (!strcmp(key,"cmd_queue_max")) {
+            cmd_queue_max=atoi(val);
+          } else if (!strcmp(key,"outbuf_high")) {
+            outbuf_high=atoi(val);
+          } else if (!strcmp(key,"outbuf_low")) {
+            outbuf_low=atoi(val);
+          } else if (!strcmp(key,"outbuf_max")) {
+            outbuf_max=atoi(val);
+          } else if (!strcmp(key,"outbuf_stall")) {
+            outbuf_stall=atoi(val);
           } else if (!strcmp(key,"protocol")) {
             if (!strcmp(val,"tcp")) port->protocol=CI_PROTOCOL_TCP;
             else if (!strcmp(val,"ipx")) port->protocol=CI_PROTOCOL_IPX;
@@ -239,6 +268,18 @@ int main(int argc, char *argv[]) {
   time_cleanup=0;
   time_reset=0;
   time_heartbeat=0;
+  io_threads=0;
+  compile_threads=0;
+  optimize=0;
+  lazy_load=0;
+  unload_idle=0;
+  cmd_budget=CMD_BUDGET;
+  cycle_budget=CYCLE_BUDGET;
+  cmd_queue_max=CMD_QUEUE_MAX;
+  outbuf_high=OUTBUF_HIGH;
+  outbuf_low=OUTBUF_LOW;
+  outbuf_max=MAX_OUTBUF_LEN;
+  outbuf_stall=OUTBUF_STALL;
   last_reset_time=0;
   last_cleanup_time=0;
   detach=0;
@@ -433,6 +474,17 @@ int main(int argc, char *argv[]) {
   if (time_cleanup==0) time_cleanup=1200;       /* 20 minutes default */
   if (time_reset==0) time_reset=800;            /* 13.3 minutes default */
   if (time_heartbeat==0) time_heartbeat=2000;   /* 2 seconds default */
+  if (io_threads<0) io_threads=0;
+  if (io_threads>MAX_IO_THREADS) io_threads=MAX_IO_THREADS;
+  if (compile_threads<0) compile_threads=0;
+  if (compile_threads>MAX_COMPILE_THREADS) compile_threads=MAX_COMPILE_THREADS;
+  if (cmd_budget<0) cmd_budget=0;
+  if (cycle_budget<0) cycle_budget=0;
+  if (cmd_queue_max<0) cmd_queue_max=0;
+  if (outbuf_max<1024) outbuf_max=1024;
+  if (outbuf_high<1 || outbuf_high>outbuf_max) outbuf_high=outbuf_max;
+  if (outbuf_low<0 || outbuf_low>=outbuf_high) outbuf_low=outbuf_high/4;
+  if (outbuf_stall<0) outbuf_stall=0;
   
   if (do_create) detach=0;
   logger(LOG_INFO, " system: starting up");
@@ -450,6 +502,7 @@ int main(int argc, char *argv[]) {
 #endif /* !USE_WINDOWS */
   init_globals(loadpath,savepath,panicpath);
   init_save_adapter();  /* Initialize persistence adapter system */
+  bcache_init();
   /* Skip network initialization if we're just creating a database */
   if (!do_create) {
     if ((retval=init_interface(&port,do_single))) {
@@ -0,0 +1,732 @@
+/**
+ * @file netio.c
+ * @brief Dedicated network I/O threads for the POSIX interface
+ *
+ * When io_threads is set, each I/O thread owns a subset of the sockets
+ * (devnum % io_threads) and does all of accept(), read(), telnet parsing,
+ * input echo and write() for them.  The interpreter stays single-threaded:
+ * it receives complete command lines and telnet events and hands back whole
+ * output chunks, all through lock-free single-producer/single-consumer rings.
+ * Thread 0 also owns the listening socket.
+ *
+ * Nothing in here touches objects, the logger or any other driver global;
+ * everything the game needs to know travels as a struct netio_msg.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "object.h"
+#include "globals.h"
+#include "intrface.h"
+#include "netio.h"
+
+#define RING_MASK (IO_RING_SIZE - 1)
+
+/* inside IAC SB, just saw an IAC; local to the I/O threads */
+#define NETIO_STATE_SB_DATA_IAC 8
+
+struct netio_ring {
+    atomic_ulong head;          /* next slot to pop, owned by the consumer */
+    atomic_ulong tail;          /* next slot to fill, owned by the producer */
+    struct netio_msg slot[IO_RING_SIZE];
+};
+
+/* game-side overflow for when an I/O thread's inbound ring is full */
+struct netio_node {
+    struct netio_msg msg;
+    struct netio_node *next;
+};
+
+struct io_conn {
+    int fd;                     /* -1 when the slot is free */
+    unsigned long conn_id;
+    int telnet_state;
+    int echo;                   /* mirrors opt_echo, follows DO/DONT ECHO */
+    char *inbuf;
+    int inbuf_count;
+    unsigned char sb_opt;
+    unsigned char sb_buf[TELNET_SB_MAX];
+    int sb_len;
+    char *outbuf;
+    int out_off;
+    int out_len;
+    int out_cap;
+    int congested;              /* reported above outbuf_high, not yet drained */
+};
+
+struct io_thread {
+    int index;
+    pthread_t tid;
+    int wake_rd, wake_wr;       /* game -> thread wakeup pipe */
+    atomic_int wake_pending;
+    struct netio_ring to_io;
+    struct netio_ring to_game;
+    struct io_conn *conns;      /* indexed by devnum / num_io */
+    int num_slots;
+    struct pollfd *fds;
+    int *fd_slot;
+    int fds_cap;
+    /* game thread only */
+    struct netio_node *backlog_head, *backlog_tail;
+    int need_wake;
+};
+
+static struct io_thread *io;
+static int num_io;
+static int io_listen_fd = -1;
+static int game_wake_rd = -1, game_wake_wr = -1;
+static atomic_int game_wake_pending;
+static atomic_int io_stopping;
+
+/**
+ * @brief Push a message onto an SPSC ring
+ *
+ * @return 0 on success, -1 if the ring is full
+ */
+static int ring_push(struct netio_ring *r, struct netio_msg *msg) {
+    unsigned long tail, head;
+
+    tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail - head >= IO_RING_SIZE) return -1;
+    r->slot[tail & RING_MASK] = *msg;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * @brief Pop a message from an SPSC ring
+ *
+ * @return 1 if a message was stored in msg, 0 if the ring is empty
+ */
+static int ring_pop(struct netio_ring *r, struct netio_msg *msg) {
+    unsigned long head, tail;
+
+    head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head == tail) return 0;
+    *msg = r->slot[head & RING_MASK];
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return 1;
+}
+
+static void wake(int fd, atomic_int *pending) {
+    char c = 0;
+
+    if (!atomic_exchange(pending, 1))
+        write(fd, &c, 1);
+}
+
+static void drain_wake(int fd, atomic_int *pending) {
+    char buf[64];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    atomic_store(pending, 0);
+}
+
+static int make_pipe(int *rd, int *wr) {
+    int p[2];
+
+    if (pipe(p) < 0) return -1;
+    fcntl(p[0], F_SETFL, fcntl(p[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(p[1], F_SETFL, fcntl(p[1], F_GETFL, 0) | O_NONBLOCK);
+    *rd = p[0];
+    *wr = p[1];
+    return 0;
+}
+
+/* ---------------------------------------------------------------------
+ * I/O thread side
+ * --------------------------------------------------------------------- */
+
+/**
+ * @brief Hand a message to the game thread
+ *
+ * The game thread never waits on an I/O thread, so if the ring is full we
+ * simply back off until it catches up.  Once shutdown has started nobody
+ * is draining any more and the message is discarded.
+ */
+static void to_game(struct io_thread *t, struct netio_msg *msg) {
+    while (ring_push(&t->to_game, msg)) {
+        if (atomic_load(&io_stopping)) {
+            if (msg->type == NETIO_ACCEPT) close(msg->fd);
+            if (msg->data) FREE(msg->data);
+            return;
+        }
+        wake(game_wake_wr, &game_wake_pending);
+        usleep(1000);
+    }
+    wake(game_wake_wr, &game_wake_pending);
+}
+
+static void send_event(struct io_thread *t, int slot, int type,
+                       unsigned char cmd, unsigned char opt,
+                       char *data, int len) {
+    struct netio_msg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = type;
+    msg.devnum = slot * num_io + t->index;
+    msg.conn_id = t->conns[slot].conn_id;
+    msg.cmd = cmd;
+    msg.opt = opt;
+    msg.data = data;
+    msg.len = len;
+    to_game(t, &msg);
+}
+
+static void out_append(struct io_conn *c, const char *data, int len) {
+    if (c->out_off == c->out_len)
+        c->out_off = c->out_len = 0;
+    if (c->out_len - c->out_off + len > outbuf_max) {
+        /* same policy as the single-threaded path: drop what won't fit, whole */
+        return;
+    }
+    if (c->out_len + len > c->out_cap) {
+        if (c->out_off) {
+            memmove(c->outbuf, c->outbuf + c->out_off, c->out_len - c->out_off);
+            c->out_len -= c->out_off;
+            c->out_off = 0;
+        }
+        if (c->out_len + len > c->out_cap) {
+            c->out_cap = c->out_len + len + WRITE_BURST;
+            c->outbuf = realloc(c->outbuf, c->out_cap);
+        }
+    }
+    memcpy(c->outbuf + c->out_len, data, len);
+    c->out_len += len;
+}
+
+static int out_write(struct io_conn *c) {
+    int n;
+
+    while (c->out_off < c->out_len) {
+        n = write(c->fd, c->outbuf + c->out_off, c->out_len - c->out_off);
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+            if (n < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        c->out_off += n;
+    }
+    c->out_off = c->out_len = 0;
+    return 0;
+}
+
+/**
+ * @brief Tell the game thread when a connection's queue crosses a watermark
+ *
+ * The game thread only sees what it hands over, so this is how it learns
+ * that a client is not keeping up (and when it has caught up again).
+ */
+static void check_pressure(struct io_thread *t, int slot) {
+    struct io_conn *c = &t->conns[slot];
+    int pending = c->out_len - c->out_off;
+
+    if (!c->congested && pending >= outbuf_high) {
+        c->congested = 1;
+        send_event(t, slot, NETIO_PRESSURE, 1, 0, NULL, pending);
+    } else if (c->congested && pending <= outbuf_low) {
+        c->congested = 0;
+        send_event(t, slot, NETIO_PRESSURE, 0, 0, NULL, pending);
+    }
+}
+
+static void release_conn(struct io_conn *c) {
+    close(c->fd);
+    c->fd = -1;
+    if (c->inbuf) FREE(c->inbuf);
+    if (c->outbuf) FREE(c->outbuf);
+    c->inbuf = NULL;
+    c->outbuf = NULL;
+    c->out_off = c->out_len = c->out_cap = 0;
+}
+
+/**
+ * @brief Close a socket on behalf of the game thread
+ *
+ * Mirrors immediate_disconnect(): one last attempt to flush, then close.
+ */
+static void close_conn(struct io_conn *c) {
+    if (c->out_off < c->out_len)
+        write(c->fd, c->outbuf + c->out_off, c->out_len - c->out_off);
+    shutdown(c->fd, SHUT_RDWR);
+    release_conn(c);
+}
+
+static void lost_conn(struct io_thread *t, int slot, int reason) {
+    send_event(t, slot, NETIO_CLOSED, reason, 0, NULL, 0);
+    release_conn(&t->conns[slot]);
+}
+
+static void adopt_conn(struct io_thread *t, struct netio_msg *msg) {
+    struct io_conn *c;
+    int slot, old;
+
+    slot = msg->devnum / num_io;
+    if (slot >= t->num_slots) {
+        old = t->num_slots;
+        t->num_slots = slot + 16;
+        t->conns = realloc(t->conns, sizeof(struct io_conn) * t->num_slots);
+        while (old < t->num_slots) {
+            memset(&t->conns[old], 0, sizeof(struct io_conn));
+            t->conns[old++].fd = -1;
+        }
+    }
+    c = &t->conns[slot];
+    if (c->fd != -1) close_conn(c);
+    c->fd = msg->fd;
+    c->conn_id = msg->conn_id;
+    c->telnet_state = TELNET_STATE_DATA;
+    c->echo = 0;
+    c->congested = 0;
+    c->inbuf = MALLOC(MAX_STR_LEN);
+    c->inbuf_count = 0;
+    c->sb_len = 0;
+}
+
+/**
+ * @brief Look up the connection a game message is addressed to
+ *
+ * @return the connection, or NULL if it has since gone away
+ */
+static struct io_conn *find_conn(struct io_thread *t, struct netio_msg *msg) {
+    int slot = msg->devnum / num_io;
+
+    if (slot >= t->num_slots) return NULL;
+    if (t->conns[slot].fd == -1) return NULL;
+    if (t->conns[slot].conn_id != msg->conn_id) return NULL;
+    return &t->conns[slot];
+}
+
+static void game_messages(struct io_thread *t) {
+    struct netio_msg msg;
+    struct io_conn *c;
+
+    while (ring_pop(&t->to_io, &msg)) {
+        switch (msg.type) {
+            case NETIO_ADOPT:
+                adopt_conn(t, &msg);
+                break;
+            case NETIO_OUTPUT:
+                c = find_conn(t, &msg);
+                if (c && c->out_off == c->out_len && msg.len <= outbuf_max) {
+                    /* nothing queued, keep the game's buffer as ours */
+                    if (c->outbuf) FREE(c->outbuf);
+                    c->outbuf = msg.data;
+                    c->out_cap = msg.len;
+                    c->out_off = 0;
+                    c->out_len = msg.len;
+                    msg.data = NULL;
+                } else if (c) {
+                    out_append(c, msg.data, msg.len);
+                }
+                if (msg.data) FREE(msg.data);
+                if (c) {
+                    /* write straight away; poll only for what doesn't fit */
+                    if (out_write(c))
+                        lost_conn(t, msg.devnum / num_io, NETIO_ERROR);
+                    else
+                        check_pressure(t, msg.devnum / num_io);
+                }
+                break;
+            case NETIO_CLOSE:
+                c = find_conn(t, &msg);
+                if (c) close_conn(c);
+                break;
+        }
+    }
+}
+
+static void accept_conns(struct io_thread *t) {
+    struct netio_msg msg;
+    socklen_t addr_len;
+    int fd;
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        addr_len = sizeof(msg.addr);
+        fd = accept(io_listen_fd, (struct sockaddr *)&msg.addr, &addr_len);
+        if (fd < 0) return;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        msg.type = NETIO_ACCEPT;
+        msg.devnum = -1;
+        msg.fd = fd;
+        to_game(t, &msg);
+    }
+}
+
+static void input_line(struct io_thread *t, int slot) {
+    struct io_conn *c = &t->conns[slot];
+    char *line;
+
+    line = MALLOC(c->inbuf_count + 1);
+    memcpy(line, c->inbuf, c->inbuf_count);
+    line[c->inbuf_count] = '\0';
+    send_event(t, slot, NETIO_LINE, 0, 0, line, c->inbuf_count);
+    c->inbuf_count = 0;
+}
+
+/**
+ * @brief Run received bytes through the telnet state machine
+ *
+ * Same rules as buffer_input() in intrface.c; negotiations and
+ * subnegotiations are forwarded since answering them needs game state.
+ */
+static void parse_input(struct io_thread *t, int slot, unsigned char *buf, int len) {
+    struct io_conn *c = &t->conns[slot];
+    unsigned char ch;
+    char *sb;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        ch = buf[i];
+        switch (c->telnet_state) {
+            case TELNET_STATE_DATA:
+                if (ch == TELNET_IAC) {
+                    c->telnet_state = TELNET_STATE_IAC;
+                } else if (ch == '\r' || ch == '\n') {
+                    if (c->inbuf_count > 0 || ch == '\n') {
+                        if (c->echo && ch == '\r')
+                            out_append(c, "\r\n", 2);
+                        input_line(t, slot);
+                    }
+                } else if (isprint(ch) || ch == '\t' || ch == '\b') {
+                    if (c->inbuf_count < MAX_STR_LEN - 2) {
+                        c->inbuf[c->inbuf_count++] = ch;
+                        if (c->echo)
+                            out_append(c, (char *)&ch, 1);
+                    }
+                }
+                break;
+
+            case TELNET_STATE_IAC:
+                if (ch == TELNET_IAC) {
+                    if (c->inbuf_count < MAX_STR_LEN - 2)
+                        c->inbuf[c->inbuf_count++] = ch;
+                    c->telnet_state = TELNET_STATE_DATA;
+                } else if (ch == TELNET_WILL) {
+                    c->telnet_state = TELNET_STATE_WILL;
+                } else if (ch == TELNET_WONT) {
+                    c->telnet_state = TELNET_STATE_WONT;
+                } else if (ch == TELNET_DO) {
+                    c->telnet_state = TELNET_STATE_DO;
+                } else if (ch == TELNET_DONT) {
+                    c->telnet_state = TELNET_STATE_DONT;
+                } else if (ch == TELNET_SB) {
+                    c->telnet_state = TELNET_STATE_SB;
+                    c->sb_len = 0;
+                } else {
+                    c->telnet_state = TELNET_STATE_DATA;
+                }
+                break;
+
+            case TELNET_STATE_WILL:
+            case TELNET_STATE_WONT:
+            case TELNET_STATE_DO:
+            case TELNET_STATE_DONT:
+                if (ch == TELOPT_ECHO && c->telnet_state == TELNET_STATE_DO)
+                    c->echo = 1;
+                else if (ch == TELOPT_ECHO && c->telnet_state == TELNET_STATE_DONT)
+                    c->echo = 0;
+                send_event(t, slot, NETIO_NEGOTIATE,
+                           c->telnet_state == TELNET_STATE_WILL ? TELNET_WILL :
+                           c->telnet_state == TELNET_STATE_WONT ? TELNET_WONT :
+                           c->telnet_state == TELNET_STATE_DO ? TELNET_DO :
+                           TELNET_DONT, ch, NULL, 0);
+                c->telnet_state = TELNET_STATE_DATA;
+                break;
+
+            case TELNET_STATE_SB:
+                c->sb_opt = ch;
+                c->sb_len = 0;
+                c->telnet_state = TELNET_STATE_SB_IAC;
+                break;
+
+            case TELNET_STATE_SB_IAC:
+                if (ch == TELNET_IAC)
+                    c->telnet_state = NETIO_STATE_SB_DATA_IAC;
+                else if (c->sb_len < TELNET_SB_MAX)
+                    c->sb_buf[c->sb_len++] = ch;
+                break;
+
+            case NETIO_STATE_SB_DATA_IAC:
+                if (ch == TELNET_SE) {
+                    sb = MALLOC(c->sb_len + 1);
+                    memcpy(sb, c->sb_buf, c->sb_len);
+                    send_event(t, slot, NETIO_SUBNEG, 0, c->sb_opt, sb, c->sb_len);
+                    c->telnet_state = TELNET_STATE_DATA;
+                } else {
+                    if (ch == TELNET_IAC && c->sb_len < TELNET_SB_MAX)
+                        c->sb_buf[c->sb_len++] = TELNET_IAC;
+                    c->telnet_state = TELNET_STATE_SB_IAC;
+                }
+                break;
+        }
+    }
+}
+
+static void read_conn(struct io_thread *t, int slot) {
+    unsigned char buf[4096];
+    int n;
+
+    n = read(t->conns[slot].fd, buf, sizeof(buf));
+    if (n == 0) {
+        lost_conn(t, slot, NETIO_EOF);
+    } else if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            lost_conn(t, slot, NETIO_ERROR);
+    } else {
+        parse_input(t, slot, buf, n);
+    }
+}
+
+static void *io_main(void *arg) {
+    struct io_thread *t = arg;
+    struct io_conn *c;
+    int nfds, i, slot;
+
+    while (1) {
+        game_messages(t);
+        if (atomic_load(&io_stopping)) break;
+
+        if (t->num_slots + 2 > t->fds_cap) {
+            t->fds_cap = t->num_slots + 2;
+            t->fds = realloc(t->fds, sizeof(struct pollfd) * t->fds_cap);
+            t->fd_slot = realloc(t->fd_slot, sizeof(int) * t->fds_cap);
+        }
+        nfds = 0;
+        t->fds[nfds].fd = t->wake_rd;
+        t->fds[nfds].events = POLLIN;
+        t->fd_slot[nfds++] = -1;
+        if (t->index == 0) {
+            t->fds[nfds].fd = io_listen_fd;
+            t->fds[nfds].events = POLLIN;
+            t->fd_slot[nfds++] = -1;
+        }
+        for (slot = 0; slot < t->num_slots; slot++) {
+            c = &t->conns[slot];
+            if (c->fd == -1) continue;
+            t->fds[nfds].fd = c->fd;
+            t->fds[nfds].events = POLLIN;
+            if (c->out_off < c->out_len) t->fds[nfds].events |= POLLOUT;
+            t->fd_slot[nfds++] = slot;
+        }
+
+        if (poll(t->fds, nfds, -1) < 0) continue;
+
+        if (t->fds[0].revents & POLLIN)
+            drain_wake(t->wake_rd, &t->wake_pending);
+        if (t->index == 0 && (t->fds[1].revents & POLLIN))
+            accept_conns(t);
+
+        for (i = 0; i < nfds; i++) {
+            slot = t->fd_slot[i];
+            if (slot == -1 || !t->fds[i].revents) continue;
+            c = &t->conns[slot];
+            if (t->fds[i].revents & POLLIN)
+                read_conn(t, slot);
+            else if (t->fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                lost_conn(t, slot, (t->fds[i].revents & POLLERR) ?
+                          NETIO_ERROR : NETIO_HANGUP);
+                continue;
+            }
+            if (c->fd != -1 && c->out_off < c->out_len) {
+                if (out_write(c))
+                    lost_conn(t, slot, NETIO_ERROR);
+                else
+                    check_pressure(t, slot);
+            }
+        }
+    }
+
+    for (slot = 0; slot < t->num_slots; slot++)
+        if (t->conns[slot].fd != -1)
+            close_conn(&t->conns[slot]);
+    return NULL;
+}
+
+/* ---------------------------------------------------------------------
+ * Game thread side
+ * --------------------------------------------------------------------- */
+
+/**
+ * @brief Start the I/O threads
+ *
+ * @param listen_fd Non-blocking listening socket, owned by thread 0 from now on
+ * @param num_threads Number of threads to start
+ * @return 0 on success, -1 if the threads or their pipes couldn't be created
+ */
+int netio_start(int listen_fd, int num_threads) {
+    int i;
+
+    io_listen_fd = listen_fd;
+    atomic_store(&io_stopping, 0);
+    atomic_store(&game_wake_pending, 0);
+    if (make_pipe(&game_wake_rd, &game_wake_wr)) return -1;
+
+    io = MALLOC(sizeof(struct io_thread) * num_threads);
+    memset(io, 0, sizeof(struct io_thread) * num_threads);
+    num_io = num_threads;
+    for (i = 0; i < num_threads; i++) {
+        io[i].index = i;
+        if (make_pipe(&io[i].wake_rd, &io[i].wake_wr)) break;
+        if (pthread_create(&io[i].tid, NULL, io_main, &io[i])) {
+            close(io[i].wake_rd);
+            close(io[i].wake_wr);
+            break;
+        }
+    }
+    if (i < num_threads) {
+        num_io = i;
+        netio_stop();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Stop the I/O threads
+ *
+ * Anything already queued to a thread is processed first, so output and
+ * closes issued before this call still reach the sockets.
+ */
+void netio_stop() {
+    struct netio_node *node;
+    int i;
+
+    netio_flush();
+    atomic_store(&io_stopping, 1);
+    for (i = 0; i < num_io; i++) {
+        write(io[i].wake_wr, "", 1);
+        pthread_join(io[i].tid, NULL);
+        close(io[i].wake_rd);
+        close(io[i].wake_wr);
+        while ((node = io[i].backlog_head)) {
+            io[i].backlog_head = node->next;
+            if (node->msg.type == NETIO_ADOPT) close(node->msg.fd);
+            if (node->msg.data) FREE(node->msg.data);
+            FREE(node);
+        }
+    }
+    if (io) FREE(io);
+    io = NULL;
+    num_io = 0;
+    close(game_wake_rd);
+    close(game_wake_wr);
+    game_wake_rd = game_wake_wr = -1;
+}
+
+/**
+ * @brief Descriptor the game loop polls to learn that messages are waiting
+ */
+int netio_wake_fd() {
+    return game_wake_rd;
+}
+
+/**
+ * @brief Deliver every waiting I/O thread message to handler
+ *
+ * The handler owns msg->data and must FREE it.
+ */
+void netio_drain(void (*handler)(struct netio_msg *)) {
+    struct netio_msg msg;
+    int i;
+
+    drain_wake(game_wake_rd, &game_wake_pending);
+    for (i = 0; i < num_io; i++)
+        while (ring_pop(&io[i].to_game, &msg))
+            handler(&msg);
+}
+
+static void to_io(struct netio_msg *msg) {
+    struct io_thread *t = &io[msg->devnum % num_io];
+    struct netio_node *node;
+
+    if (!t->backlog_head && !ring_push(&t->to_io, msg)) {
+        t->need_wake = 1;
+        return;
+    }
+    node = MALLOC(sizeof(struct netio_node));
+    node->msg = *msg;
+    node->next = NULL;
+    if (t->backlog_tail)
+        t->backlog_tail->next = node;
+    else
+        t->backlog_head = node;
+    t->backlog_tail = node;
+}
+
+void netio_adopt(int devnum, unsigned long conn_id, int fd) {
+    struct netio_msg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = NETIO_ADOPT;
+    msg.devnum = devnum;
+    msg.conn_id = conn_id;
+    msg.fd = fd;
+    to_io(&msg);
+}
+
+/**
+ * @brief Queue output for a connection; ownership of data passes to netio
+ */
+void netio_output(int devnum, unsigned long conn_id, char *data, int len) {
+    struct netio_msg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = NETIO_OUTPUT;
+    msg.devnum = devnum;
+    msg.conn_id = conn_id;
+    msg.data = data;
+    msg.len = len;
+    to_io(&msg);
+}
+
+void netio_close(int devnum, unsigned long conn_id) {
+    struct netio_msg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = NETIO_CLOSE;
+    msg.devnum = devnum;
+    msg.conn_id = conn_id;
+    to_io(&msg);
+}
+
+/**
+ * @brief Push any backlog into the rings and wake threads that have work
+ *
+ * Called once per pass of the game loop so a burst of output costs each
+ * I/O thread a single wakeup.
+ */
+void netio_flush() {
+    struct netio_node *node;
+    struct io_thread *t;
+    int i;
+
+    for (i = 0; i < num_io; i++) {
+        t = &io[i];
+        while ((node = t->backlog_head)) {
+            if (ring_push(&t->to_io, &node->msg)) break;
+            t->need_wake = 1;
+            t->backlog_head = node->next;
+            if (!t->backlog_head) t->backlog_tail = NULL;
+            FREE(node);
+        }
+        if (t->need_wake) {
+            t->need_wake = 0;
+            wake(t->wake_wr, &t->wake_pending);
+        }
+    }
+}
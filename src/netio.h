@@ -0,0 +1,55 @@
+/* netio.h */
+
+/* Network I/O threads.  When io_threads is non-zero the sockets are
+   owned by a small pool of threads that accept, read, parse telnet and
+   write; the game thread only ever sees complete lines and telnet
+   events, and only ever hands over finished output chunks.  The two
+   sides talk through single-producer/single-consumer rings, one pair
+   per I/O thread, so nothing on the interpreter side takes a lock. */
+
+#ifndef NETIO_H
+#define NETIO_H
+
+#include <netinet/in.h>
+
+/* I/O thread -> game thread */
+#define NETIO_ACCEPT    1   /* new socket in fd, peer in addr */
+#define NETIO_LINE      2   /* complete input line in data */
+#define NETIO_NEGOTIATE 3   /* IAC cmd opt received */
+#define NETIO_SUBNEG    4   /* IAC SB opt data IAC SE received */
+#define NETIO_CLOSED    5   /* socket went away, cmd holds the reason */
+#define NETIO_PRESSURE  9   /* output queue crossed outbuf_high (cmd 1) or
+                               drained to outbuf_low (cmd 0); len = bytes queued */
+
+/* game thread -> I/O thread */
+#define NETIO_ADOPT     6   /* take ownership of fd for devnum */
+#define NETIO_OUTPUT    7   /* queue data for writing, I/O thread frees it */
+#define NETIO_CLOSE     8   /* write what is pending and close */
+
+/* reasons carried by NETIO_CLOSED */
+#define NETIO_EOF       0
+#define NETIO_ERROR     1
+#define NETIO_HANGUP    2
+
+struct netio_msg {
+  int type;
+  int devnum;
+  unsigned long conn_id;   /* guards against messages for a reused slot */
+  int fd;
+  int len;
+  unsigned char cmd;
+  unsigned char opt;
+  char *data;              /* MALLOC'd, owned by whoever pops the message */
+  struct sockaddr_in addr;
+};
+
+int netio_start(int listen_fd, int num_threads);
+void netio_stop();
+int netio_wake_fd();
+void netio_drain(void (*handler)(struct netio_msg *));
+void netio_adopt(int devnum, unsigned long conn_id, int fd);
+void netio_output(int devnum, unsigned long conn_id, char *data, int len);
+void netio_close(int devnum, unsigned long conn_id);
+void netio_flush();
+
+#endif /* NETIO_H */
@@ -33,6 +33,20 @@
 #define ARRAY 17                    /* heap-allocated array pointer */
 #define MAPPING 18                  /* heap-allocated mapping pointer */
 
+/* Fused instructions, set by fuse_code().  Each replaces the type of the
+   l-value that starts a common sequence and leaves the rest of the
+   sequence in place: the interpreter runs the whole sequence at once when
+   the variable holds what it expects, and otherwise pushes the l-value
+   and carries on with the next instruction as before. */
+
+#define LOCAL_CMP_BRANCH 19         /* local, integer, comparison, BRANCH */
+#define GLOBAL_CMP_BRANCH 20        /* global, integer, comparison, BRANCH */
+#define LOCAL_STEP 21               /* local, ++ or --, then NEW_LINE or
+                                       JUMP; or local, integer, += or -=,
+                                       then NEW_LINE */
+#define LOCAL_RETURN 22             /* local, RETURN */
+#define GLOBAL_RETURN 23            /* global, RETURN */
+
 /* Forward declarations */
 struct heap_array;
 struct heap_mapping;
@@ -84,22 +98,39 @@ struct heap_array {
   struct var *elements;     /* Array of elements */
 };
 
-/* Heap-allocated mapping structure */
+/* Heap-allocated mapping structure
+ *
+ * Open-addressed table: one block holds capacity entries followed by
+ * capacity control bytes.  A control byte is MAPPING_CTRL_EMPTY,
+ * MAPPING_CTRL_DELETED, or the low 7 bits of the entry's hash for a used
+ * slot.  Lookups scan MAPPING_GROUP control bytes at a time and only touch
+ * entries whose hash tag matches.  capacity is always a power of two.
+ */
 #define DEFAULT_MAPPING_CAPACITY 16
-#define MAPPING_LOAD_FACTOR 0.75
+#define MAPPING_GROUP 8             /* control bytes probed per step */
+#define MAPPING_MAX_LOAD 7          /* grow past 7/8 full (counting tombstones) */
+#define MAPPING_CTRL_EMPTY 0x80
+#define MAPPING_CTRL_DELETED 0xfe
+#define MAPPING_SLOT_USED(map,i) (!((map)->ctrl[i] & 0x80))
+
+/* An l-value ref past the variables is a pointer to the var it names,
+   unless this bit is set: then it is a mapping value's mapping_ref, found
+   again each time it is used (see sys_mappings.c) */
+#define MAPPING_REF_TAG 1
 
 struct mapping_entry {
   struct var key;           /* Key (can be string, int, or object) */
   struct var value;         /* Value (any type) */
   unsigned int hash;        /* Cached hash value */
-  struct mapping_entry *next; /* For collision chaining */
 };
 
 struct heap_mapping {
   unsigned int size;        /* Current number of key-value pairs */
-  unsigned int capacity;    /* Allocated capacity (hash table size) */
+  unsigned int capacity;    /* Number of slots (power of two) */
   unsigned int refcount;    /* Reference count for garbage collection */
-  struct mapping_entry **buckets; /* Array of bucket chains */
+  unsigned int deleted;     /* Tombstoned slots, reclaimed on rehash */
+  struct mapping_entry *slots; /* Entry array, start of the table block */
+  unsigned char *ctrl;      /* Control bytes, inside the same block */
 };
 
 /* the var_stack structure is used as a stack of vars */
@@ -148,9 +179,16 @@ struct var_tab {
   struct var_tab *next;
 };
 
+/* a list of file names, such as the files a program #included */
+
+struct dep_list {
+  char *name;
+  struct dep_list *next;
+};
+
 /* The code structure contains information about code, including
-   num_refs, which keeps track of how many objects currently
-   reference the code */
+   num_refs, the number of loaded programs that build on it (inherit it
+   or lay out its variables), as last counted by unload.c */
 
 struct code
 {
@@ -168,6 +206,9 @@ struct code
   /* Per-program GST ref mapping: maps definer's gst[ref] -> {owner_proto, owner_local_index} */
   struct gst_ref_entry *gst_map;
   unsigned short gst_count;
+  /* Bytecode cache key over source, includes and parents (0 = none) */
+  unsigned long long src_key;
+  struct dep_list *includes;        /* files it #included, for recompile() */
 };
 
 /* the verb struct is a simple linked list of verbs */
@@ -217,6 +258,7 @@ struct object
   struct object *attacher;
   struct attach_list *attachees;
   struct var *globals;
+  struct var *load_globals;       /* PROTO: globals init() left, see unload.c */
   struct ref_list *refd_by;
   struct verb *verb_list;       /* PROTO: activated verbs */
   char obj_state;
@@ -226,6 +268,15 @@ struct object
   long last_access_time;          /* timestamp of last access (for idle tracking) */
   int heart_beat_interval;        /* heartbeat interval in seconds (0 = disabled) */
   long last_heart_beat;           /* timestamp of last heartbeat */
+  unsigned long cmd_pulse;        /* pulse cmd_count/cmd_cycles belong to */
+  unsigned long cmd_round;        /* last command round this object had */
+  int cmd_count;                  /* commands run this pulse */
+  long cmd_cycles;                /* interpreter cycles used this pulse */
+  struct cmdq *cmds;              /* queued input, oldest first */
+  struct cmdq *last_cmd;
+  int num_cmds;
+  int cmd_dropped;                /* input refused since the queue was full */
+  struct object *next_cmd_obj;    /* in cmd_head or cmd_held, see dbhandle.c */
 };
 
 /* legal object states */
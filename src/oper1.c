@@ -68,7 +68,11 @@ int eq_oper(struct object *caller, struct object *obj,
     /* Check if this is a heap array element (pointer) or regular global */
     if (tmp1.value.l_value.ref >= obj->parent->funcs->num_globals) {
       /* Heap array element - direct pointer assignment */
-      struct var *element_ptr = (struct var *)tmp1.value.l_value.ref;
+      struct var *element_ptr = element_slot(tmp1.value.l_value.ref);
+      if (!element_ptr) {
+        clear_var(&tmp2);
+        return 1;
+      }
       /* Clear old value before overwriting */
       if (element_ptr->type == STRING || element_ptr->type == FUNC_NAME || 
           element_ptr->type == EXTERN_FUNC) {
@@ -106,7 +110,11 @@ int eq_oper(struct object *caller, struct object *obj,
     /* Check if this is a heap array element (pointer) or regular local */
     if (tmp1.value.l_value.ref >= num_locals) {
       /* Heap array element - direct pointer assignment */
-      struct var *element_ptr = (struct var *)tmp1.value.l_value.ref;
+      struct var *element_ptr = element_slot(tmp1.value.l_value.ref);
+      if (!element_ptr) {
+        clear_var(&tmp2);
+        return 1;
+      }
       /* Clear old value before overwriting */
       if (element_ptr->type == STRING || element_ptr->type == FUNC_NAME || 
           element_ptr->type == EXTERN_FUNC) {
@@ -127,12 +135,77 @@ int eq_oper(struct object *caller, struct object *obj,
   return 0;
 }
 
-EQ_INT_OPER(intaddeq, += )
+/* Helpers for pleq_oper().  The left-hand side of += is grown in place
+ * when nothing else shares it; otherwise a new value is built as for +.
+ */
+
+/* Grow a string to hold len characters.  The block is sized to the next
+ * power of two so that, in a loop of appends, realloc() finds it already
+ * big enough most of the time and returns it untouched.
+ */
+static char *grow_string(char *str, unsigned long len) {
+  unsigned long cap;
+
+  cap=32;
+  while (cap<=len) cap<<=1;
+  return realloc(str,cap);
+}
+
+static int pleq_string(struct var *slot, char *add) {
+  unsigned long len,addlen;
+  char *tmpstr;
+
+  len=strlen(slot->value.string);
+  addlen=strlen(add);
+  if (!addlen) return 0;
+  if (!(tmpstr=grow_string(slot->value.string,len+addlen))) return 1;
+  memcpy(tmpstr+len,add,addlen+1);
+  slot->value.string=tmpstr;
+  return 0;
+}
+
+static int pleq_array(struct var *slot, struct heap_array *add) {
+  struct heap_array *arr,*result;
+  unsigned int i,size;
+
+  arr=slot->value.array_ptr;
+  size=arr->size;
+  if (arr->refcount==1 && (arr->max_size==UNLIMITED_ARRAY_SIZE ||
+                           size+add->size<=arr->max_size)) {
+    if (resize_heap_array(arr,size+add->size)) return 1;
+    for (i=0;i<add->size;i++)
+      copy_var(&(arr->elements[size+i]),&(add->elements[i]));
+    return 0;
+  }
+  if (!(result=array_concat(arr,add))) return 1;
+  array_release(arr);
+  slot->value.array_ptr=result;
+  return 0;
+}
+
+static int pleq_mapping(struct var *slot, struct heap_mapping *add) {
+  struct heap_mapping *map,*result;
+  unsigned int i;
+
+  map=slot->value.mapping_ptr;
+  if (map->refcount==1) {
+    for (i=0;i<add->capacity;i++)
+      if (MAPPING_SLOT_USED(add,i) &&
+          mapping_set(map,&(add->slots[i].key),&(add->slots[i].value)))
+        return 1;
+    return 0;
+  }
+  if (!(result=mapping_merge(map,add))) return 1;
+  mapping_release(map);
+  slot->value.mapping_ptr=result;
+  return 0;
+}
 
 int pleq_oper(struct object *caller, struct object *obj,
               struct object *player, struct var_stack **rts) {
   struct var tmp1,tmp2;
-  char *tmpstr;
+  struct var *slot;
+  int failed;
 
   if (pop(&tmp2,rts,obj)) return 1;
   if (pop(&tmp1,rts,obj)) {
@@ -154,157 +227,45 @@ int pleq_oper(struct object *caller, struct object *obj,
     clear_var(&tmp2);
     return 1;
   }
-  if (tmp1.type==GLOBAL_L_VALUE) {
-    /* Compute effective global index for all accesses */
-    extern struct call_frame *call_stack;
-    int ok_eff = 0;
-    unsigned int eff_idx = global_index_for(obj, call_stack ? call_stack->func : NULL,
-                                           (unsigned int)tmp1.value.l_value.ref, &ok_eff);
-    if (!ok_eff) { clear_var(&tmp1); clear_var(&tmp2); return 1; }
-    if (tmp2.type==INTEGER && obj->globals[eff_idx].type==
-        INTEGER) {
-      push(&tmp1,rts);
-      push(&tmp2,rts);
-      return intaddeq(caller,obj,player,rts);
-    }
-    /* Array concatenation assignment: array += array */
-    if (tmp2.type==ARRAY && obj->globals[eff_idx].type==ARRAY) {
-      struct heap_array *result;
-      
-      result = array_concat(obj->globals[eff_idx].value.array_ptr, tmp2.value.array_ptr);
-      if (!result) {
-        clear_var(&tmp1);
-        clear_var(&tmp2);
-        return 1;
-      }
-      
-      /* Release old array, assign new one */
-      array_release(obj->globals[eff_idx].value.array_ptr);
-      obj->globals[eff_idx].value.array_ptr = result;
-      obj->obj_state=DIRTY;
-      
-      clear_var(&tmp1);
-      clear_var(&tmp2);
-      return 0;
-    }
-    /* Mapping merge assignment: mapping += mapping */
-    if (tmp2.type==MAPPING && obj->globals[eff_idx].type==MAPPING) {
-      struct heap_mapping *result;
-      
-      result = mapping_merge(obj->globals[eff_idx].value.mapping_ptr, tmp2.value.mapping_ptr);
-      if (!result) {
-        clear_var(&tmp1);
-        clear_var(&tmp2);
-        return 1;
-      }
-      
-      /* Release old mapping, assign new one */
-      mapping_release(obj->globals[eff_idx].value.mapping_ptr);
-      obj->globals[eff_idx].value.mapping_ptr = result;
-      obj->obj_state=DIRTY;
-      
-      clear_var(&tmp1);
-      clear_var(&tmp2);
-      return 0;
-    }
-    if (tmp2.type==INTEGER && tmp2.value.integer==0) {
-      tmp2.type=STRING;
-      tmp2.value.string=copy_string("");
-    }
-    if (tmp2.type==STRING) {
-      if (obj->globals[eff_idx].type==INTEGER && obj->globals
-          [eff_idx].value.integer==0) {
-        obj->globals[eff_idx].type=STRING;
-        obj->globals[eff_idx].value.string=copy_string("");
-      }
-    }
-    if (tmp2.type!=STRING || obj->globals[eff_idx].type!=
-        STRING) {
-      clear_var(&tmp1);
-      clear_var(&tmp2);
-      return 1;
-    }
-    tmpstr=MALLOC(strlen(obj->globals[eff_idx].value.string)+
-                  strlen(tmp2.value.string)+1);
-    strcat(strcpy(tmpstr,obj->globals[eff_idx].value.string),
-           tmp2.value.string);
-    clear_global_var(obj,eff_idx);
-    obj->globals[eff_idx].type=STRING;
-    obj->globals[eff_idx].value.string=tmpstr;
-    obj->obj_state=DIRTY;
-  } else {
-    if (tmp2.type==INTEGER && locals[tmp1.value.l_value.ref].type==INTEGER) {
-      push(&tmp1,rts);
-      push(&tmp2,rts);
-      return intaddeq(caller,obj,player,rts);
-    }
+  /* the variable, or the array element or mapping value, being added to */
+  if (!(slot=lvalue_slot(&tmp1,obj))) {
+    clear_var(&tmp2);
+    return 1;
+  }
+  if (tmp1.type==GLOBAL_L_VALUE) obj->obj_state=DIRTY;
+  if (tmp2.type==INTEGER && slot->type==INTEGER) {
+    slot->value.integer+=tmp2.value.integer;
+    push(slot,rts);
+    return 0;
+  }
+  if (tmp2.type==ARRAY && slot->type==ARRAY)
     /* Array concatenation assignment: array += array */
-    if (tmp2.type==ARRAY && locals[tmp1.value.l_value.ref].type==ARRAY) {
-      struct heap_array *result;
-      
-      result = array_concat(locals[tmp1.value.l_value.ref].value.array_ptr, tmp2.value.array_ptr);
-      if (!result) {
-        clear_var(&tmp1);
-        clear_var(&tmp2);
-        return 1;
-      }
-      
-      /* Release old array, assign new one */
-      array_release(locals[tmp1.value.l_value.ref].value.array_ptr);
-      locals[tmp1.value.l_value.ref].value.array_ptr = result;
-      
-      clear_var(&tmp1);
-      clear_var(&tmp2);
-      return 0;
-    }
+    failed=pleq_array(slot,tmp2.value.array_ptr);
+  else if (tmp2.type==MAPPING && slot->type==MAPPING)
     /* Mapping merge assignment: mapping += mapping */
-    if (tmp2.type==MAPPING && locals[tmp1.value.l_value.ref].type==MAPPING) {
-      struct heap_mapping *result;
-      
-      result = mapping_merge(locals[tmp1.value.l_value.ref].value.mapping_ptr, tmp2.value.mapping_ptr);
-      if (!result) {
-        clear_var(&tmp1);
-        clear_var(&tmp2);
-        return 1;
-      }
-      
-      /* Release old mapping, assign new one */
-      mapping_release(locals[tmp1.value.l_value.ref].value.mapping_ptr);
-      locals[tmp1.value.l_value.ref].value.mapping_ptr = result;
-      
-      clear_var(&tmp1);
-      clear_var(&tmp2);
-      return 0;
-    }
+    failed=pleq_mapping(slot,tmp2.value.mapping_ptr);
+  else {
     if (tmp2.type==INTEGER && tmp2.value.integer==0) {
       tmp2.type=STRING;
       tmp2.value.string=copy_string("");
     }
     if (tmp2.type==STRING) {
-      if (locals[tmp1.value.l_value.ref].type==INTEGER && locals[tmp1.value.
-          l_value.ref].value.integer==0) {
-        locals[tmp1.value.l_value.ref].type=STRING;
-        locals[tmp1.value.l_value.ref].value.string=copy_string("");
+      if (slot->type==INTEGER && slot->value.integer==0) {
+        slot->type=STRING;
+        slot->value.string=copy_string("");
       }
     }
-    if (tmp2.type!=STRING || locals[tmp1.value.l_value.ref].type!=
-        STRING) {
+    if (tmp2.type!=STRING || slot->type!=STRING) {
       clear_var(&tmp1);
       clear_var(&tmp2);
       return 1;
     }
-    tmpstr=MALLOC(strlen(locals[tmp1.value.l_value.ref].value.string)+
-                  strlen(tmp2.value.string)+1);
-    strcat(strcpy(tmpstr,locals[tmp1.value.l_value.ref].value.string),
-           tmp2.value.string);
-    clear_var(&(locals[tmp1.value.l_value.ref]));
-    locals[tmp1.value.l_value.ref].type=STRING;
-    locals[tmp1.value.l_value.ref].value.string=tmpstr;
+    failed=pleq_string(slot,tmp2.value.string);
   }
-  clear_var(&tmp1);
   clear_var(&tmp2);
-  tmp1.type=STRING;
-  tmp1.value.string=tmpstr;
+  if (failed) return 1;
+  /* The value of the expression is the variable itself; it is only
+     resolved (and a string only copied) if something uses it */
   push(&tmp1,rts);
   return 0;
 }
@@ -34,119 +34,73 @@ int bitnot_oper(struct object *caller, struct object *obj,
 
 int postadd_oper(struct object *caller, struct object *obj,
                  struct object *player, struct var_stack **rts) {
-  struct var tmp1,tmp2;
+  struct var tmp1,*slot;
 
   if (pop(&tmp1,rts,obj)) return 1;
   if (tmp1.type!=GLOBAL_L_VALUE && tmp1.type!=LOCAL_L_VALUE) {
     clear_var(&tmp1);
     return 1;
   }
-  tmp2=tmp1;
-  if (resolve_var(&tmp2,obj)) return 1;
-  if (tmp2.type!=INTEGER) {
-    clear_var(&tmp2);
-    return 1;
-  }
-  push(&tmp2,rts);
-  if (tmp1.type==GLOBAL_L_VALUE) {
-    extern struct call_frame *call_stack;
-    int ok = 0;
-    unsigned int eff = global_index_for(obj, call_stack ? call_stack->func : NULL,
-                                        (unsigned int)tmp1.value.l_value.ref, &ok);
-    if (!ok) { clear_var(&tmp1); clear_var(&tmp2); return 1; }
-    ++(obj->globals[eff].value.integer);
-    obj->obj_state=DIRTY;
-  } else
-    ++(locals[tmp1.value.l_value.ref].value.integer);
+  /* the variable, or the array element or mapping value, being stepped */
+  if (!(slot=lvalue_slot(&tmp1,obj))) return 1;
+  if (slot->type!=INTEGER) return 1;
+  push(slot,rts);
+  ++(slot->value.integer);
+  if (tmp1.type==GLOBAL_L_VALUE) obj->obj_state=DIRTY;
   return 0;
 }
 
 int preadd_oper(struct object *caller, struct object *obj,
                 struct object *player, struct var_stack **rts) {
-  struct var tmp1,tmp2;
+  struct var tmp1,*slot;
 
   if (pop(&tmp1,rts,obj)) return 1;
   if (tmp1.type!=GLOBAL_L_VALUE && tmp1.type!=LOCAL_L_VALUE) {
     clear_var(&tmp1);
     return 1;
   }
-  tmp2=tmp1;
-  if (resolve_var(&tmp2,obj)) return 1;
-  if (tmp2.type!=INTEGER) {
-    clear_var(&tmp2);
-    return 1;
-  }
-  ++(tmp2.value.integer);
-  push(&tmp2,rts);
-  if (tmp1.type==GLOBAL_L_VALUE) {
-    extern struct call_frame *call_stack;
-    int ok = 0;
-    unsigned int eff = global_index_for(obj, call_stack ? call_stack->func : NULL,
-                                        (unsigned int)tmp1.value.l_value.ref, &ok);
-    if (!ok) { clear_var(&tmp1); clear_var(&tmp2); return 1; }
-    ++(obj->globals[eff].value.integer);
-    obj->obj_state=DIRTY;
-  } else
-    ++(locals[tmp1.value.l_value.ref].value.integer);
+  /* the variable, or the array element or mapping value, being stepped */
+  if (!(slot=lvalue_slot(&tmp1,obj))) return 1;
+  if (slot->type!=INTEGER) return 1;
+  ++(slot->value.integer);
+  push(slot,rts);
+  if (tmp1.type==GLOBAL_L_VALUE) obj->obj_state=DIRTY;
   return 0;
 }
 
 int postmin_oper(struct object *caller, struct object *obj,
                  struct object *player, struct var_stack **rts) {
-  struct var tmp1,tmp2;
+  struct var tmp1,*slot;
 
   if (pop(&tmp1,rts,obj)) return 1;
   if (tmp1.type!=GLOBAL_L_VALUE && tmp1.type!=LOCAL_L_VALUE) {
     clear_var(&tmp1);
     return 1;
   }
-  tmp2=tmp1;
-  if (resolve_var(&tmp2,obj)) return 1;
-  if (tmp2.type!=INTEGER) {
-    clear_var(&tmp2);
-    return 1;
-  }
-  push(&tmp2,rts);
-  if (tmp1.type==GLOBAL_L_VALUE) {
-    extern struct call_frame *call_stack;
-    int ok = 0;
-    unsigned int eff = global_index_for(obj, call_stack ? call_stack->func : NULL,
-                                        (unsigned int)tmp1.value.l_value.ref, &ok);
-    if (!ok) { clear_var(&tmp1); clear_var(&tmp2); return 1; }
-    --(obj->globals[eff].value.integer);
-    obj->obj_state=DIRTY;
-  } else
-    --(locals[tmp1.value.l_value.ref].value.integer);
+  /* the variable, or the array element or mapping value, being stepped */
+  if (!(slot=lvalue_slot(&tmp1,obj))) return 1;
+  if (slot->type!=INTEGER) return 1;
+  push(slot,rts);
+  --(slot->value.integer);
+  if (tmp1.type==GLOBAL_L_VALUE) obj->obj_state=DIRTY;
   return 0;
 }
 
 int premin_oper(struct object *caller, struct object *obj,
                 struct object *player, struct var_stack **rts) {
-  struct var tmp1,tmp2;
+  struct var tmp1,*slot;
 
   if (pop(&tmp1,rts,obj)) return 1;
   if (tmp1.type!=GLOBAL_L_VALUE && tmp1.type!=LOCAL_L_VALUE) {
     clear_var(&tmp1);
     return 1;
   }
-  tmp2=tmp1;
-  if (resolve_var(&tmp2,obj)) return 1;
-  if (tmp2.type!=INTEGER) {
-    clear_var(&tmp2);
-    return 1;
-  }
-  --(tmp2.value.integer);
-  push(&tmp2,rts);
-  if (tmp1.type==GLOBAL_L_VALUE) {
-    extern struct call_frame *call_stack;
-    int ok = 0;
-    unsigned int eff = global_index_for(obj, call_stack ? call_stack->func : NULL,
-                                        (unsigned int)tmp1.value.l_value.ref, &ok);
-    if (!ok) { clear_var(&tmp1); clear_var(&tmp2); return 1; }
-    --(obj->globals[eff].value.integer);
-    obj->obj_state=DIRTY;
-  } else
-    --(locals[tmp1.value.l_value.ref].value.integer);
+  /* the variable, or the array element or mapping value, being stepped */
+  if (!(slot=lvalue_slot(&tmp1,obj))) return 1;
+  if (slot->type!=INTEGER) return 1;
+  --(slot->value.integer);
+  push(slot,rts);
+  if (tmp1.type==GLOBAL_L_VALUE) obj->obj_state=DIRTY;
   return 0;
 }
 
@@ -160,9 +114,69 @@ int umin_oper(struct object *caller, struct object *obj,
   return 0;
 }
 
-BI_INT_OPER(bitor_oper, | )
+/* Shared by bitor_oper and bitand_oper: integers combine bitwise, two
+ * arrays give their union (|) or intersection (&) without duplicates */
+static int set_oper(struct object *obj, struct var_stack **rts, int is_union) {
+  struct var tmp1, tmp2;
+  struct heap_array *result;
+  
+  if (pop(&tmp2, rts, obj)) return 1;
+  if (pop(&tmp1, rts, obj)) {
+    clear_var(&tmp2);
+    return 1;
+  }
+  if (resolve_var(&tmp1, obj)) {
+    clear_var(&tmp1);
+    clear_var(&tmp2);
+    return 1;
+  }
+  if (resolve_var(&tmp2, obj)) {
+    clear_var(&tmp1);
+    clear_var(&tmp2);
+    return 1;
+  }
+  
+  if (tmp1.type == INTEGER && tmp2.type == INTEGER) {
+    if (is_union)
+      tmp1.value.integer |= tmp2.value.integer;
+    else
+      tmp1.value.integer &= tmp2.value.integer;
+    push(&tmp1, rts);
+    return 0;
+  }
+  
+  if (tmp1.type != ARRAY || tmp2.type != ARRAY ||
+      !tmp1.value.array_ptr || !tmp2.value.array_ptr) {
+    clear_var(&tmp1);
+    clear_var(&tmp2);
+    return 1;
+  }
+  if (is_union)
+    result = array_union(tmp1.value.array_ptr, tmp2.value.array_ptr);
+  else
+    result = array_intersect(tmp1.value.array_ptr, tmp2.value.array_ptr);
+  clear_var(&tmp1);
+  clear_var(&tmp2);
+  if (!result) return 1;
+  
+  tmp1.type = ARRAY;
+  tmp1.value.array_ptr = result;
+  push(&tmp1, rts);
+  return 0;
+}
+
+int bitor_oper(struct object *caller, struct object *obj,
+               struct object *player, struct var_stack **rts) {
+  return set_oper(obj, rts, 1);
+}
+
 BI_INT_OPER(exor_oper, ^ )
-BI_INT_OPER(bitand_oper, & )
+
+int bitand_oper(struct object *caller, struct object *obj,
+                struct object *player, struct var_stack **rts) {
+  return set_oper(obj, rts, 0);
+}
+
 CND_OPER(less_oper, < )
 CND_OPER(lesseq_oper, <= )
 CND_OPER(great_oper, > )
@@ -0,0 +1,513 @@
+/**
+ * @file optimize.c
+ * @brief Optimizing pass over a compiled program's functions
+ *
+ * parse_exp() and parse_line() emit code as they read it, so a constant
+ * expression is still worked out every time it runs, "if (0)" still
+ * branches, and the end of an if is a NEW_LINE that the next statement
+ * follows with one of its own.  When a program asks for it with
+ * "#pragma optimize", or optimize=1 is set in netci.ini, parse_code()
+ * hands each function to optimize_code() once the program has parsed
+ * ("#pragma no_optimize" turns it off again; whichever the program,
+ * or a file it #includes, says last is what counts):
+ *
+ *  - constant folding: an operator on constants that are already in the
+ *    code becomes its result, by the operator's own rules.  Anything
+ *    the operator would fail on (dividing by zero, adding a number to a
+ *    string) is left to fail at runtime.
+ *  - a BRANCH on a constant becomes a JUMP, or goes away
+ *  - jump threading: a JUMP or BRANCH to a JUMP goes to where that leads
+ *  - unreachable code, and JUMPs to the next instruction, are removed
+ *  - dead stores: a constant assigned to a local that nothing reads
+ *    (never an array or mapping local, which a subscript reads unseen)
+ *  - NEW_LINE coalescing: each NEW_LINE clears the stack and sets the
+ *    line, so of two in a row only the second matters
+ *
+ * Nothing is merged where something jumps into the middle of it, and
+ * every instruction that can raise an error keeps the NEW_LINE in front
+ * of it, so errors and tracebacks report the lines they did before.
+ * The passes repeat, since each one leaves work for the others.
+ *
+ * fuse_code() runs on every program, optimized or not.  It marks the
+ * sequences that counting over the bundled mudlibs found most often in
+ * loops and accessors (a local or global compared with a constant and
+ * branched on, a local stepped by ++, --, += or -= as a statement, and
+ * returning a local or global) so the interpreter can run each one as a
+ * single instruction, without the operand stack.  See object.h.
+ */
+
+#include "config.h"
+
+#include <limits.h>
+
+#include "object.h"
+#include "instr.h"
+#include "constrct.h"
+#include "globals.h"
+#include "optimize.h"
+
+#define OPT_ROUNDS  4             /* passes over a function at most */
+#define OPT_THREAD  16            /* jumps followed from one JUMP at most */
+
+#define is_const(v) ((v)->type==INTEGER || (v)->type==STRING)
+#define is_jump(v)  ((v)->type==JUMP || (v)->type==BRANCH)
+
+/* true as BRANCH and the logical operators see it */
+#define truth(v)    (!((v)->type==INTEGER && (v)->value.integer==0))
+
+/* ========================================================================
+ * FOLDING
+ * ======================================================================== */
+
+/* What cmp against a string gives: "" for the number 0, as CND_OPER
+   does, and NULL for anything a comparison would fail on */
+static char *cmp_string(struct var *v)
+{
+  if (v->type==STRING) return v->value.string;
+  if (v->value.integer==0) return "";
+  return NULL;
+}
+
+/* Work out a op b into *r.  Returns 0, or 1 if it must be left to the
+   interpreter. */
+static int fold_binary(unsigned char op, struct var *a, struct var *b,
+                       struct var *r)
+{
+  signed long x,y;
+  char *s1,*s2;
+  int cmp;
+
+  r->type=INTEGER;
+  switch (op) {
+    case OR_OPER:
+      r->value.integer=(truth(a) || truth(b));
+      return 0;
+    case AND_OPER:
+      r->value.integer=(truth(a) && truth(b));
+      return 0;
+    case CONDEQ_OPER:
+    case NOTEQ_OPER:
+      if (a->type==STRING && b->type==STRING)
+        cmp=!strcmp(a->value.string,b->value.string);
+      else
+        cmp=(a->type==INTEGER && b->type==INTEGER &&
+             a->value.integer==b->value.integer);
+      r->value.integer=(op==CONDEQ_OPER) ? cmp : !cmp;
+      return 0;
+    case LESS_OPER:
+    case LESSEQ_OPER:
+    case GREAT_OPER:
+    case GREATEQ_OPER:
+      if (a->type==STRING || b->type==STRING) {
+        if (!(s1=cmp_string(a)) || !(s2=cmp_string(b))) return 1;
+        cmp=strcmp(s1,s2);
+      } else
+        cmp=(a->value.integer>b->value.integer)-
+            (a->value.integer<b->value.integer);
+      if (op==LESS_OPER)
+        r->value.integer=(cmp<0);
+      else if (op==LESSEQ_OPER)
+        r->value.integer=(cmp<=0);
+      else if (op==GREAT_OPER)
+        r->value.integer=(cmp>0);
+      else
+        r->value.integer=(cmp>=0);
+      return 0;
+    case ADD_OPER:
+      if (a->type==STRING || b->type==STRING) {
+        if (!(s1=cmp_string(a)) || !(s2=cmp_string(b))) return 1;
+        r->type=STRING;
+        r->value.string=MALLOC(strlen(s1)+strlen(s2)+1);
+        strcat(strcpy(r->value.string,s1),s2);
+        return 0;
+      }
+      break;
+  }
+  if (a->type!=INTEGER || b->type!=INTEGER) return 1;
+  x=a->value.integer;
+  y=b->value.integer;
+  /* wrap the way the interpreter's arithmetic does in practice, without
+     relying on signed overflow here */
+  switch (op) {
+    case ADD_OPER:
+      r->value.integer=(signed long) ((unsigned long) x+(unsigned long) y);
+      return 0;
+    case MIN_OPER:
+      r->value.integer=(signed long) ((unsigned long) x-(unsigned long) y);
+      return 0;
+    case MUL_OPER:
+      r->value.integer=(signed long) ((unsigned long) x*(unsigned long) y);
+      return 0;
+    case DIV_OPER:
+    case MOD_OPER:
+      if (y==0 || (y==-1 && x==LONG_MIN)) return 1;
+      r->value.integer=(op==DIV_OPER) ? x/y : x%y;
+      return 0;
+    case BITOR_OPER:
+      r->value.integer=x|y;
+      return 0;
+    case BITAND_OPER:
+      r->value.integer=x&y;
+      return 0;
+    case EXOR_OPER:
+      r->value.integer=x^y;
+      return 0;
+    case LS_OPER:
+    case RS_OPER:
+      if (y<0 || y>=(signed long) (sizeof(long)*8)) return 1;
+      if (op==LS_OPER)
+        r->value.integer=(signed long) ((unsigned long) x<<y);
+      else
+        r->value.integer=x>>y;
+      return 0;
+  }
+  return 1;
+}
+
+static int fold_unary(unsigned char op, struct var *a, struct var *r)
+{
+  r->type=INTEGER;
+  if (op==NOT_OPER) {
+    r->value.integer=!truth(a);
+    return 0;
+  }
+  if (a->type!=INTEGER) return 1;
+  if (op==UMIN_OPER) {
+    r->value.integer=(signed long) (0UL-(unsigned long) a->value.integer);
+    return 0;
+  }
+  if (op==BITNOT_OPER) {
+    r->value.integer=~(a->value.integer);
+    return 0;
+  }
+  return 1;
+}
+
+static int is_binary(unsigned char op)
+{
+  return (op>=OR_OPER && op<=MOD_OPER);
+}
+
+static int is_unary(unsigned char op)
+{
+  return (op==NOT_OPER || op==BITNOT_OPER || op==UMIN_OPER);
+}
+
+/* ========================================================================
+ * PASSES
+ * ======================================================================== */
+
+static unsigned char *find_targets(struct fns *func)
+{
+  unsigned char *target;
+  unsigned long x;
+
+  target=MALLOC(func->num_instr);
+  memset(target,0,func->num_instr);
+  for (x=0;x<func->num_instr;x++)
+    if (is_jump(&(func->code[x])) && func->code[x].value.num<func->num_instr)
+      target[func->code[x].value.num]=1;
+  return target;
+}
+
+/* Folding, constant branches and NEW_LINE coalescing, in one walk that
+   rewrites the code in place.  Returns how many instructions went. */
+static unsigned long fold_pass(struct fns *func)
+{
+  struct var *code,*in,*last,result;
+  unsigned char *target,*out_target;
+  unsigned long *map,x,n;
+
+  code=func->code;
+  target=find_targets(func);
+  out_target=MALLOC(func->num_instr);
+  map=MALLOC(sizeof(unsigned long)*(func->num_instr+1));
+  n=0;
+  for (x=0;x<func->num_instr;x++) {
+    in=&(code[x]);
+    last=n ? &(code[n-1]) : NULL;
+    if (in->type==NEW_LINE && last && last->type==NEW_LINE) {
+      last->value.num=in->value.num;
+      out_target[n-1]|=target[x];
+      map[x]=n-1;
+      continue;
+    }
+    if (in->type==ASM_INSTR && !target[x] && is_binary(in->value.instruction)
+        && n>=2 && is_const(last) && is_const(&(code[n-2])) && !out_target[n-1]
+        && !fold_binary(in->value.instruction,&(code[n-2]),last,&result)) {
+      clear_var(&(code[n-2]));
+      clear_var(last);
+      code[n-2]=result;
+      n--;
+      map[x]=n-1;
+      continue;
+    }
+    if (in->type==ASM_INSTR && !target[x] && is_unary(in->value.instruction)
+        && n>=1 && is_const(last)
+        && !fold_unary(in->value.instruction,last,&result)) {
+      clear_var(last);
+      *last=result;
+      map[x]=n-1;
+      continue;
+    }
+    if (in->type==BRANCH && !target[x] && n>=1 && is_const(last)) {
+      if (truth(last)) {
+        /* never taken: neither the constant nor the branch is needed */
+        clear_var(last);
+        n--;
+        map[x]=n;
+      } else {
+        clear_var(last);
+        last->type=JUMP;
+        last->value.num=in->value.num;
+        map[x]=n-1;
+      }
+      continue;
+    }
+    map[x]=n;
+    out_target[n]=target[x];
+    code[n++]=*in;
+  }
+  map[func->num_instr]=n;
+  for (x=0;x<n;x++)
+    if (is_jump(&(code[x])))
+      code[x].value.num=map[code[x].value.num];
+  x=func->num_instr-n;
+  func->num_instr=n;
+  FREE(map);
+  FREE(out_target);
+  FREE(target);
+  return x;
+}
+
+/* Drop the instructions keep[] says to, pointing jumps at whatever now
+   follows a removed target.  Returns how many went. */
+static unsigned long compact(struct fns *func, unsigned char *keep)
+{
+  unsigned long *map,x,n,removed;
+
+  map=MALLOC(sizeof(unsigned long)*(func->num_instr+1));
+  n=0;
+  for (x=0;x<func->num_instr;x++) {
+    map[x]=n;
+    if (keep[x]) n++;
+  }
+  map[func->num_instr]=n;
+  removed=func->num_instr-n;
+  if (removed) {
+    n=0;
+    for (x=0;x<func->num_instr;x++) {
+      if (!keep[x]) {
+        clear_var(&(func->code[x]));
+        continue;
+      }
+      func->code[n]=func->code[x];
+      if (is_jump(&(func->code[n])))
+        func->code[n].value.num=map[func->code[n].value.num];
+      n++;
+    }
+    func->num_instr=n;
+  }
+  FREE(map);
+  return removed;
+}
+
+/* Where a jump to t really ends up: past JUMPs, and past a NEW_LINE that
+   only leads to a JUMP to another NEW_LINE, which clears the stack and
+   sets the line before anything could need them */
+static unsigned long thread(struct fns *func, unsigned long t)
+{
+  struct var *code;
+  int hops;
+
+  code=func->code;
+  for (hops=0;hops<OPT_THREAD;hops++)
+    if (code[t].type==JUMP)
+      t=code[t].value.num;
+    else if (code[t].type==NEW_LINE && t+1<func->num_instr &&
+             code[t+1].type==JUMP &&
+             code[code[t+1].value.num].type==NEW_LINE &&
+             code[t+1].value.num!=t)
+      t=code[t+1].value.num;
+    else
+      break;
+  return t;
+}
+
+/* Jump threading, then everything that can't be reached: code after a
+   RETURN or JUMP that nothing jumps to, and JUMPs to the next
+   instruction */
+static unsigned long flow_pass(struct fns *func)
+{
+  struct var *code;
+  unsigned char *keep;
+  unsigned long *todo,x,num_todo,removed;
+
+  code=func->code;
+  for (x=0;x<func->num_instr;x++)
+    if (is_jump(&(code[x])))
+      code[x].value.num=thread(func,code[x].value.num);
+  keep=MALLOC(func->num_instr);
+  memset(keep,0,func->num_instr);
+  todo=MALLOC(sizeof(unsigned long)*func->num_instr);
+  num_todo=0;
+  keep[0]=1;
+  todo[num_todo++]=0;
+  while (num_todo) {
+    x=todo[--num_todo];
+    while (1) {
+      if (is_jump(&(code[x])) && !keep[code[x].value.num]) {
+        keep[code[x].value.num]=1;
+        todo[num_todo++]=code[x].value.num;
+      }
+      if (code[x].type==JUMP || code[x].type==RETURN ||
+          x+1>=func->num_instr || keep[x+1])
+        break;
+      keep[++x]=1;
+    }
+  }
+  for (x=0;x+1<func->num_instr;x++)
+    if (keep[x] && code[x].type==JUMP && code[x].value.num==x+1)
+      keep[x]=0;
+  FREE(todo);
+  removed=compact(func,keep);
+  FREE(keep);
+  return removed;
+}
+
+/* local = constant; as a statement of its own, for a local that is used
+   nowhere else */
+static int is_dead_store(struct fns *func, unsigned char *target,
+                         unsigned long x)
+{
+  struct var *code;
+
+  code=func->code;
+  return (x+3<func->num_instr && code[x].type==LOCAL_L_VALUE &&
+          code[x].value.l_value.size>=1 && is_const(&(code[x+1])) &&
+          code[x+2].type==ASM_INSTR && code[x+2].value.instruction==EQ_OPER &&
+          code[x+3].type==NEW_LINE && !target[x+1] && !target[x+2] &&
+          !target[x+3]);
+}
+
+static unsigned long store_pass(struct fns *func)
+{
+  unsigned char *target,*keep;
+  unsigned long *uses,*stores,x,ref,removed;
+  struct var_tab *v;
+
+  if (!func->num_locals) return 0;
+  uses=MALLOC(sizeof(unsigned long)*func->num_locals);
+  stores=MALLOC(sizeof(unsigned long)*func->num_locals);
+  memset(uses,0,sizeof(unsigned long)*func->num_locals);
+  memset(stores,0,sizeof(unsigned long)*func->num_locals);
+  /* a subscript reads an array or mapping local through LOCAL_REF, with
+     its slot pushed as a plain INTEGER that can't be told from any
+     other, so those locals always count as used */
+  for (v=func->lst;v;v=v->next)
+    if ((v->array || v->is_mapping) && v->base<func->num_locals)
+      uses[v->base]++;
+  target=find_targets(func);
+  for (x=0;x<func->num_instr;x++)
+    if (func->code[x].type==LOCAL_L_VALUE &&
+        (ref=func->code[x].value.l_value.ref)<func->num_locals) {
+      uses[ref]++;
+      if (is_dead_store(func,target,x))
+        stores[ref]++;
+    }
+  keep=MALLOC(func->num_instr);
+  memset(keep,1,func->num_instr);
+  for (x=0;x<func->num_instr;x++)
+    if (func->code[x].type==LOCAL_L_VALUE &&
+        (ref=func->code[x].value.l_value.ref)<func->num_locals &&
+        uses[ref]==stores[ref] && is_dead_store(func,target,x))
+      keep[x]=keep[x+1]=keep[x+2]=0;
+  removed=compact(func,keep);
+  FREE(keep);
+  FREE(target);
+  FREE(stores);
+  FREE(uses);
+  return removed;
+}
+
+/* ========================================================================
+ * FUSION
+ * ======================================================================== */
+
+static int is_cmp(struct var *v)
+{
+  return (v->type==ASM_INSTR && v->value.instruction>=CONDEQ_OPER &&
+          v->value.instruction<=GREATEQ_OPER);
+}
+
+static int is_step(struct var *v)
+{
+  return (v->type==ASM_INSTR && v->value.instruction>=POSTADD_OPER &&
+          v->value.instruction<=PREMIN_OPER);
+}
+
+/* What code[x], a plain variable, starts; or its own type */
+static unsigned char fused_type(struct fns *func, unsigned long x)
+{
+  struct var *code;
+  unsigned long left;
+  int global;
+
+  code=func->code;
+  global=(code[x].type==GLOBAL_L_VALUE);
+  left=func->num_instr-x-1;
+  if (left>=3 && code[x+1].type==INTEGER && is_cmp(&(code[x+2])) &&
+      code[x+3].type==BRANCH)
+    return global ? GLOBAL_CMP_BRANCH : LOCAL_CMP_BRANCH;
+  if (left>=1 && code[x+1].type==RETURN)
+    return global ? GLOBAL_RETURN : LOCAL_RETURN;
+  if (global)
+    return code[x].type;
+  /* only a statement of its own, or a for loop's step, whose JUMP goes
+     back to the test; a ?: arm also ends in a JUMP, but a forward one, and
+     its value is used */
+  if (left>=2 && is_step(&(code[x+1])) &&
+      (code[x+2].type==NEW_LINE ||
+       (code[x+2].type==JUMP && code[x+2].value.num<=x)))
+    return LOCAL_STEP;
+  if (left>=3 && code[x+1].type==INTEGER && code[x+2].type==ASM_INSTR &&
+      (code[x+2].value.instruction==PLEQ_OPER ||
+       code[x+2].value.instruction==MIEQ_OPER) &&
+      code[x+3].type==NEW_LINE)
+    return LOCAL_STEP;
+  return code[x].type;
+}
+
+void fuse_code(struct code *the_code)
+{
+  struct fns *func;
+  unsigned long x;
+
+  for (func=the_code->func_list;func;func=func->next)
+    for (x=0;x<func->num_instr;x++)
+      if ((func->code[x].type==LOCAL_L_VALUE ||
+           func->code[x].type==GLOBAL_L_VALUE) &&
+          func->code[x].value.l_value.size==1)
+        func->code[x].type=fused_type(func,x);
+}
+
+/* ========================================================================
+ * ENTRY
+ * ======================================================================== */
+
+void optimize_code(struct code *the_code)
+{
+  struct fns *func;
+  unsigned long removed;
+  int round;
+
+  for (func=the_code->func_list;func;func=func->next) {
+    if (!func->num_instr) continue;
+    for (round=0;round<OPT_ROUNDS;round++) {
+      removed=fold_pass(func);
+      removed+=flow_pass(func);
+      removed+=store_pass(func);
+      if (!removed) break;
+    }
+  }
+}
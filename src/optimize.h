@@ -0,0 +1,15 @@
+/* optimize.h */
+
+/* The optimizing pass parse_code() runs over a program's functions when
+   it was compiled with #pragma optimize or optimize=1 in netci.ini */
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+void optimize_code(struct code *the_code);
+
+/* Fused instructions for the sequences programs run most; parse_code()
+   always runs this, last */
+void fuse_code(struct code *the_code);
+
+#endif /* OPTIMIZE_H */
@@ -0,0 +1,400 @@
+/**
+ * @file precomp.c
+ * @brief Compiling programs on worker threads ahead of use
+ *
+ * Boot compiles its objects one compile_object() at a time, and almost
+ * all of that is reading, preprocessing and parsing source, none of
+ * which touches the object table.  precompile() hands a list of programs
+ * to compile_threads workers and holds what they produce until
+ * parse_code() is next asked for one, so the compile_object() calls that
+ * follow only link and install.
+ *
+ * The compiler keeps its state per thread (THREAD_LOCAL) and opens files
+ * through open_source(), but adding a proto is still game-thread work.
+ * A worker that reaches an inherit whose program isn't loaded yet gives
+ * up on that file and names the parent; after the round the game thread
+ * installs whatever parents were compiled, queues the missing ones for
+ * the next round and tries the inheritor again.  Rounds go on until
+ * nothing is left or a round gets nowhere (an inherit cycle).  Programs
+ * that fail are left for compile_object() to compile and report.
+ *
+ * A held program is only handed over while it still matches: its source
+ * and includes must hash as they did when it was compiled, and a program
+ * it builds on being replaced or destructed drops it on the spot.  At
+ * most PRECOMP_MAX_HELD are held, for PRECOMP_HOLD_TIME seconds each.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+
+#include "object.h"
+#include "constrct.h"
+#include "globals.h"
+#include "file.h"
+#include "compile.h"
+#include "cache.h"
+#include "bcache.h"
+#include "precomp.h"
+
+#define JOB_TODO     0
+#define JOB_DONE     1
+#define JOB_DEFERRED 2        /* needs a parent that isn't loaded */
+#define JOB_FAILED   3
+
+struct precomp_job {
+    char *path;
+    int for_inherit;          /* install as an inherited program, don't hold */
+    int state;
+    struct code *result;      /* compiled this round, not yet taken */
+    unsigned long long key;   /* hash of the text result came from */
+    char *missing;            /* the parent a deferred job needs */
+    struct precomp_job *next;
+};
+
+/* Programs compiled ahead, waiting for parse_code() */
+struct held_code {
+    char *path;
+    struct code *code;
+    unsigned long long key;   /* bcache_text_key() when it was compiled */
+    long held_at;
+    struct held_code *next;
+};
+
+static struct held_code *held;
+static int num_held;
+
+static THREAD_LOCAL int in_worker;
+static THREAD_LOCAL char *needed;
+
+/* The round being compiled; workers take the next job under the lock */
+static pthread_mutex_t round_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct precomp_job **round_jobs;
+static int round_count, round_next;
+
+/* ========================================================================
+ * WORKERS
+ * ======================================================================== */
+
+int precomp_worker() {
+    return in_worker;
+}
+
+/* Called by load_inherit() on a worker for a parent it may not load */
+void precomp_need(char *pathname) {
+    if (in_worker && !needed)
+        needed = copy_string(pathname);
+}
+
+static void compile_job(struct precomp_job *job) {
+    needed = NULL;
+    if (!parse_code(job->path, NULL, &job->result)) {
+        job->state = JOB_DONE;
+        job->key = bcache_text_key(job->path, job->result->includes);
+    } else if (needed) {
+        job->state = JOB_DEFERRED;
+        job->missing = needed;
+    } else {
+        job->result = NULL;
+        job->state = JOB_FAILED;
+    }
+    needed = NULL;
+}
+
+static void work_round() {
+    struct precomp_job *job;
+
+    while (1) {
+        pthread_mutex_lock(&round_lock);
+        job = (round_next < round_count) ? round_jobs[round_next++] : NULL;
+        pthread_mutex_unlock(&round_lock);
+        if (!job)
+            break;
+        compile_job(job);
+    }
+}
+
+static void *worker_main(void *arg) {
+    in_worker = 1;
+    work_round();
+    return NULL;
+}
+
+/* Compile jobs on up to compile_threads workers and wait for them all */
+static void run_round(struct precomp_job **jobs, int count) {
+    pthread_t tids[MAX_COMPILE_THREADS];
+    pthread_attr_t attr;
+    int x, started;
+
+    round_jobs = jobs;
+    round_count = count;
+    round_next = 0;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, COMPILE_STACK_SIZE);
+    for (started = 0; started < compile_threads && started < count; started++)
+        if (pthread_create(&tids[started], &attr, worker_main, NULL))
+            break;
+    pthread_attr_destroy(&attr);
+    if (!started) {
+        /* no threads to be had; the rules are the same on this one */
+        logger(LOG_WARNING, "precompile: couldn't start worker threads");
+        in_worker = 1;
+        work_round();
+        in_worker = 0;
+    }
+    for (x = 0; x < started; x++)
+        pthread_join(tids[x], NULL);
+    round_jobs = NULL;
+}
+
+/* ========================================================================
+ * GAME THREAD
+ * ======================================================================== */
+
+static struct precomp_job *find_job(struct precomp_job *jobs, char *path,
+                                    int for_inherit) {
+    while (jobs) {
+        if (jobs->for_inherit == for_inherit && !strcmp(jobs->path, path))
+            return jobs;
+        jobs = jobs->next;
+    }
+    return NULL;
+}
+
+static struct precomp_job *add_job(struct precomp_job **jobs, char *path,
+                                   int for_inherit) {
+    struct precomp_job *job;
+
+    while (*jobs)
+        jobs = &(*jobs)->next;
+    job = MALLOC(sizeof(struct precomp_job));
+    job->path = copy_string(path);
+    job->for_inherit = for_inherit;
+    job->state = JOB_TODO;
+    job->result = NULL;
+    job->key = 0;
+    job->missing = NULL;
+    job->next = NULL;
+    *jobs = job;
+    return job;
+}
+
+/* Unlink *curr and return its code */
+static struct code *unhold(struct held_code **curr) {
+    struct held_code *found;
+    struct code *the_code;
+
+    found = *curr;
+    *curr = found->next;
+    the_code = found->code;
+    FREE(found->path);
+    FREE(found);
+    num_held--;
+    return the_code;
+}
+
+/* Drop what has been held longer than PRECOMP_HOLD_TIME */
+static void expire_held() {
+    struct held_code **curr;
+
+    curr = &held;
+    while (*curr)
+        if (now_time - (*curr)->held_at > PRECOMP_HOLD_TIME)
+            free_code(unhold(curr));
+        else
+            curr = &(*curr)->next;
+}
+
+/* Hold the_code for path.  Returns 1, or 0 if too many programs are held
+ * already, in which case the_code is freed. */
+static int hold(char *path, struct code *the_code, unsigned long long key) {
+    struct held_code *curr;
+
+    for (curr = held; curr; curr = curr->next)
+        if (!strcmp(curr->path, path)) {
+            free_code(curr->code);
+            curr->code = the_code;
+            curr->key = key;
+            curr->held_at = now_time;
+            return 1;
+        }
+    if (num_held >= PRECOMP_MAX_HELD) {
+        free_code(the_code);
+        return 0;
+    }
+    curr = MALLOC(sizeof(struct held_code));
+    curr->path = copy_string(path);
+    curr->code = the_code;
+    curr->key = key;
+    curr->held_at = now_time;
+    curr->next = held;
+    held = curr;
+    num_held++;
+    return 1;
+}
+
+/* parse_code() asks here first: a program precompile() compiled for
+ * filename, which the caller now owns, or NULL.  A held program whose
+ * source or includes changed since is dropped, and NULL returned. */
+struct code *precomp_take(char *filename) {
+    struct held_code **curr;
+    struct code *the_code;
+    unsigned long long key;
+
+    if (in_worker)
+        return NULL;
+    expire_held();
+    for (curr = &held; *curr; curr = &(*curr)->next)
+        if (!strcmp((*curr)->path, filename)) {
+            key = (*curr)->key;
+            the_code = unhold(curr);
+            if (key && key == bcache_text_key(filename, the_code->includes))
+                return the_code;
+            free_code(the_code);
+            return NULL;
+        }
+    return NULL;
+}
+
+/* Whether the_code builds on the program whose code is retired */
+static int built_on(struct code *the_code, struct code *retired) {
+    struct inherit_list *inh;
+    unsigned int x;
+
+    for (inh = the_code->inherits; inh; inh = inh->next)
+        if (inh->parent_proto && inh->parent_proto->funcs == retired)
+            return 1;
+    for (x = 0; x < the_code->ancestor_count; x++)
+        if (the_code->ancestor_map[x].proto &&
+            the_code->ancestor_map[x].proto->funcs == retired)
+            return 1;
+    for (x = 0; x < the_code->gst_count; x++)
+        if (the_code->gst_map[x].owner &&
+            the_code->gst_map[x].owner->funcs == retired)
+            return 1;
+    return 0;
+}
+
+/* The program whose code is the_code is being replaced or destructed:
+   drop the held programs compiled against it, while its proto is still
+   there to compare */
+void precomp_forget(struct code *the_code) {
+    struct held_code **curr;
+
+    curr = &held;
+    while (*curr)
+        if (built_on((*curr)->code, the_code))
+            free_code(unhold(curr));
+        else
+            curr = &(*curr)->next;
+}
+
+/* Whether any compiled programs are waiting to be taken; they were
+   compiled against the inherited programs loaded now */
+int precomp_holding() {
+    return held != NULL;
+}
+
+/* Install the parents a round compiled and hold everything else.
+ * Returns how many jobs finished. */
+static int collect_round(struct precomp_job *jobs) {
+    struct precomp_job *job;
+    int finished;
+
+    finished = 0;
+    for (job = jobs; job; job = job->next) {
+        if (job->state != JOB_DONE || !job->result)
+            continue;
+        if (!job->for_inherit) {
+            if (!hold(job->path, job->result, job->key))
+                job->state = JOB_FAILED;
+        } else if (find_cached_proto(job->path))
+            free_code(job->result);
+        else
+            install_inherit(job->path, job->result);
+        job->result = NULL;
+        finished++;
+    }
+    return finished;
+}
+
+/* Queue what the deferred jobs are waiting for.  Returns how many new
+ * jobs that added. */
+static int requeue_deferred(struct precomp_job **jobs) {
+    struct precomp_job *job, *parent;
+    int added;
+
+    added = 0;
+    for (job = *jobs; job; job = job->next) {
+        if (job->state != JOB_DEFERRED)
+            continue;
+        job->state = JOB_TODO;
+        if (!find_cached_proto(job->missing)) {
+            parent = find_job(*jobs, job->missing, 1);
+            if (!parent) {
+                add_job(jobs, job->missing, 1);
+                added++;
+            } else if (parent->state == JOB_FAILED)
+                job->state = JOB_FAILED;
+        }
+        FREE(job->missing);
+        job->missing = NULL;
+    }
+    return added;
+}
+
+/* Compile paths ahead of use.  Returns how many of them are now held
+ * for parse_code(). */
+int precomp_run(char **paths, int count) {
+    struct precomp_job *jobs, *job, **todo;
+    int x, todo_count, rounds, ready, finished, added;
+    char logbuf[256];
+
+    expire_held();
+    jobs = NULL;
+    for (x = 0; x < count; x++)
+        if (!find_job(jobs, paths[x], 0))
+            add_job(&jobs, paths[x], 0);
+    rounds = 0;
+    if (!compile_threads) {
+        /* nothing to overlap with: compile here, parents and all */
+        for (job = jobs; job; job = job->next)
+            compile_job(job);
+        collect_round(jobs);
+    } else
+        while (1) {
+            todo_count = 0;
+            for (job = jobs; job; job = job->next)
+                if (job->state == JOB_TODO)
+                    todo_count++;
+            if (!todo_count)
+                break;
+            todo = MALLOC(sizeof(struct precomp_job *) * todo_count);
+            todo_count = 0;
+            for (job = jobs; job; job = job->next)
+                if (job->state == JOB_TODO)
+                    todo[todo_count++] = job;
+            run_round(todo, todo_count);
+            FREE(todo);
+            rounds++;
+            finished = collect_round(jobs);
+            added = requeue_deferred(&jobs);
+            if (!finished && !added)
+                for (job = jobs; job; job = job->next)
+                    if (job->state == JOB_TODO)
+                        job->state = JOB_FAILED;
+        }
+    ready = 0;
+    while (jobs) {
+        job = jobs;
+        jobs = job->next;
+        if (job->state == JOB_DONE && !job->for_inherit)
+            ready++;
+        FREE(job->path);
+        FREE(job);
+    }
+    sprintf(logbuf, "precompile: %d of %d programs ready (%d threads, %d rounds)",
+            ready, count, compile_threads, rounds);
+    logger(LOG_INFO, logbuf);
+    return ready;
+}
@@ -0,0 +1,20 @@
+/* precomp.h */
+
+/* precompile(): compile a list of programs on compile_threads worker
+   threads ahead of the compile_object() calls that want them.  Workers
+   only parse; a program whose parent isn't loaded yet waits for a later
+   round, after the game thread has installed the parent.  Finished
+   programs are held until parse_code() is next asked for them, as long
+   as their files and the programs they build on haven't changed. */
+
+#ifndef PRECOMP_H
+#define PRECOMP_H
+
+int precomp_run(char **paths, int count);
+struct code *precomp_take(char *filename);
+int precomp_worker();
+void precomp_need(char *pathname);
+int precomp_holding();
+void precomp_forget(struct code *the_code);
+
+#endif /* PRECOMP_H */
@@ -6,20 +6,380 @@
 #include "token.h"
 #include "constrct.h"
 #include "instr.h"
+#include "bcache.h"
 
-extern char expand_buf[EBUFSIZ+1];
-extern char tmpbuf[EBUFSIZ+1];
-extern char name_buf[MAX_TOK_LEN+1];
-extern char string_buf[MAX_STR_LEN+1];
+#include <pthread.h>
+#include <sys/stat.h>
+
+extern THREAD_LOCAL char expand_buf[EBUFSIZ+1];
+extern THREAD_LOCAL char tmpbuf[EBUFSIZ+1];
+extern THREAD_LOCAL char name_buf[MAX_TOK_LEN+1];
+extern THREAD_LOCAL char string_buf[MAX_STR_LEN+1];
 
 #define isstart(c) (isalpha(c) || ((c)=='_'))
 #define iscname(c) (isstart(c) || isdigit(c))
 #define getch() *((file_info->expanded)++)
 #define ungetch() --(file_info->expanded)
 
+/* remember an included file once, in the order it was first opened */
+static void add_dependency(filptr *file_info, char *name)
+{
+  struct dep_list **curr;
+
+  curr=&(file_info->includes);
+  while (*curr) {
+    if (!strcmp((*curr)->name,name)) return;
+    curr=&((*curr)->next);
+  }
+  *curr=(struct dep_list *) MALLOC(sizeof(struct dep_list));
+  (*curr)->name=copy_string(name);
+  (*curr)->next=NULL;
+}
+
+/* Read a source file whole.  The buffer starts with a newline, so a
+   directive on the first line begins a line like any other. */
+static struct source *read_source(FILE *f)
+{
+  struct source *src;
+  long size,n;
+
+  size=0;
+  if (!fseek(f,0,SEEK_END)) {
+    size=ftell(f);
+    rewind(f);
+  }
+  if (size<0) size=0;
+  src=(struct source *) MALLOC(sizeof(struct source));
+  src->buf=(char *) MALLOC(size+2);
+  src->buf[0]='\n';
+  src->len=1;
+  while ((n=fread(src->buf+src->len,1,size+1-src->len,f))>0) {
+    src->len+=n;
+    if (src->len==size+1) {
+      /* the file grew since we sized it */
+      size=size*2+1024;
+      src->buf=(char *) realloc(src->buf,size+2);
+    }
+  }
+  src->pos=0;
+  src->tokens=0;
+  src->record=NULL;
+  return src;
+}
+
+struct source *load_source(char *filename)
+{
+  struct source *src;
+  FILE *f;
+
+  if (!(f=open_source(filename))) return NULL;
+  src=read_source(f);
+  close_file(f);
+  return src;
+}
+
+/* ========================================================================
+ * INCLUDE CACHE
+ *
+ * The preprocessor has no conditionals and stores #define bodies
+ * unexpanded, so what a header does to the #define table doesn't depend
+ * on what came before it.  A header that is nothing but directives is
+ * recorded as it is read (its #defines and #undefs in order, and the
+ * headers it included) and kept, by path, size and mtime, for every
+ * compile after.  Including it again replays the record instead of
+ * reading the file.  Headers with code in them are read each time.
+ * The record also keeps the size and mtime of every header it included,
+ * however deep, and is only replayed while all of them still match.
+ * A header changed within the last second isn't kept: mtime has only
+ * whole seconds, and it could change again without mtime moving.
+ * ======================================================================== */
+
+struct def_op {
+  struct define *def;          /* a #define, or NULL for an #undef */
+  char *name;                  /* the name #undef'd */
+  struct def_op *next;
+};
+
+struct inc_stamp {
+  char *name;
+  time_t mtime;
+  long size;                   /* -1 if it couldn't be stat'd */
+  struct inc_stamp *next;
+};
+
+struct inc_record {
+  char *name;
+  time_t mtime;
+  long size;
+  struct def_op *ops;
+  struct def_op **ops_tail;
+  struct inc_stamp *nested;    /* headers it included, in order */
+  struct inc_stamp **nested_tail;
+};
+
+/* the cache holds finished records; workers share it under inc_lock */
+struct inc_cache {
+  struct inc_record *rec;
+  struct inc_cache *next;
+};
+
+static struct inc_cache *inc_cache;
+static pthread_mutex_t inc_lock=PTHREAD_MUTEX_INITIALIZER;
+
+void free_one_define(struct define *def)
+{
+  struct parm *currparm,*nextparm;
+
+  currparm=def->params;
+  while (currparm) {
+    nextparm=currparm->next;
+    FREE(currparm->name);
+    if (currparm->exp)
+      FREE(currparm->exp);
+    FREE(currparm);
+    currparm=nextparm;
+  }
+  FREE(def->name);
+  if (def->definition)
+    FREE(def->definition);
+  FREE(def);
+}
+
+static struct define *copy_define(struct define *def)
+{
+  struct define *new;
+  struct parm *curr,**tail;
+
+  new=(struct define *) MALLOC(sizeof(struct define));
+  new->name=copy_string(def->name);
+  new->definition=copy_string(def->definition);
+  new->has_paren=def->has_paren;
+  new->params=NULL;
+  new->next=NULL;
+  tail=&(new->params);
+  for (curr=def->params;curr;curr=curr->next) {
+    *tail=(struct parm *) MALLOC(sizeof(struct parm));
+    (*tail)->name=copy_string(curr->name);
+    (*tail)->exp=NULL;
+    (*tail)->next=NULL;
+    tail=&((*tail)->next);
+  }
+  return new;
+}
+
+static struct inc_record *new_record(char *name, time_t mtime, long size)
+{
+  struct inc_record *rec;
+
+  rec=(struct inc_record *) MALLOC(sizeof(struct inc_record));
+  rec->name=copy_string(name);
+  rec->mtime=mtime;
+  rec->size=size;
+  rec->ops=NULL;
+  rec->ops_tail=&(rec->ops);
+  rec->nested=NULL;
+  rec->nested_tail=&(rec->nested);
+  return rec;
+}
+
+static void free_record(struct inc_record *rec)
+{
+  struct def_op *op;
+  struct inc_stamp *dep;
+
+  while ((op=rec->ops)) {
+    rec->ops=op->next;
+    if (op->def)
+      free_one_define(op->def);
+    else
+      FREE(op->name);
+    FREE(op);
+  }
+  while ((dep=rec->nested)) {
+    rec->nested=dep->next;
+    FREE(dep->name);
+    FREE(dep);
+  }
+  FREE(rec->name);
+  FREE(rec);
+}
+
+static void add_op(struct inc_record *rec, struct define *def, char *name)
+{
+  struct def_op *op;
+
+  op=(struct def_op *) MALLOC(sizeof(struct def_op));
+  op->def=def ? copy_define(def) : NULL;
+  op->name=def ? NULL : copy_string(name);
+  op->next=NULL;
+  *(rec->ops_tail)=op;
+  rec->ops_tail=&(op->next);
+}
+
+static void add_nested(struct inc_record *rec, char *name, time_t mtime,
+                       long size)
+{
+  struct inc_stamp *dep;
+
+  dep=(struct inc_stamp *) MALLOC(sizeof(struct inc_stamp));
+  dep->name=copy_string(name);
+  dep->mtime=mtime;
+  dep->size=size;
+  dep->next=NULL;
+  *(rec->nested_tail)=dep;
+  rec->nested_tail=&(dep->next);
+}
+
+/* Note a #define or #undef against the header being read, if any */
+static void record_op(filptr *file_info, struct define *def, char *name)
+{
+  if (file_info->curr_file->record)
+    add_op(file_info->curr_file->record,def,name);
+}
+
+/* Add what rec did to the header that included it, and to the compile */
+static void replay(filptr *file_info, struct inc_record *rec)
+{
+  struct def_op *op;
+  struct inc_stamp *dep;
+  struct inc_record *into;
+
+  into=file_info->curr_file->record;
+  for (op=rec->ops;op;op=op->next) {
+    if (op->def)
+      add_define(file_info,copy_define(op->def));
+    else
+      remove_define(file_info,op->name);
+    if (into)
+      add_op(into,op->def,op->name);
+  }
+  for (dep=rec->nested;dep;dep=dep->next) {
+    add_dependency(file_info,dep->name);
+    if (into)
+      add_nested(into,dep->name,dep->mtime,dep->size);
+  }
+}
+
+/* Whether name is, by size and mtime, the copy a record was made from */
+static int stamp_matches(char *name, time_t mtime, long size)
+{
+  struct stat st;
+  FILE *f;
+  int result;
+
+  if (size<0 || !(f=open_source(name)))
+    return 0;
+  result=(!fstat(fileno(f),&st) && st.st_mtime==mtime &&
+          (long) st.st_size==size);
+  close_file(f);
+  return result;
+}
+
+/* Keep a finished record, replacing one for an older copy of the file */
+static void cache_record(struct inc_record *rec)
+{
+  struct inc_cache *curr;
+  struct inc_record *kept;
+  struct def_op *op;
+  struct inc_stamp *dep;
+  time_t recent;
+
+  recent=time(NULL)-1;
+  if (rec->mtime>=recent)
+    return;
+  for (dep=rec->nested;dep;dep=dep->next)
+    if (dep->size<0 || dep->mtime>=recent)
+      return;
+  kept=new_record(rec->name,rec->mtime,rec->size);
+  for (op=rec->ops;op;op=op->next)
+    add_op(kept,op->def,op->name);
+  for (dep=rec->nested;dep;dep=dep->next)
+    add_nested(kept,dep->name,dep->mtime,dep->size);
+  pthread_mutex_lock(&inc_lock);
+  for (curr=inc_cache;curr;curr=curr->next)
+    if (!strcmp(curr->rec->name,rec->name))
+      break;
+  if (!curr) {
+    curr=(struct inc_cache *) MALLOC(sizeof(struct inc_cache));
+    curr->rec=NULL;
+    curr->next=inc_cache;
+    inc_cache=curr;
+  }
+  rec=curr->rec;
+  curr->rec=kept;
+  pthread_mutex_unlock(&inc_lock);
+  if (rec)
+    free_record(rec);
+}
+
+/* Replay a cached header if it, and every header it included, is the
+   copy on disk.  Returns 0 if so. */
+static int replay_cached(filptr *file_info, char *name, time_t mtime,
+                         long size)
+{
+  struct inc_cache *curr;
+  struct inc_stamp *dep;
+  int result;
+
+  result=1;
+  pthread_mutex_lock(&inc_lock);
+  for (curr=inc_cache;curr;curr=curr->next)
+    if (!strcmp(curr->rec->name,name)) {
+      if (curr->rec->mtime!=mtime || curr->rec->size!=size)
+        break;
+      for (dep=curr->rec->nested;dep;dep=dep->next)
+        if (!stamp_matches(dep->name,dep->mtime,dep->size))
+          break;
+      if (!dep) {
+        replay(file_info,curr->rec);
+        result=0;
+      }
+      break;
+    }
+  pthread_mutex_unlock(&inc_lock);
+  return result;
+}
+
+void free_source(struct source *src)
+{
+  if (src->record)
+    free_record(src->record);
+  FREE(src->buf);
+  FREE(src);
+}
+
+/* An #included file has run out: cache what it did if it was only
+   directives, and go back to the file that included it */
+void pop_source(filptr *file_info)
+{
+  struct source *src,*parent;
+  struct file_stack *prev;
+  struct inc_stamp *dep;
+  struct def_op *op;
+
+  src=file_info->curr_file;
+  prev=file_info->previous;
+  parent=prev->file_ptr;
+  if (src->tokens)
+    parent->tokens=1;
+  else if (src->record) {
+    cache_record(src->record);
+    if (parent->record) {
+      for (op=src->record->ops;op;op=op->next)
+        add_op(parent->record,op->def,op->name);
+      for (dep=src->record->nested;dep;dep=dep->next)
+        add_nested(parent->record,dep->name,dep->mtime,dep->size);
+    }
+  }
+  free_source(src);
+  file_info->curr_file=parent;
+  file_info->previous=prev->previous;
+  FREE(prev);
+}
+
 char *make_include_name(char *name)
 {
-  static char nbuf[MAX_STR_LEN];
+  static THREAD_LOCAL char nbuf[MAX_STR_LEN];
   int c,n;
 
   c=0;
@@ -83,81 +443,80 @@ void free_parm_exp(struct define *def)
 int preprocess(filptr *file_info)
 {
   int counter,c;
-  struct define *currdef,*prevdef;
+  struct define *currdef;
   struct parm *currparm,*nextparm;
-  FILE *tmp;
+  struct source *tmp;
   struct file_stack *tmp2;
+  struct stat st;
+  FILE *f;
 
   counter=0;
-  c=fgetc(file_info->curr_file);
+  c=src_getc(file_info->curr_file);
   while ((c!=EOF) && (!isspace(c)) && (counter<MAX_TOK_LEN)) {
     name_buf[counter++]=c;
-    c=fgetc(file_info->curr_file);
+    c=src_getc(file_info->curr_file);
   }
   if ((c!=EOF) && (!(isspace(c))))
     return 1;
   name_buf[counter]='\0';
   if (!strcmp(name_buf,"undef")) {
-    while ((c!=EOF) && isspace(c)) c=fgetc(file_info->curr_file);
+    while ((c!=EOF) && isspace(c)) c=src_getc(file_info->curr_file);
     counter=0;
     while ((c!=EOF) && (!isspace(c)) && (counter<MAX_TOK_LEN)) {
       name_buf[counter++]=c;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
     }
     name_buf[counter]='\0';
-    ungetc(c,file_info->curr_file);
-    currdef=file_info->defs;
-    prevdef=NULL;
-    while (currdef)
-      if (!strcmp(currdef->name,name_buf)) {
-        if (prevdef)
-          prevdef->next=currdef->next;
-        else
-          file_info->defs=currdef->next;
-        FREE(currdef->name);
-        FREE(currdef->definition);
-        currparm=currdef->params;
-        while (currparm) {
-          nextparm=currparm->next;
-          FREE(currparm->name);
-          if (currparm->exp)
-            FREE(currparm->exp);
-          FREE(currparm);
-          currparm=nextparm;
-        }
-        FREE(currdef);
-      } else
-        currdef=currdef->next;
+    src_ungetc(c,file_info->curr_file);
+    remove_define(file_info,name_buf);
+    record_op(file_info,NULL,name_buf);
     return 0;
   } else if (!strcmp(name_buf,"include")) {
     counter=0;
-    while ((c!=EOF) && isspace(c)) c=fgetc(file_info->curr_file);
+    while ((c!=EOF) && isspace(c)) c=src_getc(file_info->curr_file);
     counter=0;
     while ((c!=EOF) && (!isspace(c)) && (counter<MAX_STR_LEN)) {
       string_buf[counter++]=c;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
     }
     string_buf[counter]='\0';
-    ungetc(c,file_info->curr_file);
-    if (!(tmp=open_file(make_include_name(string_buf),FREAD_MODE,NULL))) {
+    src_ungetc(c,file_info->curr_file);
+    strcpy(string_buf,make_include_name(string_buf));
+    if (!(f=open_source(string_buf))) {
       set_c_err_msg("couldn't open include file");
       return 1;
     }
+    add_dependency(file_info,string_buf);
+    if (fstat(fileno(f),&st)) {
+      st.st_mtime=0;
+      st.st_size=-1;
+    }
+    if (file_info->curr_file->record)
+      add_nested(file_info->curr_file->record,string_buf,st.st_mtime,
+                 (long) st.st_size);
+    if (st.st_size>=0 && !replay_cached(file_info,string_buf,st.st_mtime,
+                                        (long) st.st_size)) {
+      close_file(f);
+      return 0;
+    }
+    tmp=read_source(f);
+    close_file(f);
+    if (st.st_size>=0)
+      tmp->record=new_record(string_buf,st.st_mtime,(long) st.st_size);
     tmp2=(struct file_stack *) MALLOC(sizeof(struct file_stack));
     tmp2->file_ptr=file_info->curr_file;
     tmp2->previous=file_info->previous;
     file_info->previous=tmp2;
     file_info->curr_file=tmp;
-    ungetc('\n',tmp);
     return 0;
   } else if (!strcmp(name_buf,"define")) {
     counter=0;
-    while ((c!=EOF) && isspace(c)) c=fgetc(file_info->curr_file);
+    while ((c!=EOF) && isspace(c)) c=src_getc(file_info->curr_file);
     counter=0;
     if (!isstart(c)) return 1;
     while ((c!=EOF) && iscname(c) && (counter<MAX_TOK_LEN)) {
       name_buf[counter++]=c;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
     }
     name_buf[counter]='\0';
     currdef=(struct define *) MALLOC(sizeof(struct define));
@@ -167,26 +526,25 @@ int preprocess(filptr *file_info)
     currparm=NULL;
     if (c=='(') {
       currdef->has_paren=1;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       while (c!=EOF) {
         while ((c!=EOF) && (c!='\n') && isspace(c))
-          c=fgetc(file_info->curr_file);
+          c=src_getc(file_info->curr_file);
         counter=0;
         if (c=='\n') {
           currdef->params=currparm;
-          currdef->next=file_info->defs;
-          file_info->defs=currdef;
           currdef->definition=copy_string("");
+          add_define(file_info,currdef);
           set_c_err_msg("malformed #define");
           return 1;
         }
         if (c==')') {
-          c=fgetc(file_info->curr_file);
+          c=src_getc(file_info->curr_file);
           break;
         }
         while ((c!=EOF) && (iscname(c)) && (counter<MAX_TOK_LEN)) {
           name_buf[counter++]=c;
-          c=fgetc(file_info->curr_file);
+          c=src_getc(file_info->curr_file);
         }
         name_buf[counter]='\0';
         nextparm=(struct parm *) MALLOC(sizeof(struct parm));
@@ -195,76 +553,97 @@ int preprocess(filptr *file_info)
         nextparm->exp=NULL;
         currparm=nextparm;
         while ((c!=EOF) && (c!='\n') && (isspace(c)))
-          c=fgetc(file_info->curr_file);
+          c=src_getc(file_info->curr_file);
         if ((c!=',') && (c!=')')) {
           currdef->params=currparm;
-          currdef->next=file_info->defs;
           currdef->definition=copy_string("");
-          file_info->defs=currdef;
+          add_define(file_info,currdef);
           set_c_err_msg("malformed #define");
           return 1;
         }
-        if (c==',') c=fgetc(file_info->curr_file);
+        if (c==',') c=src_getc(file_info->curr_file);
       }
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
     } else
-      ungetc(c,file_info->curr_file);
+      src_ungetc(c,file_info->curr_file);
     while (currparm) {
       nextparm=currparm->next;
       currparm->next=currdef->params;
       currdef->params=currparm;
       currparm=nextparm;
     }
-    currdef->next=file_info->defs;
-    file_info->defs=currdef;
-    while ((c!=EOF) && (c!='\n') && (isspace(c))) c=fgetc(file_info->curr_file);
+    currdef->definition=NULL;
+    add_define(file_info,currdef);
+    while ((c!=EOF) && (c!='\n') && (isspace(c))) c=src_getc(file_info->curr_file);
     counter=0;
     while ((c!=EOF) && (c!='\n') && (counter<EBUFSIZ)) {
       if (c=='\\') {
-        c=fgetc(file_info->curr_file);
+        c=src_getc(file_info->curr_file);
         if (c=='\n') {
           if (!(file_info->previous))
             ++(file_info->phys_line);
           c=' ';
         } else {
-          ungetc(c,file_info->curr_file);
+          src_ungetc(c,file_info->curr_file);
           c='\\';
         }
       }
       if (c=='/') {
-        c=fgetc(file_info->curr_file);
+        c=src_getc(file_info->curr_file);
         if (c=='*') {
           while (c!=EOF) {
-            c=fgetc(file_info->curr_file);
+            c=src_getc(file_info->curr_file);
             if (c=='*') {
-              c=fgetc(file_info->curr_file);
+              c=src_getc(file_info->curr_file);
               if (c=='/') {
                 c=' ';
                 break;
               } else {
-                ungetc(c,file_info->curr_file);
+                src_ungetc(c,file_info->curr_file);
               }
             } else if (c=='\n')
               if (!(file_info->previous))
                 ++(file_info->phys_line);
           }
         } else {
-          ungetc(c,file_info->curr_file);
+          src_ungetc(c,file_info->curr_file);
           c='/';
         }
       }
       if ((c!=EOF) && (c!='\n') && (isspace(c))) {
         expand_buf[counter++]=' ';
         while ((c!=EOF) && (c!='\n') && (isspace(c)))
-          c=fgetc(file_info->curr_file);
+          c=src_getc(file_info->curr_file);
       } else if ((c!=EOF) && (c!='\n')) {
         expand_buf[counter++]=c;
-        c=fgetc(file_info->curr_file);
+        c=src_getc(file_info->curr_file);
       }
     }
-    ungetc(c,file_info->curr_file);
+    src_ungetc(c,file_info->curr_file);
     expand_buf[counter]='\0';
     currdef->definition=copy_string(expand_buf);
+    record_op(file_info,currdef,NULL);
+    return 0;
+  } else if (!strcmp(name_buf,"pragma")) {
+    while ((c!=EOF) && (c!='\n') && isspace(c))
+      c=src_getc(file_info->curr_file);
+    counter=0;
+    while ((c!=EOF) && iscname(c) && (counter<MAX_TOK_LEN)) {
+      name_buf[counter++]=c;
+      c=src_getc(file_info->curr_file);
+    }
+    name_buf[counter]='\0';
+    while ((c!=EOF) && (c!='\n'))
+      c=src_getc(file_info->curr_file);
+    src_ungetc(c,file_info->curr_file);
+    /* pragmas this driver doesn't know are ignored, as C compilers do */
+    if (!strcmp(name_buf,"optimize"))
+      file_info->optimize=1;
+    else if (!strcmp(name_buf,"no_optimize"))
+      file_info->optimize=0;
+    /* a record only replays #defines, so a header with a pragma isn't
+       kept in the include cache */
+    file_info->curr_file->tokens=1;
     return 0;
   } else
     return 1;
@@ -367,7 +746,7 @@ void expand(struct define *def, filptr *file_info)
 
   if (def->has_paren) {
     do {
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='\n')
         if (!(file_info->previous))
           ++(file_info->phys_line);
@@ -379,7 +758,7 @@ void expand(struct define *def, filptr *file_info)
     currparm=def->params;
     do {
       do {
-        c=fgetc(file_info->curr_file);
+        c=src_getc(file_info->curr_file);
         if (c=='\n')
           if (!(file_info->previous))
             ++(file_info->phys_line);
@@ -403,19 +782,19 @@ void expand(struct define *def, filptr *file_info)
           paren_counter++;
         else if (c==')' && (!in_string))
           if (!paren_counter) {
-            ungetc(c,file_info->curr_file);
+            src_ungetc(c,file_info->curr_file);
             break;
           } else
             paren_counter--;
         else if (c==',' && (!paren_counter) && (!in_string))
           break;
         else if (c=='\\' && in_string) {
-          c=fgetc(file_info->curr_file);
+          c=src_getc(file_info->curr_file);
           if (counter<(EBUFSIZ-1))
             tmpbuf[counter++]='\\';
         }
         tmpbuf[counter++]=c;
-        c=fgetc(file_info->curr_file);
+        c=src_getc(file_info->curr_file);
       }
       tmpbuf[counter]='\0';
       currparm->exp=copy_string(tmpbuf);
@@ -76,6 +76,8 @@ OPER_PROTO(s_typeof)
 OPER_PROTO(s_command)
 OPER_PROTO(s_compile_object)
 OPER_PROTO(s_compile_string)
+OPER_PROTO(s_precompile)
+OPER_PROTO(s_recompile)
 OPER_PROTO(s_crypt)
 OPER_PROTO(s_read_file)
 OPER_PROTO(s_write_file)
@@ -136,6 +138,7 @@ OPER_PROTO(s_iterate)
 OPER_PROTO(s_next_who)
 OPER_PROTO(s_get_devidle)
 OPER_PROTO(s_get_conntime)
+OPER_PROTO(s_get_devqueue)
 OPER_PROTO(s_connect_device)
 OPER_PROTO(s_flush_device)
 OPER_PROTO(s_attach)
@@ -166,6 +169,8 @@ OPER_PROTO(s_sort_array)
 OPER_PROTO(s_reverse)
 OPER_PROTO(s_unique_array)
 OPER_PROTO(s_array_literal)
+OPER_PROTO(s_index)
+OPER_PROTO(s_range)
 
 /* Serialization efuns */
 OPER_PROTO(s_save_value)
@@ -177,6 +182,8 @@ OPER_PROTO(s_replace_string)
 /* String helper functions (sys_strings.c) */
 char *escape_string(char *str);
 char *save_value_internal(struct var *value, int depth);
+char *save_value_line(struct var *value, unsigned long *len);
+int save_value_file(struct var *value, FILE *fp);
 
 /* Token parser helpers (token_parse.c) - see token.h for prototypes */
 
@@ -193,6 +200,7 @@ OPER_PROTO(s_mapping_literal)
 OPER_PROTO(s_save_object)
 OPER_PROTO(s_restore_object)
 OPER_PROTO(s_restore_map)
+OPER_PROTO(s_save_keys)
 
 /* Object idle time tracking */
 OPER_PROTO(s_query_idle_time)
@@ -205,16 +213,25 @@ struct heap_array* allocate_array(unsigned int size, unsigned int max_size);
 void array_addref(struct heap_array *arr);
 void array_release(struct heap_array *arr);
 int resize_heap_array(struct heap_array *arr, unsigned int new_size);
+struct heap_array* array_copy(struct heap_array *arr);
+int array_unshare(struct var *slot);
+struct heap_array* array_slice(struct heap_array *arr, unsigned int from,
+                               unsigned int to);
 
 /* Array arithmetic helper functions (Phase 5) */
 struct heap_array* array_concat(struct heap_array *arr1, struct heap_array *arr2);
 struct heap_array* array_subtract(struct heap_array *arr1, struct heap_array *arr2);
+struct heap_array* array_intersect(struct heap_array *arr1, struct heap_array *arr2);
+struct heap_array* array_union(struct heap_array *arr1, struct heap_array *arr2);
+struct heap_array* array_unique(struct heap_array *arr);
 
 /* Heap mapping functions (Mapping Redux Phase 1) */
 struct heap_mapping* allocate_mapping(unsigned int initial_capacity);
 void mapping_addref(struct heap_mapping *map);
 void mapping_release(struct heap_mapping *map);
 void mapping_rehash(struct heap_mapping *map);
+struct heap_mapping* mapping_copy(struct heap_mapping *map);
+int mapping_unshare(struct var *slot);
 
 /* Mapping operations */
 unsigned int hash_string(const char *str);
@@ -225,6 +242,9 @@ int var_equals(struct var *v1, struct var *v2);
 void copy_var_to(struct var *dest, struct var *src);
 
 struct var* mapping_get_or_create(struct heap_mapping *map, struct var *key);
+unsigned long mapping_ref(struct heap_mapping *map, struct var *key, int depth);
+struct var *mapping_ref_value(unsigned long tagged);
+void mapping_refs_release(int depth);
 int mapping_get(struct heap_mapping *map, struct var *key, struct var *result);
 int mapping_set(struct heap_mapping *map, struct var *key, struct var *value);
 int mapping_delete(struct heap_mapping *map, struct var *key);
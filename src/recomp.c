@@ -0,0 +1,377 @@
+/**
+ * @file recomp.c
+ * @brief Recompiling a program and everything built on it
+ *
+ * compile_object() replaces one program's code.  A program that inherits
+ * it was bound to the parent's proto when it was compiled and keeps
+ * running what it inherited then, and a program that #included a file
+ * keeps what it was compiled from.  recompile() finds, from the inherit
+ * and include lists of the loaded programs, every program that depends
+ * on a file, and compiles them again with parents before inheritors:
+ *
+ *  - an inherited program gets a new proto, which takes the old one's
+ *    place in the proto cache, so its inheritors compile against it
+ *  - a program with objects gets its code replaced and its objects'
+ *    globals carried over, as compile_object() does
+ *  - a program is compiled again only if it names the file or one of its
+ *    parents has been replaced.  If it compiles to the same bytecode
+ *    cache key it had, the old code is kept and nothing built on it is
+ *    touched; and with bytecode_path set, anything whose cache entry is
+ *    still current loads from there instead of compiling.
+ *  - a program that fails to compile is reported and keeps its old code,
+ *    and so does everything built on it.  So does a program whose objects
+ *    are on the call stack, as compile_object() won't replace its
+ *    caller's program.
+ *
+ * The caller is usually running code that is being replaced, so replaced
+ * code is retired, and free_retired() frees it from handle_destruct()
+ * once nothing is running.
+ */
+
+#include "config.h"
+#include "object.h"
+#include "constrct.h"
+#include "globals.h"
+#include "interp.h"
+#include "dbhandle.h"
+#include "file.h"
+#include "compile.h"
+#include "cache.h"
+#include "precomp.h"
+#include "recomp.h"
+
+/* Replaced code, and the old protos of replaced inherited programs,
+   waiting for the top level */
+struct retired {
+    struct code *code;
+    struct proto *proto;
+    struct retired *next;
+};
+
+static struct retired *retired_list;
+
+/* The loaded programs, and what recomp_run() has worked out about them */
+struct rc_prog {
+    struct proto *proto;
+    int affected;             /* names the file, or builds on one that does */
+    int direct;               /* names the file itself */
+    int visited;
+};
+
+struct rc_graph {
+    struct rc_prog *progs;
+    int count;
+    int *order;               /* affected programs, parents first */
+    int num_order;
+};
+
+/* ========================================================================
+ * RETIRING
+ * ======================================================================== */
+
+static void retire(struct code *the_code, struct proto *proto) {
+    struct retired *curr;
+
+    precomp_forget(the_code);
+    curr = MALLOC(sizeof(struct retired));
+    curr->code = the_code;
+    curr->proto = proto;
+    curr->next = retired_list;
+    retired_list = curr;
+}
+
+void retire_code(struct code *the_code) {
+    if (the_code)
+        retire(the_code, NULL);
+}
+
+static int cmp_fns(const void *a, const void *b) {
+    struct fns *x = *(struct fns **) a, *y = *(struct fns **) b;
+
+    return (x > y) - (x < y);
+}
+
+void free_retired() {
+    struct retired *curr;
+    struct object *boot_obj;
+    struct proto *p;
+    struct fns **gone, *f;
+    struct var *instr;
+    unsigned long count, x;
+
+    if (!retired_list || call_stack)
+        return;
+    count = 0;
+    for (curr = retired_list; curr; curr = curr->next)
+        for (f = curr->code->func_list; f; f = f->next)
+            count++;
+    gone = MALLOC(sizeof(struct fns *) * (count + 1));
+    count = 0;
+    for (curr = retired_list; curr; curr = curr->next)
+        for (f = curr->code->func_list; f; f = f->next)
+            gone[count++] = f;
+    qsort(gone, count, sizeof(struct fns *), cmp_fns);
+
+    /* a call the interpreter resolved into retired code goes back to
+       being looked up by name */
+    boot_obj = ref_to_obj(0);
+    for (p = boot_obj ? boot_obj->parent : NULL; p; p = p->next_proto)
+        for (f = p->funcs ? p->funcs->func_list : NULL; f; f = f->next)
+            for (x = 0; x < f->num_instr; x++) {
+                instr = &(f->code[x]);
+                if (instr->type == FUNC_CALL &&
+                    bsearch(&(instr->value.func_call), gone, count,
+                            sizeof(struct fns *), cmp_fns)) {
+                    instr->type = FUNC_NAME;
+                    instr->value.string =
+                        copy_string(instr->value.func_call->funcname);
+                }
+            }
+    FREE(gone);
+
+    while (retired_list) {
+        curr = retired_list;
+        retired_list = curr->next;
+        free_code(curr->code);
+        if (curr->proto) {
+            FREE(curr->proto->pathname);
+            FREE(curr->proto);
+        }
+        FREE(curr);
+    }
+}
+
+/* ========================================================================
+ * THE DEPENDENCY GRAPH
+ * ======================================================================== */
+
+static int find_prog(struct rc_graph *graph, struct proto *proto) {
+    int x;
+
+    for (x = 0; x < graph->count; x++)
+        if (graph->progs[x].proto == proto)
+            return x;
+    return -1;
+}
+
+static int names_file(struct proto *proto, char *pathname) {
+    struct dep_list *inc;
+
+    if (!strcmp(proto->pathname, pathname))
+        return 1;
+    for (inc = proto->funcs->includes; inc; inc = inc->next)
+        if (!strcmp(inc->name, pathname))
+            return 1;
+    return 0;
+}
+
+static void build_graph(struct rc_graph *graph, char *pathname) {
+    struct object *boot_obj;
+    struct inherit_list *inh;
+    struct proto *p;
+    int x, y, changed;
+
+    graph->count = 0;
+    boot_obj = ref_to_obj(0);
+    for (p = boot_obj->parent; p; p = p->next_proto)
+        if (p->funcs)
+            graph->count++;
+    graph->progs = MALLOC(sizeof(struct rc_prog) * (graph->count + 1));
+    graph->order = MALLOC(sizeof(int) * (graph->count + 1));
+    graph->num_order = 0;
+    x = 0;
+    for (p = boot_obj->parent; p; p = p->next_proto)
+        if (p->funcs) {
+            graph->progs[x].proto = p;
+            graph->progs[x].direct = names_file(p, pathname);
+            graph->progs[x].affected = graph->progs[x].direct;
+            graph->progs[x].visited = 0;
+            x++;
+        }
+
+    /* everything that inherits something affected is affected */
+    do {
+        changed = 0;
+        for (x = 0; x < graph->count; x++) {
+            if (graph->progs[x].affected)
+                continue;
+            for (inh = graph->progs[x].proto->funcs->inherits; inh;
+                 inh = inh->next)
+                if ((y = find_prog(graph, inh->parent_proto)) >= 0 &&
+                    graph->progs[y].affected) {
+                    graph->progs[x].affected = 1;
+                    changed = 1;
+                    break;
+                }
+        }
+    } while (changed);
+}
+
+/* Add x to the order after the affected programs it inherits */
+static void visit(struct rc_graph *graph, int x) {
+    struct inherit_list *inh;
+    int y;
+
+    if (graph->progs[x].visited)
+        return;
+    graph->progs[x].visited = 1;
+    for (inh = graph->progs[x].proto->funcs->inherits; inh; inh = inh->next)
+        if ((y = find_prog(graph, inh->parent_proto)) >= 0 &&
+            graph->progs[y].affected)
+            visit(graph, y);
+    graph->order[graph->num_order++] = x;
+}
+
+/* Whether the_code was compiled against a parent that has since been
+   replaced */
+static int is_stale(struct code *the_code) {
+    struct inherit_list *inh;
+
+    for (inh = the_code->inherits; inh; inh = inh->next)
+        if (inh->parent_proto != find_cached_proto(inh->inherit_path))
+            return 1;
+    return 0;
+}
+
+/* Whether any loaded program other than proto still builds on it */
+static int still_used(struct proto *proto) {
+    struct object *boot_obj;
+    struct inherit_list *inh;
+    struct code *c;
+    struct proto *p;
+    unsigned int x;
+
+    boot_obj = ref_to_obj(0);
+    for (p = boot_obj->parent; p; p = p->next_proto) {
+        if (p == proto || !(c = p->funcs))
+            continue;
+        for (inh = c->inherits; inh; inh = inh->next)
+            if (inh->parent_proto == proto)
+                return 1;
+        for (x = 0; x < c->ancestor_count; x++)
+            if (c->ancestor_map[x].proto == proto)
+                return 1;
+        for (x = 0; x < c->gst_count; x++)
+            if (c->gst_map[x].owner == proto)
+                return 1;
+    }
+    return 0;
+}
+
+/* Whether an object of proto's program is on the call stack.  Its
+   functions resolve globals through its program's layout, so the program
+   can't change under them. */
+static int is_running(struct proto *proto) {
+    struct call_frame *frame;
+
+    for (frame = call_stack; frame; frame = frame->prev)
+        if (frame->obj && frame->obj->parent == proto)
+            return 1;
+    return 0;
+}
+
+/* Take an inherited program out of the proto chain, and retire it with
+   its code */
+void retire_proto(struct proto *proto) {
+    struct proto *prev;
+
+    for (prev = ref_to_obj(0)->parent; prev; prev = prev->next_proto)
+        if (prev->next_proto == proto) {
+            prev->next_proto = proto->next_proto;
+            break;
+        }
+    retire(proto->funcs, proto);
+}
+
+/* ========================================================================
+ * RECOMPILING
+ * ======================================================================== */
+
+/* Compile proto's program again and put it in place.  Returns 1 if it was
+   replaced, 0 if it came out the same, or -1 if it failed. */
+static int rebuild(struct proto *proto, struct object *caller,
+                   struct object *player) {
+    struct code *newcode;
+    unsigned int line;
+    char logbuf[256];
+
+    line = parse_code(proto->pathname, caller, &newcode);
+    if (line == ((unsigned int) -1)) {
+        sprintf(logbuf, "recompile: couldn't read %.200s.c", proto->pathname);
+        logger(LOG_WARNING, logbuf);
+        return -1;
+    }
+    if (line) {
+        compile_error(player, proto->pathname, line);
+        return -1;
+    }
+    if (newcode->src_key && newcode->src_key == proto->funcs->src_key) {
+        free_code(newcode);
+        return 0;
+    }
+    if (proto->proto_obj)
+        replace_code(proto->proto_obj, newcode);
+    else {
+        uncache_proto(proto->pathname);
+        install_inherit(proto->pathname, newcode);
+    }
+    return 1;
+}
+
+/* Recompile what depends on pathname: a program (without the .c) or an
+ * #included file.  Returns how many programs were replaced. */
+int recomp_run(char *pathname, struct object *caller, struct object *player) {
+    struct rc_graph graph;
+    struct proto *proto;
+    int x, affected, rebuilt, failed, result;
+    char logbuf[256];
+
+    build_graph(&graph, pathname);
+    for (x = 0; x < graph.count; x++)
+        if (graph.progs[x].affected)
+            visit(&graph, x);
+
+    affected = 0;
+    rebuilt = 0;
+    failed = 0;
+    for (x = 0; x < graph.num_order; x++) {
+        proto = graph.progs[graph.order[x]].proto;
+        /* an inherited program that was already replaced once, still
+           here for whatever hasn't been recompiled against the new one */
+        if (!proto->proto_obj && find_cached_proto(proto->pathname) != proto)
+            continue;
+        affected++;
+        if (!graph.progs[graph.order[x]].direct && !is_stale(proto->funcs))
+            continue;
+        if (proto->proto_obj && is_running(proto)) {
+            sprintf(logbuf, "recompile: %.200s is running, not replaced",
+                    proto->pathname);
+            logger(LOG_WARNING, logbuf);
+            failed++;
+            continue;
+        }
+        result = rebuild(proto, caller, player);
+        if (result < 0)
+            failed++;
+        else if (result > 0)
+            rebuilt++;
+    }
+
+    /* old inherited programs nothing builds on any more; inheritors come
+       after their parents, so they go first */
+    for (x = graph.num_order - 1; x >= 0; x--) {
+        proto = graph.progs[graph.order[x]].proto;
+        if (proto->proto_obj || find_cached_proto(proto->pathname) == proto ||
+            still_used(proto))
+            continue;
+        retire_proto(proto);
+    }
+
+    snprintf(logbuf, sizeof(logbuf),
+             "recompile: %.150s: %d of %d programs replaced, %d failed",
+             pathname, rebuilt, affected, failed);
+    logger(LOG_INFO, logbuf);
+    FREE(graph.order);
+    FREE(graph.progs);
+    return rebuilt;
+}
@@ -0,0 +1,21 @@
+/* recomp.h */
+
+/* recompile(): compile a program, or the programs that #include a file,
+   again along with every program built on them, parents first, so that
+   inheritors pick up a changed parent.  Code that is replaced may still
+   be running, so it is retired rather than freed, and free_retired()
+   frees it once the driver is back at the top level. */
+
+#ifndef RECOMP_H
+#define RECOMP_H
+
+int recomp_run(char *pathname, struct object *caller, struct object *player);
+void retire_code(struct code *the_code);
+void retire_proto(struct proto *proto);
+void free_retired();
+
+/* sys5.c: give a program with objects new code, carrying the objects'
+   globals over */
+void replace_code(struct object *proto_obj, struct code *newcode);
+
+#endif /* RECOMP_H */
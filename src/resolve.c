@@ -0,0 +1,318 @@
+/**
+ * @file resolve.c
+ * @brief Resolver thread for host/address lookups
+ *
+ * getaddrinfo()/getnameinfo() can block for as long as the DNS server takes
+ * to answer, so they run on a dedicated thread.  The game thread queues
+ * requests and picks up the answers in resolve_drain(); answers are cached
+ * so repeated get_hostname()/get_address() calls are free.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "object.h"
+#include "globals.h"
+#include "file.h"
+#include "resolve.h"
+
+struct resolve_req {
+    int type;
+    char *query;
+    char *answer;
+    int devnum;               /* connect_device() slot waiting on this, or -1 */
+    unsigned long conn_id;
+    struct resolve_req *next;
+};
+
+struct resolve_cache {
+    int type;
+    char *query;              /* NULL when the entry is unused */
+    char *answer;             /* NULL if the lookup failed */
+    int pending;
+    long expires;
+};
+
+static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolve_cond = PTHREAD_COND_INITIALIZER;
+static struct resolve_req *todo_head, *todo_tail;   /* game -> resolver */
+static struct resolve_req *done_list;               /* resolver -> game, newest first */
+static int resolve_running;
+static int resolve_stopping;
+static int wake_rd = -1, wake_wr = -1;
+static struct resolve_cache cache[RESOLVE_CACHE_SIZE];
+
+static char *copy_str(const char *s) {
+    char *r;
+
+    r = MALLOC(strlen(s) + 1);
+    strcpy(r, s);
+    return r;
+}
+
+static char *do_lookup(int type, char *query) {
+    struct addrinfo hints, *res;
+    struct sockaddr_in sin;
+    char buf[NI_MAXHOST];
+
+    if (type == RESOLVE_NAME) {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(query, NULL, &hints, &res) || !res) return NULL;
+        inet_ntop(AF_INET, &((struct sockaddr_in *)res->ai_addr)->sin_addr,
+                  buf, sizeof(buf));
+        freeaddrinfo(res);
+        return copy_str(buf);
+    }
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    if (inet_pton(AF_INET, query, &sin.sin_addr) != 1) return NULL;
+    if (getnameinfo((struct sockaddr *)&sin, sizeof(sin), buf, sizeof(buf),
+                    NULL, 0, NI_NAMEREQD))
+        return NULL;
+    return copy_str(buf);
+}
+
+static void *resolve_main(void *arg) {
+    struct resolve_req *req;
+    char c = 0;
+
+    pthread_mutex_lock(&resolve_lock);
+    while (!resolve_stopping) {
+        if (!(req = todo_head)) {
+            pthread_cond_wait(&resolve_cond, &resolve_lock);
+            continue;
+        }
+        todo_head = req->next;
+        if (!todo_head) todo_tail = NULL;
+        pthread_mutex_unlock(&resolve_lock);
+
+        req->answer = do_lookup(req->type, req->query);
+
+        pthread_mutex_lock(&resolve_lock);
+        req->next = done_list;
+        done_list = req;
+        write(wake_wr, &c, 1);
+    }
+    pthread_mutex_unlock(&resolve_lock);
+    return NULL;
+}
+
+static int start_resolver() {
+    pthread_t tid;
+    int p[2];
+
+    if (resolve_running) return 0;
+    if (pipe(p) < 0) return -1;
+    fcntl(p[0], F_SETFL, fcntl(p[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(p[1], F_SETFL, fcntl(p[1], F_GETFL, 0) | O_NONBLOCK);
+    wake_rd = p[0];
+    wake_wr = p[1];
+    if (pthread_create(&tid, NULL, resolve_main, NULL)) {
+        close(wake_rd);
+        close(wake_wr);
+        wake_rd = wake_wr = -1;
+        return -1;
+    }
+    /* never joined: a thread stuck in a DNS timeout mustn't hold up shutdown */
+    pthread_detach(tid);
+    resolve_running = 1;
+    logger(LOG_INFO, "resolve: resolver thread started");
+    return 0;
+}
+
+static int queue_request(int type, char *query, int devnum, unsigned long conn_id) {
+    struct resolve_req *req;
+
+    if (start_resolver()) return -1;
+    req = MALLOC(sizeof(struct resolve_req));
+    req->type = type;
+    req->query = copy_str(query);
+    req->answer = NULL;
+    req->devnum = devnum;
+    req->conn_id = conn_id;
+    req->next = NULL;
+    pthread_mutex_lock(&resolve_lock);
+    if (todo_tail)
+        todo_tail->next = req;
+    else
+        todo_head = req;
+    todo_tail = req;
+    pthread_cond_signal(&resolve_cond);
+    pthread_mutex_unlock(&resolve_lock);
+    return 0;
+}
+
+static struct resolve_cache *find_cache(int type, char *query) {
+    int i;
+
+    for (i = 0; i < RESOLVE_CACHE_SIZE; i++)
+        if (cache[i].query && cache[i].type == type && !strcmp(cache[i].query, query))
+            return &cache[i];
+    return NULL;
+}
+
+static struct resolve_cache *new_cache(int type, char *query) {
+    struct resolve_cache *entry;
+    int i;
+
+    /* reuse a free slot, else evict whatever expires soonest */
+    entry = &cache[0];
+    for (i = 0; i < RESOLVE_CACHE_SIZE; i++) {
+        if (!cache[i].query) {
+            entry = &cache[i];
+            break;
+        }
+        if (!cache[i].pending && (entry->pending || cache[i].expires < entry->expires))
+            entry = &cache[i];
+    }
+    if (entry->query) FREE(entry->query);
+    if (entry->answer) FREE(entry->answer);
+    entry->type = type;
+    entry->query = copy_str(query);
+    entry->answer = NULL;
+    entry->pending = 1;
+    entry->expires = 0;
+    return entry;
+}
+
+/* No resolver thread to queue a lookup on: report failure rather than
+ * block the game thread doing it here
+ */
+static void no_resolver(struct resolve_cache *entry) {
+    if (entry->answer) FREE(entry->answer);
+    entry->answer = NULL;
+    entry->pending = 0;
+    entry->expires = now_time + RESOLVE_TTL;
+}
+
+/**
+ * @brief Look up a host or address without blocking
+ *
+ * @param type RESOLVE_NAME or RESOLVE_ADDR
+ * @param query Hostname or dotted address
+ * @param answer Set to the cached answer (NULL for a failed lookup) on RESOLVE_DONE
+ * @return RESOLVE_DONE if answered from the cache, RESOLVE_PENDING if a lookup was queued
+ */
+int resolve_lookup(int type, char *query, char **answer) {
+    struct resolve_cache *entry;
+
+    *answer = NULL;
+    entry = find_cache(type, query);
+    if (entry && entry->pending) return RESOLVE_PENDING;
+    if (entry && entry->expires > now_time) {
+        *answer = entry->answer;
+        return RESOLVE_DONE;
+    }
+    /* an expired entry is looked up again in place */
+    if (!entry) entry = new_cache(type, query);
+    entry->pending = 1;
+    if (queue_request(type, query, -1, 0)) {
+        no_resolver(entry);
+        return RESOLVE_DONE;
+    }
+    return RESOLVE_PENDING;
+}
+
+/**
+ * @brief Resolve the host for a connect_device()
+ *
+ * A cached answer is returned at once.  Otherwise one lookup is queued,
+ * and its answer is handed to resolve_drain()'s handler along with devnum
+ * and conn_id.  With no resolver thread to queue it on, the host is
+ * reported as not found, as resolve_lookup() does, rather than leaving the
+ * connection waiting for an answer that will never come.
+ *
+ * @param answer Set to the answer (NULL for "no such host") on RESOLVE_DONE
+ * @return RESOLVE_DONE if answered now, RESOLVE_PENDING if a lookup was queued
+ */
+int resolve_connect(char *host, int devnum, unsigned long conn_id, char **answer) {
+    struct resolve_cache *entry;
+
+    *answer = NULL;
+    entry = find_cache(RESOLVE_NAME, host);
+    if (entry && !entry->pending && entry->expires > now_time) {
+        *answer = entry->answer;
+        return RESOLVE_DONE;
+    }
+    if (!entry) entry = new_cache(RESOLVE_NAME, host);
+    entry->pending = 1;
+    if (!queue_request(RESOLVE_NAME, host, devnum, conn_id))
+        return RESOLVE_PENDING;
+    no_resolver(entry);
+    return RESOLVE_DONE;
+}
+
+/**
+ * @brief Descriptor that becomes readable when answers are waiting, or -1
+ */
+int resolve_wake_fd() {
+    return wake_rd;
+}
+
+/**
+ * @brief Collect finished lookups
+ *
+ * Every answer goes into the cache; answers a connect_device() is waiting
+ * for are also passed to handler.
+ */
+void resolve_drain(void (*handler)(char *answer, int devnum, unsigned long conn_id)) {
+    struct resolve_req *list, *req, *prev;
+    struct resolve_cache *entry;
+    char buf[64];
+
+    if (!resolve_running) return;
+    while (read(wake_rd, buf, sizeof(buf)) > 0)
+        ;
+    pthread_mutex_lock(&resolve_lock);
+    list = done_list;
+    done_list = NULL;
+    pthread_mutex_unlock(&resolve_lock);
+
+    /* done_list is newest first; put it back in request order */
+    prev = NULL;
+    while (list) {
+        req = list->next;
+        list->next = prev;
+        prev = list;
+        list = req;
+    }
+
+    while ((req = prev)) {
+        prev = req->next;
+        entry = find_cache(req->type, req->query);
+        if (!entry) entry = new_cache(req->type, req->query);
+        if (entry->answer) FREE(entry->answer);
+        entry->answer = req->answer ? copy_str(req->answer) : NULL;
+        entry->pending = 0;
+        entry->expires = now_time + RESOLVE_TTL;
+        if (req->devnum != -1)
+            handler(req->answer, req->devnum, req->conn_id);
+        if (req->answer) FREE(req->answer);
+        FREE(req->query);
+        FREE(req);
+    }
+}
+
+/**
+ * @brief Ask the resolver thread to exit
+ *
+ * The thread isn't waited for; it may be inside a lookup that takes a
+ * while to time out.
+ */
+void resolve_stop() {
+    if (!resolve_running) return;
+    pthread_mutex_lock(&resolve_lock);
+    resolve_stopping = 1;
+    pthread_cond_signal(&resolve_cond);
+    pthread_mutex_unlock(&resolve_lock);
+}
@@ -0,0 +1,23 @@
+/* resolve.h */
+
+/* Background name resolution.  Lookups run on a resolver thread so a slow
+   DNS server never stalls the game loop; answers come back through
+   resolve_drain(), which the game loop calls when resolve_wake_fd() is
+   readable, and are cached for RESOLVE_TTL seconds. */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#define RESOLVE_NAME 0     /* hostname -> dotted address */
+#define RESOLVE_ADDR 1     /* dotted address -> hostname */
+
+#define RESOLVE_DONE 0     /* answer (possibly NULL for "no such host") set */
+#define RESOLVE_PENDING 1  /* lookup queued, ask again later */
+
+int resolve_lookup(int type, char *query, char **answer);
+int resolve_connect(char *host, int devnum, unsigned long conn_id, char **answer);
+int resolve_wake_fd();
+void resolve_drain(void (*handler)(char *answer, int devnum, unsigned long conn_id));
+void resolve_stop();
+
+#endif /* RESOLVE_H */
@@ -6,11 +6,14 @@
 /* Forward declarations */
 struct object;
 struct heap_mapping;
+struct heap_array;
 
 /* Storage adapter interface for save_object/restore_object
  * 
  * Provides abstraction between object persistence and storage mechanism.
  * Default: file adapter (saves mappings as literals in filesystem)
+ * binary: compact versioned encoding, selected with save_type=binary
+ * kv: every save in one log-structured store file, save_type=kv
  * Future: sqlite adapter, redis adapter, etc.
  */
 typedef struct save_adapter {
@@ -31,6 +34,12 @@ typedef struct save_adapter {
      */
     struct heap_mapping *(*restore_map)(char *key, struct object *caller);
     
+    /* List stored keys starting with prefix, in sorted order
+     * NULL if the adapter can't enumerate its keys
+     * Returns: array of key strings
+     */
+    struct heap_array *(*list_keys)(char *prefix, struct object *caller);
+    
 } save_adapter_t;
 
 /* Get current save adapter (file by default) */
@@ -42,7 +51,24 @@ void set_save_adapter(save_adapter_t *adapter);
 /* Initialize save adapter system */
 void init_save_adapter(void);
 
+/* Build fs_path/save_path + key + ext (allocated) */
+char *adapter_save_path(char *key, char *ext);
+
+/* Create the parent directories of a file path; 0 on success */
+int adapter_make_dirs(char *filepath);
+
 /* File adapter (default) */
 extern save_adapter_t file_adapter;
 
+/* Binary adapter (save_type=binary) */
+extern save_adapter_t binary_adapter;
+
+/* Binary save images, shared with the kv store */
+char *binary_encode_map(struct heap_mapping *data, unsigned long *len);
+struct heap_mapping *binary_decode_map(unsigned char *base, unsigned long size,
+                                       char *name);
+
+/* Single-file key-value store (save_type=kv) */
+extern save_adapter_t kv_adapter;
+
 #endif /* SAVE_ADAPTER_H */
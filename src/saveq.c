@@ -0,0 +1,513 @@
+/**
+ * @file saveq.c
+ * @brief Write-behind queue for save_object()
+ *
+ * Writing and fsyncing a save file can take far longer than building it,
+ * so the save adapters serialize on the game thread and queue the bytes
+ * here.  A writer thread puts each one in place with temp file, fsync and
+ * rename, so a crash leaves either the old save or the new one, never
+ * half of each.  Single-file stores queue appends instead, which are
+ * merged while they wait so a burst of saves costs one write and one
+ * fsync, and are compacted here too, so reading back the live records
+ * never holds up the game.  Results come back through saveq_drain().
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "object.h"
+#include "globals.h"
+#include "file.h"
+#include "saveq.h"
+
+/* One save to report back: merged appends carry several */
+struct save_report {
+    char *key;                /* storage key */
+    signed long refno;        /* object that asked for the save, or -1 */
+    struct save_report *next;
+};
+
+struct save_job {
+    char *path;
+    char *data;
+    unsigned long len;
+    unsigned long size;       /* allocated size of data (appends) */
+    int append;               /* add to the end of path instead of replacing it */
+    struct saveq_range *ranges;   /* compaction: parts of path to keep after data */
+    unsigned long num_ranges;
+    int (*check)(char *data, unsigned long len);
+    int error;                /* errno from the write, 0 on success */
+    struct save_report *reports, *last_report;
+    struct save_job *next;
+};
+
+static pthread_mutex_t saveq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t todo_cond = PTHREAD_COND_INITIALIZER;   /* work for the writer */
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;   /* a write finished */
+static struct save_job *todo_head, *todo_tail;   /* game -> writer */
+static struct save_job *done_list;               /* writer -> game, newest first */
+static struct save_job *current;                 /* being written right now */
+static unsigned long pending_bytes;
+static int saveq_running;
+static int saveq_stopping;
+static int wake_rd = -1, wake_wr = -1;
+static pthread_t writer_tid;
+
+static char *copy_str(const char *s) {
+    char *r;
+
+    r = MALLOC(strlen(s) + 1);
+    strcpy(r, s);
+    return r;
+}
+
+/* Write all of data to fd; returns 0 or an errno value */
+static int write_all(int fd, char *data, unsigned long len) {
+    unsigned long done;
+    long n;
+
+    for (done = 0; done < len; done += n) {
+        n = write(fd, data + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            return errno;
+        }
+    }
+    return 0;
+}
+
+/* Copy the job's ranges of path, as it stands, to fd; returns 0 or an
+ * errno value */
+static int copy_ranges(int fd, struct save_job *job) {
+    struct saveq_range *range;
+    unsigned long i, size = 0;
+    char *buf = NULL;
+    long n;
+    int src, err = 0;
+
+    src = open(job->path, O_RDONLY);
+    if (src < 0) return errno;
+    for (i = 0; !err && i < job->num_ranges; i++) {
+        range = &job->ranges[i];
+        if (range->length > size) {
+            if (buf) FREE(buf);
+            size = range->length;
+            buf = MALLOC(size);
+        }
+        n = pread(src, buf, range->length, range->offset);
+        if (n < 0)
+            err = errno;
+        else if ((unsigned long) n != range->length ||
+                 (job->check && job->check(buf, range->length)))
+            err = EIO;
+        else
+            err = write_all(fd, buf, range->length);
+    }
+    if (buf) FREE(buf);
+    close(src);
+    return err;
+}
+
+/* Put the job's data, and any ranges it keeps, at its path atomically;
+ * returns 0 or an errno value */
+static int write_file(struct save_job *job) {
+    char *tmp_path, *p;
+    int fd, err;
+
+    tmp_path = MALLOC(strlen(job->path) + 5);
+    sprintf(tmp_path, "%s.tmp", job->path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        err = errno;
+        FREE(tmp_path);
+        return err;
+    }
+    err = write_all(fd, job->data, job->len);
+    if (!err && job->ranges) err = copy_ranges(fd, job);
+    if (!err && fsync(fd)) err = errno;
+    if (close(fd) && !err) err = errno;
+    if (!err && rename(tmp_path, job->path)) err = errno;
+    if (err) {
+        unlink(tmp_path);
+        FREE(tmp_path);
+        return err;
+    }
+
+    /* make the rename itself durable */
+    if ((p = strrchr(tmp_path, '/'))) {
+        *p = '\0';
+        if ((fd = open(*tmp_path ? tmp_path : "/", O_RDONLY)) >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+    FREE(tmp_path);
+    return 0;
+}
+
+/* Add data to the end of path; on failure the file is cut back to its
+ * old length so no partial record is left behind.  Returns 0 or an errno
+ * value. */
+static int append_file(char *path, char *data, unsigned long len) {
+    struct stat st;
+    int fd, err;
+
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) return errno;
+    if (fstat(fd, &st)) {
+        err = errno;
+        close(fd);
+        return err;
+    }
+    err = write_all(fd, data, len);
+    if (!err && fsync(fd)) err = errno;
+    if (err) ftruncate(fd, st.st_size);
+    if (close(fd) && !err) err = errno;
+    return err;
+}
+
+static void *saveq_main(void *arg) {
+    struct save_job *job;
+    char c = 0;
+
+    pthread_mutex_lock(&saveq_lock);
+    for (;;) {
+        if (!(job = todo_head)) {
+            /* saveq_stop() only ends the thread once the queue is empty */
+            if (saveq_stopping) break;
+            pthread_cond_wait(&todo_cond, &saveq_lock);
+            continue;
+        }
+        todo_head = job->next;
+        if (!todo_head) todo_tail = NULL;
+        current = job;
+        pthread_mutex_unlock(&saveq_lock);
+
+        if (job->append)
+            job->error = append_file(job->path, job->data, job->len);
+        else
+            job->error = write_file(job);
+
+        pthread_mutex_lock(&saveq_lock);
+        current = NULL;
+        pending_bytes -= job->len;
+        FREE(job->data);
+        job->data = NULL;
+        if (job->ranges) FREE(job->ranges);
+        job->ranges = NULL;
+        job->next = done_list;
+        done_list = job;
+        write(wake_wr, &c, 1);
+        pthread_cond_broadcast(&done_cond);
+    }
+    pthread_mutex_unlock(&saveq_lock);
+    return NULL;
+}
+
+static int start_writer() {
+    int p[2];
+
+    if (saveq_running) return 0;
+    if (saveq_stopping) return -1;
+    if (pipe(p) < 0) return -1;
+    fcntl(p[0], F_SETFL, fcntl(p[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(p[1], F_SETFL, fcntl(p[1], F_GETFL, 0) | O_NONBLOCK);
+    wake_rd = p[0];
+    wake_wr = p[1];
+    if (pthread_create(&writer_tid, NULL, saveq_main, NULL)) {
+        close(wake_rd);
+        close(wake_wr);
+        wake_rd = wake_wr = -1;
+        return -1;
+    }
+    saveq_running = 1;
+    logger(LOG_INFO, "saveq: writer thread started");
+    return 0;
+}
+
+static struct save_job *new_job(char *path, char *data, unsigned long len,
+                                int append) {
+    struct save_job *job;
+
+    job = MALLOC(sizeof(struct save_job));
+    job->path = copy_str(path);
+    job->data = data;
+    job->len = job->size = len;
+    job->append = append;
+    job->ranges = NULL;
+    job->num_ranges = 0;
+    job->check = NULL;
+    job->error = 0;
+    job->reports = job->last_report = NULL;
+    job->next = NULL;
+    return job;
+}
+
+static void add_report(struct save_job *job, char *key, struct object *obj) {
+    struct save_report *report;
+
+    report = MALLOC(sizeof(struct save_report));
+    report->key = copy_str(key);
+    report->refno = obj ? obj->refno : -1;
+    report->next = NULL;
+    if (job->last_report)
+        job->last_report->next = report;
+    else
+        job->reports = report;
+    job->last_report = report;
+}
+
+/* Caller holds saveq_lock */
+static void queue_job(struct save_job *job) {
+    while (pending_bytes > SAVEQ_MAX_PENDING && (todo_head || current))
+        pthread_cond_wait(&done_cond, &saveq_lock);
+    if (todo_tail)
+        todo_tail->next = job;
+    else
+        todo_head = job;
+    todo_tail = job;
+    pending_bytes += job->len;
+    pthread_cond_signal(&todo_cond);
+}
+
+/* Write a job on the game thread when there is no writer thread */
+static int write_now(struct save_job *job) {
+    char logbuf[512];
+    int err;
+
+    if (job->append)
+        err = append_file(job->path, job->data, job->len);
+    else
+        err = write_file(job);
+    if (err) {
+        snprintf(logbuf, sizeof(logbuf), "saveq: write of %s failed: %s",
+                 job->path, strerror(err));
+        logger(LOG_ERROR, logbuf);
+    }
+    FREE(job->path);
+    FREE(job->data);
+    if (job->ranges) FREE(job->ranges);
+    FREE(job);
+    return err ? -1 : 0;
+}
+
+static int path_pending(char *path) {
+    struct save_job *job;
+
+    if (current && !strcmp(current->path, path)) return 1;
+    for (job = todo_head; job; job = job->next)
+        if (!strcmp(job->path, path)) return 1;
+    return 0;
+}
+
+/**
+ * @brief Queue a save file to be written in the background
+ *
+ * If the newest write of the same path still waiting is a save by the
+ * same object, it is replaced rather than written twice.  An older one
+ * is left alone: a save of that path queued after it has to land first.  If more than SAVEQ_MAX_PENDING
+ * bytes are already waiting this blocks until the writer catches up; if
+ * the writer thread can't be started the file is written before returning.
+ *
+ * @param path File to write
+ * @param key Storage key reported to the handler passed to saveq_drain()
+ * @param data Serialized save, allocated with MALLOC; the queue frees it
+ * @param len Length of data
+ * @param obj Object doing the save, or NULL for driver housekeeping
+ * @return 0 if queued (or written), -1 if the synchronous write failed
+ */
+int saveq_write(char *path, char *key, char *data, unsigned long len,
+                struct object *obj) {
+    struct save_job *job, *last;
+
+    if (start_writer())
+        return write_now(new_job(path, data, len, 0));
+
+    pthread_mutex_lock(&saveq_lock);
+    last = NULL;
+    for (job = todo_head; obj && job; job = job->next)
+        if (!strcmp(job->path, path))
+            last = job;
+    if (last && !last->append && last->reports &&
+        last->reports->refno == obj->refno) {
+        pending_bytes += len - last->len;
+        FREE(last->data);
+        last->data = data;
+        last->len = last->size = len;
+        pthread_mutex_unlock(&saveq_lock);
+        return 0;
+    }
+    job = new_job(path, data, len, 0);
+    add_report(job, key, obj);
+    queue_job(job);
+    pthread_mutex_unlock(&saveq_lock);
+    return 0;
+}
+
+/**
+ * @brief Queue data to be appended to path
+ *
+ * Appends are written in the order they are queued.  While the newest
+ * queued job is an append to the same path that hasn't started, data is
+ * added to it, so everything saved while the writer is busy goes out in
+ * one write and one fsync.  The data is copied.
+ *
+ * @return 0 if queued (or written), -1 if the synchronous write failed
+ */
+int saveq_append(char *path, char *key, char *data, unsigned long len,
+                 struct object *obj) {
+    struct save_job *job;
+    char *copy;
+
+    copy = MALLOC(len);
+    memcpy(copy, data, len);
+    if (start_writer())
+        return write_now(new_job(path, copy, len, 1));
+
+    pthread_mutex_lock(&saveq_lock);
+    job = todo_tail;
+    if (job && job->append && !strcmp(job->path, path)) {
+        FREE(copy);
+        if (job->len + len > job->size) {
+            job->size = (job->len + len) * 2;
+            job->data = realloc(job->data, job->size);
+        }
+        memcpy(job->data + job->len, data, len);
+        job->len += len;
+        pending_bytes += len;
+    } else {
+        job = new_job(path, copy, len, 1);
+        queue_job(job);
+    }
+    add_report(job, key, obj);
+    pthread_mutex_unlock(&saveq_lock);
+    return 0;
+}
+
+/**
+ * @brief Queue a rewrite of path that keeps only parts of it
+ *
+ * Once the writes of path queued before it have landed, path is replaced
+ * as by saveq_write() with data followed by each of ranges, in order,
+ * copied from the file as it then stands.  Each range is passed to check,
+ * if given, which returns non-zero to call it corrupt; then, as on any
+ * error, the file is left as it was.  The reading and copying are done by
+ * the writer thread.  data and ranges are allocated with MALLOC; the
+ * queue frees them.
+ *
+ * @return 0 if queued (or written), -1 if the synchronous write failed
+ */
+int saveq_compact(char *path, char *data, unsigned long len,
+                  struct saveq_range *ranges, unsigned long num_ranges,
+                  int (*check)(char *data, unsigned long len)) {
+    struct save_job *job;
+
+    job = new_job(path, data, len, 0);
+    job->ranges = ranges;
+    job->num_ranges = num_ranges;
+    job->check = check;
+    if (start_writer())
+        return write_now(job);
+
+    pthread_mutex_lock(&saveq_lock);
+    queue_job(job);
+    pthread_mutex_unlock(&saveq_lock);
+    return 0;
+}
+
+/**
+ * @brief Wait until no write of path is queued or in progress
+ *
+ * Restores call this first so they never read a save older than one
+ * already made.
+ */
+void saveq_wait(char *path) {
+    if (!saveq_running) return;
+    pthread_mutex_lock(&saveq_lock);
+    while (path_pending(path))
+        pthread_cond_wait(&done_cond, &saveq_lock);
+    pthread_mutex_unlock(&saveq_lock);
+}
+
+/**
+ * @brief Descriptor that becomes readable when writes have finished, or -1
+ */
+int saveq_wake_fd() {
+    return wake_rd;
+}
+
+/**
+ * @brief Collect finished writes
+ *
+ * Failures are logged here; every result is then passed to handler,
+ * if one is given, in the order the saves were queued.
+ */
+void saveq_drain(void (*handler)(char *key, signed long refno, int error)) {
+    struct save_job *list, *job, *prev;
+    struct save_report *report;
+    char logbuf[512];
+    char buf[64];
+
+    if (wake_rd == -1) return;
+    while (read(wake_rd, buf, sizeof(buf)) > 0)
+        ;
+    pthread_mutex_lock(&saveq_lock);
+    list = done_list;
+    done_list = NULL;
+    pthread_mutex_unlock(&saveq_lock);
+
+    /* done_list is newest first; put it back in queue order */
+    prev = NULL;
+    while (list) {
+        job = list->next;
+        list->next = prev;
+        prev = list;
+        list = job;
+    }
+
+    while ((job = prev)) {
+        prev = job->next;
+        if (job->error) {
+            snprintf(logbuf, sizeof(logbuf), "saveq: write of %s failed: %s",
+                     job->path, strerror(job->error));
+            logger(LOG_ERROR, logbuf);
+        }
+        while ((report = job->reports)) {
+            job->reports = report->next;
+            if (handler && report->refno != -1)
+                handler(report->key, report->refno, job->error);
+            FREE(report->key);
+            FREE(report);
+        }
+        FREE(job->path);
+        FREE(job);
+    }
+}
+
+/**
+ * @brief Finish every queued write and stop the writer thread
+ *
+ * Later saves are written synchronously.
+ */
+void saveq_stop() {
+    saveq_stopping = 1;
+    if (!saveq_running) return;
+    pthread_mutex_lock(&saveq_lock);
+    pthread_cond_signal(&todo_cond);
+    pthread_mutex_unlock(&saveq_lock);
+    pthread_join(writer_tid, NULL);
+    saveq_running = 0;
+    saveq_drain(NULL);
+    close(wake_rd);
+    close(wake_wr);
+    wake_rd = wake_wr = -1;
+}
@@ -0,0 +1,31 @@
+/* saveq.h */
+
+/* Write-behind queue for save_object().  Adapters serialize on the game
+   thread and hand the bytes to a writer thread, which writes a temp
+   file, fsyncs it and renames it over the old save, or appends to a
+   single-file store.  Repeated saves of the same file by the same object
+   are merged while they wait, as are runs of appends, and stores are
+   compacted there too.  Finished writes come back through saveq_drain(),
+   which the game loop calls when saveq_wake_fd() is readable. */
+
+#ifndef SAVEQ_H
+#define SAVEQ_H
+
+struct saveq_range {
+  unsigned long offset;
+  unsigned long length;
+};
+
+int saveq_write(char *path, char *key, char *data, unsigned long len,
+                struct object *obj);
+int saveq_append(char *path, char *key, char *data, unsigned long len,
+                 struct object *obj);
+int saveq_compact(char *path, char *data, unsigned long len,
+                  struct saveq_range *ranges, unsigned long num_ranges,
+                  int (*check)(char *data, unsigned long len));
+void saveq_wait(char *path);
+int saveq_wake_fd();
+void saveq_drain(void (*handler)(char *key, signed long refno, int error));
+void saveq_stop();
+
+#endif /* SAVEQ_H */
@@ -5,6 +5,8 @@
 #include "protos.h"
 #include "instr.h"
 #include "constrct.h"
+#include "interp.h"
+#include "globals.h"
 #include "file.h"
 
 /* External reference to locals from interp.c - will be passed as parameter */
@@ -275,21 +277,13 @@ int s_member_array(struct object *caller, struct object *obj, struct object *pla
     return 1;
   }
   
-  /* Search for element */
+  /* Search for element.  A single lookup is a plain scan; building a hash
+     set would cost more than the scan it replaces. */
   found = -1;
   for (i = 0; i < arr->size; i++) {
-    /* Compare based on type */
-    if (arr->elements[i].type == elem_var.type) {
-      if (elem_var.type == INTEGER && arr->elements[i].value.integer == elem_var.value.integer) {
-        found = i;
-        break;
-      } else if (elem_var.type == STRING && strcmp(arr->elements[i].value.string, elem_var.value.string) == 0) {
-        found = i;
-        break;
-      } else if (elem_var.type == OBJECT && arr->elements[i].value.objptr == elem_var.value.objptr) {
-        found = i;
-        break;
-      }
+    if (var_equals(&arr->elements[i], &elem_var)) {
+      found = i;
+      break;
     }
   }
   
@@ -302,74 +296,263 @@ int s_member_array(struct object *caller, struct object *obj, struct object *pla
   return 0;
 }
 
-/* Helper function for sort_array - compare two vars */
+/* Helper function for sort_array - compare two vars
+ * Mixed types are ordered by type so the order stays consistent:
+ * integers, then strings, then objects (by refno), then everything else.
+ */
 static int compare_vars(struct var *a, struct var *b) {
-  if (a->type != b->type) return 0; /* Different types, no order */
+  if (a->type != b->type)
+    return (a->type < b->type) ? -1 : 1;
   
   if (a->type == INTEGER) {
     return (a->value.integer < b->value.integer) ? -1 : 
            (a->value.integer > b->value.integer) ? 1 : 0;
   } else if (a->type == STRING) {
     return strcmp(a->value.string, b->value.string);
+  } else if (a->type == OBJECT) {
+    if (!a->value.objptr || !b->value.objptr)
+      return (a->value.objptr ? 1 : 0) - (b->value.objptr ? 1 : 0);
+    return (a->value.objptr->refno < b->value.objptr->refno) ? -1 :
+           (a->value.objptr->refno > b->value.objptr->refno) ? 1 : 0;
   }
   return 0;
 }
 
-/* sort_array() - Sort array in place (simple bubble sort for now)
+/* Sort state shared by the merge passes.  func is looked up once and
+ * reused for every comparison; NULL means compare_vars() * direction.
+ */
+struct sort_info {
+  struct fns *func;         /* NLPC comparator, or NULL */
+  struct object *cmp_obj;   /* object the comparator was named on */
+  struct object *real_obj;  /* object that actually holds func */
+  struct object *caller;
+  struct object *player;
+  int direction;            /* 1 ascending, -1 descending */
+  int error;                /* set once a comparator call fails */
+};
+
+#define SORT_RUN 16         /* runs insertion-sorted before merging */
+
+/* Compare a and b; <0, 0 or >0 like strcmp() */
+static int sort_compare(struct sort_info *info, struct var *a, struct var *b) {
+  struct var_stack *stack;
+  struct var tmp;
+  struct var *old_locals;
+  unsigned int old_num_locals;
+  int result;
+  
+  if (!info->func)
+    return compare_vars(a, b) * info->direction;
+  if (info->error)
+    return 0;
+  if (info->cmp_obj->flags & GARBAGE) {
+    info->error = 1;
+    return 0;
+  }
+  
+  /* push() doesn't take array/mapping references, so copy then hand over */
+  stack = NULL;
+  copy_var(&tmp, a);
+  pushnocopy(&tmp, &stack);
+  copy_var(&tmp, b);
+  pushnocopy(&tmp, &stack);
+  tmp.type = NUM_ARGS;
+  tmp.value.num = 2;
+  push(&tmp, &stack);
+  
+  old_locals = locals;
+  old_num_locals = num_locals;
+  if (interp(info->caller, info->real_obj, info->player, &stack, info->func)) {
+    locals = old_locals;
+    num_locals = old_num_locals;
+    free_stack(&stack);
+    info->error = 1;
+    return 0;
+  }
+  locals = old_locals;
+  num_locals = old_num_locals;
+  
+  /* interp() reports running out of cycles as a normal return; stop here
+     rather than make every remaining comparison fail the same way */
+#ifdef CYCLE_SOFT_MAX
+  if (use_soft_cycles && soft_cycles > CYCLE_SOFT_MAX)
+    info->error = 1;
+#endif /* CYCLE_SOFT_MAX */
+#ifdef CYCLE_HARD_MAX
+  if (use_hard_cycles && hard_cycles > CYCLE_HARD_MAX)
+    info->error = 1;
+#endif /* CYCLE_HARD_MAX */
+  
+  result = 0;
+  if (!pop(&tmp, &stack, info->real_obj)) {
+    if (tmp.type == INTEGER)
+      result = (tmp.value.integer < 0) ? -1 : (tmp.value.integer > 0);
+    clear_var(&tmp);
+  }
+  free_stack(&stack);
+  return result;
+}
+
+/* Stable bottom-up merge sort of elems[0..n).  Short runs are insertion
+ * sorted first, and neighbouring runs that are already in order skip the
+ * merge, so presorted input costs one comparison per run.  work must have
+ * room for n vars.  Elements are moved, never copied.
+ */
+static void merge_sort(struct var *elems, struct var *work, unsigned int n,
+                       struct sort_info *info) {
+  unsigned int lo, mid, hi, width, i, j, k;
+  struct var x;
+  
+  for (lo = 0; lo < n; lo += SORT_RUN) {
+    hi = (lo + SORT_RUN < n) ? lo + SORT_RUN : n;
+    for (i = lo + 1; i < hi; i++) {
+      x = elems[i];
+      for (j = i; j > lo && sort_compare(info, &elems[j - 1], &x) > 0; j--)
+        elems[j] = elems[j - 1];
+      elems[j] = x;
+    }
+  }
+  
+  for (width = SORT_RUN; width < n && !info->error; width *= 2) {
+    for (lo = 0; lo + width < n; lo += 2 * width) {
+      mid = lo + width;
+      hi = (mid + width < n) ? mid + width : n;
+      if (sort_compare(info, &elems[mid - 1], &elems[mid]) <= 0)
+        continue;
+      
+      /* merge the left run (moved into work) with the right run in place */
+      memcpy(work, &elems[lo], (mid - lo) * sizeof(struct var));
+      i = 0;
+      j = mid;
+      k = lo;
+      while (i < mid - lo && j < hi) {
+        if (sort_compare(info, &elems[j], &work[i]) < 0)
+          elems[k++] = elems[j++];
+        else
+          elems[k++] = work[i++];
+      }
+      while (i < mid - lo)
+        elems[k++] = work[i++];
+    }
+  }
+}
+
+/* sort_array() - Return a sorted copy of an array
  * Usage: mixed *sort_array(mixed *arr)
- * Note: Only supports simple numeric/string sorting, no custom function yet
+ *        mixed *sort_array(mixed *arr, int direction)
+ *        mixed *sort_array(mixed *arr, string cmp_func)
+ *        mixed *sort_array(mixed *arr, string cmp_func, object ob)
+ * cmp_func(a, b) is called in ob (default this object) and returns <0, 0
+ * or >0.  The sort is stable: elements that compare equal keep their order.
  */
 int s_sort_array(struct object *caller, struct object *obj, struct object *player,
                  struct var_stack **rts) {
-  struct var tmp, arr_var, result;
-  struct heap_array *arr;
-  unsigned int i, j;
-  int swapped;
-  struct var temp_var;
+  struct var tmp, arr_var, func_var, ob_var, result;
+  struct heap_array *arr, *new_arr;
+  struct sort_info info;
+  struct var *work;
+  unsigned int i;
+  int num_args;
   
   /* Pop NUM_ARGS */
   if (pop(&tmp, rts, obj)) return 1;
-  if (tmp.type != NUM_ARGS || tmp.value.num != 1) {
+  if (tmp.type != NUM_ARGS || tmp.value.num < 1 || tmp.value.num > 3) {
     clear_var(&tmp);
     return 1;
   }
+  num_args = tmp.value.num;
+  
+  info.func = NULL;
+  info.cmp_obj = obj;
+  info.real_obj = obj;
+  info.caller = obj;
+  info.player = player;
+  info.direction = 1;
+  info.error = 0;
+  
+  /* Pop comparator object */
+  ob_var.type = INTEGER;
+  if (num_args == 3) {
+    if (pop(&ob_var, rts, obj)) return 1;
+    if (ob_var.type != OBJECT || !ob_var.value.objptr) {
+      clear_var(&ob_var);
+      return 1;
+    }
+    info.cmp_obj = ob_var.value.objptr;
+  }
+  
+  /* Pop comparator function name or direction */
+  func_var.type = INTEGER;
+  func_var.value.integer = 1;
+  if (num_args >= 2) {
+    if (pop(&func_var, rts, obj)) return 1;
+    if (func_var.type == INTEGER && num_args == 2) {
+      info.direction = (func_var.value.integer < 0) ? -1 : 1;
+    } else if (func_var.type != STRING) {
+      clear_var(&func_var);
+      return 1;
+    }
+  }
   
   /* Pop array */
-  if (pop(&arr_var, rts, obj)) return 1;
-  if (arr_var.type != ARRAY) {
+  if (pop(&arr_var, rts, obj)) {
+    clear_var(&func_var);
+    return 1;
+  }
+  if (arr_var.type != ARRAY || !arr_var.value.array_ptr) {
     clear_var(&arr_var);
+    clear_var(&func_var);
     return 1;
   }
-  
   arr = arr_var.value.array_ptr;
-  if (!arr || arr->size == 0) {
-    push(&arr_var, rts);
-    return 0;
+  
+  if (func_var.type == STRING) {
+    if (info.cmp_obj->flags & GARBAGE)
+      info.func = NULL;
+    else
+      info.func = find_function(func_var.value.string, info.cmp_obj, &info.real_obj);
+    if (!info.func || (info.cmp_obj != obj && info.func->is_static)) {
+      clear_var(&func_var);
+      clear_var(&arr_var);
+      return 1;
+    }
+    clear_var(&func_var);
   }
   
-  /* Bubble sort */
-  for (i = 0; i < arr->size - 1; i++) {
-    swapped = 0;
-    for (j = 0; j < arr->size - i - 1; j++) {
-      if (compare_vars(&arr->elements[j], &arr->elements[j + 1]) > 0) {
-        /* Swap */
-        temp_var = arr->elements[j];
-        arr->elements[j] = arr->elements[j + 1];
-        arr->elements[j + 1] = temp_var;
-        swapped = 1;
-      }
+  /* Sort a copy; the comparator may look at or even change the original */
+  new_arr = allocate_array(arr->size, arr->size);
+  if (!new_arr) {
+    clear_var(&arr_var);
+    return 1;
+  }
+  for (i = 0; i < arr->size; i++)
+    copy_var(&new_arr->elements[i], &arr->elements[i]);
+  clear_var(&arr_var);
+  
+  if (new_arr->size > 1) {
+    work = MALLOC(new_arr->size * sizeof(struct var));
+    if (!work) {
+      array_release(new_arr);
+      return 1;
     }
-    if (!swapped) break; /* Already sorted */
+    merge_sort(new_arr->elements, work, new_arr->size, &info);
+    FREE(work);
   }
   
-  /* Return the array */
-  result = arr_var;
+  if (info.error) {
+    array_release(new_arr);
+    return 1;
+  }
+  
+  result.type = ARRAY;
+  result.value.array_ptr = new_arr;
   push(&result, rts);
   return 0;
 }
 
-/* reverse() - Reverse array in place
+/* reverse() - Reverse an array
  * Usage: mixed *reverse(mixed *arr)
+ * The argument is reversed in place only when nothing else holds it
  */
 int s_reverse(struct object *caller, struct object *obj, struct object *player,
               struct var_stack **rts) {
@@ -397,6 +580,11 @@ int s_reverse(struct object *caller, struct object *obj, struct object *player,
     push(&arr_var, rts);
     return 0;
   }
+  if (array_unshare(&arr_var)) {
+    clear_var(&arr_var);
+    return 1;
+  }
+  arr = arr_var.value.array_ptr;
   
   /* Reverse in place by swapping elements */
   for (i = 0, j = arr->size - 1; i < j; i++, j--) {
@@ -420,8 +608,6 @@ int s_unique_array(struct object *caller, struct object *obj, struct object *pla
                    struct var_stack **rts) {
   struct var tmp, arr_var, result;
   struct heap_array *arr, *new_arr;
-  unsigned int i, j, unique_count;
-  int is_duplicate;
   
   /* Pop NUM_ARGS */
   if (pop(&tmp, rts, obj)) return 1;
@@ -443,62 +629,12 @@ int s_unique_array(struct object *caller, struct object *obj, struct object *pla
     return 1;
   }
   
-  /* Count unique elements */
-  unique_count = 0;
-  for (i = 0; i < arr->size; i++) {
-    /* Check if this element appeared before */
-    is_duplicate = 0;
-    for (j = 0; j < i; j++) {
-      if (arr->elements[i].type == arr->elements[j].type) {
-        if ((arr->elements[i].type == INTEGER && arr->elements[i].value.integer == arr->elements[j].value.integer) ||
-            (arr->elements[i].type == STRING && strcmp(arr->elements[i].value.string, arr->elements[j].value.string) == 0) ||
-            (arr->elements[i].type == OBJECT && arr->elements[i].value.objptr == arr->elements[j].value.objptr)) {
-          is_duplicate = 1;
-          break;
-        }
-      }
-    }
-    
-    if (!is_duplicate) {
-      unique_count++;
-    }
-  }
-  
-  /* Allocate new heap array */
-  new_arr = allocate_array(unique_count, unique_count);
+  new_arr = array_unique(arr);
   if (!new_arr) {
     clear_var(&arr_var);
     return 1;
   }
   
-  /* Copy unique elements */
-  unique_count = 0;
-  for (i = 0; i < arr->size; i++) {
-    /* Check if duplicate */
-    is_duplicate = 0;
-    for (j = 0; j < i; j++) {
-      if (arr->elements[i].type == arr->elements[j].type) {
-        if ((arr->elements[i].type == INTEGER && arr->elements[i].value.integer == arr->elements[j].value.integer) ||
-            (arr->elements[i].type == STRING && strcmp(arr->elements[i].value.string, arr->elements[j].value.string) == 0) ||
-            (arr->elements[i].type == OBJECT && arr->elements[i].value.objptr == arr->elements[j].value.objptr)) {
-          is_duplicate = 1;
-          break;
-        }
-      }
-    }
-    
-    if (!is_duplicate) {
-      /* Copy to new array */
-      if (arr->elements[i].type == STRING) {
-        new_arr->elements[unique_count].type = STRING;
-        new_arr->elements[unique_count].value.string = copy_string(arr->elements[i].value.string);
-      } else {
-        new_arr->elements[unique_count] = arr->elements[i];
-      }
-      unique_count++;
-    }
-  }
-  
   clear_var(&arr_var);
   
   /* Return new array */
@@ -31,7 +31,6 @@ int s_keys(struct object *caller, struct object *obj, struct object *player,
   struct var tmp, map_var, result;
   struct heap_mapping *map;
   struct heap_array *keys_array;
-  unsigned int i, key_count;
   
   /* Pop NUM_ARGS */
   if (pop(&tmp, rts, obj)) return 1;
@@ -49,27 +48,12 @@ int s_keys(struct object *caller, struct object *obj, struct object *player,
   
   map = map_var.value.mapping_ptr;
   
-  /* Allocate array for keys */
-  keys_array = allocate_array(map->size, map->size);
+  keys_array = mapping_keys_array(map);
   if (!keys_array) {
     clear_var(&map_var);
     return 1;
   }
   
-  /* Collect all keys from hash table */
-  key_count = 0;
-  for (i = 0; i < map->capacity; i++) {
-    struct mapping_entry *entry = map->buckets[i];
-    while (entry) {
-      if (key_count < map->size) {
-        /* Copy key to array */
-        copy_var(&keys_array->elements[key_count], &entry->key);
-        key_count++;
-      }
-      entry = entry->next;
-    }
-  }
-  
   /* Push result array */
   result.type = ARRAY;
   result.value.array_ptr = keys_array;
@@ -88,7 +72,6 @@ int s_values(struct object *caller, struct object *obj, struct object *player,
   struct var tmp, map_var, result;
   struct heap_mapping *map;
   struct heap_array *values_array;
-  unsigned int i, value_count;
   
   /* Pop NUM_ARGS */
   if (pop(&tmp, rts, obj)) return 1;
@@ -106,27 +89,12 @@ int s_values(struct object *caller, struct object *obj, struct object *player,
   
   map = map_var.value.mapping_ptr;
   
-  /* Allocate array for values */
-  values_array = allocate_array(map->size, map->size);
+  values_array = mapping_values_array(map);
   if (!values_array) {
     clear_var(&map_var);
     return 1;
   }
   
-  /* Collect all values from hash table */
-  value_count = 0;
-  for (i = 0; i < map->capacity; i++) {
-    struct mapping_entry *entry = map->buckets[i];
-    while (entry) {
-      if (value_count < map->size) {
-        /* Copy value to array */
-        copy_var(&values_array->elements[value_count], &entry->value);
-        value_count++;
-      }
-      entry = entry->next;
-    }
-  }
-  
   /* Push result array */
   result.type = ARRAY;
   result.value.array_ptr = values_array;
@@ -139,11 +107,13 @@ int s_values(struct object *caller, struct object *obj, struct object *player,
 /* map_delete() - Delete a key from mapping
  * Usage: void map_delete(mapping m, mixed key)
  * Returns: 0 (void)
- * Note: Modifies mapping in-place
+ * Note: Modifies the mapping held by m in place.  Arguments arrive
+ * unresolved, so a mapping shared with other holders is copied first.
  */
 int s_map_delete(struct object *caller, struct object *obj, struct object *player,
                  struct var_stack **rts) {
   struct var tmp, map_var, key_var, result;
+  struct var *slot;
   struct heap_mapping *map;
   
   /* Pop NUM_ARGS */
@@ -155,19 +125,31 @@ int s_map_delete(struct object *caller, struct object *obj, struct object *playe
   
   /* Pop key */
   if (pop(&key_var, rts, obj)) return 1;
+  if (resolve_var(&key_var, obj)) {
+    clear_var(&key_var);
+    return 1;
+  }
   
   /* Pop mapping */
   if (pop(&map_var, rts, obj)) {
     clear_var(&key_var);
     return 1;
   }
-  if (map_var.type != MAPPING) {
+  slot = &map_var;
+  if (map_var.type == GLOBAL_L_VALUE || map_var.type == LOCAL_L_VALUE) {
+    slot = lvalue_slot(&map_var, obj);
+    if (slot && slot->type == MAPPING && mapping_unshare(slot))
+      slot = NULL;
+    if (slot && map_var.type == GLOBAL_L_VALUE)
+      obj->obj_state = DIRTY;
+  }
+  if (!slot || slot->type != MAPPING) {
     clear_var(&map_var);
     clear_var(&key_var);
     return 1;
   }
   
-  map = map_var.value.mapping_ptr;
+  map = slot->value.mapping_ptr;
   
   /* Delete the key */
   mapping_delete(map, &key_var);
@@ -386,7 +386,9 @@ static int deserialize_object_globals(struct object *obj, struct heap_mapping *d
 /* save_object([string key])
  * Serializes caller's global variables to storage
  * Key defaults to object pathname
- * Returns: 1 on success, 0 on failure
+ * The file is written in the background; save_done(key, success) is
+ * called on the object once it is on disk
+ * Returns: 1 on success (saved or queued), 0 on failure
  */
 int s_save_object(struct object *caller, struct object *obj, struct object *player,
                   struct var_stack **rts) {
@@ -582,6 +584,58 @@ int s_restore_map(struct object *caller, struct object *obj, struct object *play
     return 0;
 }
 
+/* save_keys([string prefix])
+ * Lists the keys in storage that start with prefix (every key if it is
+ * omitted), in sorted order
+ * Returns: array of keys, or 0 if the save adapter can't list its keys
+ */
+int s_save_keys(struct object *caller, struct object *obj, struct object *player,
+                struct var_stack **rts) {
+    struct heap_array *keys = NULL;
+    struct var tmp;
+    char *prefix = NULL;
+    int num_args;
+    save_adapter_t *adapter;
+    
+    /* Pop NUM_ARGS */
+    if (pop(&tmp, rts, obj)) return 1;
+    if (tmp.type != NUM_ARGS) {
+        clear_var(&tmp);
+        return 1;
+    }
+    num_args = tmp.value.num;
+    
+    /* Get optional prefix argument */
+    if (num_args == 1) {
+        if (pop(&tmp, rts, obj)) return 1;
+        if (tmp.type == STRING) {
+            prefix = copy_string(tmp.value.string);
+        } else if (tmp.type != INTEGER || tmp.value.integer != 0) {
+            clear_var(&tmp);
+            return 1;
+        }
+        clear_var(&tmp);
+    } else if (num_args != 0) {
+        return 1;
+    }
+    
+    adapter = get_save_adapter();
+    if (adapter->list_keys)
+        keys = adapter->list_keys(prefix ? prefix : "", obj);
+    if (prefix) FREE(prefix);
+    
+    if (!keys) {
+        tmp.type = INTEGER;
+        tmp.value.integer = 0;
+        push(&tmp, rts);
+        return 0;
+    }
+    tmp.type = ARRAY;
+    tmp.value.array_ptr = keys;
+    push(&tmp, rts);
+    return 0;
+}
+
 /* query_idle_time() - Get idle time of an object
  *
  * Returns the number of seconds since the object was last accessed.
@@ -619,10 +673,13 @@ int s_query_idle_time(struct object *caller, struct object *obj,
  * Returns a mapping of driver configuration from netci.ini:
  *   ([ "save_path": "data/save/",
  *      "save_type": "file",
+ *      "bytecode_path": "bytecode/",
  *      "auto_object": "/sys/auto",
  *      "time_cleanup": 1200,
  *      "time_reset": 800,
- *      "time_heartbeat": 2000 ])
+ *      "time_heartbeat": 2000,
+ *      "lazy_load": 0,
+ *      "unload_idle": 0 ])
  *
  * Syntax: mapping query_config()
  * Returns: mapping of config keys to values
@@ -640,8 +697,8 @@ int s_query_config(struct object *caller, struct object *obj,
     }
     if (tmp.value.num != 0) return 1;
 
-    /* Create new mapping for config (6 config items) */
-    config = allocate_mapping(6);
+    /* Create new mapping for config (9 config items) */
+    config = allocate_mapping(9);
     if (!config) {
         tmp.type = INTEGER;
         tmp.value.integer = 0;
@@ -671,6 +728,17 @@ int s_query_config(struct object *caller, struct object *obj,
         clear_var(&value);
     }
 
+    /* Add bytecode_path */
+    if (bytecode_path && *bytecode_path) {
+        key.type = STRING;
+        key.value.string = copy_string("bytecode_path");
+        value.type = STRING;
+        value.value.string = copy_string(bytecode_path);
+        mapping_set(config, &key, &value);
+        clear_var(&key);
+        clear_var(&value);
+    }
+
     /* Add auto_object */
     if (auto_object_path && *auto_object_path) {
         key.type = STRING;
@@ -706,6 +774,22 @@ int s_query_config(struct object *caller, struct object *obj,
     mapping_set(config, &key, &value);
     clear_var(&key);
 
+    /* Add lazy_load */
+    key.type = STRING;
+    key.value.string = copy_string("lazy_load");
+    value.type = INTEGER;
+    value.value.integer = lazy_load;
+    mapping_set(config, &key, &value);
+    clear_var(&key);
+
+    /* Add unload_idle */
+    key.type = STRING;
+    key.value.string = copy_string("unload_idle");
+    value.type = INTEGER;
+    value.value.integer = unload_idle;
+    mapping_set(config, &key, &value);
+    clear_var(&key);
+
     /* Return the mapping */
     tmp.type = MAPPING;
     tmp.value.mapping_ptr = config;
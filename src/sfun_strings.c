@@ -271,7 +271,10 @@ static void assign_to_lvalue(struct var *lvalue, struct var *value, struct objec
     /* Check if this is a heap array element (pointer) or regular global */
     if (lvalue->value.l_value.ref >= obj->parent->funcs->num_globals) {
       /* Heap array element - direct pointer */
-      target_var = (struct var *)lvalue->value.l_value.ref;
+      if (!(target_var = element_slot(lvalue->value.l_value.ref))) {
+        clear_var(value);
+        return;
+      }
       clear_var(target_var);
       *target_var = *value;
     } else {
@@ -288,7 +291,10 @@ static void assign_to_lvalue(struct var *lvalue, struct var *value, struct objec
     /* Check if this is a heap array element (pointer) or regular local */
     if (lvalue->value.l_value.ref >= num_locals) {
       /* Heap array element - direct pointer */
-      target_var = (struct var *)lvalue->value.l_value.ref;
+      if (!(target_var = element_slot(lvalue->value.l_value.ref))) {
+        clear_var(value);
+        return;
+      }
       clear_var(target_var);
       *target_var = *value;
     } else {
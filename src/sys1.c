@@ -9,6 +9,8 @@
 #include "dbhandle.h"
 #include "globals.h"
 #include "cache.h"
+#include "lazy.h"
+#include "unload.h"
 
 int s_add_verb(struct object *caller, struct object *obj, struct object
                *player, struct var_stack **rts) {
@@ -161,6 +163,12 @@ int s_call_other(struct object *caller, struct object *obj, struct object
     free_stack(&arg_stack);
     return 1;
   }
+  if (tmp1.type==STRING && lazy_load && tmp2.type==STRING) {
+    tmpobj=lazy_find_proto(tmp1.value.string,obj,player);
+    clear_var(&tmp1);
+    tmp1.type=OBJECT;
+    tmp1.value.objptr=tmpobj;
+  }
   if (tmp1.type!=OBJECT || tmp2.type!=STRING) {
     clear_var(&tmp1);
     clear_var(&tmp2);
@@ -338,7 +346,14 @@ int s_clone_object(struct object *caller, struct object *obj, struct object
     return 1;
   }
   if (tmp.type==STRING) {
-    if (!(tmpobj=find_proto(tmp.value.string))) {
+    if (!(tmpobj=lazy_find_proto(tmp.value.string,obj,player))) {
+      if (lazy_load) {
+        clear_var(&tmp);
+        tmp.type=INTEGER;
+        tmp.value.integer=0;
+        push(&tmp,rts);
+        return 0;
+      }
       line=parse_code(tmp.value.string,obj,&newcode);
       if (line==((unsigned int) -1)) {
         clear_var(&tmp);
@@ -390,6 +405,7 @@ int s_clone_object(struct object *caller, struct object *obj, struct object
         num_locals=old_num_locals;
         free_stack(&arg_stack);
       }
+      keep_load_globals(tmpobj);
     } else
       clear_var(&tmp);
     tmp.type=OBJECT;
@@ -265,7 +265,7 @@ int s_sysctl(struct object *caller, struct object *obj, struct object *player,
         push(&tmp,rts);
         return 0;
       }
-      curr_cmdq=cmd_head;
+      curr_cmdq=next_queued(NULL);
       old_locals=locals;
       old_num_locals=num_locals;
       while (curr_cmdq) {
@@ -277,7 +277,7 @@ int s_sysctl(struct object *caller, struct object *obj, struct object *player,
         pushnocopy(&tmp,&arg_stack);
         interp(obj,tmpobj,player,&arg_stack,tmp_fns);
         free_stack(&arg_stack);
-        curr_cmdq=curr_cmdq->next;
+        curr_cmdq=next_queued(curr_cmdq);
       }
       locals=old_locals;
       num_locals=old_num_locals;
@@ -11,6 +11,9 @@
 #include "cache.h"
 #include "file.h"
 #include "edit.h"
+#include "precomp.h"
+#include "recomp.h"
+#include "unload.h"
 #include <unistd.h>
 #include <time.h>
 
@@ -83,52 +86,32 @@ int gstcmp(struct code *c1,struct code *c2,signed long *cvt) {
   return 0;
 }
 
-struct var_tab *find_var_gst(char *name, struct var_tab *curr) {
-  while (curr)
-    if (strcmp(name,curr->name))
-      curr=curr->next;
-    else
-      return curr;
-  return NULL;
-}
-
-void cvt_array_recurse(signed long *cvt, long old_base, long new_base,
-                       struct array_size *old_array, struct array_size
-                       *new_array) {
-  long loop,size1,size2;
-  struct array_size *curr1,*curr2;
+/* Where an object of code c keeps variable v, and which program declared
+   it (NULL for c itself), or -1 */
+static signed long var_slot(struct code *c, struct var_tab *v,
+                            struct proto **owner) {
+  struct gst_ref_entry *ref;
+  unsigned short loop;
 
-  if ((!old_array->next) && (!new_array->next)) {
-    loop=0;
-    while (loop<old_array->size && loop<new_array->size) {
-      cvt[old_base+loop]=new_base+loop;
-      loop++;
-    }
-  } else if (old_array->next && new_array->next) {
-    size1=1;
-    size2=1;
-    curr1=old_array->next;
-    curr2=new_array->next;
-    while (curr1) {
-      size1*=curr1->size;
-      curr1=curr1->next;
-    }
-    while (curr2) {
-      size2*=curr2->size;
-      curr2=curr2->next;
-    }
-    loop=0;
-    while (loop<old_array->size && loop<new_array->size) {
-      cvt_array_recurse(cvt,old_base+loop*size1,new_base+loop*size2,
-                        old_array->next,new_array->next);
-      loop++;
-    }
-  }
+  if (v->base>=c->gst_count) return -1;
+  ref=&(c->gst_map[v->base]);
+  *owner=ref->owner;
+  if (!ref->owner)
+    return c->self_var_offset+ref->local_index;
+  for (loop=0;loop<c->ancestor_count;loop++)
+    if (c->ancestor_map[loop].proto==ref->owner)
+      return c->ancestor_map[loop].var_offset+ref->local_index;
+  return -1;
 }
 
+/* Map each of oc's global slots to the slot of the same variable in nc,
+   or -1.  An object keeps each ancestor's variables at that ancestor's
+   offset and its own after them, one slot each, so variables are matched
+   by name and declaring program. */
 signed long *make_cvt(struct code *oc, struct code *nc) {
-  signed long *cvt,loop;
+  signed long *cvt,loop,old_slot,new_slot;
   struct var_tab *curr_var,*new_var;
+  struct proto *old_owner,*new_owner;
 
   if (!(oc->num_globals)) return NULL;
   cvt=MALLOC(sizeof(signed long)*(oc->num_globals));
@@ -142,20 +125,72 @@ signed long *make_cvt(struct code *oc, struct code *nc) {
     }
     return cvt;
   }
-  curr_var=oc->gst;
-  while (curr_var) {
-    if ((new_var=find_var_gst(curr_var->name,nc->gst))) {
-      if (curr_var->array || new_var->array)
-        cvt_array_recurse(cvt,curr_var->base,new_var->base,
-                          curr_var->array,new_var->array);
-      else
-        cvt[curr_var->base]=new_var->base;
+  for (curr_var=oc->gst;curr_var;curr_var=curr_var->next) {
+    old_slot=var_slot(oc,curr_var,&old_owner);
+    if (old_slot<0 || old_slot>=oc->num_globals) continue;
+    for (new_var=nc->gst;new_var;new_var=new_var->next) {
+      if (strcmp(curr_var->name,new_var->name)) continue;
+      new_slot=var_slot(nc,new_var,&new_owner);
+      if (new_slot<0 || new_slot>=nc->num_globals) continue;
+      if ((old_owner==NULL)!=(new_owner==NULL)) continue;
+      if (old_owner && strcmp(old_owner->pathname,new_owner->pathname))
+        continue;
+      cvt[old_slot]=new_slot;
+      break;
     }
-    curr_var=curr_var->next;
   }
   return cvt;
 }
 
+/* Give proto_obj's program newcode, converting the globals of the
+ * prototype and its clones to the new layout.  The old code is retired,
+ * since the caller may be running it. */
+void replace_code(struct object *proto_obj, struct code *newcode) {
+  struct object *tmpobj;
+  struct var *new_globals;
+  signed long *cvt;
+
+  free_load_globals(proto_obj,proto_obj->parent->funcs->num_globals);
+  tmpobj=proto_obj;
+  cvt=make_cvt(tmpobj->parent->funcs,newcode);
+  if (gstcmp(tmpobj->parent->funcs,newcode,cvt))
+    while (tmpobj) {
+      load_data(tmpobj);
+      tmpobj->obj_state=DIRTY;
+      new_globals=convert_cvt(newcode->num_globals,cvt,tmpobj);
+      if (tmpobj->globals)
+        FREE(tmpobj->globals);
+      tmpobj->globals=new_globals;
+      tmpobj=tmpobj->next_child;
+    }
+  retire_code(proto_obj->parent->funcs);
+  proto_obj->parent->funcs=newcode;
+  proto_obj->parent->inherits=newcode->inherits;
+  
+  /* Set origin_proto for all functions in this updated proto */
+  {
+    struct fns *curr_fn = newcode->func_list;
+    char logbuf[256];
+    int count = 0;
+    while (curr_fn) {
+      sprintf(logbuf, "sys5.c UPDATE: Setting origin_proto for func '%s' to proto '%s' (%p)",
+              curr_fn->funcname ? curr_fn->funcname : "unknown",
+              proto_obj->parent->pathname ? proto_obj->parent->pathname : "unknown",
+              (void*)proto_obj->parent);
+      logger(LOG_DEBUG, logbuf);
+      curr_fn->origin_proto = proto_obj->parent;
+      curr_fn = curr_fn->next;
+      count++;
+    }
+    sprintf(logbuf, "sys5.c UPDATE: Set origin_proto for %d functions in '%s'", 
+            count, proto_obj->parent->pathname ? proto_obj->parent->pathname : "unknown");
+    logger(LOG_DEBUG, logbuf);
+  }
+  
+  if (cvt)
+    FREE(cvt);
+}
+
 int s_compile_object(struct object *caller, struct object *obj, struct object
                      *player, struct var_stack **rts) {
   struct var tmp;
@@ -164,12 +199,10 @@ int s_compile_object(struct object *caller, struct object *obj, struct object
   struct object *tmpobj,*proto_obj,*tmpobj2;
   unsigned int old_num_locals;
   struct var *old_locals;
-  struct var *new_globals;
   struct proto *tmp_proto;
   unsigned long loop;
   struct var_stack *arg_stack;
   struct fns *tmpfns;
-  signed long *cvt;
 
   if (pop(&tmp,rts,obj)) return 1;
   if (tmp.type!=NUM_ARGS) {
@@ -278,42 +311,7 @@ int s_compile_object(struct object *caller, struct object *obj, struct object
       FREE(buf5);
     }
     proto_obj=tmpobj;
-    cvt=make_cvt(tmpobj->parent->funcs,newcode);
-    if (gstcmp(tmpobj->parent->funcs,newcode,cvt))
-      while (tmpobj) {
-        load_data(tmpobj);
-        tmpobj->obj_state=DIRTY;
-        new_globals=convert_cvt(newcode->num_globals,cvt,tmpobj);
-        if (tmpobj->globals)
-          FREE(tmpobj->globals);
-        tmpobj->globals=new_globals;
-        tmpobj=tmpobj->next_child;
-      }
-    free_code(proto_obj->parent->funcs);
-    proto_obj->parent->funcs=newcode;
-    
-    /* Set origin_proto for all functions in this updated proto */
-    {
-      struct fns *curr_fn = newcode->func_list;
-      char logbuf[256];
-      int count = 0;
-      while (curr_fn) {
-        sprintf(logbuf, "sys5.c UPDATE: Setting origin_proto for func '%s' to proto '%s' (%p)",
-                curr_fn->funcname ? curr_fn->funcname : "unknown",
-                proto_obj->parent->pathname ? proto_obj->parent->pathname : "unknown",
-                (void*)proto_obj->parent);
-        logger(LOG_DEBUG, logbuf);
-        curr_fn->origin_proto = proto_obj->parent;
-        curr_fn = curr_fn->next;
-        count++;
-      }
-      sprintf(logbuf, "sys5.c UPDATE: Set origin_proto for %d functions in '%s'", 
-              count, proto_obj->parent->pathname ? proto_obj->parent->pathname : "unknown");
-      logger(LOG_DEBUG, logbuf);
-    }
-    
-    if (cvt)
-      FREE(cvt);
+    replace_code(proto_obj,newcode);
     clear_var(&tmp);
   } else {
     {
@@ -382,6 +380,7 @@ int s_compile_object(struct object *caller, struct object *obj, struct object
     }
     locals=old_locals;
     num_locals=old_num_locals;
+    keep_load_globals(proto_obj);
   }
   
   /* Attach auto object to the newly compiled/updated prototype */
@@ -393,6 +392,81 @@ int s_compile_object(struct object *caller, struct object *obj, struct object
   return 0;
 }
 
+/* precompile(string *paths) - compile programs ahead of compile_object()
+ * Compiles the listed programs, and whatever they inherit, on
+ * compile_threads worker threads.  Each result is kept until the next
+ * compile_object() (or inherit) of that path picks it up instead of
+ * compiling.  Returns how many of the paths compiled; the rest are left
+ * for compile_object() to compile and report as usual.
+ */
+int s_precompile(struct object *caller, struct object *obj,
+                 struct object *player, struct var_stack **rts) {
+  struct var tmp;
+  struct heap_array *arr;
+  char **paths;
+  unsigned int loop;
+  int count;
+
+  if (pop(&tmp,rts,obj)) return 1;
+  if (tmp.type!=NUM_ARGS) {
+    clear_var(&tmp);
+    return 1;
+  }
+  if (tmp.value.num!=1) return 1;
+  if (pop(&tmp,rts,obj)) return 1;
+  if (tmp.type!=ARRAY || !tmp.value.array_ptr) {
+    clear_var(&tmp);
+    return 1;
+  }
+  arr=tmp.value.array_ptr;
+  count=0;
+  paths=NULL;
+  if (arr->size)
+    paths=(char **) MALLOC(sizeof(char *)*arr->size);
+  for (loop=0;loop<arr->size;loop++)
+    if (arr->elements[loop].type==STRING)
+      paths[count++]=arr->elements[loop].value.string;
+  count=precomp_run(paths,count);
+  if (paths)
+    FREE(paths);
+  clear_var(&tmp);
+  tmp.type=INTEGER;
+  tmp.value.integer=count;
+  push(&tmp,rts);
+  return 0;
+}
+
+/* recompile(string path) - compile a program again with what builds on it
+ * path is a program or an #included file.  Every loaded program that
+ * names it, and every program that inherits one of those, is compiled
+ * again, parents first, so inheritors pick up a changed parent; objects
+ * keep their globals as with compile_object().  A program that fails to
+ * compile keeps its old code.  Returns how many programs were replaced.
+ */
+int s_recompile(struct object *caller, struct object *obj,
+                struct object *player, struct var_stack **rts) {
+  struct var tmp;
+  int count;
+
+  if (pop(&tmp,rts,obj)) return 1;
+  if (tmp.type!=NUM_ARGS) {
+    clear_var(&tmp);
+    return 1;
+  }
+  if (tmp.value.num!=1) return 1;
+  if (pop(&tmp,rts,obj)) return 1;
+  if (tmp.type!=STRING) {
+    clear_var(&tmp);
+    return 1;
+  }
+  count=recomp_run(tmp.value.string,obj,player);
+  clear_var(&tmp);
+  tmp.type=INTEGER;
+  tmp.value.integer=count;
+  push(&tmp,rts);
+  return 0;
+}
+
 /* compile_string(string code) - Compile LPC code from string
  * Admin/wizard only. Returns 1 on success, 0 on failure.
  * Compiles code into temporary eval context.
@@ -6,6 +6,7 @@
 #include "instr.h"
 #include "constrct.h"
 #include "dbhandle.h"
+#include "lazy.h"
 
 int s_atoo(struct object *caller, struct object *obj, struct object *player,
            struct var_stack **rts) {
@@ -42,7 +43,7 @@ int s_atoo(struct object *caller, struct object *obj, struct object *player,
     breakpoint++;
   }
   if (*numbuf=='\0') {
-    result=find_proto(pathbuf);
+    result=lazy_find_proto(pathbuf,obj,player);
   } else {
     expected_refno=atol(numbuf);
     result=ref_to_obj(expected_refno);
@@ -275,6 +275,27 @@ int s_get_conntime(struct object *caller, struct object *obj,
   return 0;
 }
 
+int s_get_devqueue(struct object *caller, struct object *obj,
+                   struct object *player, struct var_stack **rts) {
+  struct var tmp;
+
+  if (pop(&tmp,rts,obj)) return 1;
+  if (tmp.type!=NUM_ARGS) {
+    clear_var(&tmp);
+    return 1;
+  }
+  if (tmp.value.num!=1) return 1;
+  if (pop(&tmp,rts,obj)) return 1;
+  if (tmp.type!=OBJECT) {
+    clear_var(&tmp);
+    return 1;
+  }
+  tmp.type=INTEGER;
+  tmp.value.integer=get_devqueue(tmp.value.objptr);
+  push(&tmp,rts);
+  return 0;
+}
+
 int s_connect_device(struct object *caller, struct object *obj,
                      struct object *player, struct var_stack **rts) {
   struct var tmp;
@@ -192,6 +192,93 @@ int resize_heap_array(struct heap_array *arr, unsigned int new_size) {
   return 0;
 }
 
+/* ========================================================================
+ * COPY-ON-WRITE
+ *
+ * Arrays behave as values: assignment, argument passing and return only
+ * add a reference, and a holder that is about to modify an array whose
+ * refcount is above one first takes a private copy with array_unshare().
+ * A uniquely owned array is modified in place.
+ * ======================================================================== */
+
+/* Shallow copy of arr: same size, capacity and max_size, every element
+ * copied with copy_var() so nested arrays and mappings are shared.
+ * Returns: New array with refcount 1, or NULL on failure
+ */
+struct heap_array* array_copy(struct heap_array *arr) {
+  struct heap_array *result;
+  unsigned int i;
+
+  result = (struct heap_array *) MALLOC(sizeof(struct heap_array));
+  if (!result)
+    return NULL;
+  result->size = arr->size;
+  result->capacity = arr->capacity;
+  result->max_size = arr->max_size;
+  result->refcount = 1;
+  result->elements = NULL;
+  if (arr->capacity) {
+    result->elements = (struct var *) MALLOC(sizeof(struct var) * arr->capacity);
+    if (!result->elements) {
+      FREE(result);
+      return NULL;
+    }
+  }
+  for (i = 0; i < arr->size; i++)
+    copy_var(&result->elements[i], &arr->elements[i]);
+  for (; i < arr->capacity; i++) {
+    result->elements[i].type = INTEGER;
+    result->elements[i].value.integer = 0;
+  }
+  return result;
+}
+
+/* Make the array held in slot private to it before a modification
+ * Returns: 0 on success (slot may now hold a new array), 1 on failure
+ */
+int array_unshare(struct var *slot) {
+  struct heap_array *copy;
+
+  if (slot->type != ARRAY || !slot->value.array_ptr)
+    return 1;
+  if (slot->value.array_ptr->refcount <= 1)
+    return 0;
+  copy = array_copy(slot->value.array_ptr);
+  if (!copy) {
+    logger(LOG_ERROR, "array_unshare: failed to copy array");
+    return 1;
+  }
+  array_release(slot->value.array_ptr);
+  slot->value.array_ptr = copy;
+  return 0;
+}
+
+/* Elements [from, to) of arr as an array of their own.  A range covering
+ * the whole array hands back arr itself with an extra reference, which
+ * copy-on-write keeps safe; anything shorter is a shallow copy.
+ * Returns: New reference to the slice, or NULL on failure
+ */
+struct heap_array* array_slice(struct heap_array *arr, unsigned int from,
+                               unsigned int to) {
+  struct heap_array *result;
+  unsigned int i;
+
+  if (to > arr->size)
+    to = arr->size;
+  if (from > to)
+    from = to;
+  if (from == 0 && to == arr->size && arr->max_size == UNLIMITED_ARRAY_SIZE) {
+    array_addref(arr);
+    return arr;
+  }
+  result = allocate_array(to - from, UNLIMITED_ARRAY_SIZE);
+  if (!result)
+    return NULL;
+  for (i = from; i < to; i++)
+    copy_var(&result->elements[i - from], &arr->elements[i]);
+  return result;
+}
+
 
 /* s_sizeof() - Return the size of an array
  * Usage: int size = sizeof(array_var);
@@ -309,46 +396,203 @@ int s_array_literal(struct object *caller, struct object *obj, struct object *pl
   return 0;
 }
 
+/* ========================================================================
+ * SUBSCRIPT OPERATORS
+ *
+ * value[i] and value[a..b] on anything that is not a declared array or
+ * mapping variable compile to S_INDEX and S_RANGE.  Both run with an
+ * unresolved stack so a variable operand is read where it lives instead
+ * of being copied first: indexing a string costs no allocation at all and
+ * a range allocates only its result.  Negative positions count back from
+ * the end, -1 being the last character or element.
+ * ======================================================================== */
+
+/* Pop an integer argument off an unresolved stack */
+static int pop_subscript(struct var *tmp, struct var_stack **rts,
+                         struct object *obj) {
+  if (pop(tmp, rts, obj)) return 1;
+  if (tmp->type == LOCAL_L_VALUE || tmp->type == GLOBAL_L_VALUE)
+    if (resolve_var(tmp, obj)) return 1;
+  return 0;
+}
+
+/* Pop the subscripted operand.  Returns the var holding its value: the
+ * variable itself for an l-value, otherwise tmp, which the caller clears.
+ */
+static struct var *pop_operand(struct var *tmp, struct var_stack **rts,
+                               struct object *obj) {
+  struct var *slot;
+
+  if (pop(tmp, rts, obj)) return NULL;
+  if (tmp->type != LOCAL_L_VALUE && tmp->type != GLOBAL_L_VALUE)
+    return tmp;
+  slot = lvalue_slot(tmp, obj);
+  tmp->type = INTEGER;
+  tmp->value.integer = 0;
+  return slot;
+}
+
+/* s_index() - value[i]
+ * Strings give the character code at i, arrays the element and mappings
+ * the value stored under i.  Reading past either end gives 0.
+ */
+int s_index(struct object *caller, struct object *obj, struct object *player,
+            struct var_stack **rts) {
+  struct var tmp, key, found, result;
+  struct var *val;
+  long i, len;
+
+  if (pop(&tmp, rts, obj)) return 1;
+  if (tmp.type != NUM_ARGS) {
+    clear_var(&tmp);
+    return 1;
+  }
+  if (tmp.value.num != 2) return 1;
+  if (pop_subscript(&key, rts, obj)) return 1;
+  if (!(val = pop_operand(&tmp, rts, obj))) {
+    clear_var(&key);
+    return 1;
+  }
+  result.type = INTEGER;
+  result.value.integer = 0;
+  if (val->type == MAPPING) {
+    if (mapping_get(val->value.mapping_ptr, &key, &found))
+      copy_var(&result, &found);
+  } else if (key.type != INTEGER) {
+    clear_var(&key);
+    clear_var(&tmp);
+    return 1;
+  } else if (val->type == STRING) {
+    i = key.value.integer;
+    if (i < 0) {
+      len = strlen(val->value.string);
+      i += len;
+    } else
+      len = strnlen(val->value.string, i + 1);
+    if (i >= 0 && i < len)
+      result.value.integer = (unsigned char) val->value.string[i];
+  } else if (val->type == ARRAY) {
+    i = key.value.integer;
+    len = val->value.array_ptr->size;
+    if (i < 0)
+      i += len;
+    if (i >= 0 && i < len)
+      copy_var(&result, &val->value.array_ptr->elements[i]);
+  } else if (val->type != INTEGER || val->value.integer) {
+    clear_var(&key);
+    clear_var(&tmp);
+    return 1;
+  }
+  clear_var(&key);
+  clear_var(&tmp);
+  pushnocopy(&result, rts);
+  return 0;
+}
+
+/* s_range() - value[a..b]
+ * Both ends are inclusive and clipped to the value, so an empty or
+ * inverted range gives "" (that is, 0) or ({ }) rather than an error.
+ */
+int s_range(struct object *caller, struct object *obj, struct object *player,
+            struct var_stack **rts) {
+  struct var tmp, from, to, result;
+  struct var *val;
+  long len;
+
+  if (pop(&tmp, rts, obj)) return 1;
+  if (tmp.type != NUM_ARGS) {
+    clear_var(&tmp);
+    return 1;
+  }
+  if (tmp.value.num != 3) return 1;
+  if (pop_subscript(&to, rts, obj)) return 1;
+  if (to.type != INTEGER) {
+    clear_var(&to);
+    return 1;
+  }
+  if (pop_subscript(&from, rts, obj)) return 1;
+  if (from.type != INTEGER) {
+    clear_var(&from);
+    return 1;
+  }
+  if (!(val = pop_operand(&tmp, rts, obj))) return 1;
+  if (val->type == STRING)
+    len = strlen(val->value.string);
+  else if (val->type == ARRAY)
+    len = val->value.array_ptr->size;
+  else if (val->type == INTEGER && val->value.integer == 0)
+    len = 0;
+  else {
+    clear_var(&tmp);
+    return 1;
+  }
+  if (from.value.integer < 0)
+    from.value.integer += len;
+  if (to.value.integer < 0)
+    to.value.integer += len;
+  if (from.value.integer < 0)
+    from.value.integer = 0;
+  if (from.value.integer > len)
+    from.value.integer = len;
+  if (to.value.integer >= len)
+    to.value.integer = len - 1;
+  if (to.value.integer < from.value.integer)
+    to.value.integer = from.value.integer - 1;
+  if (val->type == ARRAY) {
+    result.type = ARRAY;
+    result.value.array_ptr = array_slice(val->value.array_ptr,
+                                         from.value.integer,
+                                         to.value.integer + 1);
+    if (!result.value.array_ptr) {
+      clear_var(&tmp);
+      return 1;
+    }
+  } else if (val->type == STRING && to.value.integer >= from.value.integer) {
+    len = to.value.integer - from.value.integer + 1;
+    result.type = STRING;
+    result.value.string = MALLOC(len + 1);
+    memcpy(result.value.string, val->value.string + from.value.integer, len);
+    result.value.string[len] = '\0';
+  } else {
+    result.type = INTEGER;
+    result.value.integer = 0;
+  }
+  clear_var(&tmp);
+  pushnocopy(&result, rts);
+  return 0;
+}
+
 /* array_concat() - Concatenate two arrays
- * Returns a new heap array containing all elements from arr1 followed by arr2
+ * Returns a heap array containing all elements from arr1 followed by arr2.
+ * If either side is empty the other one is returned with an extra
+ * reference instead of being copied; copy-on-write keeps that safe.
  * Caller is responsible for managing refcounts
  */
 struct heap_array* array_concat(struct heap_array *arr1, struct heap_array *arr2) {
   struct heap_array *result;
   unsigned int i;
   char logbuf[256];
-  
+
   sprintf(logbuf, "array_concat: arr1 size=%u, arr2 size=%u", arr1->size, arr2->size);
   logger(LOG_DEBUG, logbuf);
-  
+
+  result = arr2->size ? (arr1->size ? NULL : arr2) : arr1;
+  if (result && result->max_size == UNLIMITED_ARRAY_SIZE) {
+    array_addref(result);
+    return result;
+  }
+
   /* Allocate new array with combined size */
   result = allocate_array(arr1->size + arr2->size, UNLIMITED_ARRAY_SIZE);
   if (!result) {
     logger(LOG_ERROR, "array_concat: failed to allocate result array");
     return NULL;
   }
-  
-  /* Copy elements from arr1 */
-  for (i = 0; i < arr1->size; i++) {
-    result->elements[i] = arr1->elements[i];
-    /* Increment refcount for arrays and strings */
-    if (result->elements[i].type == ARRAY && result->elements[i].value.array_ptr) {
-      array_addref(result->elements[i].value.array_ptr);
-    } else if (result->elements[i].type == STRING && result->elements[i].value.string) {
-      result->elements[i].value.string = copy_string(result->elements[i].value.string);
-    }
-  }
-  
-  /* Copy elements from arr2 */
-  for (i = 0; i < arr2->size; i++) {
-    result->elements[arr1->size + i] = arr2->elements[i];
-    /* Increment refcount for arrays and strings */
-    if (result->elements[arr1->size + i].type == ARRAY && result->elements[arr1->size + i].value.array_ptr) {
-      array_addref(result->elements[arr1->size + i].value.array_ptr);
-    } else if (result->elements[arr1->size + i].type == STRING && result->elements[arr1->size + i].value.string) {
-      result->elements[arr1->size + i].value.string = copy_string(result->elements[arr1->size + i].value.string);
-    }
-  }
+
+  for (i = 0; i < arr1->size; i++)
+    copy_var(&result->elements[i], &arr1->elements[i]);
+  for (i = 0; i < arr2->size; i++)
+    copy_var(&result->elements[arr1->size + i], &arr2->elements[i]);
   
   sprintf(logbuf, "array_concat: created array with %u elements", result->size);
   logger(LOG_DEBUG, logbuf);
@@ -356,87 +600,208 @@ struct heap_array* array_concat(struct heap_array *arr1, struct heap_array *arr2
   return result;
 }
 
+/* ========================================================================
+ * TEMPORARY HASH SETS (set operations on arrays)
+ *
+ * A var_set indexes vars that live somewhere else (usually the elements
+ * of an array) using hash_var()/var_equals() from sys_mappings.c, so set
+ * operations cost O(n + m) instead of comparing every pair.  The set never
+ * owns or copies the vars; it only lives for the duration of one call.
+ * ======================================================================== */
+
+struct var_set {
+  unsigned int mask;        /* capacity - 1, capacity is a power of two */
+  unsigned int *hashes;     /* cached hash per slot */
+  struct var **items;       /* NULL for an empty slot */
+};
+
+/* Size the set for count entries at no more than half full */
+static int var_set_init(struct var_set *set, unsigned int count) {
+  unsigned int capacity;
+  char *block;
+  
+  capacity = 8;
+  while (capacity < count * 2)
+    capacity <<= 1;
+  block = MALLOC(capacity * (sizeof(struct var *) + sizeof(unsigned int)));
+  if (!block)
+    return 1;
+  set->items = (struct var **) block;
+  set->hashes = (unsigned int *) (block + capacity * sizeof(struct var *));
+  memset(set->items, 0, capacity * sizeof(struct var *));
+  set->mask = capacity - 1;
+  return 0;
+}
+
+static void var_set_free(struct var_set *set) {
+  FREE(set->items);
+}
+
+/* Returns 1 if an equal var is in the set */
+static int var_set_contains(struct var_set *set, struct var *v) {
+  unsigned int hash, pos;
+  
+  hash = hash_var(v);
+  for (pos = hash & set->mask; set->items[pos]; pos = (pos + 1) & set->mask)
+    if (set->hashes[pos] == hash && var_equals(set->items[pos], v))
+      return 1;
+  return 0;
+}
+
+/* Adds v unless an equal var is already there; returns 1 if it was added */
+static int var_set_add(struct var_set *set, struct var *v) {
+  unsigned int hash, pos;
+  
+  hash = hash_var(v);
+  for (pos = hash & set->mask; set->items[pos]; pos = (pos + 1) & set->mask)
+    if (set->hashes[pos] == hash && var_equals(set->items[pos], v))
+      return 0;
+  set->items[pos] = v;
+  set->hashes[pos] = hash;
+  return 1;
+}
+
+/* Build a new array from the listed elements, copying each one */
+static struct heap_array *array_from_list(struct var **list, unsigned int count) {
+  struct heap_array *result;
+  unsigned int i;
+  
+  result = allocate_array(count, UNLIMITED_ARRAY_SIZE);
+  if (!result)
+    return NULL;
+  for (i = 0; i < count; i++)
+    copy_var(&result->elements[i], list[i]);
+  return result;
+}
+
 /* array_subtract() - Remove elements from arr1 that are in arr2
- * Returns a new heap array containing elements from arr1 not found in arr2
+ * Returns a heap array containing elements from arr1 not found in arr2;
+ * when nothing is removed that is arr1 itself with an extra reference
  * Removes ALL occurrences of matching elements
  */
 struct heap_array* array_subtract(struct heap_array *arr1, struct heap_array *arr2) {
   struct heap_array *result;
-  unsigned int i, j, result_count, found;
-  struct var *temp_elements;
-  char logbuf[256];
-  
-  sprintf(logbuf, "array_subtract: arr1 size=%u, arr2 size=%u", arr1->size, arr2->size);
-  logger(LOG_DEBUG, logbuf);
+  struct var_set set;
+  struct var **keep;
+  unsigned int i, count;
   
-  /* Allocate temporary array to hold result elements */
-  temp_elements = (struct var *) MALLOC(sizeof(struct var) * arr1->size);
-  if (!temp_elements) {
-    logger(LOG_ERROR, "array_subtract: failed to allocate temp array");
+  if (var_set_init(&set, arr2->size))
+    return NULL;
+  keep = MALLOC((arr1->size ? arr1->size : 1) * sizeof(struct var *));
+  if (!keep) {
+    var_set_free(&set);
     return NULL;
   }
   
-  result_count = 0;
+  for (i = 0; i < arr2->size; i++)
+    var_set_add(&set, &arr2->elements[i]);
+  count = 0;
+  for (i = 0; i < arr1->size; i++)
+    if (!var_set_contains(&set, &arr1->elements[i]))
+      keep[count++] = &arr1->elements[i];
+  
+  if (count == arr1->size && arr1->max_size == UNLIMITED_ARRAY_SIZE) {
+    array_addref(arr1);
+    result = arr1;
+  } else
+    result = array_from_list(keep, count);
+  FREE(keep);
+  var_set_free(&set);
+  if (!result)
+    logger(LOG_ERROR, "array_subtract: failed to allocate result array");
+  return result;
+}
+
+/* array_intersect() - Elements of arr1 that are also in arr2 (arr1 & arr2)
+ * Each value appears once, in the order of its first occurrence in arr1
+ */
+struct heap_array* array_intersect(struct heap_array *arr1, struct heap_array *arr2) {
+  struct heap_array *result;
+  struct var_set in2, seen;
+  struct var **keep;
+  unsigned int i, count;
   
-  /* For each element in arr1, check if it's in arr2 */
-  for (i = 0; i < arr1->size; i++) {
-    found = 0;
-    
-    /* Check if arr1[i] is in arr2 */
-    for (j = 0; j < arr2->size; j++) {
-      /* Simple equality check - integers and strings */
-      if (arr1->elements[i].type == arr2->elements[j].type) {
-        if (arr1->elements[i].type == INTEGER) {
-          if (arr1->elements[i].value.integer == arr2->elements[j].value.integer) {
-            found = 1;
-            break;
-          }
-        } else if (arr1->elements[i].type == STRING) {
-          if (arr1->elements[i].value.string && arr2->elements[j].value.string &&
-              !strcmp(arr1->elements[i].value.string, arr2->elements[j].value.string)) {
-            found = 1;
-            break;
-          }
-        }
-        /* For other types (objects, arrays), use pointer equality */
-        else if (arr1->elements[i].value.objptr == arr2->elements[j].value.objptr) {
-          found = 1;
-          break;
-        }
-      }
-    }
-    
-    /* If not found in arr2, add to result */
-    if (!found) {
-      temp_elements[result_count] = arr1->elements[i];
-      /* Increment refcount for arrays and strings */
-      if (temp_elements[result_count].type == ARRAY && temp_elements[result_count].value.array_ptr) {
-        array_addref(temp_elements[result_count].value.array_ptr);
-      } else if (temp_elements[result_count].type == STRING && temp_elements[result_count].value.string) {
-        temp_elements[result_count].value.string = copy_string(temp_elements[result_count].value.string);
-      }
-      result_count++;
-    }
+  if (var_set_init(&in2, arr2->size))
+    return NULL;
+  if (var_set_init(&seen, arr1->size)) {
+    var_set_free(&in2);
+    return NULL;
   }
-  
-  /* Create result array with exact size needed */
-  result = allocate_array(result_count, UNLIMITED_ARRAY_SIZE);
-  if (!result) {
-    logger(LOG_ERROR, "array_subtract: failed to allocate result array");
-    FREE(temp_elements);
+  keep = MALLOC((arr1->size ? arr1->size : 1) * sizeof(struct var *));
+  if (!keep) {
+    var_set_free(&in2);
+    var_set_free(&seen);
     return NULL;
   }
   
-  /* Copy temp elements to result */
-  for (i = 0; i < result_count; i++) {
-    result->elements[i] = temp_elements[i];
+  for (i = 0; i < arr2->size; i++)
+    var_set_add(&in2, &arr2->elements[i]);
+  count = 0;
+  for (i = 0; i < arr1->size; i++)
+    if (var_set_contains(&in2, &arr1->elements[i]) &&
+        var_set_add(&seen, &arr1->elements[i]))
+      keep[count++] = &arr1->elements[i];
+  
+  result = array_from_list(keep, count);
+  FREE(keep);
+  var_set_free(&in2);
+  var_set_free(&seen);
+  return result;
+}
+
+/* array_union() - Elements in either array (arr1 | arr2)
+ * Each value appears once: arr1's values in order, then any new ones from arr2
+ */
+struct heap_array* array_union(struct heap_array *arr1, struct heap_array *arr2) {
+  struct heap_array *result;
+  struct var_set seen;
+  struct var **keep;
+  unsigned int i, count;
+  
+  if (var_set_init(&seen, arr1->size + arr2->size))
+    return NULL;
+  keep = MALLOC((arr1->size + arr2->size + 1) * sizeof(struct var *));
+  if (!keep) {
+    var_set_free(&seen);
+    return NULL;
   }
   
-  FREE(temp_elements);
+  count = 0;
+  for (i = 0; i < arr1->size; i++)
+    if (var_set_add(&seen, &arr1->elements[i]))
+      keep[count++] = &arr1->elements[i];
+  for (i = 0; i < arr2->size; i++)
+    if (var_set_add(&seen, &arr2->elements[i]))
+      keep[count++] = &arr2->elements[i];
+  
+  result = array_from_list(keep, count);
+  FREE(keep);
+  var_set_free(&seen);
+  return result;
+}
+
+/* array_unique() - Copy of arr with later duplicates dropped */
+struct heap_array* array_unique(struct heap_array *arr) {
+  struct heap_array *result;
+  struct var_set seen;
+  struct var **keep;
+  unsigned int i, count;
+  
+  if (var_set_init(&seen, arr->size))
+    return NULL;
+  keep = MALLOC((arr->size ? arr->size : 1) * sizeof(struct var *));
+  if (!keep) {
+    var_set_free(&seen);
+    return NULL;
+  }
   
-  sprintf(logbuf, "array_subtract: created array with %u elements (removed %u)", 
-          result_count, arr1->size - result_count);
-  logger(LOG_DEBUG, logbuf);
+  count = 0;
+  for (i = 0; i < arr->size; i++)
+    if (var_set_add(&seen, &arr->elements[i]))
+      keep[count++] = &arr->elements[i];
   
+  result = array_from_list(keep, count);
+  FREE(keep);
+  var_set_free(&seen);
   return result;
 }
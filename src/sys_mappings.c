@@ -12,7 +12,7 @@
  * - Object keys: object pointers
  * 
  * Implementation:
- * - Hash table with chaining for collision resolution
+ * - Open-addressed hash table, one block per mapping (see object.h)
  * - Reference counting for automatic memory management
  * - Dynamic growth when load factor exceeds threshold
  * - Identified by is_mapping flag in var_tab, NOT by array field
@@ -31,6 +31,7 @@
 #include "globals.h"
 #include "file.h"
 #include <string.h>
+#include <stddef.h>
 
 /* Hash function for strings (djb2 algorithm) */
 unsigned int hash_string(const char *str) {
@@ -53,10 +54,9 @@ unsigned int hash_integer(int value) {
   return hash;
 }
 
-/* Hash function for object pointers */
-unsigned int hash_object(struct object *obj) {
-  /* Hash the pointer address */
-  unsigned long addr = (unsigned long)obj;
+/* Hash function for pointers (objects, arrays, mappings) */
+static unsigned int hash_pointer(void *ptr) {
+  unsigned long addr = (unsigned long)ptr;
   unsigned int hash = (unsigned int)(addr ^ (addr >> 32));
   hash = ((hash >> 16) ^ hash) * 0x45d9f3b;
   hash = ((hash >> 16) ^ hash) * 0x45d9f3b;
@@ -64,15 +64,24 @@ unsigned int hash_object(struct object *obj) {
   return hash;
 }
 
+/* Hash function for object pointers */
+unsigned int hash_object(struct object *obj) {
+  return hash_pointer(obj);
+}
+
 /* Hash function dispatcher based on var type */
 unsigned int hash_var(struct var *key) {
   switch (key->type) {
     case STRING:
-      return hash_string(key->value.string);
+      return key->value.string ? hash_string(key->value.string) : 0;
     case INTEGER:
       return hash_integer(key->value.integer);
     case OBJECT:
       return hash_object(key->value.objptr);
+    case ARRAY:
+      return hash_pointer(key->value.array_ptr);
+    case MAPPING:
+      return hash_pointer(key->value.mapping_ptr);
     default:
       /* For other types, hash the type itself */
       return hash_integer(key->type);
@@ -88,9 +97,16 @@ int var_equals(struct var *v1, struct var *v2) {
     case INTEGER:
       return v1->value.integer == v2->value.integer;
     case STRING:
+      if (!v1->value.string || !v2->value.string)
+        return v1->value.string == v2->value.string;
       return strcmp(v1->value.string, v2->value.string) == 0;
     case OBJECT:
       return v1->value.objptr == v2->value.objptr;
+    case ARRAY:
+      /* arrays and mappings compare by identity */
+      return v1->value.array_ptr == v2->value.array_ptr;
+    case MAPPING:
+      return v1->value.mapping_ptr == v2->value.mapping_ptr;
     default:
       /* For other types, only equal if same type */
       return 1;
@@ -120,30 +136,150 @@ void copy_var_to(struct var *dest, struct var *src) {
   }
 }
 
-/* Allocate a new mapping with given initial capacity */
+/* ------------------------------------------------------------------------
+ * Table engine
+ *
+ * Slots are probed a group of MAPPING_GROUP control bytes at a time.  The
+ * group is loaded into a 64-bit word and matched with plain bit tricks, so
+ * a probe step costs a handful of ALU ops regardless of how many of the
+ * eight slots are in use.  Groups are aligned to MAPPING_GROUP, and the
+ * probe sequence steps through groups triangularly (1, 2, 3, ... groups),
+ * which visits every group of a power-of-two table exactly once.
+ * ------------------------------------------------------------------------ */
+
+#define GROUP_LSB 0x0101010101010101ULL
+#define GROUP_MSB 0x8080808080808080ULL
+
+typedef unsigned long long group_t;
+
+static group_t load_group(unsigned char *ctrl) {
+  /* assembled byte by byte so bit 8*i+7 is always slot i; compilers turn
+   * this into a single load on little-endian machines */
+  return ((group_t) ctrl[0]) | ((group_t) ctrl[1] << 8) |
+         ((group_t) ctrl[2] << 16) | ((group_t) ctrl[3] << 24) |
+         ((group_t) ctrl[4] << 32) | ((group_t) ctrl[5] << 40) |
+         ((group_t) ctrl[6] << 48) | ((group_t) ctrl[7] << 56);
+}
+
+/* High bit set in each byte that may equal tag.  Can report a false hit
+ * next to a real one; callers compare the full hash anyway. */
+static group_t match_tag(group_t g, unsigned char tag) {
+  group_t x = g ^ (GROUP_LSB * tag);
+  return (x - GROUP_LSB) & ~x & GROUP_MSB;
+}
+
+static group_t match_empty(group_t g) {
+  return g & ~(g << 6) & GROUP_MSB;
+}
+
+static group_t match_free(group_t g) {
+  /* empty or deleted */
+  return g & GROUP_MSB;
+}
+
+static unsigned int first_match(group_t m) {
+#ifdef __GNUC__
+  return __builtin_ctzll(m) >> 3;
+#else
+  unsigned int i = 0;
+  while (!(m & 0x80)) {
+    m >>= 8;
+    i++;
+  }
+  return i;
+#endif
+}
+
+#define HASH_TAG(hash) ((unsigned char) ((hash) & 0x7f))
+#define HASH_POS(hash,mask) (((hash) >> 7) & (mask) & ~(MAPPING_GROUP - 1))
+
+/* Smallest table that holds count entries without passing the load limit */
+static unsigned int capacity_for(unsigned int count) {
+  unsigned long cap = MAPPING_GROUP;
+
+  while ((unsigned long) count * 8 > cap * MAPPING_MAX_LOAD)
+    cap <<= 1;
+  return (unsigned int) cap;
+}
+
+static int alloc_table(struct heap_mapping *map, unsigned int capacity) {
+  char *block;
+
+  block = MALLOC(capacity * (sizeof(struct mapping_entry) + 1));
+  if (!block)
+    return 1;
+  map->slots = (struct mapping_entry *) block;
+  map->ctrl = (unsigned char *) (block + capacity * sizeof(struct mapping_entry));
+  memset(map->ctrl, MAPPING_CTRL_EMPTY, capacity);
+  map->capacity = capacity;
+  map->deleted = 0;
+  return 0;
+}
+
+/* Index of the slot holding key, or -1 */
+static long find_slot(struct heap_mapping *map, struct var *key, unsigned int hash) {
+  unsigned int mask, pos, step, i;
+  unsigned char tag;
+  group_t g, m;
+
+  mask = map->capacity - 1;
+  pos = HASH_POS(hash, mask);
+  tag = HASH_TAG(hash);
+  step = 0;
+  while (1) {
+    g = load_group(map->ctrl + pos);
+    for (m = match_tag(g, tag); m; m &= m - 1) {
+      i = pos + first_match(m);
+      if (map->slots[i].hash == hash && var_equals(&map->slots[i].key, key))
+        return i;
+    }
+    if (match_empty(g))
+      return -1;
+    step += MAPPING_GROUP;
+    if (step > mask)
+      return -1;
+    pos = (pos + step) & mask;
+  }
+}
+
+/* First empty or deleted slot on hash's probe sequence */
+static unsigned int find_free(struct heap_mapping *map, unsigned int hash) {
+  unsigned int mask, pos, step;
+  group_t m;
+
+  mask = map->capacity - 1;
+  pos = HASH_POS(hash, mask);
+  step = 0;
+  while (!(m = match_free(load_group(map->ctrl + pos)))) {
+    step += MAPPING_GROUP;
+    pos = (pos + step) & mask;
+  }
+  return pos + first_match(m);
+}
+
+/* Allocate a new mapping with room for initial_capacity slots
+ * (rounded up to a power of two)
+ */
 struct heap_mapping* allocate_mapping(unsigned int initial_capacity) {
   struct heap_mapping *map;
-  unsigned int i;
+  unsigned int capacity;
   
   if (initial_capacity == 0)
     initial_capacity = DEFAULT_MAPPING_CAPACITY;
+  capacity = MAPPING_GROUP;
+  while (capacity < initial_capacity)
+    capacity <<= 1;
   
   map = (struct heap_mapping *) MALLOC(sizeof(struct heap_mapping));
   if (!map)
     return NULL;
   
-  map->buckets = (struct mapping_entry **) MALLOC(initial_capacity * sizeof(struct mapping_entry *));
-  if (!map->buckets) {
+  if (alloc_table(map, capacity)) {
     FREE(map);
     return NULL;
   }
   
-  /* Initialize all buckets to NULL */
-  for (i = 0; i < initial_capacity; i++)
-    map->buckets[i] = NULL;
-  
   map->size = 0;
-  map->capacity = initial_capacity;
   map->refcount = 1;
   
   return map;
@@ -155,22 +291,9 @@ void mapping_addref(struct heap_mapping *map) {
     map->refcount++;
 }
 
-/* Free a mapping entry (including key and value) */
-void free_mapping_entry(struct mapping_entry *entry) {
-  if (!entry)
-    return;
-  
-  /* Clear key and value */
-  clear_var(&entry->key);
-  clear_var(&entry->value);
-  
-  FREE(entry);
-}
-
 /* Decrement reference count and free if zero */
 void mapping_release(struct heap_mapping *map) {
   unsigned int i;
-  struct mapping_entry *entry, *next;
   
   if (!map)
     return;
@@ -178,138 +301,242 @@ void mapping_release(struct heap_mapping *map) {
   map->refcount--;
   
   if (map->refcount == 0) {
-    /* Free all entries */
+    /* Free all keys and values */
     for (i = 0; i < map->capacity; i++) {
-      entry = map->buckets[i];
-      while (entry) {
-        next = entry->next;
-        free_mapping_entry(entry);
-        entry = next;
+      if (MAPPING_SLOT_USED(map, i)) {
+        clear_var(&map->slots[i].key);
+        clear_var(&map->slots[i].value);
       }
     }
     
-    /* Free buckets array and mapping structure */
-    FREE(map->buckets);
+    /* slots and ctrl share one block */
+    FREE(map->slots);
     FREE(map);
   }
 }
 
-/* Rehash the mapping to a larger capacity */
+/* Rebuild the table, growing it if the live entries need the room and
+ * otherwise just sweeping out tombstones.  Entries are moved, not copied.
+ * On allocation failure the old table is left as it was.
+ */
 void mapping_rehash(struct heap_mapping *map) {
-  unsigned int old_capacity, new_capacity, i, bucket;
-  struct mapping_entry **old_buckets, *entry, *next;
+  struct mapping_entry *old_slots;
+  unsigned char *old_ctrl;
+  unsigned int old_capacity, new_capacity, i, slot;
   
   old_capacity = map->capacity;
-  new_capacity = old_capacity * 2;
-  old_buckets = map->buckets;
-  
-  /* Allocate new buckets */
-  map->buckets = (struct mapping_entry **) MALLOC(new_capacity * sizeof(struct mapping_entry *));
-  if (!map->buckets) {
-    /* Rehash failed - keep old buckets */
-    map->buckets = old_buckets;
-    return;
-  }
+  old_slots = map->slots;
+  old_ctrl = map->ctrl;
   
-  /* Initialize new buckets */
-  for (i = 0; i < new_capacity; i++)
-    map->buckets[i] = NULL;
+  new_capacity = capacity_for(map->size + 1);
+  if (new_capacity < old_capacity)
+    new_capacity = old_capacity;
   
-  map->capacity = new_capacity;
+  if (alloc_table(map, new_capacity)) {
+    map->slots = old_slots;
+    map->ctrl = old_ctrl;
+    return;
+  }
   
-  /* Rehash all entries */
   for (i = 0; i < old_capacity; i++) {
-    entry = old_buckets[i];
-    while (entry) {
-      next = entry->next;
-      
-      /* Reinsert into new buckets */
-      bucket = entry->hash % new_capacity;
-      entry->next = map->buckets[bucket];
-      map->buckets[bucket] = entry;
-      
-      entry = next;
-    }
+    if (old_ctrl[i] & 0x80)
+      continue;
+    slot = find_free(map, old_slots[i].hash);
+    map->ctrl[slot] = old_ctrl[i];
+    map->slots[slot] = old_slots[i];
   }
   
-  /* Free old buckets array */
-  FREE(old_buckets);
+  FREE(old_slots);
+}
+
+/* Copy of map with the same table layout (tombstones included, since
+ * probe sequences run through them), so nothing is rehashed.  Keys and
+ * values are copied with copy_var_to(); nested arrays and mappings are
+ * shared.
+ * Returns new mapping with refcount 1, or NULL on error
+ */
+struct heap_mapping* mapping_copy(struct heap_mapping *map) {
+  struct heap_mapping *result;
+  unsigned int i;
+
+  result = (struct heap_mapping *) MALLOC(sizeof(struct heap_mapping));
+  if (!result)
+    return NULL;
+  if (alloc_table(result, map->capacity)) {
+    FREE(result);
+    return NULL;
+  }
+  memcpy(result->ctrl, map->ctrl, map->capacity);
+  for (i = 0; i < map->capacity; i++) {
+    if (!MAPPING_SLOT_USED(map, i))
+      continue;
+    result->slots[i].hash = map->slots[i].hash;
+    copy_var_to(&result->slots[i].key, &map->slots[i].key);
+    copy_var_to(&result->slots[i].value, &map->slots[i].value);
+  }
+  result->size = map->size;
+  result->deleted = map->deleted;
+  result->refcount = 1;
+  return result;
+}
+
+/* Make the mapping held in slot private to it before a modification
+ * (see array_unshare())
+ * Returns 0 on success (slot may now hold a new mapping), 1 on error
+ */
+int mapping_unshare(struct var *slot) {
+  struct heap_mapping *copy;
+
+  if (slot->type != MAPPING || !slot->value.mapping_ptr)
+    return 1;
+  if (slot->value.mapping_ptr->refcount <= 1)
+    return 0;
+  copy = mapping_copy(slot->value.mapping_ptr);
+  if (!copy) {
+    logger(LOG_ERROR, "mapping_unshare: failed to copy mapping");
+    return 1;
+  }
+  mapping_release(slot->value.mapping_ptr);
+  slot->value.mapping_ptr = copy;
+  return 0;
 }
 
 /* Get pointer to value for key, creating entry if needed
  * Returns pointer to value slot in mapping (for L_VALUE semantics)
  * Returns NULL on error
+ * The pointer stays valid until the next insert into the same mapping,
+ * which may move the table (as resize_heap_array() does for arrays), so
+ * the interpreter keeps a mapping_ref instead (see below).
  */
 struct var* mapping_get_or_create(struct heap_mapping *map, struct var *key) {
-  unsigned int hash, bucket;
+  unsigned int hash, slot;
   struct mapping_entry *entry;
+  long found;
   
   if (!map || !key)
     return NULL;
   
   hash = hash_var(key);
-  bucket = hash % map->capacity;
-  
-  /* Search for existing entry */
-  entry = map->buckets[bucket];
-  while (entry) {
-    if (entry->hash == hash && var_equals(&entry->key, key)) {
-      /* Found it! */
-      return &entry->value;
-    }
-    entry = entry->next;
+  found = find_slot(map, key, hash);
+  if (found >= 0)
+    return &map->slots[found].value;
+  
+  /* Not found - claim a slot, growing first if this would pass the load limit */
+  slot = find_free(map, hash);
+  if (map->ctrl[slot] == MAPPING_CTRL_EMPTY &&
+      (map->size + map->deleted + 1) * 8 > map->capacity * MAPPING_MAX_LOAD) {
+    mapping_rehash(map);
+    if ((map->size + map->deleted + 1) >= map->capacity)
+      return NULL;
+    slot = find_free(map, hash);
   }
   
-  /* Not found - create new entry */
-  entry = (struct mapping_entry *) MALLOC(sizeof(struct mapping_entry));
-  if (!entry)
-    return NULL;
+  if (map->ctrl[slot] == MAPPING_CTRL_DELETED)
+    map->deleted--;
+  map->ctrl[slot] = HASH_TAG(hash);
+  entry = &map->slots[slot];
   
   /* Initialize entry */
   copy_var_to(&entry->key, key);
   entry->hash = hash;
   entry->value.type = INTEGER;
   entry->value.value.integer = 0;  /* Default value */
-  
-  /* Add to chain */
-  entry->next = map->buckets[bucket];
-  map->buckets[bucket] = entry;
   map->size++;
   
-  /* Check if rehash needed */
-  if ((float)map->size / (float)map->capacity > MAPPING_LOAD_FACTOR) {
-    mapping_rehash(map);
-  }
-  
   return &entry->value;
 }
 
+/* Mapping values as l-values
+ *
+ * The table moves when it grows, so the interpreter can't hold a pointer
+ * to a value while it evaluates the rest of an expression: m[1] = m[2]
+ * inserts 2 after 1 was looked up.  A subscript pushes a mapping_ref
+ * instead, its address tagged with MAPPING_REF_TAG, and the value is
+ * found again whenever the l-value is used, after the right-hand side.
+ * The slot it was in is tried first.  Refs are kept by call depth and
+ * freed a statement at a time, once the stack that held them is gone.
+ */
+struct mapping_ref {
+  struct heap_mapping *map;
+  struct var key;           /* owned */
+  unsigned int hash;
+  unsigned int slot;        /* where the value was when looked up */
+  int depth;                /* call_stack_depth of the frame */
+  struct mapping_ref *next;
+};
+
+static struct mapping_ref *live_refs;   /* newest first */
+static struct mapping_ref *free_refs;
+
+/* Look key up in map, creating it as a read does, and make an l-value
+ * ref for it.  Takes over key, which is cleared on failure.  Returns the
+ * tagged ref, or 0 if the value can't be had. */
+unsigned long mapping_ref(struct heap_mapping *map, struct var *key, int depth) {
+  struct mapping_ref *ref;
+  struct var *value;
+
+  if (!(value = mapping_get_or_create(map, key))) {
+    clear_var(key);
+    return 0;
+  }
+  if ((ref = free_refs))
+    free_refs = ref->next;
+  else
+    ref = MALLOC(sizeof(struct mapping_ref));
+  ref->map = map;
+  ref->key = *key;
+  ref->slot = (struct mapping_entry *) ((char *) value -
+                offsetof(struct mapping_entry, value)) - map->slots;
+  ref->hash = map->slots[ref->slot].hash;
+  ref->depth = depth;
+  ref->next = live_refs;
+  live_refs = ref;
+  return (unsigned long) ref | MAPPING_REF_TAG;
+}
+
+/* The value a mapping ref stands for now, or NULL */
+struct var *mapping_ref_value(unsigned long tagged) {
+  struct mapping_ref *ref;
+  struct heap_mapping *map;
+
+  ref = (struct mapping_ref *) (tagged & ~(unsigned long) MAPPING_REF_TAG);
+  map = ref->map;
+  if (ref->slot < map->capacity && MAPPING_SLOT_USED(map, ref->slot) &&
+      map->slots[ref->slot].hash == ref->hash &&
+      var_equals(&map->slots[ref->slot].key, &ref->key))
+    return &map->slots[ref->slot].value;
+  return mapping_get_or_create(map, &ref->key);
+}
+
+/* Free the refs made at depth or deeper: called when a frame at that
+ * depth starts a statement or a call */
+void mapping_refs_release(int depth) {
+  struct mapping_ref *ref;
+
+  while ((ref = live_refs) && ref->depth >= depth) {
+    live_refs = ref->next;
+    clear_var(&ref->key);
+    ref->next = free_refs;
+    free_refs = ref;
+  }
+}
+
 /* Get value for key (read-only access)
  * Returns 1 if key exists and sets result, 0 if key not found
  */
 int mapping_get(struct heap_mapping *map, struct var *key, struct var *result) {
-  unsigned int hash, bucket;
-  struct mapping_entry *entry;
+  long found;
   
   if (!map || !key || !result)
     return 0;
   
-  hash = hash_var(key);
-  bucket = hash % map->capacity;
-  
-  /* Search for entry */
-  entry = map->buckets[bucket];
-  while (entry) {
-    if (entry->hash == hash && var_equals(&entry->key, key)) {
-      /* Found it - copy value to result */
-      *result = entry->value;
-      return 1;
-    }
-    entry = entry->next;
-  }
+  found = find_slot(map, key, hash_var(key));
+  if (found < 0)
+    return 0;
   
-  /* Not found */
-  return 0;
+  /* Found it - copy value to result */
+  *result = map->slots[found].value;
+  return 1;
 }
 
 /* Set value for key
@@ -333,65 +560,47 @@ int mapping_set(struct heap_mapping *map, struct var *key, struct var *value) {
  * Returns 0 on success, 1 if key not found
  */
 int mapping_delete(struct heap_mapping *map, struct var *key) {
-  unsigned int hash, bucket;
-  struct mapping_entry *entry, *prev;
+  unsigned int group;
+  long found;
   
   if (!map || !key)
     return 1;
   
-  hash = hash_var(key);
-  bucket = hash % map->capacity;
-  
-  /* Search for entry */
-  prev = NULL;
-  entry = map->buckets[bucket];
-  while (entry) {
-    if (entry->hash == hash && var_equals(&entry->key, key)) {
-      /* Found it - remove from chain */
-      if (prev)
-        prev->next = entry->next;
-      else
-        map->buckets[bucket] = entry->next;
-      
-      free_mapping_entry(entry);
-      map->size--;
-      return 0;
-    }
-    prev = entry;
-    entry = entry->next;
-  }
+  found = find_slot(map, key, hash_var(key));
+  if (found < 0)
+    return 1;
   
-  /* Not found */
-  return 1;
+  clear_var(&map->slots[found].key);
+  clear_var(&map->slots[found].value);
+  map->size--;
+  
+  /* A group that already has an empty slot ends every probe that reaches
+   * it, so nothing can have been placed past it on this slot's account and
+   * the slot can go straight back to empty.  Otherwise leave a tombstone. */
+  group = found & ~(MAPPING_GROUP - 1);
+  if (match_empty(load_group(map->ctrl + group))) {
+    map->ctrl[found] = MAPPING_CTRL_EMPTY;
+  } else {
+    map->ctrl[found] = MAPPING_CTRL_DELETED;
+    map->deleted++;
+  }
+  return 0;
 }
 
 /* Check if key exists in mapping
  * Returns 1 if exists, 0 if not
  */
 int mapping_exists(struct heap_mapping *map, struct var *key) {
-  unsigned int hash, bucket;
-  struct mapping_entry *entry;
-  
   if (!map || !key)
     return 0;
   
-  hash = hash_var(key);
-  bucket = hash % map->capacity;
-  
-  /* Search for entry */
-  entry = map->buckets[bucket];
-  while (entry) {
-    if (entry->hash == hash && var_equals(&entry->key, key))
-      return 1;
-    entry = entry->next;
-  }
-  
-  return 0;
+  return find_slot(map, key, hash_var(key)) >= 0;
 }
 
 /* Merge two mappings (m1 + m2)
  * Creates a new mapping with all keys from both
  * If key exists in both, m2's value wins
+ * If either side is empty the other is returned with an extra reference
  * Returns new mapping or NULL on error
  */
 struct heap_mapping* mapping_merge(struct heap_mapping *m1, struct heap_mapping *m2) {
@@ -409,41 +618,31 @@ struct heap_mapping* mapping_merge(struct heap_mapping *m1, struct heap_mapping
     return NULL;
   }
   
-  /* Allocate result mapping with capacity for both */
-  result = allocate_mapping(m1->size + m2->size);
+  if (!m2->size || !m1->size) {
+    result = m2->size ? m2 : m1;
+    mapping_addref(result);
+    return result;
+  }
+  
+  /* Start from a copy of m1's table; nothing in it needs rehashing */
+  result = mapping_copy(m1);
   if (!result) {
     logger(LOG_ERROR, "mapping_merge: failed to allocate result mapping");
     return NULL;
   }
   
-  sprintf(logbuf, "mapping_merge: allocated result=%p, copying from m1", (void*)result);
+  sprintf(logbuf, "mapping_merge: copied m1 into result=%p, now copying m2", (void*)result);
   logger(LOG_INFO, logbuf);
   
-  /* Copy all entries from m1 */
-  for (i = 0; i < m1->capacity; i++) {
-    entry = m1->buckets[i];
-    while (entry) {
-      if (mapping_set(result, &entry->key, &entry->value)) {
-        logger(LOG_ERROR, "mapping_merge: failed to set entry from m1");
-        mapping_release(result);
-        return NULL;
-      }
-      entry = entry->next;
-    }
-  }
-  
-  logger(LOG_INFO, "mapping_merge: copied m1, now copying m2");
-  
   /* Copy all entries from m2 (overwrites duplicates from m1) */
   for (i = 0; i < m2->capacity; i++) {
-    entry = m2->buckets[i];
-    while (entry) {
-      if (mapping_set(result, &entry->key, &entry->value)) {
-        logger(LOG_ERROR, "mapping_merge: failed to set entry from m2");
-        mapping_release(result);
-        return NULL;
-      }
-      entry = entry->next;
+    if (!MAPPING_SLOT_USED(m2, i))
+      continue;
+    entry = &m2->slots[i];
+    if (mapping_set(result, &entry->key, &entry->value)) {
+      logger(LOG_ERROR, "mapping_merge: failed to set entry from m2");
+      mapping_release(result);
+      return NULL;
     }
   }
   
@@ -455,6 +654,7 @@ struct heap_mapping* mapping_merge(struct heap_mapping *m1, struct heap_mapping
 
 /* Subtract mappings (m1 - m2)
  * Creates a new mapping with keys from m1 that are NOT in m2
+ * If none of m1's keys are in m2, m1 is returned with an extra reference
  * Returns new mapping or NULL on error
  */
 struct heap_mapping* mapping_subtract(struct heap_mapping *m1, struct heap_mapping *m2) {
@@ -465,23 +665,30 @@ struct heap_mapping* mapping_subtract(struct heap_mapping *m1, struct heap_mappi
   if (!m1 || !m2)
     return NULL;
   
+  for (i = 0; i < m1->capacity && m2->size; i++)
+    if (MAPPING_SLOT_USED(m1, i) && mapping_exists(m2, &m1->slots[i].key))
+      break;
+  if (!m2->size || i == m1->capacity) {
+    mapping_addref(m1);
+    return m1;
+  }
+  
   /* Allocate result mapping */
-  result = allocate_mapping(m1->size);
+  result = allocate_mapping(capacity_for(m1->size));
   if (!result)
     return NULL;
   
   /* Copy entries from m1 that don't exist in m2 */
   for (i = 0; i < m1->capacity; i++) {
-    entry = m1->buckets[i];
-    while (entry) {
-      /* Only add if key doesn't exist in m2 */
-      if (!mapping_exists(m2, &entry->key)) {
-        if (mapping_set(result, &entry->key, &entry->value)) {
-          mapping_release(result);
-          return NULL;
-        }
+    if (!MAPPING_SLOT_USED(m1, i))
+      continue;
+    entry = &m1->slots[i];
+    /* Only add if key doesn't exist in m2 */
+    if (!mapping_exists(m2, &entry->key)) {
+      if (mapping_set(result, &entry->key, &entry->value)) {
+        mapping_release(result);
+        return NULL;
       }
-      entry = entry->next;
     }
   }
   
@@ -508,14 +715,13 @@ struct heap_array* mapping_keys_array(struct heap_mapping *map) {
   /* Collect all keys from hash table */
   key_count = 0;
   for (i = 0; i < map->capacity; i++) {
-    entry = map->buckets[i];
-    while (entry) {
-      if (key_count < map->size) {
-        /* Copy key to array */
-        copy_var(&keys_array->elements[key_count], &entry->key);
-        key_count++;
-      }
-      entry = entry->next;
+    if (!MAPPING_SLOT_USED(map, i))
+      continue;
+    entry = &map->slots[i];
+    if (key_count < map->size) {
+      /* Copy key to array */
+      copy_var(&keys_array->elements[key_count], &entry->key);
+      key_count++;
     }
   }
   
@@ -542,14 +748,13 @@ struct heap_array* mapping_values_array(struct heap_mapping *map) {
   /* Collect all values from hash table */
   value_count = 0;
   for (i = 0; i < map->capacity; i++) {
-    entry = map->buckets[i];
-    while (entry) {
-      if (value_count < map->size) {
-        /* Copy value to array */
-        copy_var(&values_array->elements[value_count], &entry->value);
-        value_count++;
-      }
-      entry = entry->next;
+    if (!MAPPING_SLOT_USED(map, i))
+      continue;
+    entry = &map->slots[i];
+    if (value_count < map->size) {
+      /* Copy value to array */
+      copy_var(&values_array->elements[value_count], &entry->value);
+      value_count++;
     }
   }
   
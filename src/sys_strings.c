@@ -3,6 +3,8 @@
  * Contains low-level string utilities used by the driver:
  * - escape_string() - Escape special characters for serialization
  * - save_value_internal() - Recursive value serialization
+ * - save_value_line() - The same, as a save file line with its length
+ * - save_value_file() - The same, streamed to a file
  */
 
 #include "config.h"
@@ -77,150 +79,232 @@ char *escape_string(char *str) {
  * VALUE SERIALIZATION
  * ======================================================================== */
 
-/* Serialize a value to string (recursive)
+/* Output buffer for the serializer.  Text is appended in place and the
+ * buffer doubles when full, so a value of any size costs one pass.  With
+ * fp set, the buffer is flushed to the file whenever it passes
+ * SAVE_FLUSH_SIZE instead of growing, so a save needs no more than that
+ * much memory however large the value is.
+ */
+struct save_buf {
+    char *data;
+    size_t length;
+    size_t capacity;
+    FILE *fp;                 /* stream output, or NULL to build a string */
+    int error;                /* out of memory or write failed */
+};
+
+#define SAVE_BUF_INIT 256
+#define SAVE_FLUSH_SIZE 65536
+
+static int save_buf_init(struct save_buf *sb, FILE *fp) {
+    sb->capacity = fp ? SAVE_FLUSH_SIZE : SAVE_BUF_INIT;
+    sb->data = MALLOC(sb->capacity);
+    sb->length = 0;
+    sb->fp = fp;
+    sb->error = 0;
+    return sb->data ? 0 : 1;
+}
+
+static void save_buf_flush(struct save_buf *sb) {
+    if (sb->length && fwrite(sb->data, 1, sb->length, sb->fp) != sb->length)
+        sb->error = 1;
+    sb->length = 0;
+}
+
+/* Make room for len more bytes plus a terminator */
+static int save_buf_reserve(struct save_buf *sb, size_t len) {
+    size_t need;
+    char *grown;
+    
+    if (sb->error) return 1;
+    need = sb->length + len + 1;
+    if (need <= sb->capacity) return 0;
+    if (sb->fp) {
+        save_buf_flush(sb);
+        need = len + 1;
+        if (need <= sb->capacity) return sb->error;
+    }
+    while (sb->capacity < need)
+        sb->capacity *= 2;
+    grown = realloc(sb->data, sb->capacity);
+    if (!grown) {
+        sb->error = 1;
+        return 1;
+    }
+    sb->data = grown;
+    return 0;
+}
+
+static void save_buf_add(struct save_buf *sb, const char *str, size_t len) {
+    if (save_buf_reserve(sb, len)) return;
+    memcpy(sb->data + sb->length, str, len);
+    sb->length += len;
+}
+
+/* Append str as a quoted literal, escaped the same way as escape_string() */
+static void save_buf_add_quoted(struct save_buf *sb, char *str) {
+    size_t len, i;
+    char *p, c;
+    
+    if (!str) str = "";
+    len = strlen(str);
+    /* worst case every character needs a backslash */
+    if (save_buf_reserve(sb, len * 2 + 2)) return;
+    p = sb->data + sb->length;
+    *p++ = '"';
+    for (i = 0; i < len; i++) {
+        c = str[i];
+        switch (c) {
+            case '\\': *p++ = '\\'; *p++ = '\\'; break;
+            case '"':  *p++ = '\\'; *p++ = '"';  break;
+            case '\n': *p++ = '\\'; *p++ = 'n';  break;
+            case '\t': *p++ = '\\'; *p++ = 't';  break;
+            case '\r': *p++ = '\\'; *p++ = 'r';  break;
+            default:   *p++ = c;                 break;
+        }
+    }
+    *p++ = '"';
+    sb->length = p - sb->data;
+}
+
+/* Serialize a value into sb (recursive)
  * Handles: integers, strings, arrays, mappings, objects
- * Returns: Newly allocated string representation (caller must FREE)
+ * Returns: 0 on success, 1 on error
  */
-char *save_value_internal(struct var *value, int depth) {
-    char *result, *temp, *escaped;
+static int save_value_buf(struct save_buf *sb, struct var *value, int depth) {
     struct heap_array *arr;
     struct heap_mapping *map;
     struct mapping_entry *entry;
     char numbuf[64];
-    int i, first;
-    char *key_str, *val_str;
+    unsigned int i;
+    int first;
     
     /* Check recursion depth */
     if (depth > MAX_SAVE_DEPTH) {
         logger(LOG_ERROR, "save_value: maximum recursion depth exceeded");
-        return NULL;
+        return 1;
     }
     
     switch (value->type) {
         case INTEGER:
             /* Simple integer */
-            sprintf(numbuf, "%ld", value->value.integer);
-            return copy_string(numbuf);
+            sprintf(numbuf, "%ld", (long) value->value.integer);
+            save_buf_add(sb, numbuf, strlen(numbuf));
+            break;
             
         case STRING:
             /* Escaped string with quotes */
-            escaped = escape_string(value->value.string);
-            if (!escaped) return NULL;
-            
-            result = MALLOC(strlen(escaped) + 3);  /* "string" */
-            if (!result) {
-                FREE(escaped);
-                return NULL;
-            }
-            sprintf(result, "\"%s\"", escaped);
-            FREE(escaped);
-            return result;
+            save_buf_add_quoted(sb, value->value.string);
+            break;
             
         case ARRAY:
             /* Array literal: ({elem1,elem2,...}) */
             arr = value->value.array_ptr;
-            if (!arr || arr->size == 0) {
-                return copy_string("({})");
+            save_buf_add(sb, "({", 2);
+            for (i = 0; arr && i < arr->size; i++) {
+                if (i > 0) save_buf_add(sb, ",", 1);
+                if (save_value_buf(sb, &arr->elements[i], depth + 1))
+                    return 1;
             }
-            
-            /* Build array string */
-            result = copy_string("({");
-            for (i = 0; i < arr->size; i++) {
-                temp = save_value_internal(&arr->elements[i], depth + 1);
-                if (!temp) {
-                    FREE(result);
-                    return NULL;
-                }
-                
-                /* Append element */
-                escaped = MALLOC(strlen(result) + strlen(temp) + 2);
-                if (i > 0) {
-                    sprintf(escaped, "%s,%s", result, temp);
-                } else {
-                    sprintf(escaped, "%s%s", result, temp);
-                }
-                FREE(result);
-                FREE(temp);
-                result = escaped;
-            }
-            
-            /* Close array */
-            temp = MALLOC(strlen(result) + 3);
-            sprintf(temp, "%s})", result);
-            FREE(result);
-            return temp;
+            save_buf_add(sb, "})", 2);
+            break;
             
         case MAPPING:
             /* Mapping literal: ([key1:val1,key2:val2,...]) */
             map = value->value.mapping_ptr;
-            if (!map || map->size == 0) {
-                return copy_string("([])");
-            }
-            
-            /* Build mapping string */
-            result = copy_string("([");
+            save_buf_add(sb, "([", 2);
             first = 1;
-            
-            for (i = 0; i < map->capacity; i++) {
-                entry = map->buckets[i];
-                while (entry) {
-                    /* Serialize key */
-                    key_str = save_value_internal(&entry->key, depth + 1);
-                    if (!key_str) {
-                        FREE(result);
-                        return NULL;
-                    }
-                    
-                    /* Serialize value */
-                    val_str = save_value_internal(&entry->value, depth + 1);
-                    if (!val_str) {
-                        FREE(key_str);
-                        FREE(result);
-                        return NULL;
-                    }
-                    
-                    /* Append key:value */
-                    temp = MALLOC(strlen(result) + strlen(key_str) + strlen(val_str) + 4);
-                    if (first) {
-                        sprintf(temp, "%s%s:%s", result, key_str, val_str);
-                        first = 0;
-                    } else {
-                        sprintf(temp, "%s,%s:%s", result, key_str, val_str);
-                    }
-                    FREE(result);
-                    FREE(key_str);
-                    FREE(val_str);
-                    result = temp;
-                    
-                    entry = entry->next;
-                }
+            for (i = 0; map && i < map->capacity; i++) {
+                if (!MAPPING_SLOT_USED(map, i))
+                    continue;
+                entry = &map->slots[i];
+                if (!first) save_buf_add(sb, ",", 1);
+                first = 0;
+                if (save_value_buf(sb, &entry->key, depth + 1))
+                    return 1;
+                save_buf_add(sb, ":", 1);
+                if (save_value_buf(sb, &entry->value, depth + 1))
+                    return 1;
             }
-            
-            /* Close mapping */
-            temp = MALLOC(strlen(result) + 3);
-            sprintf(temp, "%s])", result);
-            FREE(result);
-            return temp;
+            save_buf_add(sb, "])", 2);
+            break;
             
         case OBJECT:
             /* Save object as path string */
             if (value->value.objptr && value->value.objptr->parent && 
                 value->value.objptr->parent->pathname) {
-                escaped = escape_string(value->value.objptr->parent->pathname);
-                result = MALLOC(strlen(escaped) + 3);
-                sprintf(result, "\"%s\"", escaped);
-                FREE(escaped);
-                return result;
+                save_buf_add_quoted(sb, value->value.objptr->parent->pathname);
+                break;
             }
-            return copy_string("0");
+            save_buf_add(sb, "0", 1);
+            break;
             
         default:
-            /* Unsupported type - return 0 */
+            /* Unsupported type - save 0 */
             {
                 char logbuf[256];
                 sprintf(logbuf, "save_value: unsupported type %d", value->type);
                 logger(LOG_WARNING, logbuf);
             }
-            return copy_string("0");
+            save_buf_add(sb, "0", 1);
+            break;
+    }
+    return sb->error;
+}
+
+/* Serialize a value to string
+ * Returns: Newly allocated string representation (caller must FREE)
+ */
+char *save_value_internal(struct var *value, int depth) {
+    struct save_buf sb;
+    
+    if (save_buf_init(&sb, NULL)) return NULL;
+    if (save_value_buf(&sb, value, depth)) {
+        FREE(sb.data);
+        return NULL;
+    }
+    sb.data[sb.length] = '\0';
+    return sb.data;
+}
+
+/* Serialize a value as one line of a save file, newline included
+ * Returns: Newly allocated text (caller must FREE) with its length in
+ * *len, or NULL on error
+ */
+char *save_value_line(struct var *value, unsigned long *len) {
+    struct save_buf sb;
+    int failed;
+    
+    if (save_buf_init(&sb, NULL)) return NULL;
+    failed = save_value_buf(&sb, value, 0);
+    if (!failed) {
+        save_buf_add(&sb, "\n", 1);
+        failed = sb.error;
+    }
+    if (failed) {
+        FREE(sb.data);
+        return NULL;
+    }
+    sb.data[sb.length] = '\0';
+    *len = sb.length;
+    return sb.data;
+}
+
+/* Serialize a value straight to a stdio stream, followed by a newline.
+ * A caller with a raw descriptor can fdopen() it.
+ * Returns: 0 on success, -1 on error (nothing useful was written)
+ */
+int save_value_file(struct var *value, FILE *fp) {
+    struct save_buf sb;
+    int failed;
+    
+    if (save_buf_init(&sb, fp)) return -1;
+    failed = save_value_buf(&sb, value, 0);
+    if (!failed) {
+        save_buf_add(&sb, "\n", 1);
+        save_buf_flush(&sb);
+        failed = sb.error;
     }
+    FREE(sb.data);
+    return failed ? -1 : 0;
 }
@@ -7,21 +7,36 @@
 #include "constrct.h"
 #include "instr.h"
 
-char expand_buf[EBUFSIZ+1];
-char tmpbuf[EBUFSIZ+1];
-char name_buf[MAX_TOK_LEN+1];
-char string_buf[MAX_STR_LEN+1];
+THREAD_LOCAL char expand_buf[EBUFSIZ+1];
+THREAD_LOCAL char tmpbuf[EBUFSIZ+1];
+THREAD_LOCAL char name_buf[MAX_TOK_LEN+1];
+THREAD_LOCAL char string_buf[MAX_STR_LEN+1];
 
 #define isstart(c) (isalpha(c) || ((c)=='_'))
 #define iscname(c) (isstart(c) || isdigit(c))
 #define getch() *((file_info->expanded)++)
 #define ungetch() --(file_info->expanded)
 
+/* bucket for name in a compiler hash table of size buckets */
+unsigned int name_bucket(char *name, unsigned int size)
+{
+  unsigned int hash;
+
+  hash=5381;
+  while (*name)
+    hash=((hash<<5)+hash)+(unsigned char) *(name++);
+  return hash%size;
+}
+
+/* #defines are chained per bucket, newest first, so a redefinition
+   hides the older one until it is #undef'd */
+#define def_bucket(name) name_bucket(name,DEF_HASH)
+
 struct define *find_define(filptr *file_info, char *name)
 {
   struct define *curr;
 
-  curr=file_info->defs;
+  curr=file_info->defs[def_bucket(name)];
   while (curr) {
     if (!strcmp(curr->name,name))
       return curr;
@@ -30,32 +45,102 @@ struct define *find_define(filptr *file_info, char *name)
   return NULL;
 }
 
+void add_define(filptr *file_info, struct define *def)
+{
+  unsigned int bucket;
+
+  bucket=def_bucket(def->name);
+  def->next=file_info->defs[bucket];
+  file_info->defs[bucket]=def;
+}
+
+/* #undef drops every definition of name */
+void remove_define(filptr *file_info, char *name)
+{
+  struct define **curr,*next;
+
+  curr=&(file_info->defs[def_bucket(name)]);
+  while (*curr)
+    if (!strcmp((*curr)->name,name)) {
+      next=(*curr)->next;
+      free_one_define(*curr);
+      *curr=next;
+    } else
+      curr=&((*curr)->next);
+}
+
 unsigned char find_keyword(char *name)
 {
-  if (!strcmp(name,"if"))
-    return IF_TOK;
-  if ((!strcmp(name,"int")) || (!strcmp(name,"string")) ||
-      (!strcmp(name,"object")) || (!strcmp(name,"var")))
-    return VAR_DCL_TOK;
-  if (!strcmp(name,"mapping"))
-    return MAPPING_TOK;
-  if (!strcmp(name,"inherit"))
-    return INHERIT_TOK;
-  if (!strcmp(name,"static"))
-    return STATIC_TOK;
-  if (!strcmp(name,"else"))
-    return ELSE_TOK;
-  if (!strcmp(name,"while"))
-    return WHILE_TOK;
-  if (!strcmp(name,"for"))
-    return FOR_TOK;
-  if (!strcmp(name,"do"))
-    return DO_TOK;
-  if (!strcmp(name,"return"))
-    return RETURN_TOK;
+  /* every name goes through here, so only compare the keywords that
+     start with the same letter */
+  switch (*name) {
+    case 'd':
+      if (!strcmp(name,"do"))
+        return DO_TOK;
+      break;
+    case 'e':
+      if (!strcmp(name,"else"))
+        return ELSE_TOK;
+      break;
+    case 'f':
+      if (!strcmp(name,"for"))
+        return FOR_TOK;
+      break;
+    case 'i':
+      if (!strcmp(name,"if"))
+        return IF_TOK;
+      if (!strcmp(name,"int"))
+        return VAR_DCL_TOK;
+      if (!strcmp(name,"inherit"))
+        return INHERIT_TOK;
+      break;
+    case 'm':
+      if (!strcmp(name,"mapping"))
+        return MAPPING_TOK;
+      break;
+    case 'o':
+      if (!strcmp(name,"object"))
+        return VAR_DCL_TOK;
+      break;
+    case 'r':
+      if (!strcmp(name,"return"))
+        return RETURN_TOK;
+      break;
+    case 's':
+      if (!strcmp(name,"string"))
+        return VAR_DCL_TOK;
+      if (!strcmp(name,"static"))
+        return STATIC_TOK;
+      break;
+    case 'v':
+      if (!strcmp(name,"var"))
+        return VAR_DCL_TOK;
+      break;
+    case 'w':
+      if (!strcmp(name,"while"))
+        return WHILE_TOK;
+      break;
+  }
   return 0;
 }
 
+/* the character a backslash escape inside quotes stands for */
+
+static int escape_char(int c)
+{
+  switch (c) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'a': return '\a';
+    case 'b': return '\b';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    case '0': return '\0';
+  }
+  return c;
+}
+
 void get_exp_token(filptr *file_info, token_t *token)
 {
   char c;
@@ -141,17 +226,34 @@ void get_exp_token(filptr *file_info, token_t *token)
     token->token_data.name=string_buf;
     return;
   }
+  if (c=='\'') {
+    c=getch();
+    if (c=='\\' && *(file_info->expanded))
+      c=escape_char(getch());
+    else if (!c || c=='\'') {
+      token->type=NO_TOK;
+      return;
+    }
+    if (*(file_info->expanded)!='\'') {
+      token->type=NO_TOK;
+      return;
+    }
+    (file_info->expanded)++;
+    token->type=INTEGER_TOK;
+    token->token_data.integer=(unsigned char) c;
+    return;
+  }
   if (c=='{') {
     token->type=LBRACK_TOK;
     return;
   }
   if (c=='}') {
-    c=fgetc(file_info->curr_file);
+    c=src_getc(file_info->curr_file);
     if (c==')') {
       token->type=RARRASGN_TOK;  /* }) for array literal end */
       return;
     }
-    ungetc(c,file_info->curr_file);
+    src_ungetc(c,file_info->curr_file);
     token->type=RBRACK_TOK;
     return;
   }
@@ -164,7 +266,7 @@ void get_exp_token(filptr *file_info, token_t *token)
     return;
   }
   if (c=='(') {
-    c=fgetc(file_info->curr_file);
+    c=src_getc(file_info->curr_file);
     if (c=='{') {
       token->type=LARRASGN_TOK;  /* ({ for array literal start */
       return;
@@ -173,7 +275,7 @@ void get_exp_token(filptr *file_info, token_t *token)
       token->type=LMAPSGN_TOK;  /* ([ for mapping literal start */
       return;
     }
-    ungetc(c,file_info->curr_file);
+    src_ungetc(c,file_info->curr_file);
     token->type=LPAR_TOK;
     return;
   }
@@ -195,6 +297,10 @@ void get_exp_token(filptr *file_info, token_t *token)
   }
   if (c=='.') {
     token->type=DOT_TOK;
+    if (getch()=='.')
+      token->type=RANGE_TOK;
+    else
+      ungetch();
     return;
   }
   if (c==':') {
@@ -346,10 +452,85 @@ void get_exp_token(filptr *file_info, token_t *token)
   return;
 }
 
+/* Put a token back to be read again.  Up to MAX_LOOKAHEAD may be put
+   back; the last one put back is read first. */
 void unget_token(filptr *file_info, token_t *token)
 {
-  file_info->put_back_token=*token;
-  file_info->is_put_back=1;
+  struct ahead_token *ahead;
+
+  if (file_info->num_ahead>=MAX_LOOKAHEAD) {
+    logger(LOG_ERROR,"compile: token lookahead overflow");
+    return;
+  }
+  ahead=&(file_info->ahead[file_info->num_ahead++]);
+  ahead->token=*token;
+  ahead->string=NULL;
+  if (token->type==NAME_TOK) {
+    strcpy(ahead->name,token->token_data.name);
+    ahead->token.token_data.name=ahead->name;
+  } else if (token->type==STRING_TOK) {
+    ahead->string=copy_string(token->token_data.name);
+    ahead->token.token_data.name=ahead->string;
+  }
+}
+
+/* Take the next put-back token; its text goes back where the tokenizer
+   would have left it */
+static void take_ahead(filptr *file_info, token_t *token)
+{
+  struct ahead_token *ahead;
+
+  ahead=&(file_info->ahead[--(file_info->num_ahead)]);
+  *token=ahead->token;
+  if (token->type==NAME_TOK) {
+    strcpy(name_buf,ahead->name);
+    token->token_data.name=name_buf;
+  } else if (token->type==STRING_TOK) {
+    strcpy(string_buf,ahead->string);
+    token->token_data.name=string_buf;
+    FREE(ahead->string);
+    ahead->string=NULL;
+  }
+}
+
+/* Look at the token n places ahead (0 is the next one) without taking
+   it.  n must be less than MAX_LOOKAHEAD; the token's text lasts until
+   the next get_token(). */
+void peek_token(filptr *file_info, int n, token_t *token)
+{
+  struct ahead_token read[MAX_LOOKAHEAD];
+  int x;
+
+  for (x=0;x<=n;x++) {
+    get_token(file_info,&(read[x].token));
+    read[x].string=NULL;
+    if (read[x].token.type==NAME_TOK) {
+      strcpy(read[x].name,read[x].token.token_data.name);
+      read[x].token.token_data.name=read[x].name;
+    } else if (read[x].token.type==STRING_TOK) {
+      read[x].string=copy_string(read[x].token.token_data.name);
+      read[x].token.token_data.name=read[x].string;
+    }
+  }
+  *token=read[n].token;
+  if (token->type==NAME_TOK)
+    token->token_data.name=strcpy(name_buf,read[n].name);
+  else if (token->type==STRING_TOK)
+    token->token_data.name=strcpy(string_buf,read[n].string);
+  while (x--) {
+    unget_token(file_info,&(read[x].token));
+    if (read[x].string)
+      FREE(read[x].string);
+  }
+}
+
+void clear_lookahead(filptr *file_info)
+{
+  while (file_info->num_ahead)
+    if (file_info->ahead[--(file_info->num_ahead)].string) {
+      FREE(file_info->ahead[file_info->num_ahead].string);
+      file_info->ahead[file_info->num_ahead].string=NULL;
+    }
 }
 
 void tokenize_name(filptr *file_info, token_t *token)
@@ -358,17 +539,17 @@ void tokenize_name(filptr *file_info, token_t *token)
   struct define *tmp;
 
   counter=0;
-  c=fgetc(file_info->curr_file);
+  c=src_getc(file_info->curr_file);
   while ((counter<MAX_TOK_LEN) && (c!=EOF) && iscname(c)) {
     name_buf[counter++]=c;
-    c=fgetc(file_info->curr_file);
+    c=src_getc(file_info->curr_file);
   }
   if ((c==EOF) || iscname(c)) {
     token->type=NO_TOK;
     return;
   }
   name_buf[counter]='\0';
-  ungetc(c,file_info->curr_file);
+  src_ungetc(c,file_info->curr_file);
   if ((token->type=find_keyword(name_buf)))
     return;
   if ((tmp=find_define(file_info,name_buf))) {
@@ -385,12 +566,12 @@ void tokenize_int(filptr *file_info, token_t *token)
   signed long val;
 
   val=0;
-  c=fgetc(file_info->curr_file);
+  c=src_getc(file_info->curr_file);
   while ((c!=EOF) && isdigit(c)) {
     val=(val*10)+digit_value(c);
-    c=fgetc(file_info->curr_file);
+    c=src_getc(file_info->curr_file);
   }
-  ungetc(c,file_info->curr_file);
+  src_ungetc(c,file_info->curr_file);
   token->type=INTEGER_TOK;
   token->token_data.integer=val;
 } 
@@ -403,10 +584,10 @@ void tokenize_string(filptr *file_info, token_t *token)
 
   counter=0;
   str=string_buf;
-  c=fgetc(file_info->curr_file);
+  c=src_getc(file_info->curr_file);
   while ((c!=EOF) && (c!='\"') && (c!='\n') && ((counter++)<MAX_STR_LEN)) {
     if (c=='\\') {
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='n')
         c='\n';
       if (c=='t')
@@ -423,7 +604,7 @@ void tokenize_string(filptr *file_info, token_t *token)
         c='\v';
     }
     *(str++)=c;
-    c=fgetc(file_info->curr_file);
+    c=src_getc(file_info->curr_file);
   }
   if (c!='\"') {
     token->type=NO_TOK;
@@ -434,14 +615,31 @@ void tokenize_string(filptr *file_info, token_t *token)
   token->token_data.name=string_buf;
 }
 
+/* a character constant, 'c' or '\n', is just an integer */
+
+void tokenize_char(filptr *file_info, token_t *token)
+{
+  int c;
+
+  c=src_getc(file_info->curr_file);
+  if (c=='\\')
+    c=escape_char(src_getc(file_info->curr_file));
+  else if (c=='\'' || c=='\n')
+    c=EOF;
+  if (c==EOF || src_getc(file_info->curr_file)!='\'') {
+    token->type=NO_TOK;
+    return;
+  }
+  token->type=INTEGER_TOK;
+  token->token_data.integer=(unsigned char) c;
+}
+
 void get_token(filptr *file_info, token_t *token)
 {
   int c,done;
-  struct file_stack *tmp;
 
-  if (file_info->is_put_back) {
-    *token=file_info->put_back_token;
-    file_info->is_put_back=0;
+  if (file_info->num_ahead) {
+    take_ahead(file_info,token);
     return;
   }
   while (1) {
@@ -456,14 +654,10 @@ void get_token(filptr *file_info, token_t *token)
         file_info->depth=0;
       }
     }
-    c=fgetc(file_info->curr_file);
+    c=src_getc(file_info->curr_file);
     if (c==EOF) {
       if (file_info->previous) {
-        close_file(file_info->curr_file);
-        file_info->curr_file=file_info->previous->file_ptr;
-        tmp=file_info->previous;
-        file_info->previous=tmp->previous;
-        FREE(tmp);
+        pop_source(file_info);
         continue;
       }
       token->type=EOF_TOK;
@@ -472,27 +666,29 @@ void get_token(filptr *file_info, token_t *token)
     if (c=='\n') {
       if (!(file_info->previous))
         ++(file_info->phys_line);
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='#') {
         if (preprocess(file_info)) {
           token->type=NO_TOK;
           return;
         }
       } else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       continue;
     }
     if (isspace(c))
       continue;
+    if (c!='/')
+      file_info->curr_file->tokens=1;
     if (isstart(c)) {
-      ungetc(c,file_info->curr_file);
+      src_ungetc(c,file_info->curr_file);
       tokenize_name(file_info,token);
       if (file_info->expanded)
         continue;
       return;
     }
     if (isdigit(c)) {
-      ungetc(c,file_info->curr_file);
+      src_ungetc(c,file_info->curr_file);
       tokenize_int(file_info,token);
       return;
     }
@@ -500,21 +696,25 @@ void get_token(filptr *file_info, token_t *token)
       tokenize_string(file_info,token);
       return;
     }
+    if (c=='\'') {
+      tokenize_char(file_info,token);
+      return;
+    }
     if (c=='/') {
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='*') {
-        c=fgetc(file_info->curr_file);
+        c=src_getc(file_info->curr_file);
         done=0;
         while ((c!=EOF) && (!done)) {
           if (c=='\n')
             if (!(file_info->previous))
               (file_info->phys_line)++;
           if (c=='*') {
-            c=fgetc(file_info->curr_file);
+            c=src_getc(file_info->curr_file);
             if (c=='/')
               done=1;
           } else
-            c=fgetc(file_info->curr_file);
+            c=src_getc(file_info->curr_file);
         }
         if (c!='/') {
           token->type=NO_TOK;
@@ -522,7 +722,8 @@ void get_token(filptr *file_info, token_t *token)
         }
         continue;
       }
-      ungetc(c,file_info->curr_file);
+      src_ungetc(c,file_info->curr_file);
+      file_info->curr_file->tokens=1;
       c='/';
     }
     if (c=='{') {
@@ -530,12 +731,12 @@ void get_token(filptr *file_info, token_t *token)
       return;
     }
     if (c=='}') {
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c==')') {
         token->type=RARRASGN_TOK;  /* }) for array literal end */
         return;
       }
-      ungetc(c,file_info->curr_file);
+      src_ungetc(c,file_info->curr_file);
       token->type=RBRACK_TOK;
       return;
     }
@@ -548,7 +749,7 @@ void get_token(filptr *file_info, token_t *token)
       return;
     }
     if (c=='(') {
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='{') {
         token->type=LARRASGN_TOK;  /* ({ for array literal start */
         return;
@@ -557,7 +758,7 @@ void get_token(filptr *file_info, token_t *token)
         token->type=LMAPSGN_TOK;  /* ([ for mapping literal start */
         return;
       }
-      ungetc(c,file_info->curr_file);
+      src_ungetc(c,file_info->curr_file);
       token->type=LPAR_TOK;
       return;
     }
@@ -579,40 +780,45 @@ void get_token(filptr *file_info, token_t *token)
     }
     if (c=='.') {
       token->type=DOT_TOK;
+      c=src_getc(file_info->curr_file);
+      if (c=='.')
+        token->type=RANGE_TOK;
+      else
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c==':') {
       token->type=COLON_TOK;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c==':')
         token->type=SECOND_TOK;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='=') {
       token->type=EQ_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='=')
         token->type=CONDEQ_OPER;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='+') {
       token->type=ADD_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='+')
         token->type=POSTADD_OPER;
       else if (c=='=')
         token->type=PLEQ_OPER;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='-') {
       token->type=MIN_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='-')
         token->type=POSTMIN_OPER;
       else if (c=='=')
@@ -620,74 +826,74 @@ void get_token(filptr *file_info, token_t *token)
       else if (c=='>')
       token->type=CALL_TOK;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='*') {
       token->type=MUL_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='=')
         token->type=MUEQ_OPER;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='/') {
       token->type=DIV_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='=')
         token->type=DIEQ_OPER;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='%') {
       token->type=MOD_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='=')
         token->type=MOEQ_OPER;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='&') {
       token->type=BITAND_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='=')
         token->type=ANEQ_OPER;
       else if (c=='&')
         token->type=AND_OPER;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='^') {
       token->type=EXOR_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='=')
         token->type=EXEQ_OPER;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='|') {
       token->type=BITOR_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='=')
         token->type=OREQ_OPER;
       else if (c=='|')
         token->type=OR_OPER;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='!') {
       token->type=NOT_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='=')
         token->type=NOTEQ_OPER;
       else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='~') {
@@ -696,34 +902,34 @@ void get_token(filptr *file_info, token_t *token)
     }
     if (c=='<') {
       token->type=LESS_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='=')
         token->type=LESSEQ_OPER;
       else if (c=='<') {
         token->type=LS_OPER;
-        c=fgetc(file_info->curr_file);
+        c=src_getc(file_info->curr_file);
         if (c=='=')
           token->type=LSEQ_OPER;
         else
-          ungetc(c,file_info->curr_file);
+          src_ungetc(c,file_info->curr_file);
       } else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     if (c=='>') {
       token->type=GREAT_OPER;
-      c=fgetc(file_info->curr_file);
+      c=src_getc(file_info->curr_file);
       if (c=='=')
         token->type=GREATEQ_OPER;
       else if (c=='>') {
         token->type=RS_OPER;
-        c=fgetc(file_info->curr_file);
+        c=src_getc(file_info->curr_file);
         if (c=='=')
           token->type=RSEQ_OPER;
         else
-          ungetc(c,file_info->curr_file);
+          src_ungetc(c,file_info->curr_file);
       } else
-        ungetc(c,file_info->curr_file);
+        src_ungetc(c,file_info->curr_file);
       return;
     }
     token->type=NO_TOK;
@@ -52,16 +52,63 @@ typedef struct
   } token_data;
 } token_t;
 
+/* A source file read whole, with a cursor.  The preprocessor and
+   tokenizer read it with src_getc()/src_ungetc(), which behave like
+   fgetc()/ungetc() without going through stdio a character at a time.
+   As with ungetc(), only a character read may be pushed back; it is
+   stored over the one it replaces. */
+
+struct source
+{
+  char *buf;
+  long len;
+  long pos;
+  int tokens;                  /* has handed the parser a token */
+  struct inc_record *record;   /* what an #include did, for the cache */
+};
+
+#define src_getc(s)    ((s)->pos<(s)->len ? (unsigned char) (s)->buf[(s)->pos++] : EOF)
+#define src_ungetc(c,s) ((c)!=EOF ? ((s)->buf[--((s)->pos)]=(c)) : 0)
+
 struct file_stack
 {
-  FILE *file_ptr;
+  struct source *file_ptr;
   struct file_stack *previous;
 };
 
+/* Tokens read ahead of the parser.  NAME and STRING text is kept with
+   the token, since name_buf and string_buf are reused by the next one. */
+
+#define MAX_LOOKAHEAD 4
+
+struct ahead_token
+{
+  token_t token;
+  char name[MAX_TOK_LEN+1];
+  char *string;
+};
+
+/* Names the compiler looks up, hashed.  Newest first in each bucket,
+   like the lists they index. */
+
+struct name_ent
+{
+  char *name;
+  void *item;
+  struct name_ent *next;
+};
+
+struct name_index
+{
+  struct name_ent *bucket[NAME_HASH];
+  unsigned int count;
+};
+
 typedef struct
 {
   unsigned int num;
   struct var_tab *varlist;
+  struct name_index *index;           /* varlist by name */
 } sym_tab_t;
 
 struct parm
@@ -82,17 +129,20 @@ struct define
 
 typedef struct
 {
-  FILE *curr_file;
+  struct source *curr_file;
   struct file_stack *previous;        /* previously opened files */
-  token_t put_back_token;             /* the put-back token */
-  int is_put_back;
+  struct ahead_token ahead[MAX_LOOKAHEAD]; /* put back or peeked, last first */
+  int num_ahead;
   char *expanded;                     /* expanded #defines, etc */
   unsigned int phys_line;             /* physical line */
   struct code *curr_code;             /* code */
   sym_tab_t *glob_sym;                /* global symbol table */
-  struct define *defs;                /* #defines */
+  struct define *defs[DEF_HASH];      /* #defines, hashed by name */
   int depth;
   int layout_locked;                  /* True after variable layout is built, prevents late inherits */
+  struct dep_list *includes;          /* files #included, for the bytecode cache */
+  struct name_index *funcs;           /* curr_code->func_list by name */
+  int optimize;                       /* run optimize_code(): ini or #pragma */
 } filptr;
 
 typedef struct
@@ -104,9 +154,14 @@ typedef struct
 
 /* Function prototypes */
 
-struct fns *find_func(struct fns *curr_fn, char *name);
+struct fns *find_func(struct name_index *funcs, char *name);
 unsigned char find_syscall(char *name);
 struct var_tab *find_var(char *name, sym_tab_t *sym);
+void link_var(sym_tab_t *sym, struct var_tab *var);
+unsigned int name_bucket(char *name, unsigned int size);
+void *index_find(struct name_index *idx, char *name);
+void index_add(struct name_index **idx, char *name, void *item);
+void free_index(struct name_index *idx);
 
 void free_file_stack(filptr *file_info);
 void free_sym_t(sym_tab_t *sym);
@@ -126,6 +181,15 @@ unsigned int add_var(filptr *file_info, sym_tab_t *sym, int is_mapping);
 
 void get_token(filptr *file_info, token_t *token);
 void unget_token(filptr *file_info, token_t *token);
+void peek_token(filptr *file_info, int n, token_t *token);
+void clear_lookahead(filptr *file_info);
+struct source *load_source(char *filename);
+void free_source(struct source *src);
+void pop_source(filptr *file_info);
+struct define *find_define(filptr *file_info, char *name);
+void add_define(filptr *file_info, struct define *def);
+void remove_define(filptr *file_info, char *name);
+void free_one_define(struct define *def);
 int preprocess(filptr *file_info);
 void expand_def(struct define *def, char *buf);
 void expand(struct define *def, filptr *file_info);
@@ -28,26 +28,23 @@ int parse_mapping_value(filptr *file_info, struct var *result);
  * ======================================================================== */
 
 /* Create a mock filptr that reads from a string
- * Opens /dev/null as dummy file to prevent crash
+ * Gives it an empty source so the tokenizer sees EOF past the string
  * Returns: filptr pointer (caller must call free_string_filptr)
  */
 filptr *create_string_filptr(char *str) {
     filptr *fp;
-    FILE *dummy;
     
     fp = MALLOC(sizeof(filptr));
     if (!fp) return NULL;
     
-    /* Open /dev/null as a dummy file to prevent crash if tokenizer tries to read from it */
-    dummy = fopen("/dev/null", "r");
-    if (!dummy) {
-        FREE(fp);
-        return NULL;
-    }
-    
     /* Initialize fields */
     memset(fp, 0, sizeof(filptr));
-    fp->curr_file = dummy;             /* Dummy file that returns EOF immediately */
+    fp->curr_file = MALLOC(sizeof(struct source));
+    fp->curr_file->buf = NULL;         /* Empty source: returns EOF immediately */
+    fp->curr_file->len = 0;
+    fp->curr_file->pos = 0;
+    fp->curr_file->tokens = 0;
+    fp->curr_file->record = NULL;
     fp->expanded = str;                /* Point directly to LPC string (don't free!) */
     fp->phys_line = 1;
     
@@ -57,8 +54,9 @@ filptr *create_string_filptr(char *str) {
 /* Free a mock filptr created by create_string_filptr */
 void free_string_filptr(filptr *fp) {
     if (fp) {
-        /* Close the dummy file */
-        if (fp->curr_file) fclose(fp->curr_file);
+        /* Drop the empty source and any tokens put back */
+        if (fp->curr_file) free_source(fp->curr_file);
+        clear_lookahead(fp);
         /* Don't free expanded - it's managed by LPC */
         FREE(fp);
     }
@@ -165,7 +163,16 @@ int parse_array_value(filptr *file_info, struct var *result) {
     
     get_token(file_info, &token);
     
-    /* Empty array: ({}) */
+    /* Empty array: ({}) - the tokenizer may hand back }) as } and ) */
+    if (token.type == RBRACK_TOK) {
+        get_token(file_info, &token);
+        if (token.type != RPAR_TOK) {
+            FREE(temp_elements);
+            logger(LOG_ERROR, "parse_array_value: expected ) after {");
+            return 1;
+        }
+        token.type = RARRASGN_TOK;
+    }
     if (token.type == RARRASGN_TOK) {
         arr = allocate_array(0, UNLIMITED_ARRAY_SIZE);
         if (!arr) {
@@ -8,14 +8,63 @@
 
 #define CYCLE_SOFT_MAX 100000
 
-#define MAX_CONNS 512      /* max # players that can be connected at
-                              one time */
+#define CMD_BUDGET 10      /* default for the cmd_budget ini setting: commands
+                              one object may run per pulse before the rest
+                              of its input waits for the next pulse */
+#define CYCLE_BUDGET 0     /* default for cycle_budget: interpreter cycles
+                              one object's commands may use per pulse.
+                              0 means no limit */
+#define CMD_QUEUE_MAX 200  /* default for cmd_queue_max: commands one object
+                              may have waiting; further input is dropped
+                              until it catches up. 0 means no limit */
+
+#define MAX_CONNS 8192     /* max # players that can be connected at
+                              one time (also limited by open files) */
+#define CONN_TABLE_INIT 32 /* connection slots allocated at startup; the
+                              table doubles as needed up to MAX_CONNS */
+#define INBUF_INIT 128     /* first allocation of a connection's input
+                              line buffer; doubles up to MAX_STR_LEN */
 #define MIN_FREE_FILES 3   /* at least this many files are GUARANTEED
                               to be openable by CI objects while the
                               system is running.  3 is a good number. */
 
-#define WRITE_BURST 256    /* number of characters to write over the
-                              net at a time */
+#define WRITE_BURST 256    /* slack added when an I/O thread grows a
+                              connection's output buffer */
+
+#define OUTBUF_HIGH 16384  /* default outbuf_high: queued output at which a
+                              connection counts as congested and its object
+                              gets output_pressure(1) */
+#define OUTBUF_LOW 4096    /* default outbuf_low: congestion ends, and
+                              output_pressure(0) is called, once the queue
+                              drains to this */
+#define OUTBUF_STALL 0     /* default outbuf_stall: seconds a connection may
+                              stay congested before it is dropped. 0 means
+                              never drop */
+
+#define RESOLVE_CACHE_SIZE 64  /* host/address lookups remembered */
+#define RESOLVE_TTL 600    /* seconds a lookup result stays cached */
+#define LAZY_MISS_CACHE 256  /* paths with no source, or whose source
+                                didn't compile, that lazy_load remembers;
+                                must be a power of two */
+#define LAZY_MISS_TTL 60   /* seconds lazy_load remembers such a path */
+#define UNLOAD_SWEEP_TIME 60  /* most seconds between unload_idle sweeps */
+
+#define SAVEQ_MAX_PENDING 67108864  /* bytes of save_object() data that may
+                                       wait for the writer thread before
+                                       further saves block */
+#define KV_COMPACT_MIN 1048576  /* dead bytes the kv save store may hold
+                                   before it is rewritten; it is also
+                                   left alone until most of it is dead */
+
+#define MAX_IO_THREADS 16  /* upper bound on the io_threads ini setting */
+#define MAX_COMPILE_THREADS 16  /* upper bound on compile_threads */
+#define COMPILE_STACK_SIZE 8388608  /* stack for each precompile() worker;
+                                       the parser recurses */
+#define PRECOMP_HOLD_TIME 300  /* seconds precompile() holds a program for
+                                  compile_object() before dropping it */
+#define PRECOMP_MAX_HELD 1024  /* most programs precompile() holds at once */
+#define IO_RING_SIZE 1024  /* slots in each I/O thread message ring;
+                              must be a power of two */
 
 
 #define ITOA_BUFSIZ 32     /* max # chars a signed long will take in
@@ -24,7 +73,9 @@
 
 #define NUM_ELINES 32      /* number of lines in a block of edit buffer */
 
-#define MAX_OUTBUF_LEN 16359  /* maximum amount of output buffered */
+#define MAX_OUTBUF_LEN 65536  /* default outbuf_max: most output buffered
+                                 per connection; messages that don't fit
+                                 are dropped whole */
 
 #define OBJ_ALLOC_BLKSIZ 8 /* chunk-size for object allocation */
 #define CACHE_SIZE 8    /* number of objects to keep in the cache at one
@@ -40,3 +91,8 @@
 #define EBUFSIZ 2047       /* #define expansion buffer size */
 
 #define MAX_DEPTH 8        /* maximum #define recursion */
+
+#define DEF_HASH 64        /* buckets in a compile's #define table */
+
+#define NAME_HASH 64       /* buckets in the compiler's variable and
+                              function name tables */
@@ -0,0 +1,352 @@
+/**
+ * @file unload.c
+ * @brief Unloading programs nobody is using
+ *
+ * A program stays loaded from its first compile until its object is
+ * destructed, so a long-running server ends up holding the code of every
+ * area anyone ever visited.  With unload_idle set, a sweep every
+ * UNLOAD_SWEEP_TIME seconds (or unload_idle, if that is shorter) unloads:
+ *
+ *  - with lazy_load, which loads it again the next time its path is
+ *    used, a program whose object has had no function called in unload_idle
+ *    seconds, that nothing depends on and that loading again gives back
+ *    exactly: no clones, no other program built on it, an object that no
+ *    variable, array or mapping points to, that holds and is held by
+ *    nothing, that has no connection, editor, input_to, alarm, queued
+ *    command or heart_beat, and whose globals are still the ones init()
+ *    left it with and hold no object.  The boot object, the auto object
+ *    and privileged objects are never unloaded.  The object is
+ *    destructed, which takes the program with it.
+ *  - an inherited program that no loaded program builds on any more; the
+ *    next compile that inherits it loads it again
+ *
+ * What a program is built on is counted into its code's num_refs by each
+ * sweep, from the inherit lists and variable maps of the programs loaded.
+ * Code is retired, not freed, so calls other programs had resolved into
+ * it go back to being looked up by name.
+ *
+ * refd_by only records the plain globals that point to an object, so
+ * each sweep that may unload objects also walks the globals of every
+ * object, marking HELD the objects an array or mapping element or an
+ * input_to() refers to.  A value shared by several variables is walked
+ * once.  The globals init() left are kept, from the object's load, in
+ * load_globals; arrays and mappings are shared with the object's own,
+ * so the first write to one leaves the two different.
+ */
+
+#include "config.h"
+#include "object.h"
+#include "constrct.h"
+#include "globals.h"
+#include "interp.h"
+#include "dbhandle.h"
+#include "file.h"
+#include "cache.h"
+#include "precomp.h"
+#include "recomp.h"
+#include "unload.h"
+
+/* deeper than this, a sweep gives up walking and unloads no object */
+#define MAX_WALK_DEPTH 100
+
+/* An array or mapping the walk has been through */
+struct seen {
+    void *value;
+    int holds;                /* it holds an object, at any depth */
+};
+
+static long next_sweep;
+static struct seen *seen;
+static unsigned long seen_size, seen_count;
+static int walk_failed;
+
+static void count_ref(struct proto *proto, struct proto *from) {
+    if (proto && proto != from && proto->funcs)
+        proto->funcs->num_refs++;
+}
+
+/* Count, into num_refs, the programs that build on each program */
+static void count_refs(struct proto *chain) {
+    struct inherit_list *inh;
+    struct proto *p;
+    struct code *c;
+    unsigned int x;
+
+    for (p = chain; p; p = p->next_proto)
+        if (p->funcs)
+            p->funcs->num_refs = 0;
+    for (p = chain; p; p = p->next_proto) {
+        if (!(c = p->funcs))
+            continue;
+        for (inh = c->inherits; inh; inh = inh->next)
+            count_ref(inh->parent_proto, p);
+        for (x = 0; x < c->ancestor_count; x++)
+            count_ref(c->ancestor_map[x].proto, p);
+        for (x = 0; x < c->gst_count; x++)
+            count_ref(c->gst_map[x].owner, p);
+    }
+}
+
+/* The slot for value in seen: its own, or the empty one it would go in */
+static struct seen *find_seen(void *value) {
+    unsigned long x;
+
+    x = ((unsigned long) value >> 4) & (seen_size - 1);
+    while (seen[x].value && seen[x].value != value)
+        x = (x + 1) & (seen_size - 1);
+    return &seen[x];
+}
+
+static void add_seen(void *value, int holds) {
+    struct seen *old, *slot;
+    unsigned long old_size, x;
+
+    if (2 * (seen_count + 1) > seen_size) {
+        old = seen;
+        old_size = seen_size;
+        seen_size = old_size ? 2 * old_size : 256;
+        seen = MALLOC(seen_size * sizeof(struct seen));
+        memset(seen, 0, seen_size * sizeof(struct seen));
+        for (x = 0; x < old_size; x++)
+            if (old[x].value)
+                *find_seen(old[x].value) = old[x];
+        if (old)
+            FREE(old);
+    }
+    slot = find_seen(value);
+    slot->value = value;
+    slot->holds = holds;
+    seen_count++;
+}
+
+/* Mark HELD every object an element of val refers to, at any depth.
+ * Returns whether val is or holds an object. */
+static int walk_value(struct var *val, int depth) {
+    struct heap_array *arr;
+    struct heap_mapping *map;
+    struct seen *slot;
+    unsigned int i;
+    void *value;
+    int holds;
+
+    if (val->type == OBJECT) {
+        /* refd_by already has the plain globals */
+        if (depth && val->value.objptr)
+            val->value.objptr->flags |= HELD;
+        return 1;
+    }
+    if (val->type == ARRAY)
+        value = val->value.array_ptr;
+    else if (val->type == MAPPING)
+        value = val->value.mapping_ptr;
+    else
+        return 0;
+    if (!value)
+        return 0;
+    if (seen_size && (slot = find_seen(value))->value)
+        return slot->holds;
+    if (depth >= MAX_WALK_DEPTH) {
+        walk_failed = 1;
+        return 1;
+    }
+    holds = 0;
+    if (val->type == ARRAY) {
+        arr = val->value.array_ptr;
+        for (i = 0; i < arr->size; i++)
+            holds |= walk_value(&arr->elements[i], depth + 1);
+    } else {
+        map = val->value.mapping_ptr;
+        for (i = 0; i < map->capacity; i++)
+            if (MAPPING_SLOT_USED(map, i)) {
+                holds |= walk_value(&map->slots[i].key, depth + 1);
+                holds |= walk_value(&map->slots[i].value, depth + 1);
+            }
+    }
+    add_seen(value, holds);
+    return holds;
+}
+
+/* Mark HELD (set) every object something other than a plain global
+ * refers to, or clear the marks again and forget what was walked */
+static void mark_held(int set) {
+    struct obj_blk *curr_block;
+    struct object *obj;
+    signed long i, base, x;
+
+    walk_failed = 0;
+    curr_block = obj_list;
+    base = 0;
+    while (curr_block) {
+        for (i = 0; i < OBJ_ALLOC_BLKSIZ && base + i < db_top; i++) {
+            obj = &(curr_block->block[i]);
+            if (!set) {
+                obj->flags &= ~HELD;
+                continue;
+            }
+            if ((obj->flags & GARBAGE) || !obj->parent || !obj->parent->funcs)
+                continue;
+            if (obj->input_func_obj)
+                obj->input_func_obj->flags |= HELD;
+            if (obj->globals)
+                for (x = 0; x < obj->parent->funcs->num_globals; x++)
+                    walk_value(&obj->globals[x], 0);
+        }
+        base += OBJ_ALLOC_BLKSIZ;
+        curr_block = curr_block->next;
+    }
+    if (!set && seen) {
+        FREE(seen);
+        seen = NULL;
+        seen_size = seen_count = 0;
+    }
+}
+
+static int same_value(struct var *a, struct var *b) {
+    if (a->type != b->type)
+        return 0;
+    switch (a->type) {
+        case STRING:
+        case FUNC_NAME:
+        case EXTERN_FUNC:
+            return !strcmp(a->value.string, b->value.string);
+        case OBJECT:
+            return a->value.objptr == b->value.objptr;
+        case ARRAY:
+            return a->value.array_ptr == b->value.array_ptr;
+        case MAPPING:
+            return a->value.mapping_ptr == b->value.mapping_ptr;
+        default:
+            return a->value.integer == b->value.integer;
+    }
+}
+
+/* Whether loading obj's program again would give back its globals: they
+ * are the ones init() left and hold no object */
+static int restorable(struct object *obj) {
+    unsigned int x, num_globals;
+
+    num_globals = obj->parent->funcs->num_globals;
+    if (!num_globals)
+        return 1;
+    if (!obj->globals || !obj->load_globals)
+        return 0;
+    for (x = 0; x < num_globals; x++)
+        if (!same_value(&obj->globals[x], &obj->load_globals[x]) ||
+            walk_value(&obj->globals[x], 0))
+            return 0;
+    return 1;
+}
+
+/* Keep the globals init() has just left a new prototype with, for a
+ * sweep to tell whether it still has them */
+void keep_load_globals(struct object *proto_obj) {
+    unsigned int x, num_globals;
+
+    num_globals = proto_obj->parent->funcs->num_globals;
+    if (unload_idle <= 0 || !lazy_load || !num_globals ||
+        !proto_obj->globals || proto_obj->load_globals)
+        return;
+    proto_obj->load_globals = MALLOC(num_globals * sizeof(struct var));
+    for (x = 0; x < num_globals; x++)
+        copy_var(&proto_obj->load_globals[x], &proto_obj->globals[x]);
+}
+
+/* Drop them, when obj is destructed or its globals are converted to a
+ * new program, after which it can't be unloaded */
+void free_load_globals(struct object *obj, unsigned int num_globals) {
+    unsigned int x;
+
+    if (!obj->load_globals)
+        return;
+    for (x = 0; x < num_globals; x++)
+        clear_var(&obj->load_globals[x]);
+    FREE(obj->load_globals);
+    obj->load_globals = NULL;
+}
+
+static int has_alarm(struct object *obj) {
+    struct alarmq *curr;
+
+    for (curr = alarm_list; curr; curr = curr->next)
+        if (curr->obj == obj)
+            return 1;
+    return 0;
+}
+
+/* Whether anything other than the auto object is attached to obj */
+static int has_attachees(struct object *obj) {
+    struct attach_list *curr;
+
+    for (curr = obj->attachees; curr; curr = curr->next)
+        if (curr->attachee != auto_proto)
+            return 1;
+    return 0;
+}
+
+/* Whether proto_obj's program can go */
+static int is_idle(struct object *proto_obj, struct object *boot_obj) {
+    if (proto_obj == boot_obj || proto_obj == auto_proto)
+        return 0;
+    if (proto_obj->flags & (GARBAGE | INTERACTIVE | CONNECTED | IN_EDITOR |
+                            PRIV | HELD))
+        return 0;
+    if (now_time - proto_obj->last_access_time < unload_idle)
+        return 0;
+    if (proto_obj->next_child || proto_obj->parent->funcs->num_refs)
+        return 0;
+    if (proto_obj->refd_by || proto_obj->contents || proto_obj->location ||
+        proto_obj->attacher || proto_obj->devnum != -1 ||
+        proto_obj->input_func || proto_obj->heart_beat_interval)
+        return 0;
+    return !has_attachees(proto_obj) && !has_alarm(proto_obj) &&
+           !proto_obj->num_cmds && restorable(proto_obj);
+}
+
+void unload_idle_programs() {
+    struct object *boot_obj;
+    struct proto *p, *next;
+    int programs, inherited;
+    char logbuf[256];
+
+    if (unload_idle <= 0 || call_stack || now_time < next_sweep)
+        return;
+    next_sweep = now_time + (unload_idle < UNLOAD_SWEEP_TIME ?
+                             unload_idle : UNLOAD_SWEEP_TIME);
+    if (!(boot_obj = ref_to_obj(0)) || !boot_obj->parent)
+        return;
+    count_refs(boot_obj->parent);
+    if (lazy_load)
+        mark_held(1);
+
+    programs = 0;
+    inherited = 0;
+    for (p = boot_obj->parent->next_proto; p; p = next) {
+        next = p->next_proto;
+        if (!p->funcs)
+            continue;
+        if (p->proto_obj) {
+            /* only lazy_load brings it back when it's named again */
+            if (lazy_load && !walk_failed &&
+                is_idle(p->proto_obj, boot_obj)) {
+                sprintf(logbuf, "unload: %.200s idle for %ld seconds",
+                        p->pathname, now_time - p->proto_obj->last_access_time);
+                logger(LOG_DEBUG, logbuf);
+                queue_for_destruct(p->proto_obj);
+                programs++;
+            }
+        } else if (!p->funcs->num_refs && !precomp_holding()) {
+            /* compiled for inheriting, and nothing inherits it now */
+            if (find_cached_proto(p->pathname) == p)
+                uncache_proto(p->pathname);
+            retire_proto(p);
+            inherited++;
+        }
+    }
+    if (lazy_load)
+        mark_held(0);
+    if (programs || inherited) {
+        sprintf(logbuf, "unload: %d idle programs, %d inherited programs "
+                "unloaded", programs, inherited);
+        logger(LOG_INFO, logbuf);
+    }
+}
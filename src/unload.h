@@ -0,0 +1,17 @@
+/* unload.h */
+
+/* unload_idle: with it set in netci.ini, an inherited program nothing
+   inherits any more is unloaded, and with lazy_load so is a program whose
+   object has had no function called for that many seconds, that
+   nothing else holds on to and whose globals are still the ones init()
+   left.  The next inherit or use of its path loads it again, from the
+   bytecode cache when bytecode_path is set. */
+
+#ifndef UNLOAD_H
+#define UNLOAD_H
+
+void unload_idle_programs();
+void keep_load_globals(struct object *proto_obj);
+void free_load_globals(struct object *obj, unsigned int num_globals);
+
+#endif /* UNLOAD_H */
@@ -2336,7 +2336,7 @@ void RefreshCommandList(HWND hDlg) {
   int len;
 
   SendMessage(GetDlgItem(hDlg,IDLB_LIST),LB_RESETCONTENT,0,0);
-  curr=cmd_head;
+  curr=next_queued(NULL);
   while (curr) {
     len=0;
     pos1=curr->cmd;
@@ -2399,7 +2399,7 @@ void RefreshCommandList(HWND hDlg) {
     *pos2='\0';
     SendMessage(GetDlgItem(hDlg,IDLB_LIST),LB_ADDSTRING,0,(LPARAM) buf);
     FREE(buf);
-    curr=curr->next;
+    curr=next_queued(curr);
   }
 }
 
@@ -2476,7 +2476,7 @@ LRESULT APIENTRY DialogNewCommand(HWND hDlg,UINT message,UINT wParam,UINT lParam
 
 LRESULT APIENTRY DialogCommand(HWND hDlg,UINT message,UINT wParam,UINT lParam) {
   long index;
-  struct cmdq *curr,*prev;
+  struct cmdq *curr;
   int tabs[2];
 
   switch (message) {
@@ -2494,8 +2494,8 @@ LRESULT APIENTRY DialogCommand(HWND hDlg,UINT message,UINT wParam,UINT lParam) {
           if (HIWORD(wParam)!=LBN_DBLCLK) return FALSE;
           index=SendMessage(GetDlgItem(hDlg,IDLB_LIST),LB_GETCURSEL,0,0);
           if (index<0) break;
-          curr=cmd_head;
-          while (curr && (index--)) curr=curr->next;
+          curr=next_queued(NULL);
+          while (curr && (index--)) curr=next_queued(curr);
           if (!curr) break;
           DefaultRefno=curr->obj->refno;
           DialogBox(hInst,"DLGObject",hDlg,DialogObject);
@@ -2512,22 +2512,14 @@ LRESULT APIENTRY DialogCommand(HWND hDlg,UINT message,UINT wParam,UINT lParam) {
         case IDB_DELETE:
           index=SendMessage(GetDlgItem(hDlg,IDLB_LIST),LB_GETCURSEL,0,0);
           if (index<0) break;
-          curr=cmd_head;
-          prev=NULL;
-          while (curr && (index--)) {
-            prev=curr;
-            curr=curr->next;
-          }
+          curr=next_queued(NULL);
+          while (curr && (index--)) curr=next_queued(curr);
           if (!curr) break;
           sprintf(temp_buf,"Are you sure you want to destroy command "
                   "by object %s#%ld ?",curr->obj->parent->pathname,
                   (long) curr->obj->refno);
           if (MessageBox(hDlg,temp_buf,"Destroy",MB_OKCANCEL)==IDOK) {
-            if (prev) prev->next=curr->next;
-            else cmd_head=curr->next;
-            if (cmd_tail==curr) cmd_tail=prev;
-            if (curr->cmd) FREE(curr->cmd);
-            FREE(curr);
+            unqueue_command(curr);
             RefreshCommandList(hDlg);
           }
           break;